@@ -0,0 +1,66 @@
+// bounded_queue.h
+// - Blocking producer/consumer queue shared by the batch stages and the --serve pool
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace ilpd {
+
+// Bounded blocking queue: push() waits while full, pop() waits while empty until close().
+// Time spent blocked is summed over all threads (the clock is only read when a call has to wait).
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity): capacity_(capacity ? capacity : 1), closed_(false), pushWaitNs_(0), popWaitNs_(0) {}
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (items_.size() >= capacity_) {
+            auto start = std::chrono::steady_clock::now();
+            notFull_.wait(lock, [this] { return items_.size() < capacity_; });
+            pushWaitNs_ += elapsed_ns(start);
+        }
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+    }
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!closed_ && items_.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+            popWaitNs_ += elapsed_ns(start);
+        }
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+    // Producers blocked on a full queue (backpressure) / consumers blocked on an empty one (starved)
+    uint64_t push_wait_ns() const { std::lock_guard<std::mutex> lock(mutex_); return pushWaitNs_; }
+    uint64_t pop_wait_ns() const { std::lock_guard<std::mutex> lock(mutex_); return popWaitNs_; }
+private:
+    static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    size_t capacity_;
+    bool closed_;
+    uint64_t pushWaitNs_;
+    uint64_t popWaitNs_;
+    std::deque<T> items_;
+    mutable std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+};
+
+} // namespace ilpd
@@ -1,8 +1,30 @@
 // braw2ilpd.cpp
 // - Supports -o/--output, -a/--all, -v/--verbose, -s/--silent, -h/--help
-// - Uses BlackmagicRaw API and CoreFoundation like original
-// - Atomic text write (tmp + fsync + rename)
-// - Caches all immersive attributes and outputs detailed file from cache
+// - Batch mode: several inputs and/or --files-from <list|->, one factory per run
+// - Parallel batch (-j N): bounded work queue, one codec per worker, results reported in input order
+// - Open stage (--open-jobs N): opens in flight apart from -j, --timeout per clip, --retries with
+//   backoff, clips still failing after that quarantined in --retry-list
+// - Writer stage (--writers N): output files are written off the extraction workers, with backpressure
+// - Bounded memory: attribute buffers are recycled from written clips to the next reads, --max-memory
+//   caps what the clips in flight hold; --stats adds peak RSS and heap allocation counts
+// - --recursive <dir>: streams .braw files from a directory tree straight into the batch queue
+// - Batch dedup: each unique (UUID, projection data hash) ILPD is written once, clips go to --manifest
+// - Incremental runs: .ilpd-index caches results by (path, size, mtime, inode) to skip unchanged clips
+// - --fast: reads the immersive metadata straight from the container (mmap), SDK fallback, --verify
+// - s3:// and http(s):// inputs: container metadata fetched with byte-range requests (libcurl)
+// - --serve <socket>: daemon with warm codecs answering NDJSON requests from a result cache
+// - --durability none|file|batch|full: fsync policy for every file written
+// - -o -: projection data to stdout (NDJSON records in batch mode), logs to stderr
+// - --stats / --trace <file.json>: per-stage timing summary and Chrome trace (one track per thread)
+// - Extraction itself lives in libilpdextract (ilpdextract.h), this file is the CLI on top
+// - --watch <dir>: extracts clips as they finish copying into dir (card offload), until Ctrl-C
+// - --emit-aime: an AIME document per unique ILPD, built from the attributes already in memory
+// - --pack <file.ilpdpack>: the unique ILPDs of a run appended to one mmappable file (ilpd_pack.h),
+//   read back with braw2ilpd get / unpack
+// - --shard i/N: deterministic partition of the inputs by path hash; braw2ilpd merge joins the shards
+// - braw2ilpd catalog: unique lens profiles of an archive by UUID and profile hash, see ilpd_catalog.h
+// - braw2ilpd stmap: per-eye STMaps (EXR/TIFF) generated from the lens profile, see stmap.h
+// - braw2ilpd_main() is the CLI itself; main() is left out with BRAW2ILPD_NO_MAIN (braw2ilpd_bench)
 
 #include <iostream>
 #include <fstream>
@@ -11,62 +33,191 @@
 #include <vector>
 #include <map>
 #include <cstring>
-#include <iomanip>
+#include <cstdio>
 #include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <queue>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <cctype>
+#include <string_view>
+#include <csignal>
+#include <chrono>
+#include <cmath>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
-#include "BlackmagicRawAPI.h"
+#include "ilpdextract.h"
+#include "bounded_queue.h"
+#include "json_reader.h"
+#include "braw_server.h"
+#include "braw_watch.h"
+#include "stmap.h"
+#include "ilpd_catalog.h"
+#include "ilpd_pack.h"
+#include "braw2ilpd.h"
 
+using namespace ilpd;
 using std::string;
 using std::vector;
 using std::map;
-using std::ostringstream;
 using std::cout;
 using std::cerr;
 using std::endl;
 
-// Exit codes
-enum ExitCode {
-    OK = 0,
-    USAGE = 1,
-    FACTORY_FAIL = 2,
-    CODEC_FAIL = 3,
-    OPENCLIP_FAIL = 4,
-    IMMERSIVE_NOT_SUPPORTED = 5,
-    FILE_NOT_FOUND = 6,
-    WRITE_FAIL = 7,
-    INVALID_FILE_FORMAT = 8
-};
+// --inventory: which camera (from the ILPD file name) and lens profile each clip was shot with
+static constexpr AttrMask INVENTORY_ATTRS = attrs_used_for(ATTR_USE_NAMING);
 
-// Logger
-struct Logger {
-    bool verbose;
-    bool silent;
-    Logger(): verbose(false), silent(false) {}
-    void info(const string &s) const { if (!silent) std::cout << s << std::endl; }
-    void debug(const string &s) const { if (verbose && !silent) std::cout << s << std::endl; }
-    void error(const string &s) const { std::cerr << s << std::endl; }
-};
+// --stats: heap allocations of the run, counted by the operator new at the end of this file once
+// g_countAllocations is set (not with BRAW2ILPD_NO_MAIN: the program linking us owns operator new)
+static std::atomic<bool> g_countAllocations(false);
+static std::atomic<uint64_t> g_allocations(0);
+static std::atomic<uint64_t> g_allocatedBytes(0);
+
+static string memory_summary(uint64_t clips) {
+    char line[160];
+    snprintf(line, sizeof(line), "Peak RSS: %.1f MiB\n", peak_rss_bytes() / (1024.0 * 1024.0));
+    string out = line;
+#ifndef BRAW2ILPD_NO_MAIN
+    const uint64_t allocations = g_allocations.load();
+    snprintf(line, sizeof(line), "Heap allocations: %llu (%.1f MiB)", (unsigned long long)allocations,
+             g_allocatedBytes.load() / (1024.0 * 1024.0));
+    out += line;
+    if (clips) {
+        snprintf(line, sizeof(line), ", %.1f per clip", (double)allocations / clips);
+        out += line;
+    }
+    out += "\n";
+#else
+    (void)clips;
+#endif
+    return out;
+}
 
 // CLI config
 struct Config {
     bool outputAll;
+    bool emitAime;       // --emit-aime: an .aime next to every ILPD written
     bool verbose;
     bool silent;
-    string outputArg; // empty == not provided
-    string inputBraw;
-    Config(): outputAll(false), verbose(false), silent(false), outputArg(""), inputBraw("") {}
+    unsigned jobs;    // worker threads for batch mode
+    unsigned writers; // writer threads for batch mode (ILPD, -a and index output)
+    string outputArg; // empty == not provided, "-" == stdout
+    bool toStdout;    // -o -
+    string filesFrom; // empty == not provided, "-" == stdin
+    string manifestPath; // batch manifest, empty == none
+    bool incremental;    // use the extraction index
+    bool rebuildIndex;   // ignore index hits, rewrite it from this run
+    string indexPath;    // empty == <output dir>/.ilpd-index
+    bool fast;           // read metadata from the container, SDK only as fallback
+    bool verify;         // --fast plus SDK cross-check
+    Durability durability; // fsync policy for output files
+    string serveSocket;  // --serve: Unix socket path, empty == normal run
+    bool jobsGiven;      // -j given explicitly (--serve defaults to one worker per core)
+    bool stats;          // print the stage timing summary at the end
+    string tracePath;    // --trace: Chrome trace-event JSON, empty == none
+    unsigned shardIndex; // --shard i/N: 1-based shard of this run
+    unsigned shardCount; // 0 == not sharded
+    string watchDir;     // --watch: keep extracting clips copied into this directory, empty == none
+    unsigned settleMs;   // --settle: how long a watched clip must stay unchanged
+    AttrMask inventoryAttrs; // --attrs/--inventory: table of these attributes only, 0 == normal extraction
+    bool inventoryJson;  // --inventory-format ndjson (or a .json/.jsonl/.ndjson -o)
+    uint64_t sampleFrames; // --sample-frames: frames read per clip, SAMPLE_ALL_FRAMES == all, 0 == none
+    unsigned openJobs;   // --open-jobs: clips opened at once in batch mode, 0 == as -j
+    unsigned timeoutMs;  // --timeout: give up on a clip still opening after this, 0 == never
+    unsigned retries;    // --retries: further attempts after an open failure or timeout
+    string retryListPath; // --retry-list: clips still failing after the retries, empty == none
+    string packPath;     // --pack: append the run's ILPDs to this pack, empty == none
+    uint64_t maxMemory;  // --max-memory: bytes the clips in flight may hold in batch mode, 0 == no limit
+    vector<string> inputs;
+    vector<string> recursiveDirs;
+    Config(): outputAll(false), emitAime(false), verbose(false), silent(false), jobs(1), writers(1), outputArg(""), toStdout(false), filesFrom(""), manifestPath(""),
+              incremental(false), rebuildIndex(false), indexPath(""), fast(false), verify(false), durability(Durability::NONE), serveSocket(""), jobsGiven(false),
+              stats(false), tracePath(""), shardIndex(0), shardCount(0), watchDir(""), settleMs(2000),
+              inventoryAttrs(0), inventoryJson(false), sampleFrames(0), openJobs(0), timeoutMs(0), retries(0), retryListPath(""), packPath(""),
+              maxMemory(0) {}
 };
 
 static void print_usage() {
-    std::cout << "Usage: braw2ilpd <input.braw> [-o|--output <path>] [-a|--all] [-v|--verbose] [-s|--silent]\n";
+    std::cout << "Usage: braw2ilpd <input.braw> [more.braw ...] [-o|--output <path>] [-a|--all] [-v|--verbose] [-s|--silent]\n";
+    std::cout << "       braw2ilpd --serve <socket> [-j N] [--fast|--verify]\n";
+    std::cout << "       braw2ilpd merge [--manifest <out>] [--index <out>] <shard manifest|index> ...\n";
+    std::cout << "       braw2ilpd catalog add|list|get|diff <catalog> ... (catalog --help)\n";
+    std::cout << "       braw2ilpd get <file.ilpdpack> <uuid> [-o <file>] | unpack <file.ilpdpack> [-o <dir>] [--list] [uuid ...]\n";
+    std::cout << "       braw2ilpd stmap <input.braw|profile.ilpd> [-o <dir|file.exr>] [--size WxH] [--fov deg] [--gpu] (stmap --help)\n";
+    std::cout << "  Inputs may also be s3://bucket/key.braw or https:// URLs (metadata is read with byte-range requests)\n";
     std::cout << "  -o, --output <path>   Specify output file or directory. If omitted, default is ./cameraID.uuid.ilpd\n";
+    std::cout << "                        With several inputs the output must be a directory\n";
+    std::cout << "                        '-' writes the ILPD to stdout (one JSON record per clip in batch mode)\n";
+    std::cout << "  --files-from <list>   Read input paths from a file, one per line ('-' reads stdin)\n";
+    std::cout << "  -r, --recursive <dir> Extract every .braw under dir (hidden and ._ files are skipped)\n";
+    std::cout << "  --watch <dir>         Keep running and extract each .braw copied into dir once it settles (Ctrl-C stops)\n";
+    std::cout << "  --settle <seconds>    --watch: time a clip's size and mtime must stay unchanged (default 2)\n";
+    std::cout << "  -j, --jobs <N>        Extract N clips in parallel in batch mode (0 = one per CPU core, default 1)\n";
+    std::cout << "  --writers <N>         Batch mode: write outputs on N threads while the next clips are read (default 1)\n";
+    std::cout << "  --open-jobs <N>       Batch mode: open N clips at once, for slow or network volumes (default as -j)\n";
+    std::cout << "  --timeout <seconds>   Batch mode: fail a clip still opening after this long (CLIP_TIMEOUT, default none)\n";
+    std::cout << "  --retries <N>         Batch mode: try clips that failed to open or timed out N more times, with backoff\n";
+    std::cout << "  --retry-list <file>   Batch mode: write the clips still failing after the retries (for --files-from)\n";
+    std::cout << "  --max-memory <size>   Batch mode: read no further ahead while the clips in flight hold this much\n";
+    std::cout << "                        (bytes, or with a K/M/G suffix, e.g. 512M; default no limit)\n";
+    std::cout << "  --manifest <file>     Batch mode: write one line per clip (status, UUID, hash, ILPD path)\n";
+    std::cout << "                        .json/.jsonl: JSON Lines with all attributes, .csv: CSV, otherwise TSV\n";
+    std::cout << "  --incremental         Skip clips unchanged since the last run (index in <output dir>/.ilpd-index)\n";
+    std::cout << "  --index <file>        Use this index file (implies --incremental)\n";
+    std::cout << "  --rebuild-index       Extract every clip again and rewrite the index\n";
+    std::cout << "  --fast                Read metadata directly from the .braw container, fall back to the SDK\n";
+    std::cout << "  --verify              Like --fast, but also read through the SDK and compare the results\n";
+    std::cout << "  --durability <level>  none (default): rename only, file: fsync each file and its directory,\n";
+    std::cout << "                        batch: fsync everything once at the end, full: file with F_FULLFSYNC\n";
+    std::cout << "  --shard <i/N>         Only extract the clips of shard i of N (by hash of the path below -r, or as given)\n";
+    std::cout << "  --stats               Print per-stage timings (count, total, p50/p95/p99, max), bytes written,\n";
+    std::cout << "                        peak RSS and heap allocations\n";
+    std::cout << "  --trace <file.json>   Write a Chrome trace-event file (Perfetto, chrome://tracing), one track per thread\n";
+    std::cout << "  --serve <socket>      Run as a daemon answering JSON requests on a Unix socket (-j workers, default one per core)\n";
+    std::cout << "  --sample-frames <N|all>  Also read the metadata of N frames (or all) spread over each clip, without\n";
+    std::cout << "                        decoding: recovers an OpticalInteraxial of 0, warns about mid-clip changes\n";
     std::cout << "  -a, --all             Also output detailed attributes text file\n";
+    std::cout << "  --inventory           Only list which camera/UUID shot each clip (--attrs uuid,filename), no files written\n";
+    std::cout << "  --attrs <list>        Inventory of just these attributes: uuid, filename, interaxial, kind, calibration, data\n";
+    std::cout << "                        or all; one row per clip to stdout or -o <file>, as CSV or NDJSON\n";
+    std::cout << "  --inventory-format <csv|ndjson>  Inventory table format (default csv, ndjson for a .json/.jsonl/.ndjson -o)\n";
+    std::cout << "  --emit-aime           Also write an AIME document (<name>.aime: ILPD + optical attributes) per ILPD written\n";
+    std::cout << "  --pack <file.ilpdpack>  Also append every unique ILPD of the run to one pack file indexed by UUID\n";
     std::cout << "  -v, --verbose         Verbose logging\n";
     std::cout << "  -s, --silent          Suppress non-error output\n";
     std::cout << "  -h, --help            Show this help\n";
 }
 
+// "512M", "2G", "65536": bytes with an optional K/M/G/T suffix (powers of 1024, "MB"/"MiB" spellings too)
+static bool parse_byte_size(const string &v, uint64_t &bytes) {
+    char* end = nullptr;
+    const double n = strtod(v.c_str(), &end);
+    if (v.empty() || end == v.c_str() || !(n > 0)) return false;
+    string unit(end);
+    std::transform(unit.begin(), unit.end(), unit.begin(), [](unsigned char c) { return (char)std::toupper(c); });
+    if (unit.size() > 1 && (unit.substr(1) == "B" || unit.substr(1) == "IB")) unit.resize(1);
+    double scale = 1;
+    if (unit == "K") scale = 1024.0;
+    else if (unit == "M") scale = 1024.0 * 1024;
+    else if (unit == "G") scale = 1024.0 * 1024 * 1024;
+    else if (unit == "T") scale = 1024.0 * 1024 * 1024 * 1024;
+    else if (!unit.empty() && unit != "B") return false;
+    if (n * scale < 1 || n * scale > 1e18) return false;
+    bytes = (uint64_t)(n * scale);
+    return true;
+}
+
 // Parse args (supports unordered flags, requires -o/--output for custom output path)
 static bool parse_args(int argc, char** argv, Config &cfg, Logger &log) {
     if (argc < 2) { print_usage(); return false; }
@@ -75,11 +226,158 @@ static bool parse_args(int argc, char** argv, Config &cfg, Logger &log) {
         string a = argv[i];
         if (a == "-h" || a == "--help") { print_usage(); return false; }
         else if (a == "-a" || a == "--all") cfg.outputAll = true;
+        else if (a == "--emit-aime") cfg.emitAime = true;
+        else if (a == "--inventory") { if (!cfg.inventoryAttrs) cfg.inventoryAttrs = INVENTORY_ATTRS; }
+        else if (a == "--attrs" || a.compare(0, 8, "--attrs=") == 0) {
+            string v;
+            if (a.size() > 7) v = a.substr(8);
+            else if (i + 1 < argc) v = argv[++i];
+            else { log.error("Missing value for " + a); return false; }
+            string err;
+            if (!parse_attr_mask(v, cfg.inventoryAttrs, err)) {
+                log.error("Invalid value for --attrs: " + err);
+                return false;
+            }
+        } else if (a == "--inventory-format") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            if (v != "csv" && v != "ndjson") { log.error("Invalid value for --inventory-format: " + v + " (csv or ndjson)"); return false; }
+            cfg.inventoryJson = v == "ndjson";
+        }
         else if (a == "-v" || a == "--verbose") cfg.verbose = true;
         else if (a == "-s" || a == "--silent") cfg.silent = true;
         else if (a == "-o" || a == "--output") {
             if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
             cfg.outputArg = argv[++i];
+        } else if (a == "-j" || a == "--jobs") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            if (v.empty() || v.find_first_not_of("0123456789") != string::npos) {
+                log.error("Invalid value for " + a + ": " + v);
+                return false;
+            }
+            cfg.jobs = (unsigned)std::stoul(v);
+            cfg.jobsGiven = true;
+            if (cfg.jobs == 0) cfg.jobs = std::max(1u, std::thread::hardware_concurrency());
+        } else if (a == "--sample-frames") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            if (v == "all") {
+                cfg.sampleFrames = SAMPLE_ALL_FRAMES;
+            } else if (v.empty() || v.size() > 18 || v.find_first_not_of("0123456789") != string::npos || std::stoull(v) == 0) {
+                log.error("Invalid value for " + a + ": " + v + " (a frame count or all)");
+                return false;
+            } else {
+                cfg.sampleFrames = std::stoull(v);
+            }
+        } else if (a == "--writers") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            if (v.empty() || v.find_first_not_of("0123456789") != string::npos || std::stoul(v) == 0) {
+                log.error("Invalid value for " + a + ": " + v);
+                return false;
+            }
+            cfg.writers = (unsigned)std::stoul(v);
+        } else if (a == "-r" || a == "--recursive") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.recursiveDirs.push_back(argv[++i]);
+        } else if (a == "--watch") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.watchDir = argv[++i];
+        } else if (a == "--settle") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            char* end = nullptr;
+            double seconds = strtod(v.c_str(), &end);
+            if (v.empty() || *end != '\0' || !(seconds >= 0) || seconds > 3600) {
+                log.error("Invalid value for " + a + ": " + v);
+                return false;
+            }
+            cfg.settleMs = (unsigned)(seconds * 1000 + 0.5);
+        } else if (a == "--open-jobs" || a == "--retries") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            if (v.empty() || v.size() > 4 || v.find_first_not_of("0123456789") != string::npos ||
+                (a == "--open-jobs" && std::stoul(v) == 0)) {
+                log.error("Invalid value for " + a + ": " + v);
+                return false;
+            }
+            (a == "--open-jobs" ? cfg.openJobs : cfg.retries) = (unsigned)std::stoul(v);
+        } else if (a == "--timeout") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            char* end = nullptr;
+            double seconds = strtod(v.c_str(), &end);
+            if (v.empty() || *end != '\0' || !(seconds > 0) || seconds > 86400) {
+                log.error("Invalid value for " + a + ": " + v);
+                return false;
+            }
+            cfg.timeoutMs = std::max(1u, (unsigned)(seconds * 1000 + 0.5));
+        } else if (a == "--pack") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.packPath = argv[++i];
+        } else if (a == "--max-memory") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            string v = argv[++i];
+            if (!parse_byte_size(v, cfg.maxMemory)) {
+                log.error("Invalid value for " + a + ": " + v);
+                return false;
+            }
+        } else if (a == "--retry-list") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.retryListPath = argv[++i];
+        } else if (a == "--manifest") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.manifestPath = argv[++i];
+        } else if (a == "--fast") {
+            cfg.fast = true;
+        } else if (a == "--verify") {
+            cfg.fast = true;
+            cfg.verify = true;
+        } else if (a == "--incremental") {
+            cfg.incremental = true;
+        } else if (a == "--rebuild-index") {
+            cfg.incremental = true;
+            cfg.rebuildIndex = true;
+        } else if (a == "--index") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.indexPath = argv[++i];
+            cfg.incremental = true;
+        } else if (a == "--durability" || a.compare(0, 13, "--durability=") == 0) {
+            string v;
+            if (a.size() > 12) v = a.substr(13);
+            else if (i + 1 < argc) v = argv[++i];
+            else { log.error("Missing value for " + a); return false; }
+            if (!parse_durability(v, cfg.durability)) {
+                log.error("Invalid value for --durability: " + v + " (none, file, batch or full)");
+                return false;
+            }
+        } else if (a == "--shard" || a.compare(0, 8, "--shard=") == 0) {
+            string v;
+            if (a.size() > 7) v = a.substr(8);
+            else if (i + 1 < argc) v = argv[++i];
+            else { log.error("Missing value for " + a); return false; }
+            size_t slash = v.find('/');
+            string idx = v.substr(0, slash);
+            string count = slash == string::npos ? string() : v.substr(slash + 1);
+            if (idx.empty() || count.empty() || (idx + count).find_first_not_of("0123456789") != string::npos ||
+                idx.size() > 9 || count.size() > 9 || std::stoul(idx) == 0 || std::stoul(idx) > std::stoul(count)) {
+                log.error("Invalid value for --shard: " + v + " (i/N with 1 <= i <= N)");
+                return false;
+            }
+            cfg.shardIndex = (unsigned)std::stoul(idx);
+            cfg.shardCount = (unsigned)std::stoul(count);
+        } else if (a == "--stats") {
+            cfg.stats = true;
+        } else if (a == "--trace") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.tracePath = argv[++i];
+        } else if (a == "--serve") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.serveSocket = argv[++i];
+        } else if (a == "--files-from") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            cfg.filesFrom = argv[++i];
         } else if (!a.empty() && a[0] == '-') {
             log.error("Unknown option: " + a);
             print_usage();
@@ -88,492 +386,2664 @@ static bool parse_args(int argc, char** argv, Config &cfg, Logger &log) {
             pos.push_back(a);
         }
     }
-    if (pos.empty()) { log.error("Missing input .braw file"); print_usage(); return false; }
-    if (pos.size() > 1) {
-        log.error("Too many arguments. Expected one input .braw file, got " + std::to_string(pos.size()));
-        print_usage();
-        return false;
-    }
-    cfg.inputBraw = pos[0];
-    return true;
-}
-
-
-// Atomic text write: write tmp, flush, rename
-static bool write_text_file_atomic(const string &dest, const string &content, string &err) {
-    try {
-        std::filesystem::path destPath(dest);
-        if (destPath.has_parent_path()) {
-            std::filesystem::create_directories(destPath.parent_path());
+    if (!cfg.serveSocket.empty()) {
+        if (!pos.empty() || !cfg.filesFrom.empty() || !cfg.recursiveDirs.empty() || !cfg.watchDir.empty()) {
+            log.error("--serve takes no input files, clips are sent as requests");
+            return false;
+        }
+        if (cfg.stats || !cfg.tracePath.empty()) {
+            log.error("--stats and --trace are not available with --serve (use the stats request)");
+            return false;
         }
-        
-        string tmp = dest + ".tmp";
-        std::ofstream tmpFile(tmp, std::ios::binary);
-        if (!tmpFile) {
-            err = "Failed to create temporary file: " + tmp;
+        if (cfg.shardCount || cfg.emitAime || cfg.inventoryAttrs) {
+            log.error(string(cfg.shardCount ? "--shard" : cfg.emitAime ? "--emit-aime" : "--attrs/--inventory") + " is not available with --serve");
             return false;
         }
-        
-        tmpFile << content;
-        tmpFile.flush();
-        tmpFile.close();
-        
-        if (tmpFile.fail()) {
-            err = "Failed to write/close temporary file";
-            std::filesystem::remove(tmp);
+        if (!cfg.packPath.empty()) {
+            log.error("--pack is not available with --serve");
             return false;
         }
-        
-        std::filesystem::rename(tmp, dest);
+        if (cfg.openJobs || cfg.timeoutMs || cfg.retries || !cfg.retryListPath.empty() || cfg.maxMemory) {
+            log.error("--open-jobs, --timeout, --retries, --retry-list and --max-memory are batch options, not available with --serve");
+            return false;
+        }
+        return true;
+    }
+    if (pos.empty() && cfg.filesFrom.empty() && cfg.recursiveDirs.empty() && cfg.watchDir.empty()) { log.error("Missing input .braw file"); print_usage(); return false; }
+    cfg.inputs = pos;
+    if (cfg.inventoryAttrs) {
+        // a table and nothing else; -o names the table file
+        if (cfg.outputAll || cfg.emitAime || cfg.incremental || !cfg.manifestPath.empty() || !cfg.packPath.empty()) {
+            log.error(string(cfg.outputAll ? "-a/--all" : cfg.emitAime ? "--emit-aime" : cfg.incremental ? "--incremental" :
+                             !cfg.manifestPath.empty() ? "--manifest" : "--pack") +
+                      " writes files and cannot be used with --attrs/--inventory");
+            return false;
+        }
+        if (cfg.outputArg == "-") cfg.outputArg.clear();
+        string ext = std::filesystem::path(cfg.outputArg).extension().string();
+        if (ext == ".json" || ext == ".jsonl" || ext == ".ndjson") cfg.inventoryJson = true;
         return true;
-        
-    } catch (const std::exception& e) {
-        err = string("Error: ") + e.what();
-        try { std::filesystem::remove(dest + ".tmp"); } catch (...) {}
+    }
+    cfg.toStdout = cfg.outputArg == "-";
+    if (cfg.toStdout && (cfg.outputAll || cfg.incremental || cfg.emitAime || !cfg.packPath.empty())) {
+        log.error(string(cfg.outputAll ? "-a/--all" : cfg.incremental ? "--incremental" : cfg.emitAime ? "--emit-aime" : "--pack") +
+                  " needs an output directory and cannot be used with -o -");
         return false;
     }
+    return true;
+}
+
+// Append the paths listed in a --files-from list (one per line, empty lines ignored)
+static bool read_files_from(const string &listPath, vector<string> &inputs, Logger &log) {
+    std::ifstream listFile;
+    std::istream *in = &std::cin;
+    if (listPath != "-") {
+        listFile.open(listPath);
+        if (!listFile) {
+            log.error("Failed to open input list: " + listPath);
+            return false;
+        }
+        in = &listFile;
+    }
+    string line;
+    while (std::getline(*in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        inputs.push_back(line);
+    }
+    return true;
 }
 
-// CFStringRef -> std::string (UTF-8)
-static string CFStringToStdString(CFStringRef s) {
-    if (!s) return string();
-    const char* fast = CFStringGetCStringPtr(s, kCFStringEncodingUTF8);
-    if (fast) return string(fast);
-    CFIndex len = CFStringGetLength(s);
-    CFIndex maxSize = CFStringGetMaximumSizeForEncoding(len, kCFStringEncodingUTF8) + 1;
-    string buf;
-    buf.resize((size_t)maxSize);
-    if (CFStringGetCString(s, &buf[0], maxSize, kCFStringEncodingUTF8)) {
-        buf.resize(strlen(buf.c_str()));
-        return buf;
+// Streaming .braw finder: yields clips while walking the tree instead of listing it first
+class BrawScanner {
+public:
+    BrawScanner(const string &root, const Logger &log): root_(root), log_(log), walker_(root), started_(false) {}
+    bool next(string &path) {
+        std::error_code ec;
+        if (!started_) {
+            started_ = true;
+            if (!walker_.open(ec)) {
+                log_.error("Failed to scan directory: " + root_ + " (" + ec.message() + ")");
+                return false;
+            }
+        }
+        // An unreadable subdirectory costs the clips in it, not the rest of the scan
+        auto skipped = [&](const string &dir, const std::error_code &e) {
+            log_.error("Warning: skipped " + dir + " while scanning " + root_ + " (" + e.message() + ")");
+        };
+        std::filesystem::directory_entry entry;
+        while (walker_.next(entry, skipped)) {
+            if (entry.path().extension() != ".braw" || !entry.is_regular_file(ec)) continue;
+            path = entry.path().string();
+            return true;
+        }
+        return false;
     }
-    return string();
+private:
+    string root_;
+    const Logger &log_;
+    DirWalker walker_;
+    bool started_;
+};
+
+// With several inputs every clip gets its own auto name, so -o has to name a directory
+static bool output_accepts_batch(const string &outputArg) {
+    if (outputArg.empty() || outputArg == "." || outputArg == "-") return true;
+    if (std::filesystem::is_directory(outputArg)) return true;
+    if (std::filesystem::exists(outputArg)) return false;
+    string ext = std::filesystem::path(outputArg).extension().string();
+    return ext.empty() || ext == ".";
 }
 
-// A generic AttrValue to cache attribute result
-struct AttrValue {
-    uint32_t vt = 0;
-    string asString;                // human readable representation (formatted for display)
-    string rawValue;                // raw string value (for strings only, used for processing)
-    vector<uint8_t> rawBytes;       // raw bytes copy (SafeArray data truncated)
-    uint32_t safeArrayElementCount = 0;
-    uint32_t safeArrayVariantType = 0;
+
+// What happened to one clip's ILPD, for the batch report and manifest
+struct ClipRecord {
+    string uuid;
+    uint64_t hash = 0;
+    string ilpdPath;
+    string action;      // written, deduplicated, conflict, no-data
+    ImmersiveAttrs attrs;   // for the manifest, without the projection data (see hash)
 };
 
-// Container for all attributes
-struct ImmersiveAttrs {
-    map<BlackmagicRawImmersiveAttribute, AttrValue> attrs;
-    bool hasProjectionData() const {
-        auto it = attrs.find(blackmagicRawImmersiveAttributeOpticalProjectionData);
-        return it != attrs.end() && !it->second.rawValue.empty();
+// In-process dedup of ILPD writes across a batch.
+// A profile is identified by its UUID plus the hash of its projection data; the first clip
+// to claim an output path writes it, later clips with the same content only record it.
+// Two payloads under one UUID (or one output path) are reported as a conflict.
+class DedupTable {
+public:
+    enum Decision { WRITE, DUPLICATE, CONFLICT };
+
+    Decision claim(const string &uuid, uint64_t hash, const string &ilpdPath, const string &clip, string &detail) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!uuid.empty()) {
+            auto u = uuids_.find(uuid);
+            if (u == uuids_.end()) {
+                uuids_[uuid] = {hash, clip};
+            } else if (u->second.hash != hash) {
+                detail = "UUID " + uuid + " already seen with different projection data (first clip: " + u->second.firstClip + ")";
+                return CONFLICT;
+            }
+        }
+        for (;;) {
+            auto it = paths_.find(ilpdPath);
+            if (it == paths_.end()) {
+                paths_[ilpdPath] = {hash, PENDING, clip};
+                return WRITE;
+            }
+            PathEntry &e = it->second;
+            if (e.hash != hash) {
+                detail = "Output " + ilpdPath + " already written with different projection data (first clip: " + e.firstClip + ")";
+                return CONFLICT;
+            }
+            if (e.state == WRITTEN) { detail = e.firstClip; return DUPLICATE; }
+            if (e.state == FAILED) {
+                // previous writer failed, take over
+                e.state = PENDING;
+                e.firstClip = clip;
+                return WRITE;
+            }
+            changed_.wait(lock);
+        }
+    }
+
+    // Register an output that already exists on disk (e.g. from an index hit)
+    void note_existing(const string &uuid, uint64_t hash, const string &ilpdPath, const string &clip) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!uuid.empty() && !uuids_.count(uuid)) uuids_[uuid] = {hash, clip};
+        if (!paths_.count(ilpdPath)) paths_[ilpdPath] = {hash, WRITTEN, clip};
     }
-    string getProjectionData() const {
-        auto it = attrs.find(blackmagicRawImmersiveAttributeOpticalProjectionData);
-        return (it != attrs.end()) ? it->second.rawValue : string();
+
+    void finish(const string &ilpdPath, bool ok) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = paths_.find(ilpdPath);
+        if (it != paths_.end()) it->second.state = ok ? WRITTEN : FAILED;
+        changed_.notify_all();
     }
+
+private:
+    enum State { PENDING, WRITTEN, FAILED };
+    struct UuidEntry { uint64_t hash; string firstClip; };
+    struct PathEntry { uint64_t hash; State state; string firstClip; };
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    map<string, UuidEntry> uuids_;
+    map<string, PathEntry> paths_;
 };
 
-// Helper: variant -> readable string (and raw copy for SafeArray)
-static string variant_to_string_and_store(const Variant &v, AttrValue &out, Logger &log) {
-    if (v.vt == blackmagicRawVariantTypeString && v.bstrVal) {
-        out.rawValue = CFStringToStdString(v.bstrVal);
-        out.asString = "String value: " + out.rawValue;  // Use already stored value
-        return out.asString;
-    }
-    else if (v.vt == blackmagicRawVariantTypeSafeArray && v.parray) {
-        out.safeArrayElementCount = v.parray->bounds.cElements;
-        out.safeArrayVariantType = v.parray->variantType;
-        if (v.parray->data && out.safeArrayElementCount > 0) {
-            uint32_t elementSize = 1;
-            switch (v.parray->variantType) {
-                case blackmagicRawVariantTypeU8: elementSize = 1; break;
-                case blackmagicRawVariantTypeS16:
-                case blackmagicRawVariantTypeU16: elementSize = 2; break;
-                case blackmagicRawVariantTypeS32:
-                case blackmagicRawVariantTypeU32:
-                case blackmagicRawVariantTypeFloat32: elementSize = 4; break;
-                case blackmagicRawVariantTypeFloat64: elementSize = 8; break;
-                default: elementSize = 1; break;
-            }
-            uint64_t totalSize = (uint64_t)elementSize * (uint64_t)out.safeArrayElementCount;
-            const uint64_t PREVIEW_LIMIT = 512;      // hex preview limit
-            const uint64_t COPY_LIMIT = 64 * 1024;   // raw bytes copy limit
-            uint64_t copySize = (totalSize > COPY_LIMIT) ? COPY_LIMIT : totalSize;
-            if (copySize > 0) {
-                out.rawBytes.resize((size_t)copySize);
-                memcpy(out.rawBytes.data(), v.parray->data, (size_t)copySize);
-            }
-            // build hex preview up to PREVIEW_LIMIT
-            uint64_t previewSize = (copySize > PREVIEW_LIMIT) ? PREVIEW_LIMIT : copySize;
-            ostringstream oss;
-            oss << "SafeArray elems=" << out.safeArrayElementCount << ", type=" << out.safeArrayVariantType
-                << ", totalSize=" << totalSize << ", hex(first " << previewSize << " bytes)=";
-            const unsigned char* data = v.parray->data;
-            for (uint64_t j = 0; j < previewSize; ++j) {
-                oss << std::hex << std::setfill('0') << std::setw(2) << (unsigned)(data[j]);
-                if (j + 1 < previewSize) oss << " ";
-            }
-            if (previewSize < totalSize) oss << " ... (truncated)";
-            oss << std::dec;
-            out.asString = oss.str();
-            return out.asString;
-        } else {
-            out.asString = "SafeArray(empty)";
-            return out.asString;
+// Persistent extraction index (.ilpd-index).
+// Layout: header, fixed-size entries sorted by absolute clip path, then one string blob.
+// The file is mmapped and searched in place, so loading costs no per-entry allocation.
+// Projection data itself is not stored, only its hash; the ILPD on disk is the payload.
+class ExtractionIndex {
+public:
+    ExtractionIndex(): entries_(nullptr), count_(0), blob_(nullptr), blobSize_(0) {}
+    ExtractionIndex(const ExtractionIndex&) = delete;
+    ExtractionIndex& operator=(const ExtractionIndex&) = delete;
+
+    // A missing index is not an error, an unreadable or foreign one is ignored with a warning
+    bool load(const string &path, const Logger &log) {
+        path_ = path;
+        // save() renames the new index over this one while it is still open
+        if (!file_.open(path, true)) return file_.found() ? invalid(log) : true;
+        if (file_.size() < sizeof(Header)) return invalid(log);
+        Header h;
+        memcpy(&h, file_.data(), sizeof(h));
+        uint64_t entriesBytes = h.entryCount * (uint64_t)sizeof(Entry);
+        if (memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0 || h.version != VERSION || h.attrCount != ATTR_COUNT ||
+            h.entrySize != sizeof(Entry) || sizeof(Header) + entriesBytes > file_.size()) {
+            return invalid(log);
         }
-    } else {
-        // numeric/basic types
-        ostringstream oss;
-        switch (v.vt) {
-            case blackmagicRawVariantTypeEmpty:
-                oss << "[Empty]"; break;
-            case blackmagicRawVariantTypeU8:
-                oss << "U8 value: " << static_cast<unsigned>(v.uiVal); break;
-            case blackmagicRawVariantTypeS16:
-                oss << "S16 value: " << v.iVal; break;
-            case blackmagicRawVariantTypeU16:
-                oss << "U16 value: " << v.uiVal; break;
-            case blackmagicRawVariantTypeS32:
-                oss << "S32 value: " << v.intVal; break;
-            case blackmagicRawVariantTypeU32:
-                oss << "U32 value: " << v.uintVal; break;
-            case blackmagicRawVariantTypeFloat32:
-                oss << "Float32 value: " << v.fltVal; break;
-            case blackmagicRawVariantTypeFloat64:
-                oss << "Float64 value: " << v.dblVal; break;
-            default:
-                oss << "[Unknown vt=" << v.vt << "]"; break;
-        }
-        out.asString = oss.str();
-        return out.asString;
-    }
-}
-
-// List of attributes to extract (expand as needed)
-static const BlackmagicRawImmersiveAttribute ATTR_LIST[] = {
-    blackmagicRawImmersiveAttributeOpticalLensProcessingDataFileUUID,
-    blackmagicRawImmersiveAttributeOpticalILPDFileName,
-    blackmagicRawImmersiveAttributeOpticalInteraxial,
-    blackmagicRawImmersiveAttributeOpticalProjectionKind,
-    blackmagicRawImmersiveAttributeOpticalCalibrationType,
-    blackmagicRawImmersiveAttributeOpticalProjectionData,
-    // add more attributes here if needed
-};
-static const size_t ATTR_COUNT = sizeof(ATTR_LIST) / sizeof(ATTR_LIST[0]);
-
-// Human-friendly name & description for attributes
-static string attr_name(BlackmagicRawImmersiveAttribute a) {
-    switch (a) {
-        case blackmagicRawImmersiveAttributeOpticalLensProcessingDataFileUUID: return "OpticalLensProcessingDataFileUUID";
-        case blackmagicRawImmersiveAttributeOpticalILPDFileName: return "OpticalILPDFileName";
-        case blackmagicRawImmersiveAttributeOpticalInteraxial: return "OpticalInteraxial";
-        case blackmagicRawImmersiveAttributeOpticalProjectionKind: return "OpticalProjectionKind";
-        case blackmagicRawImmersiveAttributeOpticalCalibrationType: return "OpticalCalibrationType";
-        case blackmagicRawImmersiveAttributeOpticalProjectionData: return "OpticalProjectionData";
-        default: return "UnknownAttribute";
-    }
-}
-static string attr_desc(BlackmagicRawImmersiveAttribute a) {
-    switch (a) {
-        case blackmagicRawImmersiveAttributeOpticalLensProcessingDataFileUUID: return "UUID of the projection data file";
-        case blackmagicRawImmersiveAttributeOpticalILPDFileName: return "Name of the ILPD projection data file";
-        case blackmagicRawImmersiveAttributeOpticalInteraxial: return "Interaxial lens separation";
-        case blackmagicRawImmersiveAttributeOpticalProjectionKind: return "Projection kind ('fish' indicates Apple immersive video)";
-        case blackmagicRawImmersiveAttributeOpticalCalibrationType: return "Calibration type ('meiRives' indicates ILPD lens projection)";
-        case blackmagicRawImmersiveAttributeOpticalProjectionData: return "The contents of the projection data file (ILPD)";
-        default: return "";
-    }
-}
-
-// Extract all attributes once and cache into ImmersiveAttrs
-static bool extract_all_attributes(IBlackmagicRawClipImmersiveVideo* immersive, ImmersiveAttrs &out, Logger &log) {
-    for (size_t i = 0; i < ATTR_COUNT; ++i) {
-        BlackmagicRawImmersiveAttribute a = ATTR_LIST[i];
-        Variant v;
-        memset(&v, 0, sizeof(v));
-        HRESULT hr = immersive->GetImmersiveAttribute(a, &v);
-        AttrValue av;
-        av.vt = v.vt;
-        if (hr == S_OK) {
-            variant_to_string_and_store(v, av, log);
-            log.debug(string("Read attribute: ") + attr_name(a));
-        } else {
-            av.asString = "[Attribute not available]";
-            log.debug(string("Failed to read attribute: ") + attr_name(a));
+        entries_ = reinterpret_cast<const Entry*>(file_.data() + sizeof(Header));
+        count_ = (size_t)h.entryCount;
+        blob_ = file_.data() + sizeof(Header) + entriesBytes;
+        blobSize_ = file_.size() - sizeof(Header) - (size_t)entriesBytes;
+        for (size_t i = 0; i < count_; ++i) {
+            if (!in_blob(entries_[i].pathOff, entries_[i].pathLen) || !in_blob(entries_[i].outOff, entries_[i].outLen)) return invalid(log);
+            for (size_t a = 0; a < ATTR_COUNT; ++a) {
+                if (!in_blob(entries_[i].attrs[a].off, entries_[i].attrs[a].len)) return invalid(log);
+            }
         }
-        out.attrs[a] = av;
-        VariantClear(&v);
+        log.debug("Loaded extraction index: " + path + " (" + std::to_string(count_) + " entries)");
+        return true;
     }
-    return true;
-}
 
-// Make auto ilpd name cameraID.uuid.ilpd (fallbacks)
-static string make_auto_ilpd_name(const string &inputBraw, const ImmersiveAttrs &attrs) {
-    string cameraPart;
-    string uuidPart;
-    
-    // Get camera and uuid from ILPD filename
-    auto it = attrs.attrs.find(blackmagicRawImmersiveAttributeOpticalILPDFileName);
-    if (it != attrs.attrs.end() && !it->second.rawValue.empty()) {
-        std::filesystem::path fnPath(it->second.rawValue);
-        string stem = fnPath.stem().string();
-        size_t posDot = stem.find_last_of('.');
-        if (posDot != string::npos) {
-            cameraPart = stem.substr(0, posDot);
-            uuidPart = stem.substr(posDot + 1);
-        } else {
-            cameraPart = stem;
-        }
-    }
-    
-    // Get UUID from separate attribute if not found above
-    if (uuidPart.empty()) {
-        auto it2 = attrs.attrs.find(blackmagicRawImmersiveAttributeOpticalLensProcessingDataFileUUID);
-        if (it2 != attrs.attrs.end() && !it2->second.rawValue.empty()) {
-            uuidPart = it2->second.rawValue;
-        }
+    // False when the file was there but had to be ignored
+    bool readable() const { return !ignored_; }
+    size_t size() const { return count_; }
+
+    // An index file (as opposed to a manifest), judged by its magic
+    static bool is_index_file(const string &path) {
+        char magic[sizeof(MAGIC)];
+        std::ifstream in(path, std::ios::binary);
+        return in.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(magic)) == 0;
     }
-    
-    // Fallbacks
-    if (cameraPart.empty()) {
-        std::filesystem::path inputPath(inputBraw);
-        cameraPart = inputPath.stem().string();
+
+    // On a hit, fills rec and attrs (everything except the projection data) and returns true
+    bool lookup(const string &absPath, const FileKey &key, ClipRecord &rec, ImmersiveAttrs &attrs) const {
+        const Entry* e = find(absPath);
+        if (!e || e->size != key.size || e->mtimeNs != key.mtimeNs || e->inode != key.inode) return false;
+        decode(*e, rec, attrs);
+        return true;
     }
-    if (uuidPart.empty()) uuidPart = "default";
-    
-    return cameraPart + "." + uuidPart + ".ilpd";
-}
 
-// Helper to create detailed attribute file path based on main ILPD path
-static string make_detailed_attributes_path(const string &ilpdPath) {
-    std::filesystem::path finalPath(ilpdPath);
-    std::filesystem::path detailed = finalPath.parent_path() / (finalPath.stem().string() + "_detailed_attributes.txt");
-    
-    // Keep the same relative/absolute style as the main output file
-    if (finalPath.is_absolute()) {
-        return std::filesystem::absolute(detailed).string();
-    } else {
-        return detailed.string();
+    // Every loaded entry in path order: fn(path, key, rec, attrs)
+    template <class Fn>
+    void each(Fn fn) const {
+        for (size_t i = 0; i < count_; ++i) {
+            ClipRecord rec;
+            ImmersiveAttrs attrs;
+            decode(entries_[i], rec, attrs);
+            FileKey key;
+            key.size = entries_[i].size;
+            key.mtimeNs = entries_[i].mtimeNs;
+            key.inode = entries_[i].inode;
+            fn(string(path_of(entries_[i])), key, rec, attrs);
+        }
     }
-}
 
-// Generate detailed attributes content
-static bool write_detailed_attributes(const string &ilpdPath, const Config &cfg, const ImmersiveAttrs &cached, Logger &log) {
-    string detailedPath = make_detailed_attributes_path(ilpdPath);
-    
-    ostringstream content;
-    content << "Complete Blackmagic RAW Immersive Video Attribute List (Detailed)\n";
-    content << string(62, '=') << "\n\n";
-    content << "Input file: " << cfg.inputBraw << "\n";
-    content << "ILPD file: " << ilpdPath << "\n";
-    content << "Generated on: " << __DATE__ << " " << __TIME__ << "\n\n";
+    // Queue every entry of another index for the next save (braw2ilpd merge); the last import wins
+    void import_from(const ExtractionIndex &other) {
+        other.each([this](const string &path, const FileKey &key, const ClipRecord &rec, const ImmersiveAttrs &attrs) {
+            record(path, key, attrs, rec);
+        });
+    }
 
-    for (size_t i = 0; i < ATTR_COUNT; ++i) {
-        BlackmagicRawImmersiveAttribute a = ATTR_LIST[i];
-        content << "[" << (i+1) << "] " << attr_name(a) << "\n";
-        content << "Description: " << attr_desc(a) << "\n";
-        auto it = cached.attrs.find(a);
-        if (it == cached.attrs.end()) {
-            content << "Not retrieved.\n\n";
-            continue;
+    void record(const string &absPath, const FileKey &key, const ImmersiveAttrs &attrs, const ClipRecord &rec) {
+        Pending p;
+        p.path = absPath;
+        p.key = key;
+        p.hash = rec.hash;
+        p.ilpdPath = rec.ilpdPath;
+        p.hasIlpd = rec.action != "no-data";
+        for (size_t a = 0; a < ATTR_COUNT; ++a) {
+            const AttrValue* v = attrs.get((AttrSlot)a);
+            if (!v || !v->available) continue;
+            p.present[a] = true;
+            p.vt[a] = v->vt;
+            // projection data is represented by its hash only
+            if (a == ATTR_PROJECTION_DATA) continue;
+            p.values[a] = attr_value_text(*v);
         }
-        const AttrValue &av = it->second;
-        content << av.asString << "\n\n";
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(std::move(p));
     }
 
-    string outStr = content.str();
-    string err;
-    if (!write_text_file_atomic(detailedPath, outStr, err)) {
-        log.error(string("Failed to write detailed attributes file: ") + err);
-        return false;
-    } else {
-        log.info(string("Detailed attributes saved to: ") + detailedPath);
-        return true;
-    }
-}
+    // Merge this run's entries over the loaded ones and rewrite the index atomically
+    bool save(AtomicWriter &writer, const Logger &log) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) return true;
+        std::stable_sort(pending_.begin(), pending_.end(), [](const Pending &a, const Pending &b) { return a.path < b.path; });
+        // later duplicates (same clip given twice, or imported from a later shard) win
+        vector<const Pending*> fresh;
+        for (size_t i = 0; i < pending_.size(); ++i) {
+            if (i + 1 < pending_.size() && pending_[i + 1].path == pending_[i].path) continue;
+            fresh.push_back(&pending_[i]);
+        }
 
-// Resource cleanup helper
-static void cleanup_resources(IBlackmagicRawClipImmersiveVideo* immersive, IBlackmagicRawClip* clip, 
-                             IBlackmagicRaw* codec, IBlackmagicRawFactory* factory) {
-    if (immersive) immersive->Release();
-    if (clip) clip->Release();
-    if (codec) codec->Release();
-    if (factory) factory->Release();
-}
-
-// Resolve output path according to rules, preserving relative/absolute path style
-static string resolve_output_path(const string &outputArg, const string &autoName, Logger &log) {
-    std::filesystem::path result;
-    bool shouldBeAbsolute = false;
-    
-    if (outputArg.empty()) {
-        // Default case: relative path in current directory
-        result = autoName;
-        shouldBeAbsolute = false;
-    }
-    else if (outputArg == ".") {
-        result = autoName;
-        shouldBeAbsolute = false;
-    }
-    else {
-        // Check if user provided absolute or relative path
-        std::filesystem::path userPath(outputArg);
-        shouldBeAbsolute = userPath.is_absolute();
-        
-        if (std::filesystem::exists(outputArg)) {
-            if (std::filesystem::is_directory(outputArg)) {
-                result = userPath / autoName;
-            } else {
-                result = userPath; // overwrite existing file
-            }
-        } else {
-            string ext = userPath.extension().string();
-            if (ext.empty() || ext == ".") {
-                // No extension, treat as directory
-                try {
-                    std::filesystem::create_directories(userPath);
-                    result = userPath / autoName;
-                } catch (const std::filesystem::filesystem_error& e) {
-                    log.error("Failed to create directory: " + outputArg);
-                    return string();
+        size_t oldCount = count_;
+        string entries;
+        string blob;
+        entries.reserve((oldCount + fresh.size()) * sizeof(Entry));
+        size_t oi = 0, ni = 0;
+        uint64_t total = 0;
+        while (oi < oldCount || ni < fresh.size()) {
+            int cmp;
+            if (oi >= oldCount) cmp = 1;
+            else if (ni >= fresh.size()) cmp = -1;
+            else cmp = path_of(entries_[oi]).compare(fresh[ni]->path);
+            Entry e;
+            if (cmp < 0) {
+                e = entries_[oi];
+                e.pathOff = append(blob, path_of(entries_[oi]));
+                e.outOff = append(blob, std::string_view(blob_ + entries_[oi].outOff, entries_[oi].outLen));
+                for (size_t a = 0; a < ATTR_COUNT; ++a) {
+                    e.attrs[a].off = append(blob, std::string_view(blob_ + entries_[oi].attrs[a].off, entries_[oi].attrs[a].len));
                 }
+                ++oi;
             } else {
-                // Has extension, treat as file
-                if (ext != ".ilpd") {
-                    log.info("Note: Output file does not have .ilpd extension. ILPD files typically use .ilpd extension.");
-                }
-                if (userPath.has_parent_path()) {
-                    try {
-                        std::filesystem::create_directories(userPath.parent_path());
-                    } catch (const std::filesystem::filesystem_error& e) {
-                        log.error("Failed to create parent directories for: " + userPath.parent_path().string());
-                        return string();
-                    }
+                const Pending &p = *fresh[ni];
+                memset(&e, 0, sizeof(e));
+                e.size = p.key.size;
+                e.mtimeNs = p.key.mtimeNs;
+                e.inode = p.key.inode;
+                e.hash = p.hash;
+                e.flags = p.hasIlpd ? FLAG_HAS_ILPD : 0;
+                e.pathOff = append(blob, p.path);
+                e.pathLen = (uint32_t)p.path.size();
+                e.outOff = append(blob, p.ilpdPath);
+                e.outLen = (uint32_t)p.ilpdPath.size();
+                for (size_t a = 0; a < ATTR_COUNT; ++a) {
+                    e.attrs[a].present = p.present[a] ? 1 : 0;
+                    e.attrs[a].vt = p.vt[a];
+                    e.attrs[a].off = append(blob, p.values[a]);
+                    e.attrs[a].len = (uint32_t)p.values[a].size();
                 }
-                result = userPath;
+                if (cmp == 0) ++oi;
+                ++ni;
             }
+            entries.append(reinterpret_cast<const char*>(&e), sizeof(e));
+            ++total;
         }
-    }
-    
-    // Return path in the same style as user input
-    if (shouldBeAbsolute) {
-        try {
-            return std::filesystem::absolute(result).string();
-        } catch (const std::filesystem::filesystem_error& e) {
-            log.error("Failed to resolve absolute path: " + string(e.what()));
-            return result.string();
+
+        Header h;
+        memcpy(h.magic, MAGIC, sizeof(h.magic));
+        h.version = VERSION;
+        h.attrCount = (uint32_t)ATTR_COUNT;
+        h.entryCount = total;
+        h.entrySize = sizeof(Entry);
+        string content(reinterpret_cast<const char*>(&h), sizeof(h));
+        content += entries;
+        content += blob;
+        string err;
+        if (!writer.write(path_, content, err, log.track)) {
+            log.error("Failed to write extraction index: " + err);
+            return false;
         }
-    } else {
-        return result.string();
+        log.debug("Extraction index saved: " + path_ + " (" + std::to_string(total) + " entries)");
+        return true;
     }
-}
 
-int main(int argc, char** argv) {
-    Config cfg;
-    Logger log;
-    if (!parse_args(argc, argv, cfg, log)) return USAGE;
-    log.verbose = cfg.verbose;
-    log.silent = cfg.silent;
+private:
+    static constexpr char MAGIC[8] = {'I', 'L', 'P', 'D', 'I', 'D', 'X', '1'};
+    static const uint32_t VERSION = 1;
+    static const uint32_t FLAG_HAS_ILPD = 1;
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t attrCount;
+        uint64_t entryCount;
+        uint64_t entrySize;
+    };
+    struct EntryAttr {
+        uint32_t present;
+        uint32_t vt;
+        uint64_t off;
+        uint32_t len;
+        uint32_t reserved;
+    };
+    struct Entry {
+        uint64_t size;
+        int64_t mtimeNs;
+        uint64_t inode;
+        uint64_t hash;
+        uint64_t pathOff;
+        uint32_t pathLen;
+        uint32_t flags;
+        uint64_t outOff;
+        uint32_t outLen;
+        uint32_t reserved;
+        EntryAttr attrs[ATTR_COUNT];
+    };
+    struct Pending {
+        string path;
+        FileKey key;
+        uint64_t hash = 0;
+        string ilpdPath;
+        bool hasIlpd = false;
+        bool present[ATTR_COUNT] = {};
+        uint32_t vt[ATTR_COUNT] = {};
+        string values[ATTR_COUNT];
+    };
 
-    // Create factory
-    IBlackmagicRawFactory* factory = CreateBlackmagicRawFactoryInstance();
-    if (!factory) { 
-        log.error("Failed to create BlackmagicRawFactory. Please ensure Blackmagic RAW SDK is properly installed."); 
-        return FACTORY_FAIL; 
+    void decode(const Entry &e, ClipRecord &rec, ImmersiveAttrs &attrs) const {
+        rec.hash = e.hash;
+        rec.ilpdPath = string(blob_ + e.outOff, e.outLen);
+        rec.action = (e.flags & FLAG_HAS_ILPD) ? "unchanged" : "no-data";
+        for (size_t a = 0; a < ATTR_COUNT; ++a) {
+            const EntryAttr &ea = e.attrs[a];
+            if (!ea.present) continue;
+            AttrValue av;
+            av.vt = ea.vt;
+            av.available = true;
+            string value(blob_ + ea.off, ea.len);
+            if (ea.vt == blackmagicRawVariantTypeString) {
+                av.rawValue = value;
+            } else {
+                // numbers are stored as text; older indexes kept the display form ("Float32 value: 64.5")
+                size_t colon = value.rfind(": ");
+                av.number = strtod(value.c_str() + (colon == string::npos ? 0 : colon + 2), nullptr);
+            }
+            attrs.set((AttrSlot)a, std::move(av));
+        }
+        rec.uuid = string(attrs.text(ATTR_UUID));
     }
-
-    // Create codec
-    IBlackmagicRaw* codec = nullptr;
-    HRESULT hrCreateCodec = factory->CreateCodec(&codec);
-    if (hrCreateCodec != S_OK || !codec) {
-        log.error("Failed to create codec"); 
-        cleanup_resources(nullptr, nullptr, codec, factory);
-        return CODEC_FAIL;
+    bool invalid(const Logger &log) {
+        log.error("Warning: ignoring unreadable extraction index: " + path_);
+        ignored_ = true;
+        file_.close();
+        entries_ = nullptr;
+        count_ = 0;
+        blob_ = nullptr;
+        blobSize_ = 0;
+        return true;
+    }
+    bool in_blob(uint64_t off, uint64_t len) const { return off <= blobSize_ && len <= blobSize_ - off; }
+    std::string_view path_of(const Entry &e) const { return std::string_view(blob_ + e.pathOff, e.pathLen); }
+    const Entry* find(const string &absPath) const {
+        const Entry* first = entries_;
+        const Entry* last = entries_ + count_;
+        const Entry* it = std::lower_bound(first, last, absPath, [this](const Entry &e, const string &p) {
+            return path_of(e).compare(p) < 0;
+        });
+        return (it != last && path_of(*it) == absPath) ? it : nullptr;
+    }
+    static uint64_t append(string &blob, std::string_view s) {
+        uint64_t off = blob.size();
+        blob.append(s.data(), s.size());
+        return off;
     }
 
-    // Check if input file exists
-    if (!std::filesystem::exists(cfg.inputBraw)) {
-        log.error("Input file does not exist: " + cfg.inputBraw);
-        cleanup_resources(nullptr, nullptr, codec, factory);
-        return FILE_NOT_FOUND;
+    string path_;
+    MappedFile file_;
+    const Entry* entries_;
+    size_t count_;
+    const char* blob_;
+    size_t blobSize_;
+    bool ignored_ = false;
+    std::mutex mutex_;
+    vector<Pending> pending_;
+};
+constexpr char ExtractionIndex::MAGIC[8];
+
+// --watch runs until SIGINT/SIGTERM; the batch then drains and saves the index and manifest as usual.
+// A second signal gets the default action, for when the drain itself hangs.
+static DirWatcher* g_watcher = nullptr;
+
+extern "C" void on_stop_watch(int sig) {
+    signal(sig, SIG_DFL);
+    if (g_watcher) g_watcher->stop();
+}
+
+// What a clip is assigned to a shard by: its path below the --recursive root, or the input as given
+// (lexically normalized), so nodes that mount the archive in different places still agree
+static string shard_key(const string &input, const string &root) {
+    if (is_remote_input(input)) return input;
+    string rel = input;
+    if (!root.empty() && rel.compare(0, root.size(), root) == 0) {
+        rel.erase(0, root.size());
+        while (!rel.empty() && rel[0] == '/') rel.erase(0, 1);
     }
+    return std::filesystem::path(rel).lexically_normal().generic_string();
+}
 
-    // Check if input file has .braw extension
-    std::filesystem::path inputPath(cfg.inputBraw);
-    if (inputPath.extension() != ".braw") {
-        log.error("Input file does not have .braw extension: " + cfg.inputBraw);
-        cleanup_resources(nullptr, nullptr, codec, factory);
-        return INVALID_FILE_FORMAT;
+static bool in_shard(const Config &cfg, const string &input, const string &root) {
+    if (!cfg.shardCount) return true;
+    const string key = shard_key(input, root);
+    return hash64(key.data(), key.size()) % cfg.shardCount == cfg.shardIndex - 1;
+}
+
+// Directory that holds the default index: the output directory, or the parent of an output file
+static string default_index_path(const string &outputArg) {
+    std::filesystem::path dir(".");
+    if (!outputArg.empty() && outputArg != ".") {
+        std::filesystem::path p(outputArg);
+        string ext = p.extension().string();
+        if (std::filesystem::is_directory(p) || ext.empty() || ext == ".") dir = p;
+        else if (p.has_parent_path()) dir = p.parent_path();
     }
+    return (dir / ".ilpd-index").string();
+}
 
-    // Open clip
-    CFStringRef inputCF = CFStringCreateWithCString(kCFAllocatorDefault, cfg.inputBraw.c_str(), kCFStringEncodingUTF8);
-    if (!inputCF) { 
-        log.error("Failed to create CFString for input path"); 
-        cleanup_resources(nullptr, nullptr, codec, factory);
-        return OPENCLIP_FAIL; 
+// Batch mode: the attributes of written clips, cleared with their buffers kept, for the open stage to
+// read the next clips into. A projection data string grown once is reused for the rest of the run
+// instead of being allocated per clip; the pool keeps as many as there can be clips in flight.
+class AttrsPool {
+public:
+    explicit AttrsPool(size_t max): max_(max) {}
+    // Recycled attributes into `attrs` (left as is when the pool is empty)
+    void take(ImmersiveAttrs &attrs) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) return;
+        attrs = std::move(free_.back());
+        free_.pop_back();
     }
-    IBlackmagicRawClip* clip = nullptr;
-    HRESULT hrOpen = codec->OpenClip(inputCF, &clip);
-    CFRelease(inputCF);
-    if (hrOpen != S_OK || !clip) { 
-        log.error("Failed to open clip: " + cfg.inputBraw); 
-        if (hrOpen == E_INVALIDARG) {
-            log.error("This may indicate the file is corrupted or not a valid Blackmagic RAW file.");
-        } else if (hrOpen == E_ACCESSDENIED) {
-            log.error("Access denied. Check file permissions.");
+    void give(ImmersiveAttrs &&attrs) {
+        attrs.clear();
+        // an unusually large payload is not kept around for the rest of the run
+        for (AttrValue &v : attrs.values) {
+            if (v.rawValue.capacity() > MAX_KEPT) string().swap(v.rawValue);
+            if (v.rawBytes.capacity() > MAX_KEPT) vector<uint8_t>().swap(v.rawBytes);
         }
-        cleanup_resources(nullptr, clip, codec, factory);
-        return OPENCLIP_FAIL; 
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < max_) free_.push_back(std::move(attrs));
     }
+private:
+    static const size_t MAX_KEPT = 4 << 20;
+    size_t max_;
+    std::mutex mutex_;
+    vector<ImmersiveAttrs> free_;
+};
+
+// Shared state for one run; pointers are null when the feature is off
+struct RunContext {
+    DedupTable* dedup = nullptr;
+    ExtractionIndex* index = nullptr;
+    bool indexLookups = false;      // false with --rebuild-index
+    AtomicWriter* writer = nullptr; // every output file goes through it (--durability)
+    std::shared_ptr<StageStats> stats;  // --stats/--trace: each batch thread records on its own track
+    std::ostream* inventory = nullptr;  // --attrs/--inventory: the table rows go here instead of files
+    PackBuilder* pack = nullptr;    // --pack: every ILPD of the run is also collected here
+    AttrsPool* buffers = nullptr;   // batch mode: attribute buffers passed from written clips to new reads
+};
 
-    // Query immersive interface
-    IBlackmagicRawClipImmersiveVideo* immersive = nullptr;
-    HRESULT hrImmersive = clip->QueryInterface(IID_IBlackmagicRawClipImmersiveVideo, (void**)&immersive);
-    if (hrImmersive != S_OK || !immersive) {
-        log.error("This clip does not support immersive video features.");
-        log.error("This tool only works with Blackmagic RAW files from URSA Cine Immersive cameras.");
-        log.error("Please ensure the input file is an immersive video recording.");
-        cleanup_resources(immersive, clip, codec, factory);
-        return IMMERSIVE_NOT_SUPPORTED;
+// What is left to write for one extracted clip; filled by process_clip, applied by write_clip_outputs
+// (in batch mode on the writer stage, so the next clip is read while this one is written)
+struct ClipOutput {
+    ImmersiveAttrs attrs;
+    string ilpdPath;
+    bool pending = false;       // false: nothing left to do (unchanged clip, -o -)
+    bool writeIlpd = false;     // this clip won the dedup claim for ilpdPath
+    bool writeDetailed = false; // -a
+    string aime;                // --emit-aime document, built with the claim
+    bool indexed = false;
+    string indexKeyPath;
+    FileKey fileKey;
+};
+
+// Batch open stage: called around the calls that can block on the volume or the network (stat, the
+// SDK, remote reads); false once the deadline has given up on this clip, which must then be left alone
+typedef std::function<bool(bool blocking)> ReadPhase;
+
+// First half of process_clip, the part that waits on the volume: skip the clip through the index or read
+// its attributes into out.attrs. `skipped` is set when the index answered and nothing is left to do.
+static ExitCode read_clip(Extractor &extractor, const string &inputBraw, Logger &log, const RunContext &ctx,
+                          ClipRecord &rec, ClipOutput &out, bool &skipped, const ReadPhase &phase = ReadPhase()) {
+    StageTimer timer(log.track, Stage::EXTRACT, log.track ? log.track->label(inputBraw) : 0);
+    DedupTable* dedup = ctx.dedup;
+    const bool remote = is_remote_input(inputBraw);
+    skipped = false;
+    auto blocking = [&](bool b) { return !phase || phase(b); };
+
+    // Skip clips that have not changed since they were indexed
+    bool haveKey = false;
+    if (ctx.index && !remote) {
+        if (!blocking(true)) return CLIP_TIMEOUT;
+        haveKey = stat_file_key(inputBraw, out.fileKey);
+        if (!blocking(false)) return CLIP_TIMEOUT;
     }
+    if (haveKey) {
+        out.indexed = true;
+        out.indexKeyPath = std::filesystem::absolute(inputBraw).lexically_normal().string();
+        ImmersiveAttrs previous;
+        if (ctx.indexLookups && ctx.index->lookup(out.indexKeyPath, out.fileKey, rec, previous) &&
+            (rec.action == "no-data" || std::filesystem::exists(rec.ilpdPath))) {
+            if (dedup && rec.action != "no-data") dedup->note_existing(rec.uuid, rec.hash, rec.ilpdPath, inputBraw);
+            if (ctx.pack && rec.action != "no-data") ctx.pack->add_existing(rec.uuid, rec.hash, rec.ilpdPath);
+            ctx.index->record(out.indexKeyPath, out.fileKey, previous, rec);
+            rec.attrs = std::move(previous);
+            rec.attrs.erase(ATTR_PROJECTION_DATA);
+            log.info("Unchanged since last run, skipped: " + inputBraw);
+            skipped = true;
+            return OK;
+        }
+        rec = ClipRecord();
+    }
+
+    if (!blocking(true)) return CLIP_TIMEOUT;
+    ExitCode rc = extractor.extract(inputBraw, out.attrs, log);
+    if (!blocking(false)) return CLIP_TIMEOUT;
+    return rc;
+}
 
-    // Extract all immersive attributes once
-    ImmersiveAttrs cached;
-    extract_all_attributes(immersive, cached, log);
+// Second half of process_clip, CPU only: name the ILPD, hash it, claim it in the dedup table
+// and build the AIME document, from the attributes read_clip left in out.attrs.
+// `rec` receives what happened to the ILPD, `out` what write_clip_outputs still has to do.
+// With -o - the projection data is handed back in `streamData` instead.
+static ExitCode plan_clip(const string &inputBraw, const Config &cfg, Logger &log, const RunContext &ctx, ClipRecord &rec,
+                         string &streamData, ClipOutput &out) {
+    DedupTable* dedup = ctx.dedup;
+    // the attributes stay in out.attrs whatever happens, so their buffers get reused (see hand_over_attrs)
+    ImmersiveAttrs &cached = out.attrs;
+    // only the requested attributes were read; the reporter turns them into a table row
+    if (cfg.inventoryAttrs) return OK;
+
+    rec.uuid = string(cached.text(ATTR_UUID));
+
+    if (cfg.toStdout) {
+        rec.ilpdPath = "-";
+        if (!cached.hasProjectionData()) {
+            rec.action = "no-data";
+            log.error("Warning: No OpticalProjectionData found, nothing written to stdout");
+            return OK;
+        }
+        // a copy: the payload buffer is kept for the next clip read into these attributes
+        streamData.assign(cached.projectionData());
+        rec.hash = hash64(streamData.data(), streamData.size());
+        rec.action = "streamed";
+        return OK;
+    }
 
     // Build auto name and resolve output
-    string autoName = make_auto_ilpd_name(cfg.inputBraw, cached);
+    string autoName = make_auto_ilpd_name(inputBraw, cached);
     string finalOut = resolve_output_path(cfg.outputArg, autoName, log);
     if (finalOut.empty()) {
         log.error("Failed to determine final output path.");
-        cleanup_resources(immersive, clip, codec, factory);
         return WRITE_FAIL;
     }
-    log.info(string("Will write ILPD to: ") + finalOut);
+    rec.ilpdPath = finalOut;
+    out.ilpdPath = finalOut;
 
-    // Write ILPD (text) if found
+    // Claim the ILPD (text) if found; the write itself is left to write_clip_outputs
     if (cached.hasProjectionData()) {
-        string ilpdContent = cached.getProjectionData();
+        std::string_view ilpdContent = cached.projectionData();
+        rec.hash = hash64(ilpdContent.data(), ilpdContent.size());
+        DedupTable::Decision decision = DedupTable::WRITE;
+        string detail;
+        if (dedup) decision = dedup->claim(rec.uuid, rec.hash, finalOut, inputBraw, detail);
+        if (decision == DedupTable::CONFLICT) {
+            rec.action = "conflict";
+            log.error("ILPD conflict: " + detail);
+            return ILPD_CONFLICT;
+        }
+        if (decision == DedupTable::DUPLICATE) {
+            rec.action = "deduplicated";
+            log.info(string("ILPD already written to: ") + finalOut + " (identical to " + detail + ")");
+        } else {
+            out.writeIlpd = true;
+            // once per written ILPD, on the extraction worker
+            string err;
+            if (cfg.emitAime && !make_aime(cached, out.aime, err)) log.error("Warning: No AIME written for " + inputBraw + ": " + err);
+        }
+    } else {
+        rec.action = "no-data";
+        log.error("Warning: No OpticalProjectionData found, ILPD file not created");
+    }
+
+    // Detailed attributes if requested (once per written ILPD in batch mode)
+    out.writeDetailed = cfg.outputAll && (out.writeIlpd || !dedup || rec.action == "no-data");
+    out.pending = true;
+    return OK;
+}
+
+// Extract one clip and decide what to write; the codec is only created if the SDK is needed
+static ExitCode process_clip(Extractor &extractor, const string &inputBraw, const Config &cfg, Logger &log,
+                             const RunContext &ctx, ClipRecord &rec, string &streamData, ClipOutput &out) {
+    bool skipped;
+    ExitCode rc = read_clip(extractor, inputBraw, log, ctx, rec, out, skipped);
+    if (rc != OK || skipped) return rc;
+    return plan_clip(inputBraw, cfg, log, ctx, rec, streamData, out);
+}
+
+// Write what process_clip left in `out`: the ILPD, the detailed attributes file and the index entry.
+// A claimed output is always finished in the dedup table, so clips waiting on it are released.
+static ExitCode write_clip_outputs(ClipOutput &out, const string &inputBraw, const RunContext &ctx, Logger &log,
+                                   ClipRecord &rec) {
+    StageTimer timer(log.track, Stage::OUTPUT, log.track ? log.track->label(inputBraw) : 0);
+    if (out.writeIlpd) {
+        log.info(string("Will write ILPD to: ") + out.ilpdPath);
         string err;
-        if (!write_text_file_atomic(finalOut, ilpdContent, err)) {
+        bool ok = ctx.writer->write(out.ilpdPath, out.attrs.projectionData(), err, log.track);
+        if (ctx.dedup) ctx.dedup->finish(out.ilpdPath, ok);
+        if (!ok) {
             log.error(string("Failed to write ILPD: ") + err);
-            cleanup_resources(immersive, clip, codec, factory);
             return WRITE_FAIL;
         }
-        log.info(string("ILPD saved to: ") + finalOut);
-    } else {
-        log.error("Warning: No OpticalProjectionData found, ILPD file not created");
+        rec.action = "written";
+        log.info(string("ILPD saved to: ") + out.ilpdPath);
+        if (ctx.pack) ctx.pack->add(rec.uuid, rec.hash, out.attrs.projectionData(), out.ilpdPath);
+        if (!out.aime.empty()) {
+            const string aimePath = make_aime_path(out.ilpdPath);
+            if (!ctx.writer->write(aimePath, out.aime, err, log.track)) {
+                log.error(string("Failed to write AIME: ") + err);
+                return WRITE_FAIL;
+            }
+            log.info(string("AIME saved to: ") + aimePath);
+        }
+    }
+    if (out.writeDetailed) write_detailed_attributes(out.ilpdPath, inputBraw, out.attrs, log, ctx.writer);
+    if (out.indexed) ctx.index->record(out.indexKeyPath, out.fileKey, out.attrs, rec);
+    return OK;
+}
+
+struct ClipJob {
+    size_t index;
+    string input;
+    unsigned attempt = 0;   // --retries: 0 for the first read
+};
+
+// Nanoseconds for the verbose stage summary
+static string format_wait(uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f ms", ns / 1e6);
+    return buf;
+}
+static string format_size(uint64_t bytes) {
+    char buf[32];
+    if (bytes < 1024 * 1024) snprintf(buf, sizeof(buf), "%.1f KiB", bytes / 1024.0);
+    else snprintf(buf, sizeof(buf), "%.1f MiB", bytes / (1024.0 * 1024.0));
+    return buf;
+}
+
+struct ClipResult {
+    string input;
+    ExitCode status;
+    ClipRecord record;
+    string streamData;  // -o -: projection data for the stdout record
+    vector<LogLine> log;
+    uint64_t held = 0;  // bytes charged to the MemoryBudget until the clip is reported
+};
+
+// Manifest formats, chosen by extension: .json/.jsonl/.ndjson -> JSON Lines with typed attributes,
+// .csv -> CSV with one column per attribute, anything else -> the tab separated summary
+enum class ManifestFormat { TSV, JSONL, CSV };
+
+static ManifestFormat manifest_format(const string &path) {
+    string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (ext == ".json" || ext == ".jsonl" || ext == ".ndjson") return ManifestFormat::JSONL;
+    if (ext == ".csv") return ManifestFormat::CSV;
+    return ManifestFormat::TSV;
+}
+
+static const char TSV_HEADER[] = "clip\tstatus\tuuid\thash\tilpd\taction";
+
+static string csv_header() {
+    string h = "clip,status,uuid,hash,ilpd,action";
+    for (size_t i = 0; i < ATTR_COUNT; ++i) {
+        if (i != ATTR_PROJECTION_DATA) h += string(",") + ATTR_TABLE[i].name;
+    }
+    return h;
+}
+
+// Tab separated, so keep fields on one line
+static string tsv_field(const string &s) {
+    string out = s;
+    for (char &c : out) if (c == '\t' || c == '\n' || c == '\r') c = ' ';
+    return out;
+}
+// RFC 4180 quoting, only when needed
+static string csv_field(const string &s) {
+    if (s.find_first_of(",\"\r\n") == string::npos) return s;
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"') out += '"';
+        out += c;
     }
+    out += '"';
+    return out;
+}
+static string json_or_null(const string &s) { return s.empty() ? string("null") : json_quote(s); }
 
-    // Detailed attributes if requested
-    if (cfg.outputAll) {
-        write_detailed_attributes(finalOut, cfg, cached, log);
+// --manifest: one line per clip, flushed as each clip is reported so an interrupted run
+// still leaves a complete prefix.
+class ManifestWriter {
+public:
+    bool open(const string &path, const Logger &log) {
+        format_ = manifest_format(path);
+        path_ = path;
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            log.error("Failed to create manifest: " + path);
+            return false;
+        }
+        if (format_ == ManifestFormat::TSV) out_ << TSV_HEADER << '\n';
+        if (format_ == ManifestFormat::CSV) out_ << csv_header() << "\r\n";
+        out_.flush();
+        return true;
     }
+    ManifestFormat format() const { return format_; }
 
-    // Cleanup
-    cleanup_resources(immersive, clip, codec, factory);
+    // Close the file and hand it to the writer's durability policy
+    bool close(AtomicWriter &writer, string &err) {
+        out_.close();
+        if (out_.fail()) {
+            err = "Failed to write manifest: " + path_;
+            return false;
+        }
+        return writer.sync(path_, err);
+    }
 
-    log.info("Extraction completed successfully!");
-    return OK;
+    void write(const string &clip, ExitCode status, const ClipRecord &rec) {
+        string attrs;
+        if (format_ == ManifestFormat::CSV) {
+            for (size_t i = 0; i < ATTR_COUNT; ++i) {
+                if (i == ATTR_PROJECTION_DATA) continue;
+                const AttrValue* v = rec.attrs.get((AttrSlot)i);
+                attrs += ',';
+                if (v) attrs += csv_field(attr_value_text(*v));
+            }
+        } else if (format_ == ManifestFormat::JSONL) {
+            attrs = "{";
+            for (AttrMask m = rec.attrs.present & ~attr_bit(ATTR_PROJECTION_DATA); m; m &= m - 1) {
+                const AttrSlot a = attr_index(m);
+                if (attrs.size() > 1) attrs += ',';
+                attrs += json_quote(ATTR_TABLE[a].name) + ':' + attr_value_json(rec.attrs.values[a]);
+            }
+            attrs += '}';
+        }
+        write_row(clip, status, rec, attrs);
+    }
+
+    // One row with the attributes already in this format's form: ",cell,cell..." for CSV, a JSON object
+    // for JSON Lines, unused for TSV (braw2ilpd merge passes shard rows through this way)
+    void write_row(const string &clip, ExitCode status, const ClipRecord &rec, const string &attrs) {
+        const string hash = rec.hash ? hash_to_hex(rec.hash) : string();
+        if (format_ == ManifestFormat::TSV) {
+            out_ << tsv_field(clip) << '\t' << exit_code_name(status) << '\t' << tsv_field(rec.uuid) << '\t'
+                 << hash << '\t' << tsv_field(rec.ilpdPath) << '\t' << rec.action << '\n';
+        } else if (format_ == ManifestFormat::CSV) {
+            out_ << csv_field(clip) << ',' << exit_code_name(status) << ',' << csv_field(rec.uuid) << ',' << hash << ','
+                 << csv_field(rec.ilpdPath) << ',' << rec.action << attrs << "\r\n";
+        } else {
+            out_ << "{\"clip\":" << json_quote(clip) << ",\"status\":" << json_quote(exit_code_name(status))
+                 << ",\"code\":" << (int)status << ",\"uuid\":" << json_or_null(rec.uuid) << ",\"hash\":" << json_or_null(hash)
+                 << ",\"ilpd\":" << json_or_null(rec.ilpdPath) << ",\"action\":" << json_or_null(rec.action)
+                 << ",\"attrs\":" << (attrs.empty() ? string("{}") : attrs) << "}\n";
+        }
+        out_.flush();
+    }
+
+private:
+    ManifestFormat format_ = ManifestFormat::TSV;
+    string path_;
+    std::ofstream out_;
+};
+
+// One NDJSON line per clip for -o - in batch mode
+static string stream_record(const ClipResult &r) {
+    string line = "{\"clip\":" + json_quote(r.input) + ",\"status\":" + json_quote(exit_code_name(r.status));
+    if (!r.record.uuid.empty()) line += ",\"uuid\":" + json_quote(r.record.uuid);
+    if (r.record.hash) line += ",\"hash\":" + json_quote(hash_to_hex(r.record.hash));
+    if (!r.streamData.empty()) line += ",\"ilpd\":" + json_quote(r.streamData);
+    line += "}\n";
+    return line;
+}
+
+// --attrs/--inventory: clip, status, then the requested attributes in slot order
+struct InventoryTable {
+    AttrMask mask;
+    bool json;
+
+    string header() const {
+        if (json) return string();
+        string h = "clip,status";
+        for (AttrMask m = mask; m; m &= m - 1) h += string(",") + ATTR_TABLE[attr_index(m)].name;
+        return h + "\r\n";
+    }
+    string row(const ClipResult &r) const {
+        const ImmersiveAttrs &attrs = r.record.attrs;
+        string line = json ? "{\"clip\":" + json_quote(r.input) + ",\"status\":" + json_quote(exit_code_name(r.status))
+                           : csv_field(r.input) + ',' + exit_code_name(r.status);
+        for (AttrMask m = mask; m; m &= m - 1) {
+            const AttrDesc &d = ATTR_TABLE[attr_index(m)];
+            const AttrValue* v = attrs.get(d.slot);
+            if (json) line += ',' + json_quote(d.name) + ':' + (v ? attr_value_json(*v) : string("null"));
+            else line += ',' + (v ? csv_field(attr_value_text(*v)) : string());
+        }
+        return line + (json ? "}\n" : "\r\n");
+    }
+};
+
+// --max-memory: what the clips between their read and their report hold, roughly (their buffers by
+// capacity). The producer waits before handing out another clip while the budget is spent; clips
+// already handed out are never held up, so one clip always proceeds and the total can pass the
+// budget by the clips the open stage had queued. Without a limit it only keeps the peak.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(uint64_t limit): limit_(limit), held_(0), peak_(0), waitNs_(0) {}
+    uint64_t charge(uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        held_ += bytes;
+        peak_ = std::max(peak_, held_);
+        return bytes;
+    }
+    void release(uint64_t bytes) {
+        if (!bytes) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        held_ -= bytes;
+        if (held_ < limit_) below_.notify_all();
+    }
+    void wait() {
+        if (!limit_) return;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (held_ < limit_) return;
+        auto start = std::chrono::steady_clock::now();
+        below_.wait(lock, [this] { return held_ < limit_; });
+        waitNs_ += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    uint64_t limit() const { return limit_; }
+    uint64_t peak() const { std::lock_guard<std::mutex> lock(mutex_); return peak_; }
+    uint64_t wait_ns() const { std::lock_guard<std::mutex> lock(mutex_); return waitNs_; }
+private:
+    const uint64_t limit_;
+    uint64_t held_;
+    uint64_t peak_;
+    uint64_t waitNs_;
+    mutable std::mutex mutex_;
+    std::condition_variable below_;
+};
+
+// Collects results from the workers and reports them strictly in input order
+class OrderedReporter {
+public:
+    OrderedReporter(const Logger &log, ManifestWriter* manifest, std::ostream* stream, const InventoryTable* inventory = nullptr,
+                    MemoryBudget* budget = nullptr, AttrsPool* buffers = nullptr):
+        log_(log), manifest_(manifest), stream_(stream), inventory_(inventory), budget_(budget), buffers_(buffers), next_(0),
+        total_(0), failed_(0) {
+    }
+    void complete(size_t index, ClipResult result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_[index] = std::move(result);
+        for (auto it = pending_.find(next_); it != pending_.end(); it = pending_.find(next_)) {
+            report(it->second);
+            const uint64_t held = it->second.held;
+            if (buffers_) buffers_->give(std::move(it->second.record.attrs));
+            pending_.erase(it);
+            if (budget_) budget_->release(held);
+            ++next_;
+        }
+    }
+    size_t total() const { return total_; }
+    size_t failed() const { return failed_; }
+private:
+    void report(const ClipResult &r) {
+        log_.replay(r.log);
+        if (stream_) *stream_ << (inventory_ ? inventory_->row(r) : stream_record(r)) << std::flush;
+        ++total_;
+        if (r.status == OK) {
+            log_.info(string("[OK] ") + r.input);
+        } else {
+            ++failed_;
+            log_.error(string("[") + exit_code_name(r.status) + "] " + r.input);
+        }
+        if (manifest_) manifest_->write(r.input, r.status, r.record);
+    }
+    const Logger &log_;
+    ManifestWriter* manifest_;
+    std::ostream* stream_;
+    const InventoryTable* inventory_;
+    MemoryBudget* budget_;
+    AttrsPool* buffers_;
+    std::mutex mutex_;
+    map<size_t, ClipResult> pending_;
+    size_t next_;
+    size_t total_;
+    size_t failed_;
+};
+
+// A clip that extracted fine and still has files to write
+struct WriteJob {
+    size_t index;
+    ClipResult result;
+    ClipOutput output;
+};
+
+// Once a clip's files are written (or there is nothing to write): rows (--manifest, inventory) are built
+// from its attributes when it is reported, which gives them back to the pool then; otherwise back now
+static void hand_over_attrs(bool rows, ClipResult &result, ClipOutput &out, AttrsPool &buffers) {
+    if (rows) result.record.attrs = std::move(out.attrs);
+    else buffers.give(std::move(out.attrs));
+}
+
+static uint64_t attrs_bytes(const ImmersiveAttrs &attrs) {
+    uint64_t n = 0;
+    for (const AttrValue &v : attrs.values) n += v.rawValue.capacity() + v.rawBytes.capacity();
+    return n;
+}
+
+// What a clip holds from its read to its report, for the MemoryBudget
+static uint64_t held_bytes(const ClipResult &r, const ClipOutput &out) {
+    uint64_t n = sizeof(WriteJob) + r.input.capacity() + r.streamData.capacity() + attrs_bytes(r.record.attrs) +
+                 attrs_bytes(out.attrs) + out.ilpdPath.capacity() + out.aime.capacity();
+    for (const LogLine &l : r.log) n += sizeof(l) + l.text.capacity();
+    return n;
+}
+
+// --retries: failures worth another attempt are the volume's or the network's, not the clip's
+static bool transient_failure(ExitCode rc) {
+    return rc == OPENCLIP_FAIL || rc == CLIP_TIMEOUT;
+}
+
+// Backoff before retry `attempt` (1 = the first): 0.25 s doubling up to 30 s, plus up to a quarter
+// more (from the path) so clips that failed together do not all come back at once
+static uint64_t retry_delay_ms(const string &input, unsigned attempt) {
+    const uint64_t base = std::min<uint64_t>(30000, 250ull << std::min(attempt - 1, 7u));
+    return base + hash64(input.data(), input.size(), attempt) % (base / 4 + 1);
+}
+
+// The clips of a batch still being read, and the ones waiting out a retry backoff. A due retry goes
+// back into the open queue on the scheduler's thread, so a producer blocked in next() (--watch)
+// does not hold it up; the open queue is closed once nothing is outstanding.
+class RetryScheduler {
+public:
+    explicit RetryScheduler(BoundedQueue<ClipJob> &queue): queue_(queue), outstanding_(0), stop_(false), thread_([this] { run(); }) {}
+    ~RetryScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            changed_.notify_all();
+        }
+        thread_.join();
+    }
+    void started() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++outstanding_;
+    }
+    // The clip has its final read result
+    void finished() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --outstanding_;
+        changed_.notify_all();
+    }
+    void retry(ClipJob job, uint64_t delayMs) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiting_.push({std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs), std::move(job)});
+        changed_.notify_all();
+    }
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return outstanding_ == 0; });
+    }
+private:
+    struct Waiting {
+        std::chrono::steady_clock::time_point due;
+        ClipJob job;
+        bool operator<(const Waiting &o) const { return due > o.due; }   // earliest on top
+    };
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            if (waiting_.empty()) {
+                changed_.wait(lock);
+            } else if (std::chrono::steady_clock::now() < waiting_.top().due) {
+                changed_.wait_until(lock, waiting_.top().due);
+            } else {
+                ClipJob job = waiting_.top().job;
+                waiting_.pop();
+                lock.unlock();
+                queue_.push(std::move(job));
+                lock.lock();
+            }
+        }
+    }
+    BoundedQueue<ClipJob> &queue_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::priority_queue<Waiting> waiting_;
+    size_t outstanding_;
+    bool stop_;
+    std::thread thread_;    // last: starts once the members above exist
+};
+
+// Open stage of a batch: `slots` threads each reading one clip at a time with its own codec, so slow
+// volumes keep that many opens in flight whatever -j is. With a deadline (--timeout) a watchdog gives
+// up on a read still blocked past it: the clip gets CLIP_TIMEOUT and the thread is replaced by a new
+// one with a fresh codec. The SDK cannot cancel an OpenClip, so the stuck thread is detached and just
+// exits, result discarded, whenever its call returns. Past MAX_STALLED such threads, clips are failed
+// (and retried later) without being opened until some of the stalled reads come back.
+// A read may so outlive the run: it only uses what its Slot owns (codec, copies of the logger and the
+// context, a scratch timing track absorbed into the thread's own track after each clip).
+class OpenStage {
+public:
+    typedef std::function<void(const ClipJob &, ClipResult &&, ClipOutput &&, bool skipped)> Done;
+
+    OpenStage(const Extractor &extractor, unsigned slots, unsigned timeoutMs, BoundedQueue<ClipJob> &queue,
+              const Logger &log, const RunContext &ctx, const Done &done)
+        : extractor_(extractor), timeoutMs_(timeoutMs), queue_(queue), log_(log), ctx_(ctx), done_(done),
+          maxStalled_(std::max(16u, slots * 4)), stalled_(std::make_shared<std::atomic<unsigned>>(0)), stopping_(false) {
+        for (unsigned i = 0; i < slots; ++i) slots_.push_back(std::make_shared<Slot>(extractor_.fork(), log_, ctx_));
+    }
+    // Without --fast every codec is created up front, so a broken SDK fails the run before any clip
+    ExitCode open_codecs() {
+        for (auto &slot : slots_) {
+            ExitCode rc = slot->extractor.open(log_);
+            if (rc != OK) return rc;
+        }
+        return OK;
+    }
+    void start() {
+        for (size_t i = 0; i < slots_.size(); ++i) threads_.push_back(spawn(slots_[i], "open " + std::to_string(i + 1)));
+        if (timeoutMs_) watchdog_ = std::thread([this] { watch(); });
+    }
+    // After the queue is closed and drained
+    void join() {
+        {
+            std::lock_guard<std::mutex> lock(watchMutex_);
+            stopping_ = true;
+            watchChanged_.notify_all();
+        }
+        if (watchdog_.joinable()) watchdog_.join();
+        for (std::thread &t : threads_) {
+            if (t.joinable()) t.join();
+        }
+    }
+    unsigned abandoned() const { return abandonedCount_; }
+
+private:
+    struct Slot {
+        Slot(Extractor e, const Logger &l, const RunContext &c)
+            : extractor(std::move(e)), log(l), ctx(c), scratch(c.stats ? new StageTrack(c.stats->scratch()) : nullptr) {}
+        Extractor extractor;
+        Logger log;
+        RunContext ctx;             // keeps the StageStats alive, the rest is only used before a read can stall
+        std::unique_ptr<StageTrack> scratch;
+        std::mutex mutex;
+        bool reading = false;       // a clip is being read
+        bool blocked = false;       // ... and the thread is inside a call that may not return
+        bool abandoned = false;     // the watchdog gave up on it
+        std::chrono::steady_clock::time_point since;
+        ClipJob job;
+    };
+
+    std::thread spawn(std::shared_ptr<Slot> slot, const string &name) {
+        StageTrack* track = ctx_.stats ? ctx_.stats->track(name) : nullptr;
+        std::shared_ptr<std::atomic<unsigned>> stalled = stalled_;
+        return std::thread([this, slot, stalled, track] {
+            ClipJob job;
+            while (queue_.pop(job)) {
+                ClipResult result;
+                result.input = job.input;
+                ClipOutput out;
+                bool skipped = false;
+                if (*stalled >= maxStalled_) {
+                    result.status = CLIP_TIMEOUT;
+                    result.log.push_back({true, "Not opened: " + std::to_string(stalled->load()) + " reads on the volume are stalled"});
+                    done_(job, std::move(result), std::move(out), false);
+                    continue;
+                }
+                if (ctx_.buffers) ctx_.buffers->take(out.attrs);
+                {
+                    std::lock_guard<std::mutex> lock(slot->mutex);
+                    slot->reading = true;
+                    slot->since = std::chrono::steady_clock::now();
+                    slot->job = job;
+                }
+                Logger clipLog = slot->log;
+                clipLog.sink = &result.log;
+                clipLog.track = slot->scratch.get();
+                auto phase = [&](bool blocking) {
+                    std::lock_guard<std::mutex> lock(slot->mutex);
+                    slot->blocked = blocking;
+                    return !slot->abandoned;
+                };
+                result.status = read_clip(slot->extractor, job.input, clipLog, slot->ctx, result.record, out, skipped, phase);
+                {
+                    std::lock_guard<std::mutex> lock(slot->mutex);
+                    if (slot->abandoned) {
+                        // the run may be over by now: touch nothing but the slot and the counter
+                        --*stalled;
+                        return;
+                    }
+                    slot->reading = false;
+                }
+                if (track) track->absorb(*slot->scratch);
+                done_(job, std::move(result), std::move(out), skipped);
+            }
+        });
+    }
+
+    void watch() {
+        const auto timeout = std::chrono::milliseconds(timeoutMs_);
+        const auto interval = std::chrono::milliseconds(std::min(500u, std::max(10u, timeoutMs_ / 10)));
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.1f s", timeoutMs_ / 1000.0);
+        vector<ClipJob> timedOut;
+        std::unique_lock<std::mutex> lock(watchMutex_);
+        while (!stopping_) {
+            watchChanged_.wait_for(lock, interval);
+            const auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < slots_.size() && !stopping_; ++i) {
+                {
+                    std::lock_guard<std::mutex> slotLock(slots_[i]->mutex);
+                    Slot &s = *slots_[i];
+                    if (!s.reading || !s.blocked || s.abandoned || now - s.since < timeout) continue;
+                    s.abandoned = true;
+                    timedOut.push_back(s.job);
+                }
+                ++*stalled_;
+                ++abandonedCount_;
+                threads_[i].detach();
+                slots_[i] = std::make_shared<Slot>(extractor_.fork(), log_, ctx_);
+                threads_[i] = spawn(slots_[i], "open " + std::to_string(i + 1) + " #" + std::to_string(abandonedCount_ + 1));
+            }
+            if (timedOut.empty()) continue;
+            // reported without the lock: done_ can wait on a full queue
+            lock.unlock();
+            for (const ClipJob &job : timedOut) {
+                ClipResult result;
+                result.input = job.input;
+                result.status = CLIP_TIMEOUT;
+                result.log.push_back({true, "Timed out: reading the clip took longer than " + string(buf)});
+                done_(job, std::move(result), ClipOutput(), false);
+            }
+            timedOut.clear();
+            lock.lock();
+        }
+    }
+
+    const Extractor &extractor_;
+    unsigned timeoutMs_;
+    BoundedQueue<ClipJob> &queue_;
+    const Logger &log_;
+    const RunContext &ctx_;
+    Done done_;
+    const unsigned maxStalled_;
+    std::shared_ptr<std::atomic<unsigned>> stalled_;    // shared with the detached threads
+    unsigned abandonedCount_ = 0;
+    // slots_ and threads_ change on the watchdog thread only (and are read elsewhere once it is joined)
+    vector<std::shared_ptr<Slot>> slots_;
+    vector<std::thread> threads_;
+    std::thread watchdog_;
+    std::mutex watchMutex_;
+    std::condition_variable watchChanged_;
+    bool stopping_;
+};
+
+// Run a batch: `next` produces input paths (on the calling thread). The open stage reads clips
+// (--open-jobs threads with a codec each, deadline and retries), workers name, hash and dedup them,
+// writers take finished clips off a bounded queue so extraction never waits on the destination
+// volume unless the writers fall a full queue behind.
+static ExitCode run_batch(const Extractor &extractor, const std::function<bool(string&)> &next,
+                          const Config &cfg, const Logger &log, RunContext ctx) {
+    unsigned workerCount = cfg.jobs ? cfg.jobs : 1;
+    unsigned openCount = cfg.openJobs ? cfg.openJobs : workerCount;
+    if (workerCount > 1 || openCount > 1) {
+        log.debug("Batch workers: " + std::to_string(workerCount) + ", opens in flight: " + std::to_string(openCount));
+    }
+
+    ManifestWriter manifest;
+    if (!cfg.manifestPath.empty() && !manifest.open(cfg.manifestPath, log)) return WRITE_FAIL;
+
+    BoundedQueue<ClipJob> queue((size_t)openCount * 4);
+    // Streamed records each carry their own data, so there is nothing to deduplicate
+    DedupTable dedup;
+    if (!cfg.toStdout && !ctx.inventory) ctx.dedup = &dedup;
+    const InventoryTable inventory = {cfg.inventoryAttrs, cfg.inventoryJson};
+    if (ctx.inventory) *ctx.inventory << inventory.header() << std::flush;
+    MemoryBudget budget(cfg.maxMemory);
+    unsigned writerCount = cfg.writers ? cfg.writers : 1;
+    BoundedQueue<WriteJob> planQueue((size_t)(openCount + workerCount) * 4);
+    BoundedQueue<WriteJob> writeQueue((size_t)(workerCount + writerCount) * 4);
+    // one set of attribute buffers per clip that can be between its read and its report at once
+    AttrsPool buffers((size_t)(openCount + workerCount + writerCount) * 5);
+    ctx.buffers = &buffers;
+    const bool rows = !cfg.manifestPath.empty() || cfg.inventoryAttrs;
+    OrderedReporter reporter(log, cfg.manifestPath.empty() ? nullptr : &manifest,
+                             ctx.inventory ? ctx.inventory : cfg.toStdout ? &std::cout : nullptr,
+                             ctx.inventory ? &inventory : nullptr, &budget, &buffers);
+
+    // Where a read clip goes next: the workers, another attempt after a backoff, or the report
+    RetryScheduler retries(queue);
+    std::mutex quarantineMutex;
+    vector<std::pair<size_t, string>> quarantine;   // clips still failing on the volume after every attempt
+    const bool retrying = cfg.retries || cfg.timeoutMs || !cfg.retryListPath.empty();
+    OpenStage::Done readDone = [&](const ClipJob &job, ClipResult &&result, ClipOutput &&out, bool skipped) {
+        if (transient_failure(result.status) && job.attempt < cfg.retries) {
+            ClipJob again = job;
+            ++again.attempt;
+            const uint64_t delay = retry_delay_ms(job.input, again.attempt);
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.1f s", delay / 1000.0);
+            log.info("Retry " + std::to_string(again.attempt) + "/" + std::to_string(cfg.retries) + " in " + buf + ": " +
+                     job.input + " (" + exit_code_name(result.status) + ")");
+            buffers.give(std::move(out.attrs));
+            retries.retry(std::move(again), delay);
+            return;     // still outstanding
+        }
+        result.held = budget.charge(held_bytes(result, out));
+        if (result.status == OK && !skipped) {
+            planQueue.push({job.index, std::move(result), std::move(out)});
+        } else {
+            if (transient_failure(result.status) && retrying) {
+                result.log.push_back({true, "Quarantined after " + std::to_string(job.attempt + 1) + (job.attempt ? " attempts: " : " attempt: ") + job.input});
+                std::lock_guard<std::mutex> lock(quarantineMutex);
+                quarantine.push_back({job.index, job.input});
+            }
+            buffers.give(std::move(out.attrs));
+            reporter.complete(job.index, std::move(result));
+        }
+        retries.finished();
+    };
+    OpenStage opens(extractor, openCount, cfg.timeoutMs, queue, log, ctx, readDone);
+    if (!cfg.fast) {
+        ExitCode rc = opens.open_codecs();
+        if (rc != OK) return rc;
+    }
+
+    vector<std::thread> writers;
+    for (unsigned w = 0; w < writerCount; ++w) {
+        writers.emplace_back([&, w] {
+            StageTrack* track = ctx.stats ? ctx.stats->track("writer " + std::to_string(w + 1)) : nullptr;
+            WriteJob job;
+            while (writeQueue.pop(job)) {
+                Logger clipLog = log;
+                clipLog.sink = &job.result.log;
+                clipLog.track = track;
+                job.result.status = write_clip_outputs(job.output, job.result.input, ctx, clipLog, job.result.record);
+                hand_over_attrs(rows, job.result, job.output, buffers);
+                reporter.complete(job.index, std::move(job.result));
+            }
+        });
+    }
+    vector<std::thread> workers;
+    for (unsigned w = 0; w < workerCount; ++w) {
+        workers.emplace_back([&, w] {
+            StageTrack* track = ctx.stats ? ctx.stats->track("worker " + std::to_string(w + 1)) : nullptr;
+            WriteJob job;
+            while (planQueue.pop(job)) {
+                ClipResult &result = job.result;
+                Logger clipLog = log;
+                clipLog.sink = &result.log;
+                clipLog.track = track;
+                result.status = plan_clip(result.input, cfg, clipLog, ctx, result.record, result.streamData, job.output);
+                if (result.status == OK && job.output.pending) {
+                    writeQueue.push(std::move(job));
+                } else {
+                    hand_over_attrs(rows, result, job.output, buffers);
+                    reporter.complete(job.index, std::move(result));
+                }
+            }
+        });
+    }
+    opens.start();
+
+    size_t index = 0;
+    string input;
+    while (next(input)) {
+        budget.wait();
+        retries.started();
+        queue.push({index++, input});
+    }
+    retries.wait_idle();
+    queue.close();
+    opens.join();
+    planQueue.close();
+    for (std::thread &t : workers) t.join();
+    writeQueue.close();
+    for (std::thread &t : writers) t.join();
+    // Summed over threads: where the pipeline spent its time waiting
+    log.debug("Stage waits: opens idle " + format_wait(queue.pop_wait_ns()) +
+              ", opens blocked on workers " + format_wait(planQueue.push_wait_ns()) +
+              ", workers blocked on writers " + format_wait(writeQueue.push_wait_ns()) +
+              ", writers idle " + format_wait(writeQueue.pop_wait_ns()));
+    string held = "Clips in flight held at most " + format_size(budget.peak());
+    if (budget.limit()) held += " (--max-memory " + format_size(budget.limit()) + ", reading paused " + format_wait(budget.wait_ns()) + ")";
+    log.debug(held);
+
+    size_t total = reporter.total();
+    size_t failed = reporter.failed();
+    log.info("Processed " + std::to_string(total) + " clips: " + std::to_string(total - failed) +
+             " succeeded, " + std::to_string(failed) + " failed");
+    if (opens.abandoned()) {
+        log.error("Warning: gave up on " + std::to_string(opens.abandoned()) + " stalled reads (their threads are left to finish)");
+    }
+    ExitCode rc = failed ? BATCH_FAIL : OK;
+    if (!quarantine.empty()) {
+        // in input order, ready for --files-from
+        std::sort(quarantine.begin(), quarantine.end());
+        if (cfg.retryListPath.empty()) {
+            log.error("Warning: " + std::to_string(quarantine.size()) + " clips quarantined (--retry-list <file> saves them)");
+        } else {
+            string list;
+            for (const auto &clip : quarantine) list += clip.second + "\n";
+            string err;
+            if (!ctx.writer->write(cfg.retryListPath, list, err)) {
+                log.error("Failed to write retry list: " + err);
+                rc = WRITE_FAIL;
+            } else {
+                log.error("Warning: " + std::to_string(quarantine.size()) + " clips quarantined in " + cfg.retryListPath +
+                          " (run again with --files-from)");
+            }
+        }
+    }
+    if (!cfg.manifestPath.empty()) {
+        string err;
+        if (!manifest.close(*ctx.writer, err)) {
+            log.error(err);
+            return WRITE_FAIL;
+        }
+    }
+    return rc;
+}
+
+// exit_code_name() backwards, for manifest rows
+static bool exit_code_from_name(const string &name, ExitCode &code) {
+    for (int c = OK; c <= CLIP_TIMEOUT; ++c) {
+        if (name == exit_code_name(c)) {
+            code = (ExitCode)c;
+            return true;
+        }
+    }
+    return false;
+}
+
+// One clip line of a shard manifest. `attrs` keeps the attribute part in the form
+// ManifestWriter::write_row takes it; rows rebuilt from an index carry rec.attrs instead.
+struct ManifestRow {
+    string clip;
+    ExitCode status = OK;
+    ClipRecord rec;
+    string attrs;
+    bool fromIndex = false;
+};
+
+// Fields in manifest column order: clip, status, uuid, hash, ilpd, action
+static bool manifest_row(const vector<string> &f, ManifestRow &row, string &err) {
+    row.clip = f[0];
+    if (!exit_code_from_name(f[1], row.status)) {
+        err = "unknown status " + f[1];
+        return false;
+    }
+    row.rec.uuid = f[2];
+    if (!f[3].empty()) {
+        char* end = nullptr;
+        row.rec.hash = strtoull(f[3].c_str(), &end, 16);
+        if (f[3].size() != 16 || *end != '\0') {
+            err = "invalid hash " + f[3];
+            return false;
+        }
+    }
+    row.rec.ilpdPath = f[4];
+    row.rec.action = f[5];
+    return true;
+}
+
+// RFC 4180 records, quoted fields may span lines
+static bool csv_records(const string &text, vector<vector<string>> &records) {
+    vector<string> fields;
+    string field;
+    bool quoted = false;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (quoted) {
+            if (c != '"') field += c;
+            else if (i + 1 < text.size() && text[i + 1] == '"') { field += '"'; ++i; }
+            else quoted = false;
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.push_back(std::move(field));
+            field.clear();
+        } else if (c == '\n' || c == '\r') {
+            if (c == '\r' && i + 1 < text.size() && text[i + 1] == '\n') ++i;
+            fields.push_back(std::move(field));
+            field.clear();
+            records.push_back(std::move(fields));
+            fields.clear();
+        } else {
+            field += c;
+        }
+    }
+    if (quoted) return false;
+    if (!field.empty() || !fields.empty()) {
+        fields.push_back(std::move(field));
+        records.push_back(std::move(fields));
+    }
+    return true;
+}
+
+// Read back a manifest written by ManifestWriter in `format`
+static bool read_manifest(const string &path, ManifestFormat format, vector<ManifestRow> &rows, string &err) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        err = "Failed to open manifest: " + path;
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const string text = ss.str();
+    string rowErr;
+    size_t lineNo = 0;
+    auto fail = [&](const string &what) {
+        err = "Invalid manifest " + path + (lineNo ? " (line " + std::to_string(lineNo) + ")" : string()) + ": " + what;
+        return false;
+    };
+
+    if (format == ManifestFormat::CSV) {
+        vector<vector<string>> records;
+        if (!csv_records(text, records)) return fail("unterminated quoted field");
+        string header;
+        for (size_t i = 0; !records.empty() && i < records[0].size(); ++i) header += (i ? "," : "") + records[0][i];
+        if (header != csv_header()) return fail("not a braw2ilpd CSV manifest, or written with other attribute columns");
+        for (size_t r = 1; r < records.size(); ++r) {
+            lineNo = r + 1;
+            const vector<string> &f = records[r];
+            if (f.size() == 1 && f[0].empty()) continue;
+            if (f.size() != records[0].size()) return fail("expected " + std::to_string(records[0].size()) + " columns");
+            ManifestRow row;
+            if (!manifest_row(f, row, rowErr)) return fail(rowErr);
+            for (size_t i = 6; i < f.size(); ++i) row.attrs += ',' + csv_field(f[i]);
+            rows.push_back(std::move(row));
+        }
+        return true;
+    }
+
+    std::istringstream lines(text);
+    string line;
+    while (std::getline(lines, line)) {
+        ++lineNo;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (format == ManifestFormat::TSV && lineNo == 1) {
+            if (line != TSV_HEADER) return fail("not a braw2ilpd manifest");
+            continue;
+        }
+        if (line.empty()) continue;
+        vector<string> f;
+        ManifestRow row;
+        if (format == ManifestFormat::TSV) {
+            size_t start = 0;
+            for (size_t tab; (tab = line.find('\t', start)) != string::npos; start = tab + 1) f.push_back(line.substr(start, tab - start));
+            f.push_back(line.substr(start));
+            if (f.size() != 6) return fail("expected 6 columns");
+        } else {
+            JsonValue v;
+            JsonParser parser(line);
+            if (!parser.parse(v, rowErr)) return fail(rowErr);
+            if (v.type != JsonValue::OBJECT) return fail("expected a JSON object");
+            for (const char* key : {"clip", "status", "uuid", "hash", "ilpd", "action"}) {
+                const JsonValue* m = v.get(key);
+                if (m && m->type != JsonValue::STRING && m->type != JsonValue::NUL) return fail(string("\"") + key + "\" is not a string");
+                f.push_back(m ? m->str : string());
+            }
+            const JsonValue* attrs = v.get("attrs");
+            if (attrs && attrs->type == JsonValue::OBJECT) row.attrs = attrs->raw;
+        }
+        if (!manifest_row(f, row, rowErr)) return fail(rowErr);
+        rows.push_back(std::move(row));
+    }
+    return true;
+}
+
+static void print_merge_usage() {
+    std::cout << "Usage: braw2ilpd merge [--manifest <out>] [--index <out>] [--durability <level>] [-v|-s] <shard file> ...\n";
+    std::cout << "  Joins the manifests and extraction indexes written by --shard runs (each input is recognized\n";
+    std::cout << "  by its content). Clips are ordered by path, an ILPD written by several shards is kept once\n";
+    std::cout << "  (the others become deduplicated) and UUID or output conflicts between shards are reported.\n";
+    std::cout << "  --manifest <file>     Merged manifest (.json/.jsonl, .csv or TSV; CSV and JSON Lines need inputs\n";
+    std::cout << "                        of the same format). Built from the indexes when no manifest is given\n";
+    std::cout << "  --index <file>        Merge the shard indexes into this index (entries already in it are kept)\n";
+    std::cout << "  --durability <level>  fsync policy for the merged files (see braw2ilpd --help)\n";
+    std::cout << "  Without --manifest or --index the shards are only checked. Exits with ILPD_CONFLICT (10) on conflicts.\n";
+}
+
+// braw2ilpd merge: turn the per-shard results of a --shard run into what a single run over the
+// whole archive reports. The dedup decisions are replayed over all shards in clip order.
+static int run_merge(int argc, char** argv) {
+    Logger log;
+    string manifestOut;
+    string indexOut;
+    Durability durability = Durability::NONE;
+    vector<string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "-h" || a == "--help") { print_merge_usage(); return USAGE; }
+        else if (a == "-v" || a == "--verbose") log.verbose = true;
+        else if (a == "-s" || a == "--silent") log.silent = true;
+        else if (a == "--manifest" || a == "--index") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return USAGE; }
+            (a == "--manifest" ? manifestOut : indexOut) = argv[++i];
+        } else if (a == "--durability" || a.compare(0, 13, "--durability=") == 0) {
+            string v;
+            if (a.size() > 12) v = a.substr(13);
+            else if (i + 1 < argc) v = argv[++i];
+            else { log.error("Missing value for " + a); return USAGE; }
+            if (!parse_durability(v, durability)) {
+                log.error("Invalid value for --durability: " + v + " (none, file, batch or full)");
+                return USAGE;
+            }
+        } else if (!a.empty() && a[0] == '-') {
+            log.error("Unknown option: " + a);
+            print_merge_usage();
+            return USAGE;
+        } else {
+            inputs.push_back(a);
+        }
+    }
+    if (inputs.empty()) { log.error("Missing shard manifests or indexes to merge"); print_merge_usage(); return USAGE; }
+
+    vector<string> manifests;
+    vector<string> indexes;
+    for (const string &in : inputs) {
+        if (!std::filesystem::is_regular_file(in)) {
+            log.error("File not found: " + in);
+            return FILE_NOT_FOUND;
+        }
+        (ExtractionIndex::is_index_file(in) ? indexes : manifests).push_back(in);
+    }
+    if (!indexOut.empty() && indexes.empty()) {
+        log.error("--index needs shard indexes to merge");
+        return USAGE;
+    }
+
+    // CSV and JSON Lines keep the attributes in their own layout, so they only merge with their own kind
+    const ManifestFormat outFormat = manifest_format(manifestOut);
+    vector<ManifestRow> rows;
+    for (const string &m : manifests) {
+        ManifestFormat format = manifest_format(m);
+        if (!manifestOut.empty() && outFormat != ManifestFormat::TSV && format != outFormat) {
+            log.error("Cannot merge " + m + " into " + manifestOut + ": CSV and JSON Lines manifests only merge with their own format");
+            return USAGE;
+        }
+        size_t before = rows.size();
+        string err;
+        if (!read_manifest(m, format, rows, err)) {
+            log.error(err);
+            return INVALID_FILE_FORMAT;
+        }
+        log.debug("Read manifest: " + m + " (" + std::to_string(rows.size() - before) + " clips)");
+    }
+    std::deque<ExtractionIndex> shardIndexes;
+    for (const string &path : indexes) {
+        shardIndexes.emplace_back();
+        if (!shardIndexes.back().load(path, log) || !shardIndexes.back().readable()) return INVALID_FILE_FORMAT;
+        // no manifests: the indexes are all there is to check (and to build --manifest from)
+        if (!manifests.empty()) continue;
+        shardIndexes.back().each([&](const string &clip, const FileKey&, const ClipRecord &rec, const ImmersiveAttrs &attrs) {
+            ManifestRow row;
+            row.clip = clip;
+            row.rec = rec;
+            if (row.rec.action == "unchanged") row.rec.action = "written";
+            row.rec.attrs = attrs;
+            row.rec.attrs.erase(ATTR_PROJECTION_DATA);
+            row.fromIndex = true;
+            rows.push_back(std::move(row));
+        });
+    }
+
+    // Shards are disjoint, so a clip twice means overlapping runs; the later input wins
+    std::stable_sort(rows.begin(), rows.end(), [](const ManifestRow &a, const ManifestRow &b) { return a.clip < b.clip; });
+    vector<ManifestRow*> unique;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (i + 1 < rows.size() && rows[i + 1].clip == rows[i].clip) {
+            log.error("Warning: clip listed by more than one shard, keeping the last: " + rows[i].clip);
+            continue;
+        }
+        unique.push_back(&rows[i]);
+    }
+
+    // Same rules as DedupTable, in clip order: the first clip to reach an output writes it.
+    // Conflicts found inside one shard are decided again, the clip that won there may not win here.
+    struct Claim { uint64_t hash; string firstClip; };
+    map<string, Claim> uuids;
+    map<string, Claim> paths;
+    vector<const ManifestRow*> outputs;
+    size_t deduplicated = 0;
+    size_t conflicts = 0;
+    for (ManifestRow* row : unique) {
+        ClipRecord &rec = row->rec;
+        const bool shardConflict = row->status == ILPD_CONFLICT && rec.action == "conflict";
+        if (!rec.hash || (row->status != OK && !shardConflict) ||
+            (!shardConflict && rec.action != "written" && rec.action != "deduplicated" && rec.action != "unchanged")) continue;
+        if (shardConflict) {
+            row->status = OK;
+            rec.action = "deduplicated";
+        }
+        string detail;
+        if (!rec.uuid.empty()) {
+            auto u = uuids.find(rec.uuid);
+            if (u == uuids.end()) uuids[rec.uuid] = {rec.hash, row->clip};
+            else if (u->second.hash != rec.hash) {
+                detail = "UUID " + rec.uuid + " already seen with different projection data (first clip: " + u->second.firstClip + ")";
+            }
+        }
+        if (detail.empty()) {
+            auto p = paths.find(rec.ilpdPath);
+            if (p == paths.end()) {
+                paths[rec.ilpdPath] = {rec.hash, row->clip};
+                outputs.push_back(row);
+                if (rec.action == "deduplicated") rec.action = "written";
+                if (shardConflict) log.error("Warning: " + row->clip + " lost a conflict in its shard, " + rec.ilpdPath + " may hold other data");
+            } else if (p->second.hash != rec.hash) {
+                detail = "Output " + rec.ilpdPath + " already written with different projection data (first clip: " + p->second.firstClip + ")";
+            } else if (rec.action == "written") {
+                rec.action = "deduplicated";
+            }
+        }
+        if (!detail.empty()) {
+            log.error("ILPD conflict: " + detail + ", clip: " + row->clip);
+            row->status = ILPD_CONFLICT;
+            rec.action = "conflict";
+            ++conflicts;
+        }
+        if (rec.action == "deduplicated") ++deduplicated;
+    }
+
+    // The outputs that are reachable from here must hold what the shards recorded
+    size_t mismatches = 0;
+    for (const ManifestRow* row : outputs) {
+        std::ifstream in(row->rec.ilpdPath, std::ios::binary);
+        if (!in) {
+            log.debug("Not found here, not checked: " + row->rec.ilpdPath);
+            continue;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        const string data = ss.str();
+        if (hash64(data.data(), data.size()) != row->rec.hash) {
+            log.error("ILPD on disk does not match the shard record: " + row->rec.ilpdPath + " (clip: " + row->clip + ")");
+            ++mismatches;
+        }
+    }
+
+    AtomicWriter writer(durability);
+    ExitCode rc = OK;
+    if (!manifestOut.empty()) {
+        ManifestWriter manifest;
+        if (!manifest.open(manifestOut, log)) return WRITE_FAIL;
+        for (const ManifestRow* row : unique) {
+            if (row->fromIndex) manifest.write(row->clip, row->status, row->rec);
+            else manifest.write_row(row->clip, row->status, row->rec, row->attrs);
+        }
+        string err;
+        if (!manifest.close(writer, err)) {
+            log.error(err);
+            rc = WRITE_FAIL;
+        }
+    }
+    if (!indexOut.empty()) {
+        ExtractionIndex merged;
+        merged.load(indexOut, log);
+        for (const ExtractionIndex &shard : shardIndexes) merged.import_from(shard);
+        if (!merged.save(writer, log)) rc = WRITE_FAIL;
+    }
+    string err;
+    if (!writer.finish(err)) {
+        log.error(err);
+        rc = WRITE_FAIL;
+    }
+    log.info("Merged " + std::to_string(unique.size()) + " clips from " + std::to_string(manifests.size()) + " manifests and " +
+             std::to_string(indexes.size()) + " indexes: " + std::to_string(outputs.size()) + " ILPD files, " +
+             std::to_string(deduplicated) + " deduplicated, " + std::to_string(conflicts) + " conflicts");
+    if (rc == OK && conflicts) rc = ILPD_CONFLICT;
+    if (rc == OK && mismatches) rc = VERIFY_MISMATCH;
+    return rc;
+}
+
+static void print_unpack_usage() {
+    std::cout << "Usage: braw2ilpd get <file.ilpdpack> <uuid> [-o <file>] [-v|-s]\n";
+    std::cout << "       braw2ilpd unpack <file.ilpdpack> [-o <dir>] [--list] [uuid ...] [--durability <level>] [-v|-s]\n";
+    std::cout << "  Reads the profiles written with --pack. get prints one ILPD to stdout (or -o <file>), unpack\n";
+    std::cout << "  writes them as the ILPD files they were packed from ([cameraID].[uuid].ilpd) into -o <dir>\n";
+    std::cout << "  (default .), all of them or the UUIDs given. --list: UUID, hash, size and name of each entry.\n";
+    std::cout << "  Exits with FILE_NOT_FOUND (6) when a UUID is not in the pack.\n";
+}
+
+// braw2ilpd get / unpack: profiles out of an .ilpdpack (mapped once, looked up by binary search)
+static int run_unpack(int argc, char** argv) {
+    Logger log;
+    const bool get = string(argv[0]) == "get";
+    string outputArg;
+    bool list = false;
+    Durability durability = Durability::NONE;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "-h" || a == "--help") { print_unpack_usage(); return USAGE; }
+        else if (a == "-v" || a == "--verbose") log.verbose = true;
+        else if (a == "-s" || a == "--silent") log.silent = true;
+        else if (a == "--list" && !get) list = true;
+        else if (a == "-o" || a == "--output" || a == "--durability") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return USAGE; }
+            string v = argv[++i];
+            if (a != "--durability") {
+                outputArg = v;
+            } else if (!parse_durability(v, durability)) {
+                log.error("Invalid value for --durability: " + v + " (none, file, batch or full)");
+                return USAGE;
+            }
+        } else if (!a.empty() && a[0] == '-') {
+            log.error("Unknown option: " + a);
+            print_unpack_usage();
+            return USAGE;
+        } else {
+            args.push_back(a);
+        }
+    }
+    if (args.empty() || (get && args.size() != 2)) { print_unpack_usage(); return USAGE; }
+    PackReader pack;
+    string err;
+    if (!pack.open(args[0], err)) {
+        log.error(err);
+        return std::filesystem::exists(args[0]) ? INVALID_FILE_FORMAT : FILE_NOT_FOUND;
+    }
+
+    vector<size_t> selected;
+    ExitCode rc = OK;
+    for (size_t k = 1; k < args.size(); ++k) {
+        size_t i;
+        if (pack.find(args[k], i)) {
+            selected.push_back(i);
+        } else {
+            log.error("Not in the pack: " + args[k]);
+            rc = FILE_NOT_FOUND;
+        }
+    }
+    if (args.size() == 1) {
+        for (size_t i = 0; i < pack.size(); ++i) selected.push_back(i);
+    }
+    if (get) {
+        if (selected.empty()) return rc;
+        const std::string_view data = pack.data(selected[0]);
+        if (outputArg.empty() || outputArg == "-") {
+            if (!write_all(stdout_fd(), data)) {
+                log.error("Failed to write ILPD to stdout");
+                return WRITE_FAIL;
+            }
+            return OK;
+        }
+        AtomicWriter writer(durability);
+        if (!writer.write(outputArg, data, err) || !writer.finish(err)) {
+            log.error("Failed to write ILPD: " + err);
+            return WRITE_FAIL;
+        }
+        log.info("ILPD saved to: " + outputArg);
+        return OK;
+    }
+    if (list) {
+        for (size_t i : selected) {
+            const PackEntry e = pack.entry(i);
+            std::cout << e.uuid << "\t" << hash_to_hex(e.hash) << "\t" << e.length << "\t" << e.name << "\n";
+        }
+        return rc;
+    }
+
+    const std::filesystem::path dir = outputArg.empty() ? std::filesystem::path(".") : std::filesystem::path(outputArg);
+    AtomicWriter writer(durability);
+    for (size_t i : selected) {
+        const PackEntry e = pack.entry(i);
+        // packed names are plain file names; anything else falls back to the UUID
+        string name = e.name;
+        if (name.empty() || name.find('/') != string::npos || name == "." || name == "..") name = e.uuid + ".ilpd";
+        const string path = (dir / name).string();
+        if (!writer.write(path, pack.data(i), err)) {
+            log.error("Failed to write ILPD: " + err);
+            return WRITE_FAIL;
+        }
+        log.debug("ILPD saved to: " + path);
+    }
+    if (!writer.finish(err)) {
+        log.error(err);
+        return WRITE_FAIL;
+    }
+    log.info("Unpacked " + std::to_string(selected.size()) + " of " + std::to_string(pack.size()) + " profiles into " + dir.string());
+    return rc;
+}
+
+static void print_catalog_usage() {
+    std::cout << "Usage: braw2ilpd catalog add <catalog> <index|manifest|file.ilpd|clip.braw> ... [--fast] [--durability <level>] [-v|-s]\n";
+    std::cout << "       braw2ilpd catalog list <catalog> [--json]\n";
+    std::cout << "       braw2ilpd catalog get <catalog> <uuid|hash|file.ilpd> ...\n";
+    std::cout << "       braw2ilpd catalog diff <catalog> <uuid|hash|file.ilpd> <uuid|hash|file.ilpd>\n";
+    std::cout << "  Keeps one entry per lens profile (UUID + normalized projection data) seen in the extraction\n";
+    std::cout << "  results, with its camera ID and the first and last clip (by clip mtime) that used it.\n";
+    std::cout << "  add                   Update the catalog from extraction indexes, manifests or ILPD files; clips whose\n";
+    std::cout << "                        ILPD is already catalogued cost a lookup, new profiles are read from their ILPD.\n";
+    std::cout << "                        Clips (.braw, s3://, https://) are extracted (--fast: from the container)\n";
+    std::cout << "  list                  Profiles by camera, oldest first; a camera with several has been recalibrated\n";
+    std::cout << "                        (--json: one JSON object per profile)\n";
+    std::cout << "  get                   The entries of a UUID or profile hash, with the profile, as JSON lines\n";
+    std::cout << "  diff                  What changed between two profiles, as one JSON document (JSON Pointer paths)\n";
+    std::cout << "  Exits with FILE_NOT_FOUND (6) when get or diff find no entry.\n";
+}
+
+// One profile of catalog get/diff: a profile hash, a UUID or an ILPD file (matched by its content)
+static bool catalog_find(const ProfileCatalog &catalog, const string &key, vector<size_t> &found, const Logger &log) {
+    char* end = nullptr;
+    const uint64_t hash = key.size() == 16 ? strtoull(key.c_str(), &end, 16) : 0;
+    if (end && *end == '\0') found = catalog.find_hash(hash);
+    if (found.empty() && std::filesystem::is_regular_file(key)) {
+        std::ifstream in(key, std::ios::binary);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        const string data = normalize_profile(ss.str());
+        found = catalog.find_hash(hash64(data.data(), data.size()));
+    }
+    if (found.empty()) found = catalog.find_uuid(key);
+    if (found.empty()) log.error("Not in the catalog: " + key);
+    return !found.empty();
+}
+
+// braw2ilpd catalog: the lens profiles of an archive, built up from extraction results
+static int run_catalog(int argc, char** argv, std::shared_ptr<ClipBackend> backend) {
+    Logger log;
+    Durability durability = Durability::NONE;
+    bool json = false;
+    bool fast = false;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "-h" || a == "--help") { print_catalog_usage(); return USAGE; }
+        else if (a == "-v" || a == "--verbose") log.verbose = true;
+        else if (a == "-s" || a == "--silent") log.silent = true;
+        else if (a == "--json") json = true;
+        else if (a == "--fast") fast = true;
+        else if (a == "--durability") {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return USAGE; }
+            string v = argv[++i];
+            if (!parse_durability(v, durability)) {
+                log.error("Invalid value for --durability: " + v + " (none, file, batch or full)");
+                return USAGE;
+            }
+        } else if (!a.empty() && a[0] == '-') {
+            log.error("Unknown option: " + a);
+            print_catalog_usage();
+            return USAGE;
+        } else {
+            args.push_back(a);
+        }
+    }
+    const string command = args.empty() ? string() : args[0];
+    const size_t operands = args.size() < 2 ? 0 : args.size() - 2;
+    if ((command != "add" || !operands) && (command != "list" || operands) && (command != "get" || !operands) &&
+        (command != "diff" || operands != 2)) {
+        print_catalog_usage();
+        return USAGE;
+    }
+    const string catalogPath = args[1];
+    ProfileCatalog catalog;
+    string err;
+    if (!catalog.load(catalogPath, err)) {
+        log.error(err);
+        return INVALID_FILE_FORMAT;
+    }
+
+    if (command == "list") {
+        vector<CatalogEntry> entries;
+        for (size_t i = 0; i < catalog.size(); ++i) entries.push_back(catalog.entry(i));
+        std::sort(entries.begin(), entries.end(), [](const CatalogEntry &a, const CatalogEntry &b) {
+            if (a.camera != b.camera) return a.camera < b.camera;
+            return a.firstSeenNs != b.firstSeenNs ? a.firstSeenNs < b.firstSeenNs : a.firstClip < b.firstClip;
+        });
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const CatalogEntry &e = entries[i];
+            if (json) {
+                std::cout << catalog_entry_json(e, false) << "\n";
+                continue;
+            }
+            if (i == 0 || entries[i - 1].camera != e.camera) {
+                size_t n = 1;
+                while (i + n < entries.size() && entries[i + n].camera == e.camera) ++n;
+                std::cout << (e.camera.empty() ? string("(unknown camera)") : e.camera) << ": " << n
+                          << (n == 1 ? " profile" : " profiles, recalibrated") << "\n";
+            }
+            std::cout << "  " << hash_to_hex(e.hash) << "  " << e.uuid << "  " << e.firstClip << " .. " << e.lastClip << "\n";
+        }
+        log.debug(std::to_string(entries.size()) + " profiles in " + catalogPath);
+        return OK;
+    }
+    if (command == "get") {
+        ExitCode rc = OK;
+        for (size_t k = 2; k < args.size(); ++k) {
+            vector<size_t> found;
+            if (!catalog_find(catalog, args[k], found, log)) { rc = FILE_NOT_FOUND; continue; }
+            for (size_t i : found) std::cout << catalog_entry_json(catalog.entry(i), true) << "\n";
+        }
+        return rc;
+    }
+    if (command == "diff") {
+        vector<size_t> a, b;
+        if (!catalog_find(catalog, args[2], a, log) | !catalog_find(catalog, args[3], b, log)) return FILE_NOT_FOUND;
+        if (a.size() > 1 || b.size() > 1) log.error("Warning: several profiles match, comparing the first ones (see catalog get)");
+        std::cout << diff_profiles_json(catalog.entry(a[0]), catalog.entry(b[0])) << "\n";
+        return OK;
+    }
+
+    // add: one sighting per clip; a clip costs a lookup unless its ILPD is new to the catalog
+    const int64_t now = (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    size_t clips = 0, skipped = 0, added = 0, conflicts = 0, failed = 0;
+    ExtractOptions options;
+    options.fast = fast;
+    options.backend = std::move(backend);
+    Extractor extractor(options);
+    auto clip_time = [&](const string &clip) {
+        FileKey key;
+        return !is_remote_input(clip) && stat_file_key(clip, key) ? key.mtimeNs : now;
+    };
+    auto camera_of = [](std::string_view fileName) {
+        string camera, uuid;
+        split_ilpd_file_name(fileName, camera, uuid);
+        return camera;
+    };
+    // `content`: the projection data when it is already in memory (a clip, an ILPD given as input)
+    auto sight = [&](CatalogSighting s, const string &ilpdPath, const string *content) {
+        ++clips;
+        // indexes keep absolute paths, manifests the ones given: one spelling per clip
+        if (!is_remote_input(s.clip)) s.clip = std::filesystem::absolute(s.clip).lexically_normal().string();
+        size_t index;
+        if (catalog.find_raw(s.rawHash, s.uuid, index)) {
+            catalog.see(index, s);
+            return;
+        }
+        string data;
+        if (content) {
+            data = *content;
+        } else {
+            std::ifstream in(ilpdPath, std::ios::binary);
+            if (!in) {
+                log.error("Warning: ILPD not found, clip not catalogued: " + ilpdPath + " (clip: " + s.clip + ")");
+                ++skipped;
+                return;
+            }
+            std::stringstream ss;
+            ss << in.rdbuf();
+            data = ss.str();
+            if (s.rawHash && hash64(data.data(), data.size()) != s.rawHash) {
+                log.error("Warning: ILPD on disk does not match the extraction record, clip not catalogued: " + ilpdPath +
+                          " (clip: " + s.clip + ")");
+                ++skipped;
+                return;
+            }
+        }
+        bool isNew = false;
+        index = catalog.add(s, data, isNew);
+        if (!isNew) return;
+        ++added;
+        const CatalogEntry e = catalog.entry(index);
+        log.info("New profile " + hash_to_hex(e.hash) + ": " + (e.camera.empty() ? string("(unknown camera)") : e.camera) +
+                 " UUID " + e.uuid + ", first clip " + e.firstClip);
+        for (size_t i = 0; i < catalog.size(); ++i) {
+            const CatalogEntry o = catalog.entry(i);
+            if (i != index && !e.camera.empty() && o.camera == e.camera) {
+                log.info("  " + e.camera + " was recalibrated: it also has profile " + hash_to_hex(o.hash) + " (last clip " + o.lastClip + ")");
+                break;
+            }
+        }
+    };
+    for (size_t k = 2; k < args.size(); ++k) {
+        const string &input = args[k];
+        string ext = input_name_path(input).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        if (ext == ".braw" || is_remote_input(input)) {
+            ImmersiveAttrs attrs;
+            if (extractor.extract(input, attrs, log) != OK) {
+                ++failed;
+                continue;
+            }
+            if (!attrs.hasProjectionData()) {
+                log.info("No projection data, not catalogued: " + input);
+                continue;
+            }
+            CatalogSighting s;
+            s.uuid = string(attrs.text(ATTR_UUID));
+            s.camera = camera_of(attrs.text(ATTR_ILPD_FILE_NAME));
+            const string data(attrs.projectionData());
+            s.rawHash = hash64(data.data(), data.size());
+            s.clip = input;
+            s.seenNs = clip_time(input);
+            sight(s, string(), &data);
+            continue;
+        }
+        if (!std::filesystem::is_regular_file(input)) {
+            log.error("File not found: " + input);
+            return FILE_NOT_FOUND;
+        }
+        const size_t start = clips;
+        if (ext == ".ilpd") {
+            std::ifstream in(input, std::ios::binary);
+            std::stringstream ss;
+            ss << in.rdbuf();
+            const string data = ss.str();
+            CatalogSighting s;
+            split_ilpd_file_name(std::filesystem::path(input).filename().string(), s.camera, s.uuid);
+            s.rawHash = hash64(data.data(), data.size());
+            s.clip = input;
+            s.seenNs = clip_time(input);
+            // an ILPD is no clip: it only brings in its profile if that is new
+            size_t known;
+            if (!catalog.find_raw(s.rawHash, s.uuid, known)) sight(s, input, &data);
+        } else if (ExtractionIndex::is_index_file(input)) {
+            ExtractionIndex index;
+            if (!index.load(input, log) || !index.readable()) return INVALID_FILE_FORMAT;
+            index.each([&](const string &clip, const FileKey &key, const ClipRecord &rec, const ImmersiveAttrs &attrs) {
+                if (rec.action == "no-data" || !rec.hash) return;
+                CatalogSighting s;
+                s.uuid = rec.uuid;
+                const string output = std::filesystem::path(rec.ilpdPath).filename().string();
+                s.camera = camera_of(attrs.has(ATTR_ILPD_FILE_NAME) ? attrs.text(ATTR_ILPD_FILE_NAME) : std::string_view(output));
+                s.rawHash = rec.hash;
+                s.clip = clip;
+                s.seenNs = key.mtimeNs;
+                sight(s, rec.ilpdPath, nullptr);
+            });
+        } else {
+            vector<ManifestRow> rows;
+            if (!read_manifest(input, manifest_format(input), rows, err)) {
+                log.error(err);
+                return INVALID_FILE_FORMAT;
+            }
+            for (const ManifestRow &row : rows) {
+                const ClipRecord &rec = row.rec;
+                if (row.status == ILPD_CONFLICT) ++conflicts;
+                if (row.status != OK || !rec.hash || (rec.action != "written" && rec.action != "deduplicated" && rec.action != "unchanged")) continue;
+                CatalogSighting s;
+                s.uuid = rec.uuid;
+                // manifests do not keep the ILPD file name attribute, the output was named after it
+                s.camera = camera_of(std::filesystem::path(rec.ilpdPath).filename().string());
+                s.rawHash = rec.hash;
+                s.clip = row.clip;
+                s.seenNs = clip_time(row.clip);
+                sight(s, rec.ilpdPath, nullptr);
+            }
+        }
+        log.debug("Read " + input + ": " + std::to_string(clips - start) + " clips");
+    }
+
+    if (conflicts) {
+        log.error("Warning: " + std::to_string(conflicts) + " manifest clips lost an ILPD conflict, so their profiles were not written; "
+                  "add those clips themselves to catalog them");
+    }
+    ExitCode rc = failed ? BATCH_FAIL : OK;
+    if (catalog.modified()) {
+        AtomicWriter writer(durability);
+        if (!catalog.save(catalogPath, writer, err) || !writer.finish(err)) {
+            log.error("Failed to write catalog: " + err);
+            rc = WRITE_FAIL;
+        }
+    }
+    log.info("Catalogued " + std::to_string(clips - skipped) + " clips: " + std::to_string(added) + " new profiles, " +
+             std::to_string(catalog.size()) + " in " + catalogPath + (skipped ? ", " + std::to_string(skipped) + " skipped" : string()) +
+             (failed ? ", " + std::to_string(failed) + " clips failed" : string()));
+    return rc;
+}
+
+static void print_stmap_usage() {
+    std::cout << "Usage: braw2ilpd stmap <input.braw|profile.ilpd> [more ...] [-o <dir|file.exr|file.tif>] [options]\n";
+    std::cout << "  Writes an STMap per eye of the clip's lens profile: an equirectangular map whose R/G hold the\n";
+    std::cout << "  normalized source position (s, t; t = 0 at the bottom, -1 outside the lens) of every pixel.\n";
+    std::cout << "  -o, --output <path>   Output directory (default .) or, for one input, a file name that gets the eye\n";
+    std::cout << "                        before the extension\n";
+    std::cout << "  --size <WxH>          Output size (default: the source size of each eye); repeat for several sizes,\n";
+    std::cout << "                        which adds .WxH to the file names\n";
+    std::cout << "  --fov <degrees>       Field of view covered by the map, horizontally and vertically (default 180)\n";
+    std::cout << "  --format exr|tiff     32-bit float OpenEXR (default) or TIFF; also taken from the -o extension\n";
+    std::cout << "  --eye <name>          Only this eye (see -v for the names in the profile)\n";
+    std::cout << "  --gpu                 Generate all maps in one GPU batch (Metal, macOS) and check them against the CPU\n";
+    std::cout << "  -j, --jobs <N>        CPU threads (default one per CPU core)\n";
+    std::cout << "  --no-simd             Use the scalar CPU kernel only\n";
+    std::cout << "  --fast                Read the profile of a .braw from the container, fall back to the SDK\n";
+    std::cout << "  --durability <level>  fsync policy for the maps written (see braw2ilpd --help)\n";
+    std::cout << "  -v, --verbose         Verbose logging\n";
+    std::cout << "  -s, --silent          Suppress non-error output\n";
+}
+
+// Lens profile of a clip (projection data) or of an .ilpd written earlier
+static ExitCode read_stmap_profile(const string &input, Extractor &extractor, string &profile, Logger &log) {
+    string ext = std::filesystem::path(input).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (ext == ".braw" || is_remote_input(input)) {
+        ImmersiveAttrs attrs;
+        ExitCode rc = extractor.extract(input, attrs, log);
+        if (rc != OK) return rc;
+        if (!attrs.hasProjectionData()) {
+            log.error("No projection data in " + input);
+            return INVALID_FILE_FORMAT;
+        }
+        profile = attrs.takeProjectionData();
+        return OK;
+    }
+    std::ifstream in(input, std::ios::binary);
+    if (!in) {
+        log.error("File not found: " + input);
+        return FILE_NOT_FOUND;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    profile = ss.str();
+    return OK;
+}
+
+// braw2ilpd stmap: the lens profiles of clips (or .ilpd files written earlier) as STMaps for compositing
+static int run_stmap(int argc, char** argv, std::shared_ptr<ClipBackend> backend) {
+    Logger log;
+    vector<string> inputs;
+    vector<std::pair<unsigned, unsigned>> sizes;
+    string outputArg;
+    string eyeName;
+    bool fast = false;
+    bool gpu = false;
+    bool formatGiven = false;
+    Durability durability = Durability::NONE;
+    StmapOptions opts;
+    opts.threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        auto value = [&](string &out) {
+            if (i + 1 >= argc) { log.error("Missing value for " + a); return false; }
+            out = argv[++i];
+            return true;
+        };
+        string v;
+        if (a == "-h" || a == "--help") { print_stmap_usage(); return USAGE; }
+        else if (a == "-v" || a == "--verbose") log.verbose = true;
+        else if (a == "-s" || a == "--silent") log.silent = true;
+        else if (a == "--fast") fast = true;
+        else if (a == "--gpu") gpu = true;
+        else if (a == "--no-simd") opts.scalar = true;
+        else if (a == "-o" || a == "--output") { if (!value(outputArg)) return USAGE; }
+        else if (a == "--eye") { if (!value(eyeName)) return USAGE; }
+        else if (a == "--size") {
+            if (!value(v)) return USAGE;
+            unsigned w = 0, h = 0;
+            char x = 0, extra = 0;
+            if (sscanf(v.c_str(), "%u%c%u%c", &w, &x, &h, &extra) != 3 || (x != 'x' && x != 'X') || !w || !h || w > 65536 || h > 65536) {
+                log.error("Invalid value for --size: " + v + " (WxH, e.g. 4096x4096)");
+                return USAGE;
+            }
+            sizes.emplace_back(w, h);
+        } else if (a == "--fov") {
+            if (!value(v)) return USAGE;
+            char* end = nullptr;
+            opts.fovDeg = strtod(v.c_str(), &end);
+            if (v.empty() || *end || !(opts.fovDeg > 0) || opts.fovDeg > 360) {
+                log.error("Invalid value for --fov: " + v + " (degrees, up to 360)");
+                return USAGE;
+            }
+        } else if (a == "--format") {
+            if (!value(v)) return USAGE;
+            if (v == "exr") opts.format = StmapFormat::EXR;
+            else if (v == "tif" || v == "tiff") opts.format = StmapFormat::TIFF;
+            else { log.error("Invalid value for --format: " + v + " (exr or tiff)"); return USAGE; }
+            formatGiven = true;
+        } else if (a == "--durability") {
+            if (!value(v)) return USAGE;
+            if (!parse_durability(v, durability)) {
+                log.error("Invalid value for --durability: " + v + " (none, file, batch or full)");
+                return USAGE;
+            }
+        } else if (a == "-j" || a == "--jobs") {
+            if (!value(v)) return USAGE;
+            char* end = nullptr;
+            unsigned long n = strtoul(v.c_str(), &end, 10);
+            if (v.empty() || *end || n > 1024) { log.error("Invalid value for " + a + ": " + v); return USAGE; }
+            if (n) opts.threads = (unsigned)n;
+        } else if (!a.empty() && a[0] == '-') {
+            log.error("Unknown option: " + a);
+            print_stmap_usage();
+            return USAGE;
+        } else {
+            inputs.push_back(a);
+        }
+    }
+    if (inputs.empty()) { log.error("Missing input .braw or .ilpd file"); print_stmap_usage(); return USAGE; }
+    if (sizes.empty()) sizes.emplace_back(0, 0);
+
+    // -o: a directory (<stem>.<eye>.stmap.exr in it) or a file name that gets the eye before its extension
+    std::filesystem::path dir = outputArg.empty() ? std::filesystem::path(".") : std::filesystem::path(outputArg);
+    string outExt = std::filesystem::path(outputArg).extension().string();
+    std::transform(outExt.begin(), outExt.end(), outExt.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    const bool fileName = (outExt == ".exr" || outExt == ".tif" || outExt == ".tiff") && !std::filesystem::is_directory(outputArg);
+    if (fileName) {
+        if (inputs.size() > 1) {
+            log.error("With several inputs, -o/--output must be a directory: " + outputArg);
+            return USAGE;
+        }
+        if (!formatGiven) opts.format = outExt == ".exr" ? StmapFormat::EXR : StmapFormat::TIFF;
+        dir = std::filesystem::path(outputArg).parent_path();
+    }
+    AtomicWriter writer(durability);
+    opts.writer = &writer;
+    // batch: the maps written so far are only durable once this ran
+    auto finish = [&](ExitCode rc) {
+        string err;
+        if (!writer.finish(err)) {
+            log.error(err);
+            if (rc == OK) rc = WRITE_FAIL;
+        }
+        return rc;
+    };
+
+    ExtractOptions options;
+    options.fast = fast;
+    options.backend = std::move(backend);
+    Extractor extractor(options);
+    vector<StmapJob> jobs;
+    for (const string &input : inputs) {
+        string profile;
+        ExitCode rc = read_stmap_profile(input, extractor, profile, log);
+        if (rc != OK) return rc;
+        LensModel model;
+        string err;
+        if (!parse_lens_model(profile, model, err)) {
+            log.error(input + ": " + err);
+            return INVALID_FILE_FORMAT;
+        }
+        std::filesystem::path stem = fileName ? std::filesystem::path(outputArg).stem() : std::filesystem::path(input).filename();
+        if (!fileName) stem.replace_extension();
+        size_t matched = 0;
+        for (const EyeLens &e : model.eyes) {
+            log.debug("Lens " + describe_lens(e));
+            if (!eyeName.empty() && e.name != eyeName) continue;
+            ++matched;
+            for (const auto &size : sizes) {
+                StmapJob job;
+                job.eye = e;
+                job.opts = opts;
+                job.opts.width = size.first;
+                job.opts.height = size.second;
+                string name = stem.string() + "." + e.name;
+                if (sizes.size() > 1) name += "." + std::to_string(size.first) + "x" + std::to_string(size.second);
+                if (fileName) name += outExt;
+                else name += opts.format == StmapFormat::EXR ? ".stmap.exr" : ".stmap.tif";
+                job.path = (dir / name).string();
+                jobs.push_back(std::move(job));
+            }
+        }
+        if (!matched) {
+            log.error("No eye named " + eyeName + " in " + input);
+            return USAGE;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto written = [&](const StmapJob &job, const char* kernel) {
+        const auto now = std::chrono::steady_clock::now();
+        char took[64];
+        snprintf(took, sizeof(took), "%.2f s", std::chrono::duration<double>(now - start).count());
+        start = now;
+        unsigned w, h;
+        stmap_size(job.eye, job.opts, w, h);
+        string how = kernel;
+        if (how != "metal") how += ", " + std::to_string(opts.threads) + (opts.threads == 1 ? " thread" : " threads");
+        log.info("STMap written to: " + job.path + " (" + std::to_string(w) + "x" + std::to_string(h) + ", " + how + ", " + took + ")");
+    };
+
+    if (gpu && !stmap_gpu_name()) {
+        log.error("Warning: no GPU backend available, using the CPU");
+        gpu = false;
+    }
+    if (gpu) {
+        ExitCode rc = OK;
+        string err;
+        bool ran = write_stmaps_gpu(jobs, [&](size_t i, const string &jobErr) {
+            if (!jobErr.empty()) {
+                log.error(jobs[i].path + ": " + jobErr);
+                if (rc == OK) rc = WRITE_FAIL;
+            } else {
+                written(jobs[i], stmap_gpu_name());
+            }
+        }, err);
+        if (ran) return finish(rc);
+        log.error("Warning: GPU batch failed, using the CPU: " + err);
+    }
+    for (const StmapJob &job : jobs) {
+        string err;
+        if (!write_stmap(job.eye, job.opts, job.path, err)) {
+            log.error(job.path + ": " + err);
+            return finish(WRITE_FAIL);
+        }
+        written(job, stmap_kernel_name(opts.scalar));
+    }
+    return finish(OK);
+}
+
+int braw2ilpd_main(int argc, char** argv, std::shared_ptr<ClipBackend> backend) {
+    if (argc >= 2 && string(argv[1]) == "stmap") return run_stmap(argc - 1, argv + 1, std::move(backend));
+    if (argc >= 2 && string(argv[1]) == "merge") return run_merge(argc - 1, argv + 1);
+    if (argc >= 2 && (string(argv[1]) == "get" || string(argv[1]) == "unpack")) return run_unpack(argc - 1, argv + 1);
+    if (argc >= 2 && string(argv[1]) == "catalog") return run_catalog(argc - 1, argv + 1, std::move(backend));
+    Config cfg;
+    Logger log;
+    if (!parse_args(argc, argv, cfg, log)) return USAGE;
+    log.verbose = cfg.verbose;
+    log.silent = cfg.silent;
+    log.infoToStderr = cfg.toStdout || (cfg.inventoryAttrs && cfg.outputArg.empty());
+
+    if (!cfg.serveSocket.empty()) {
+        ExtractOptions options;
+        options.fast = cfg.fast;
+        options.verify = cfg.verify;
+        options.sampleFrames = cfg.sampleFrames;
+        options.backend = backend;
+        Extractor extractor(options);
+        ServeOptions serveOpts;
+        serveOpts.socketPath = cfg.serveSocket;
+        serveOpts.jobs = cfg.jobsGiven ? cfg.jobs : std::max(1u, std::thread::hardware_concurrency());
+        serveOpts.eagerOpen = !cfg.fast;
+        serveOpts.durability = cfg.durability;
+        return serve(extractor, serveOpts, log);
+    }
+
+    if (!cfg.filesFrom.empty() && !read_files_from(cfg.filesFrom, cfg.inputs, log)) return USAGE;
+    if (cfg.inputs.empty() && cfg.recursiveDirs.empty() && cfg.watchDir.empty()) { log.error("No input .braw files given"); return USAGE; }
+    vector<string> dirs = cfg.recursiveDirs;
+    if (!cfg.watchDir.empty()) dirs.push_back(cfg.watchDir);
+    for (const string &dir : dirs) {
+        if (!std::filesystem::is_directory(dir)) {
+            log.error("Not a directory: " + dir);
+            return FILE_NOT_FOUND;
+        }
+    }
+    // an inventory is a table even for one clip, so it always runs as a batch
+    // a single clip with --timeout/--retries still needs the open stage
+    const bool batch = cfg.inputs.size() > 1 || !cfg.recursiveDirs.empty() || !cfg.watchDir.empty() || cfg.inventoryAttrs ||
+                       cfg.timeoutMs || cfg.retries;
+    if (batch && !cfg.inventoryAttrs && !output_accepts_batch(cfg.outputArg)) {
+        log.error("With several inputs, -o/--output must be a directory: " + cfg.outputArg);
+        return USAGE;
+    }
+
+    RunContext ctx;
+    AtomicWriter writer(cfg.durability);
+    ctx.writer = &writer;
+    // shared with the open stage, whose stalled reads can outlive the run
+    std::shared_ptr<StageStats> stats;
+    if (cfg.stats || !cfg.tracePath.empty()) {
+        stats = std::make_shared<StageStats>(!cfg.tracePath.empty());
+        ctx.stats = stats;
+        log.track = stats->track("main");
+    }
+    if (cfg.stats) g_countAllocations = true;
+    std::unique_ptr<PackBuilder> pack;
+    if (!cfg.packPath.empty()) {
+        pack.reset(new PackBuilder(cfg.packPath));
+        ctx.pack = pack.get();
+    }
+    // batch durability: everything written above is made durable here, before the run reports success
+    auto finish = [&](ExitCode rc) {
+        if (ctx.pack && !ctx.pack->commit(writer, log) && rc == OK) rc = WRITE_FAIL;
+        if (ctx.index && !ctx.index->save(writer, log) && rc == OK) rc = WRITE_FAIL;
+        string err;
+        if (!writer.finish(err, log.track)) {
+            log.error(err);
+            if (rc == OK) rc = WRITE_FAIL;
+        }
+        // stderr, so the summary never mixes with -o - data
+        if (cfg.stats) std::cerr << stats->summary() << memory_summary(stats->count(Stage::EXTRACT));
+        if (!cfg.tracePath.empty()) {
+            if (stats->write_trace(cfg.tracePath, err)) {
+                log.debug("Trace written to: " + cfg.tracePath);
+            } else {
+                log.error("Failed to write trace: " + err);
+                if (rc == OK) rc = WRITE_FAIL;
+            }
+        }
+        return rc;
+    };
+    ExtractionIndex index;
+    if (cfg.incremental) {
+        if (!index.load(cfg.indexPath.empty() ? default_index_path(cfg.outputArg) : cfg.indexPath, log)) return USAGE;
+        ctx.index = &index;
+        ctx.indexLookups = !cfg.rebuildIndex;
+    }
+
+    // Create factory and codec (deferred with --fast until a clip needs the SDK)
+    ExtractOptions options;
+    options.fast = cfg.fast;
+    options.verify = cfg.verify;
+    options.sampleFrames = cfg.sampleFrames;
+    if (cfg.inventoryAttrs) options.attrs = cfg.inventoryAttrs;
+    options.backend = std::move(backend);
+    Extractor extractor(options);
+
+    std::ofstream inventoryFile;
+    if (cfg.inventoryAttrs) {
+        ctx.inventory = &std::cout;
+        if (!cfg.outputArg.empty()) {
+            inventoryFile.open(cfg.outputArg, std::ios::binary | std::ios::trunc);
+            if (!inventoryFile) {
+                log.error("Failed to create inventory: " + cfg.outputArg);
+                return WRITE_FAIL;
+            }
+            ctx.inventory = &inventoryFile;
+        }
+    }
+
+    if (!batch) {
+        if (!in_shard(cfg, cfg.inputs[0], string())) {
+            log.info("Not in shard " + std::to_string(cfg.shardIndex) + "/" + std::to_string(cfg.shardCount) + ", skipped: " + cfg.inputs[0]);
+            return finish(OK);
+        }
+        if (!cfg.fast) {
+            ExitCode rc = extractor.open(log);
+            if (rc != OK) return rc;
+        }
+        ClipRecord rec;
+        string streamData;
+        ClipOutput out;
+        ExitCode rc = process_clip(extractor, cfg.inputs[0], cfg, log, ctx, rec, streamData, out);
+        if (rc == OK && out.pending) rc = write_clip_outputs(out, cfg.inputs[0], ctx, log, rec);
+        if (rc == OK && cfg.toStdout && !write_all(stdout_fd(), streamData)) {
+            log.error("Failed to write ILPD to stdout");
+            rc = WRITE_FAIL;
+        }
+        rc = finish(rc);
+        if (rc == OK) log.info("Extraction completed successfully!");
+        return rc;
+    }
+
+    // Batch: keep going after failures, report per-clip status and a summary.
+    // Explicit inputs come first, then each --recursive tree as it is walked, then --watch.
+    std::unique_ptr<DirWatcher> watcher;
+    if (!cfg.watchDir.empty()) {
+        WatchOptions watchOpts;
+        watchOpts.root = cfg.watchDir;
+        watchOpts.settleMs = cfg.settleMs;
+        watcher.reset(new DirWatcher(watchOpts, log));
+        string err;
+        if (!watcher->start(err)) {
+            log.error("Failed to watch " + cfg.watchDir + ": " + err);
+            return finish(USAGE);
+        }
+        g_watcher = watcher.get();
+        signal(SIGINT, on_stop_watch);
+        signal(SIGTERM, on_stop_watch);
+        log.info("Watching " + cfg.watchDir + " for new clips (Ctrl-C to finish)");
+    }
+    size_t nextInput = 0;
+    size_t nextDir = 0;
+    std::unique_ptr<BrawScanner> scanner;
+    auto source = [&](string &input, string &root) {
+        if (nextInput < cfg.inputs.size()) {
+            input = cfg.inputs[nextInput++];
+            root.clear();
+            return true;
+        }
+        for (;;) {
+            if (scanner && scanner->next(input)) {
+                root = cfg.recursiveDirs[nextDir - 1];
+                return true;
+            }
+            if (nextDir >= cfg.recursiveDirs.size()) {
+                if (!watcher || !watcher->next(input)) return false;
+                root = cfg.watchDir;
+                return true;
+            }
+            log.debug("Scanning: " + cfg.recursiveDirs[nextDir]);
+            scanner.reset(new BrawScanner(cfg.recursiveDirs[nextDir++], log));
+        }
+    };
+    size_t otherShards = 0;
+    ExitCode rc = run_batch(extractor, [&](string &input) {
+        string root;
+        while (source(input, root)) {
+            if (in_shard(cfg, input, root)) return true;
+            ++otherShards;
+        }
+        return false;
+    }, cfg, log, ctx);
+    if (watcher) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        g_watcher = nullptr;
+    }
+    if (cfg.shardCount) {
+        log.info("Shard " + std::to_string(cfg.shardIndex) + "/" + std::to_string(cfg.shardCount) + ": " +
+                 std::to_string(otherShards) + " clips left to other shards");
+    }
+    if (inventoryFile.is_open()) {
+        inventoryFile.close();
+        string err;
+        if (inventoryFile.fail()) err = "Failed to write inventory: " + cfg.outputArg;
+        if (!err.empty() || !writer.sync(cfg.outputArg, err)) {
+            log.error(err);
+            if (rc == OK) rc = WRITE_FAIL;
+        }
+    }
+
+    return finish(rc);
+}
+
+#ifndef BRAW2ILPD_NO_MAIN
+// Counting costs one relaxed load per allocation until --stats turns it on. Every form of operator new
+// and delete is replaced, so none of them mixes with the library's own allocator.
+static void* counted_alloc(std::size_t size, std::size_t align, bool nothrow) {
+    if (g_countAllocations.load(std::memory_order_relaxed)) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    if (!size) size = 1;
+    for (;;) {
+        void* p = nullptr;
+#ifdef _WIN32
+        // _aligned_malloc blocks must go back through _aligned_free, so every aligned form takes it
+        if (!align) p = malloc(size);
+        else p = _aligned_malloc(size, align);
+#else
+        if (align <= alignof(std::max_align_t)) p = malloc(size);
+        else if (posix_memalign(&p, align, size) != 0) p = nullptr;
+#endif
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            if (nothrow) return nullptr;
+            throw std::bad_alloc();
+        }
+        if (!nothrow) {
+            handler();
+            continue;
+        }
+        try {
+            handler();
+        } catch (const std::bad_alloc &) {
+            return nullptr;
+        }
+    }
+}
+void* operator new(std::size_t size) { return counted_alloc(size, 0, false); }
+void* operator new[](std::size_t size) { return counted_alloc(size, 0, false); }
+void* operator new(std::size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size, 0, true); }
+void* operator new[](std::size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size, 0, true); }
+void* operator new(std::size_t size, std::align_val_t al) { return counted_alloc(size, (std::size_t)al, false); }
+void* operator new[](std::size_t size, std::align_val_t al) { return counted_alloc(size, (std::size_t)al, false); }
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept { return counted_alloc(size, (std::size_t)al, true); }
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept { return counted_alloc(size, (std::size_t)al, true); }
+#ifdef _WIN32
+static void aligned_release(void* p) { _aligned_free(p); }
+#else
+static void aligned_release(void* p) { free(p); }
+#endif
+#ifdef _MSC_VER
+#define BRAW2ILPD_NOINLINE __declspec(noinline)
+#else
+#define BRAW2ILPD_NOINLINE __attribute__((noinline))
+#endif
+// all of it is free() (aligned_release() for the aligned forms); out of line: inlined, GCC takes the
+// free() for a mismatch with the new expression
+BRAW2ILPD_NOINLINE void operator delete(void* p) noexcept { free(p); }
+BRAW2ILPD_NOINLINE void operator delete[](void* p) noexcept { free(p); }
+BRAW2ILPD_NOINLINE void operator delete(void* p, std::size_t) noexcept { free(p); }
+BRAW2ILPD_NOINLINE void operator delete[](void* p, std::size_t) noexcept { free(p); }
+BRAW2ILPD_NOINLINE void operator delete(void* p, const std::nothrow_t &) noexcept { free(p); }
+BRAW2ILPD_NOINLINE void operator delete[](void* p, const std::nothrow_t &) noexcept { free(p); }
+BRAW2ILPD_NOINLINE void operator delete(void* p, std::align_val_t) noexcept { aligned_release(p); }
+BRAW2ILPD_NOINLINE void operator delete[](void* p, std::align_val_t) noexcept { aligned_release(p); }
+BRAW2ILPD_NOINLINE void operator delete(void* p, std::size_t, std::align_val_t) noexcept { aligned_release(p); }
+BRAW2ILPD_NOINLINE void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { aligned_release(p); }
+BRAW2ILPD_NOINLINE void operator delete(void* p, std::align_val_t, const std::nothrow_t &) noexcept { aligned_release(p); }
+BRAW2ILPD_NOINLINE void operator delete[](void* p, std::align_val_t, const std::nothrow_t &) noexcept { aligned_release(p); }
+
+int main(int argc, char** argv) {
+    return braw2ilpd_main(argc, argv, nullptr);
 }
+#endif
@@ -0,0 +1,12 @@
+// braw2ilpd.h
+// - Entry point of the braw2ilpd CLI, so tools that link braw2ilpd.cpp (braw2ilpd_bench,
+//   built with BRAW2ILPD_NO_MAIN) can run it in-process against another backend
+
+#pragma once
+
+#include <memory>
+
+#include "ilpdextract.h"
+
+// argc/argv as for main(); `backend` replaces the Blackmagic RAW SDK when set
+int braw2ilpd_main(int argc, char** argv, std::shared_ptr<ilpd::ClipBackend> backend);
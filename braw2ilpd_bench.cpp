@@ -0,0 +1,391 @@
+// braw2ilpd_bench.cpp
+// - Performance regression suite that needs neither the SDK nor real URSA Cine Immersive media
+// - MockBackend stands in for the SDK: synthetic ILPD payloads of a configurable size, a configurable
+//   number of distinct lens profiles, injected CreateCodec / OpenClip / GetImmersiveAttribute latency
+// - Scenarios: single-clip latency, batch throughput per -j, dedup, manifest formats, durability levels
+// - Runs the real CLI in-process (braw2ilpd_main) and reports clips/s and peak RSS per scenario; each
+//   scenario runs in a forked child, so its peak RSS is not the high-water mark of the ones before it
+//   (Windows has no fork(): there the scenarios run in the bench process one after the other)
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "ilpdextract.h"
+#include "sdk_string.h"
+#include "braw2ilpd.h"
+
+using namespace ilpd;
+using std::string;
+using std::vector;
+
+struct MockOptions {
+    size_t payloadBytes = 16384;    // size of the synthetic OpticalProjectionData
+    unsigned profiles = 0;          // distinct lens profiles (UUID + payload), 0 = one per clip
+    unsigned codecUs = 20000;       // CreateCodec latency
+    unsigned openUs = 2000;         // OpenClip latency
+    unsigned attrUs = 50;           // latency of each GetImmersiveAttribute
+};
+
+static void mock_sleep(unsigned us) {
+    if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static Variant mock_string(const string &s) {
+    Variant v;
+    VariantInit(&v);
+    v.vt = blackmagicRawVariantTypeString;
+    v.bstrVal = sdk_string_create(s);
+    return v;
+}
+
+// One open mock clip; every value is derived from its lens profile
+class MockClip : public ImmersiveClip {
+public:
+    MockClip(unsigned profile, const MockOptions &opts): profile_(profile), opts_(opts) {}
+    HRESULT get_attribute(BlackmagicRawImmersiveAttribute a, Variant &v) override {
+        mock_sleep(opts_.attrUs);
+        char uuid[40];
+        snprintf(uuid, sizeof(uuid), "00000000-0000-4000-8000-%012x", profile_);
+        switch (a) {
+            case blackmagicRawImmersiveAttributeOpticalLensProcessingDataFileUUID: v = mock_string(uuid); return S_OK;
+            case blackmagicRawImmersiveAttributeOpticalILPDFileName: v = mock_string(string("MOCKCAM.") + uuid + ".ilpd"); return S_OK;
+            case blackmagicRawImmersiveAttributeOpticalProjectionKind: v = mock_string("Fisheye"); return S_OK;
+            case blackmagicRawImmersiveAttributeOpticalCalibrationType: v = mock_string("Mock"); return S_OK;
+            case blackmagicRawImmersiveAttributeOpticalInteraxial:
+                VariantInit(&v);
+                v.vt = blackmagicRawVariantTypeFloat32;
+                v.fltVal = 64.0f;
+                return S_OK;
+            case blackmagicRawImmersiveAttributeOpticalProjectionData: v = mock_string(payload()); return S_OK;
+            default: return E_INVALIDARG;
+        }
+    }
+private:
+    // JSON-ish text padded to the requested size, different for every profile
+    string payload() const {
+        string out = "{\"profile\":" + std::to_string(profile_) + ",\"data\":\"";
+        while (out.size() + 2 < opts_.payloadBytes) out += (char)('a' + (out.size() * 7 + profile_) % 26);
+        out += "\"}";
+        return out;
+    }
+    unsigned profile_;
+    const MockOptions &opts_;
+};
+
+class MockCodec : public ClipCodec {
+public:
+    explicit MockCodec(const MockOptions &opts): opts_(opts) {}
+    // Clip number from the file name (clip_000042.braw), mapped onto the configured profiles
+    ExitCode open_clip(const string &input, std::unique_ptr<ImmersiveClip> &clip, const Logger &log) override {
+        mock_sleep(opts_.openUs);
+        string stem = std::filesystem::path(input).stem().string();
+        size_t digits = stem.find_first_of("0123456789");
+        if (digits == string::npos) {
+            log.error("Failed to open clip: " + input);
+            return OPENCLIP_FAIL;
+        }
+        unsigned n = (unsigned)std::strtoul(stem.c_str() + digits, nullptr, 10);
+        clip.reset(new MockClip(opts_.profiles ? n % opts_.profiles : n, opts_));
+        return OK;
+    }
+private:
+    const MockOptions &opts_;
+};
+
+class MockBackend : public ClipBackend {
+public:
+    explicit MockBackend(const MockOptions &opts): opts_(opts) {}
+    ExitCode create_codec(std::unique_ptr<ClipCodec> &codec, const Logger &) override {
+        mock_sleep(opts_.codecUs);
+        codec.reset(new MockCodec(opts_));
+        return OK;
+    }
+private:
+    MockOptions opts_;
+};
+
+// Peak resident set size of this process so far, in MiB: in a scenario's child, what the scenario
+// needed on top of the small bench process it was forked from
+static double peak_rss_mb() {
+    return peak_rss_bytes() / (1024.0 * 1024.0);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct BenchConfig {
+    size_t clips = 200;
+    vector<unsigned> jobs = {1, 2, 4, 8};
+    unsigned dedupProfiles = 4;
+    string workDir;             // empty == a fresh directory under the system temp dir
+    string scenario;            // empty == all
+    bool keep = false;
+    MockOptions mock;
+};
+
+class Bench {
+public:
+    explicit Bench(const BenchConfig &cfg): cfg_(cfg), failed_(false) {}
+
+    bool setup() {
+        root_ = cfg_.workDir.empty()
+            ? std::filesystem::temp_directory_path() / ("braw2ilpd_bench." + std::to_string(process_id()))
+            : std::filesystem::path(cfg_.workDir);
+        inputs_ = root_ / "clips";
+        std::error_code ec;
+        std::filesystem::create_directories(inputs_, ec);
+        if (ec) {
+            std::cerr << "Failed to create " << inputs_.string() << ": " << ec.message() << std::endl;
+            return false;
+        }
+        // The mock never reads the files, they only have to exist with a .braw extension
+        for (size_t i = 0; i < cfg_.clips; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "clip_%06zu.braw", i);
+            std::ofstream(inputs_ / name);
+        }
+        return true;
+    }
+
+    void teardown() {
+        std::error_code ec;
+        if (!cfg_.keep) std::filesystem::remove_all(root_, ec);
+    }
+
+    bool wants(const string &scenario) const { return cfg_.scenario.empty() || cfg_.scenario == scenario; }
+    bool failed() const { return failed_; }
+
+    // Warm extraction loop, then a cold CLI run for one clip
+    void single_clip_latency() {
+        isolated([&] { warm_latency(); });
+        // Cold CLI run for one clip: factory, codec, extraction and the ILPD write
+        run("single-clip (cli)", {(inputs_ / "clip_000000.braw").string(), "-o", out_dir("single").string() + "/"}, 1, cfg_.mock);
+    }
+
+    void batch_throughput() {
+        for (unsigned j : cfg_.jobs) {
+            run("batch -j " + std::to_string(j), batch_args("batch-j" + std::to_string(j), j), cfg_.clips, cfg_.mock);
+        }
+    }
+
+    void dedup() {
+        MockOptions mock = cfg_.mock;
+        mock.profiles = cfg_.dedupProfiles;
+        run("dedup " + std::to_string(mock.profiles) + " profiles", batch_args("dedup", max_jobs()), cfg_.clips, mock);
+    }
+
+    void manifests() {
+        for (const char* ext : {"tsv", "jsonl", "csv"}) {
+            vector<string> args = batch_args(string("manifest-") + ext, max_jobs());
+            args.push_back("--manifest");
+            args.push_back((root_ / ("manifest." + string(ext))).string());
+            run(string("manifest ") + ext, args, cfg_.clips, cfg_.mock);
+        }
+    }
+
+    void durability() {
+        for (const char* level : {"none", "file", "batch", "full"}) {
+            vector<string> args = batch_args(string("durability-") + level, max_jobs());
+            args.push_back("--durability");
+            args.push_back(level);
+            run(string("durability ") + level, args, cfg_.clips, cfg_.mock);
+        }
+    }
+
+    static void header() {
+        printf("%-28s %8s %10s %10s %10s\n", "scenario", "clips", "seconds", "clips/s", "peak RSS");
+    }
+
+private:
+    // Runs `scenario` in a forked child, which prints its report lines; a failure there fails the bench
+    template<typename F> void isolated(F scenario) {
+#ifdef _WIN32
+        scenario();
+#else
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "fork: " << strerror(errno) << std::endl;
+            failed_ = true;
+            return;
+        }
+        if (pid == 0) {
+            scenario();
+            fflush(stdout);
+            _exit(failed_ ? 1 : 0);
+        }
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed_ = true;
+#endif
+    }
+
+    // Warm Extractor, one clip at a time: what the hot extraction loop costs per clip
+    void warm_latency() {
+        ExtractOptions options;
+        MockOptions mock = cfg_.mock;
+        options.backend = std::make_shared<MockBackend>(mock);
+        Extractor extractor(options);
+        Logger log;
+        log.silent = true;
+        if (extractor.open(log) != OK) { failed_ = true; return; }
+        vector<double> ms;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < cfg_.clips; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "clip_%06zu.braw", i);
+            auto t = std::chrono::steady_clock::now();
+            ImmersiveAttrs attrs;
+            if (extractor.extract((inputs_ / name).string(), attrs, log) != OK) failed_ = true;
+            ms.push_back(seconds_since(t) * 1000);
+        }
+        double total = seconds_since(start);
+        std::sort(ms.begin(), ms.end());
+        auto pct = [&](double p) { return ms[std::min(ms.size() - 1, (size_t)(p * ms.size()))]; };
+        report("single-clip (extract)", cfg_.clips, total);
+        printf("    latency ms: p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n", pct(0.50), pct(0.95), pct(0.99), ms.back());
+    }
+
+    unsigned max_jobs() const { return *std::max_element(cfg_.jobs.begin(), cfg_.jobs.end()); }
+
+    // Fresh output directory per run, so every run writes all of its files
+    std::filesystem::path out_dir(const string &name) const {
+        std::filesystem::path dir = root_ / "out" / name;
+        std::error_code ec;
+        std::filesystem::remove_all(dir, ec);
+        std::filesystem::create_directories(dir, ec);
+        return dir;
+    }
+
+    vector<string> batch_args(const string &name, unsigned jobs) const {
+        return {"-r", inputs_.string(), "-o", out_dir(name).string() + "/", "-j", std::to_string(jobs)};
+    }
+
+    void run(const string &name, vector<string> args, size_t clips, const MockOptions &mock) {
+        args.insert(args.begin(), "braw2ilpd");
+        args.push_back("-s");
+        vector<char*> argv;
+        for (string &a : args) argv.push_back(&a[0]);
+        argv.push_back(nullptr);
+        isolated([&] {
+            auto start = std::chrono::steady_clock::now();
+            int rc = braw2ilpd_main((int)args.size(), argv.data(), std::make_shared<MockBackend>(mock));
+            double secs = seconds_since(start);
+            if (rc != OK) {
+                std::cerr << name << ": braw2ilpd failed with " << exit_code_name(rc) << std::endl;
+                failed_ = true;
+            }
+            report(name, clips, secs);
+        });
+    }
+
+    void report(const string &name, size_t clips, double secs) const {
+        printf("%-28s %8zu %10.3f %10.1f %7.1f MB\n", name.c_str(), clips, secs, secs > 0 ? clips / secs : 0.0, peak_rss_mb());
+        fflush(stdout);
+    }
+
+    BenchConfig cfg_;
+    std::filesystem::path root_;
+    std::filesystem::path inputs_;
+    bool failed_;
+};
+
+static void print_usage() {
+    std::cout << "Usage: braw2ilpd_bench [options]\n";
+    std::cout << "  --clips <N>            Clips per scenario (default 200)\n";
+    std::cout << "  --jobs <list>          -j values for the batch scenario, e.g. 1,2,4,8 (default); the largest is used elsewhere\n";
+    std::cout << "  --payload <bytes>      Size of the synthetic projection data (default 16384)\n";
+    std::cout << "  --profiles <N>         Distinct lens profiles in the dedup scenario (default 4)\n";
+    std::cout << "  --codec-latency <us>   Injected CreateCodec latency (default 20000)\n";
+    std::cout << "  --open-latency <us>    Injected OpenClip latency (default 2000)\n";
+    std::cout << "  --attr-latency <us>    Injected latency per GetImmersiveAttribute (default 50)\n";
+    std::cout << "  --scenario <name>      Only run one of: single, batch, dedup, manifest, durability\n";
+    std::cout << "  --dir <path>           Work directory (default: a new one in the system temp dir)\n";
+    std::cout << "  --keep                 Keep the work directory\n";
+    std::cout << "  -h, --help             Show this help\n";
+}
+
+static bool parse_uint(const string &s, unsigned long &out) {
+    if (s.empty() || s.find_first_not_of("0123456789") != string::npos) return false;
+    out = std::stoul(s);
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, BenchConfig &cfg) {
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "-h" || a == "--help") { print_usage(); return false; }
+        if (a == "--keep") { cfg.keep = true; continue; }
+        if (i + 1 >= argc) {
+            std::cerr << (a[0] == '-' ? "Missing value for " : "Unknown argument: ") << a << std::endl;
+            return false;
+        }
+        string v = argv[++i];
+        unsigned long n = 0;
+        bool ok = true;
+        if (a == "--clips") { ok = parse_uint(v, n) && n > 0; cfg.clips = n; }
+        else if (a == "--payload") { ok = parse_uint(v, n) && n > 0; cfg.mock.payloadBytes = n; }
+        else if (a == "--profiles") { ok = parse_uint(v, n) && n > 0; cfg.dedupProfiles = (unsigned)n; }
+        else if (a == "--codec-latency") { ok = parse_uint(v, n); cfg.mock.codecUs = (unsigned)n; }
+        else if (a == "--open-latency") { ok = parse_uint(v, n); cfg.mock.openUs = (unsigned)n; }
+        else if (a == "--attr-latency") { ok = parse_uint(v, n); cfg.mock.attrUs = (unsigned)n; }
+        else if (a == "--dir") cfg.workDir = v;
+        else if (a == "--scenario") {
+            ok = v == "single" || v == "batch" || v == "dedup" || v == "manifest" || v == "durability";
+            cfg.scenario = v;
+        } else if (a == "--jobs") {
+            cfg.jobs.clear();
+            size_t pos = 0;
+            while (ok && pos <= v.size()) {
+                size_t comma = v.find(',', pos);
+                if (comma == string::npos) comma = v.size();
+                ok = parse_uint(v.substr(pos, comma - pos), n) && n > 0;
+                cfg.jobs.push_back((unsigned)n);
+                pos = comma + 1;
+            }
+        } else {
+            std::cerr << "Unknown option: " << a << std::endl;
+            return false;
+        }
+        if (!ok) {
+            std::cerr << "Invalid value for " << a << ": " << v << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg;
+    if (!parse_args(argc, argv, cfg)) return USAGE;
+
+    Bench bench(cfg);
+    if (!bench.setup()) return WRITE_FAIL;
+    printf("mock: %zu clips, %zu byte payload, latency codec %u us, open %u us, attribute %u us\n", cfg.clips,
+           cfg.mock.payloadBytes, cfg.mock.codecUs, cfg.mock.openUs, cfg.mock.attrUs);
+    Bench::header();
+    if (bench.wants("single")) bench.single_clip_latency();
+    if (bench.wants("batch")) bench.batch_throughput();
+    if (bench.wants("dedup")) bench.dedup();
+    if (bench.wants("manifest")) bench.manifests();
+    if (bench.wants("durability")) bench.durability();
+    bench.teardown();
+    return bench.failed() ? BATCH_FAIL : OK;
+}
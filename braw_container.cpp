@@ -0,0 +1,560 @@
+// braw_container.cpp
+// - QuickTime atom walker for the .braw immersive metadata (moov[/trak][/udta]/meta keys + ilst)
+// - MappedFileSource: local files through a read-only mapping, only touched pages are read
+// - HttpRangeSource: s3:// / http(s):// objects through libcurl byte-range requests
+
+#include "braw_container.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+#ifdef BRAW2ILPD_HAVE_CURL
+#include <curl/curl.h>
+#endif
+
+namespace ilpd {
+
+using std::string;
+using std::vector;
+
+// Memory-mapped local file; only the pages the reader touches are faulted in
+class MappedFileSource : public ByteSource {
+public:
+    bool open(const string &path, string &err) {
+        if (!file_.open(path)) { err = file_.found() ? "mmap failed" : "cannot open file"; return false; }
+        if (file_.size() == 0) { err = "cannot stat file"; return false; }
+        file_.advise_random();  // no readahead, we jump between atoms
+        return true;
+    }
+    uint64_t size() const override { return file_.size(); }
+    bool read(uint64_t offset, size_t len, string &out) override {
+        if (offset > file_.size() || len > file_.size() - offset) return false;
+        out.assign(file_.data() + offset, len);
+        return true;
+    }
+private:
+    MappedFile file_;
+};
+
+static inline uint32_t be32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+}
+static inline uint64_t be64(const char* p) { return ((uint64_t)be32(p) << 32) | be32(p + 4); }
+
+// Lowercase alphanumerics only, so "com.blackmagic-design.optical_projection_data" and
+// "OpticalProjectionData" compare equal on their tail
+static string normalize_key(const string &s) {
+    string out;
+    for (char c : s) {
+        if (isalnum((unsigned char)c)) out += (char)tolower((unsigned char)c);
+    }
+    return out;
+}
+
+// Reads the immersive attributes from the QuickTime metadata of a .braw (moov[/trak][/udta]/meta
+// keys + ilst, mdta style). Keys are matched on their tail against the attribute names, since the
+// exact key strings are not documented; if the projection data (or, when it is not asked for, any
+// wanted attribute) is not found the layout is treated as unrecognized and the caller falls back to the SDK.
+class ContainerMetadataReader {
+public:
+    ContainerMetadataReader(ByteSource &src, AttrMask mask): src_(src), mask_(mask) {}
+
+    bool read(ImmersiveAttrs &out, string &why) {
+        for (AttrMask m = mask_; m; m &= m - 1) {
+            wanted_.push_back(normalize_key(ATTR_TABLE[attr_index(m)].name));
+            wantedIndex_.push_back((int)attr_index(m));
+        }
+        if (!walk(0, src_.size(), 0, out)) {
+            if (why_.empty()) why_ = "malformed container";
+            why = why_;
+            return false;
+        }
+        const bool found = (mask_ & attrs_used_for(ATTR_USE_OUTPUT)) ? out.hasProjectionData() : !out.empty();
+        if (!found) {
+            why = "immersive metadata not found in container";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Atom {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t headerSize;
+        string type;
+    };
+    static const uint64_t MAX_KEYS_SIZE = 1 << 20;     // keys atoms are a few KiB
+    static const uint64_t MAX_VALUE_SIZE = 64 << 20;   // ILPD payloads are well below this
+
+    bool header(uint64_t off, uint64_t end, Atom &a) {
+        if (end - off < 8) return false;
+        string h;
+        size_t n = (size_t)std::min<uint64_t>(16, end - off);
+        if (!src_.read(off, n, h)) { why_ = "read error"; return false; }
+        uint64_t size = be32(h.data());
+        a.offset = off;
+        a.type.assign(h.data() + 4, 4);
+        a.headerSize = 8;
+        if (size == 1) {
+            if (n < 16) return false;
+            size = be64(h.data() + 8);
+            a.headerSize = 16;
+        } else if (size == 0) {
+            size = end - off;
+        }
+        if (size < a.headerSize || size > end - off) return false;
+        a.size = size;
+        return true;
+    }
+
+    bool walk(uint64_t begin, uint64_t end, int depth, ImmersiveAttrs &out) {
+        for (uint64_t off = begin; off + 8 <= end;) {
+            Atom a;
+            if (!header(off, end, a)) return depth > 0;  // tolerate trailing padding inside containers
+            uint64_t body = a.offset + a.headerSize;
+            uint64_t bodyEnd = a.offset + a.size;
+            if (a.type == "moov" || a.type == "trak" || a.type == "udta") {
+                if (depth < 4 && !walk(body, bodyEnd, depth + 1, out)) return false;
+            } else if (a.type == "meta" && depth > 0) {
+                if (!parse_meta(body, bodyEnd, out)) return false;
+            }
+            off = bodyEnd;
+        }
+        return true;
+    }
+
+    bool parse_meta(uint64_t begin, uint64_t end, ImmersiveAttrs &out) {
+        // ISO 'meta' is a full box (4 bytes version/flags), QuickTime 'meta' is not
+        string peek;
+        if (end - begin >= 4 && src_.read(begin, 4, peek) && be32(peek.data()) == 0) begin += 4;
+        vector<int> keySlots;   // 1-based key index -> AttrSlot or -1
+        uint64_t ilstBegin = 0, ilstEnd = 0;
+        for (uint64_t off = begin; off + 8 <= end;) {
+            Atom a;
+            if (!header(off, end, a)) break;
+            if (a.type == "keys") {
+                if (!parse_keys(a.offset + a.headerSize, a.offset + a.size, keySlots)) return false;
+            } else if (a.type == "ilst") {
+                ilstBegin = a.offset + a.headerSize;
+                ilstEnd = a.offset + a.size;
+            }
+            off = a.offset + a.size;
+        }
+        if (keySlots.empty() || ilstBegin == 0) return true;
+        return parse_ilst(ilstBegin, ilstEnd, keySlots, out);
+    }
+
+    bool parse_keys(uint64_t begin, uint64_t end, vector<int> &slots) {
+        if (end - begin < 8 || end - begin > MAX_KEYS_SIZE) return false;
+        string k;
+        if (!src_.read(begin, (size_t)(end - begin), k)) { why_ = "read error"; return false; }
+        uint32_t count = be32(k.data() + 4);
+        size_t pos = 8;
+        slots.assign(1, -1);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (k.size() - pos < 8) return false;
+            uint32_t keySize = be32(k.data() + pos);
+            if (keySize < 8 || keySize > k.size() - pos) return false;
+            string key = normalize_key(k.substr(pos + 8, keySize - 8));
+            int slot = -1;
+            for (size_t a = 0; a < wanted_.size(); ++a) {
+                const string &w = wanted_[a];
+                if (key.size() >= w.size() && key.compare(key.size() - w.size(), w.size(), w) == 0) { slot = (int)a; break; }
+            }
+            slots.push_back(slot < 0 ? -1 : wantedIndex_[slot]);
+            pos += keySize;
+        }
+        return true;
+    }
+
+    bool parse_ilst(uint64_t begin, uint64_t end, const vector<int> &slots, ImmersiveAttrs &out) {
+        for (uint64_t off = begin; off + 8 <= end;) {
+            Atom item;
+            if (!header(off, end, item)) return false;
+            uint32_t keyIndex = be32(item.type.data());
+            if (keyIndex < slots.size() && slots[keyIndex] >= 0) {
+                Atom data;
+                uint64_t dataOff = item.offset + item.headerSize;
+                if (header(dataOff, item.offset + item.size, data) && data.type == "data" &&
+                    data.size >= data.headerSize + 8u) {
+                    uint64_t valueLen = data.size - data.headerSize - 8;
+                    if (valueLen > MAX_VALUE_SIZE) return false;
+                    // read into the slot's own buffer, so reused attributes are not reallocated
+                    const AttrSlot attr = (AttrSlot)slots[keyIndex];
+                    AttrValue &av = out.reset(attr);
+                    string &typeAndValue = av.rawValue;
+                    if (!src_.read(data.offset + data.headerSize, (size_t)(valueLen + 8), typeAndValue)) {
+                        out.erase(attr);
+                        why_ = "read error";
+                        return false;
+                    }
+                    uint32_t wellKnownType = be32(typeAndValue.data()) & 0xFFFFFF;
+                    typeAndValue.erase(0, 8);   // in place, the value bytes are not copied again
+                    if (!store(wellKnownType, av)) out.erase(attr);
+                }
+            }
+            off = item.offset + item.size;
+        }
+        return true;
+    }
+
+    // QuickTime well-known data types -> AttrValue, formatted like the SDK path; `av` holds the value
+    // bytes in rawValue, which only strings keep. False for a type that is not understood.
+    bool store(uint32_t wellKnownType, AttrValue &av) {
+        const string &value = av.rawValue;
+        Variant v;
+        memset(&v, 0, sizeof(v));
+        switch (wellKnownType) {
+            case 1:   // UTF-8
+                av.vt = blackmagicRawVariantTypeString;
+                av.available = true;
+                return true;
+            case 23:  // BE float32
+                if (value.size() != 4) return false;
+                v.vt = blackmagicRawVariantTypeFloat32;
+                { uint32_t bits = be32(value.data()); memcpy(&v.fltVal, &bits, 4); }
+                break;
+            case 24:  // BE float64
+                if (value.size() != 8) return false;
+                v.vt = blackmagicRawVariantTypeFloat64;
+                { uint64_t bits = be64(value.data()); memcpy(&v.dblVal, &bits, 8); }
+                break;
+            case 21:  // BE signed int
+            case 22:  // BE unsigned int
+                if (value.size() == 4) {
+                    v.vt = wellKnownType == 21 ? blackmagicRawVariantTypeS32 : blackmagicRawVariantTypeU32;
+                    v.uintVal = be32(value.data());
+                } else if (value.size() == 2) {
+                    v.vt = wellKnownType == 21 ? blackmagicRawVariantTypeS16 : blackmagicRawVariantTypeU16;
+                    v.uiVal = (uint16_t)(((unsigned char)value[0] << 8) | (unsigned char)value[1]);
+                } else {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        av.rawValue.clear();
+        store_variant(v, av);
+        return true;
+    }
+
+    ByteSource &src_;
+    AttrMask mask_;
+    vector<string> wanted_;
+    vector<int> wantedIndex_;   // AttrSlot of each wanted_ key
+    string why_;
+};
+
+bool read_attrs_container(ByteSource &src, ImmersiveAttrs &out, string &why, AttrMask mask) {
+    ContainerMetadataReader reader(src, mask);
+    return reader.read(out, why);
+}
+
+bool read_attrs_container(const string &inputBraw, ImmersiveAttrs &out, string &why, AttrMask mask) {
+    MappedFileSource src;
+    if (!src.open(inputBraw, why)) return false;
+    return read_attrs_container(src, out, why, mask);
+}
+
+#ifdef BRAW2ILPD_HAVE_CURL
+static string env_or(const char* name, const string &fallback) {
+    const char* v = getenv(name);
+    return (v && *v) ? string(v) : fallback;
+}
+
+// Percent-encode an object key, keeping '/' separators
+static string url_encode_path(const string &s) {
+    static const char* HEX = "0123456789ABCDEF";
+    string out;
+    for (unsigned char c : s) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+            out += (char)c;
+        } else {
+            out += '%';
+            out += HEX[c >> 4];
+            out += HEX[c & 15];
+        }
+    }
+    return out;
+}
+
+struct RemoteRequest {
+    string url;
+    bool sigv4 = false;
+    string region;
+    string userpwd;
+    string sessionToken;
+};
+
+// s3://bucket/key -> path-style URL on $AWS_ENDPOINT_URL(_S3), or virtual-hosted AWS URL.
+// Requests are SigV4-signed by libcurl when AWS credentials are set in the environment.
+static bool resolve_remote(const string &input, RemoteRequest &req, string &err) {
+    if (input.compare(0, 5, "s3://") != 0) {
+        req.url = input;
+        return true;
+    }
+    string rest = input.substr(5);
+    size_t slash = rest.find('/');
+    if (slash == string::npos || slash == 0 || slash + 1 == rest.size()) {
+        err = "invalid S3 URL, expected s3://bucket/key";
+        return false;
+    }
+    string bucket = rest.substr(0, slash);
+    string key = rest.substr(slash + 1);
+    req.region = env_or("AWS_REGION", env_or("AWS_DEFAULT_REGION", "us-east-1"));
+    string endpoint = env_or("AWS_ENDPOINT_URL_S3", env_or("AWS_ENDPOINT_URL", ""));
+    if (!endpoint.empty()) {
+        while (!endpoint.empty() && endpoint.back() == '/') endpoint.pop_back();
+        req.url = endpoint + "/" + bucket + "/" + url_encode_path(key);
+    } else {
+        req.url = "https://" + bucket + ".s3." + req.region + ".amazonaws.com/" + url_encode_path(key);
+    }
+    string keyId = env_or("AWS_ACCESS_KEY_ID", "");
+    string secret = env_or("AWS_SECRET_ACCESS_KEY", "");
+    if (!keyId.empty() && !secret.empty()) {
+#if LIBCURL_VERSION_NUM >= 0x074b00
+        req.sigv4 = true;
+        req.userpwd = keyId + ":" + secret;
+        req.sessionToken = env_or("AWS_SESSION_TOKEN", "");
+#else
+        err = "libcurl 7.75 or newer is required to sign S3 requests";
+        return false;
+#endif
+    }
+    return true;
+}
+
+// ByteSource over HTTP range requests with a small extent cache.
+// open() fetches the first and the last block in parallel, since moov sits at one end of the file;
+// small reads are widened to a block and cached, large ones (the ILPD payload) are fetched as is.
+class HttpRangeSource : public ByteSource {
+public:
+    static const uint64_t BLOCK = 64 * 1024;
+    static const uint64_t CACHE_LIMIT = 4 * 1024 * 1024;
+
+    explicit HttpRangeSource(const RemoteRequest &req): req_(req), size_(0), requests_(0), bytes_(0), tick_(0) {}
+
+    bool open(string &err) {
+        Transfer head, tail;
+        setup(head, "0-" + std::to_string(BLOCK - 1), BLOCK);
+        setup(tail, "-" + std::to_string(BLOCK), BLOCK);
+        Transfer* both[] = {&head, &tail};
+        bool ok = perform(both, 2, err);
+        if (ok) ok = accept(head, err);
+        if (ok) ok = accept(tail, err);
+        cleanup(head);
+        cleanup(tail);
+        return ok;
+    }
+
+    uint64_t size() const override { return size_; }
+
+    bool read(uint64_t offset, size_t len, string &out) override {
+        if (offset > size_ || len > size_ - offset) return false;
+        for (Extent &e : extents_) {
+            if (offset >= e.offset && offset + len <= e.offset + e.data.size()) {
+                e.lastUse = ++tick_;
+                out.assign(e.data, (size_t)(offset - e.offset), len);
+                return true;
+            }
+        }
+        string err;
+        if (len > BLOCK) return fetch(offset, len, &out, err);
+        uint64_t begin = offset - offset % BLOCK;
+        uint64_t end = std::min(size_, std::max(offset + len, begin + BLOCK));
+        if (!fetch(begin, end - begin, nullptr, err)) return false;
+        return read(offset, len, out);
+    }
+
+    uint64_t requests() const { return requests_; }
+    uint64_t bytes() const { return bytes_; }
+
+private:
+    struct Transfer {
+        CURL* easy = nullptr;
+        struct curl_slist* headers = nullptr;
+        string body;
+        string contentRange;
+        uint64_t limit = 0;
+        long status = 0;
+        CURLcode result = CURLE_OK;
+    };
+    struct Extent {
+        uint64_t offset;
+        string data;
+        uint64_t lastUse;
+    };
+
+    static size_t on_body(char* ptr, size_t size, size_t nmemb, void* user) {
+        Transfer* t = static_cast<Transfer*>(user);
+        size_t n = size * nmemb;
+        if (t->body.size() + n > t->limit) return 0;  // server ignored Range, don't pull the whole clip
+        t->body.append(ptr, n);
+        return n;
+    }
+    static size_t on_header(char* ptr, size_t size, size_t nmemb, void* user) {
+        Transfer* t = static_cast<Transfer*>(user);
+        size_t n = size * nmemb;
+        string line(ptr, n);
+        if (line.size() > 14 && curl_strnequal(line.c_str(), "Content-Range:", 14)) {
+            t->contentRange = line.substr(14);
+        }
+        return n;
+    }
+
+    void setup(Transfer &t, const string &range, uint64_t limit) {
+        t.easy = curl_easy_init();
+        t.limit = limit;
+        if (!t.easy) return;
+        curl_easy_setopt(t.easy, CURLOPT_URL, req_.url.c_str());
+        curl_easy_setopt(t.easy, CURLOPT_RANGE, range.c_str());
+        curl_easy_setopt(t.easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(t.easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(t.easy, CURLOPT_CONNECTTIMEOUT, 30L);
+        curl_easy_setopt(t.easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(t.easy, CURLOPT_LOW_SPEED_TIME, 60L);
+        curl_easy_setopt(t.easy, CURLOPT_WRITEFUNCTION, &HttpRangeSource::on_body);
+        curl_easy_setopt(t.easy, CURLOPT_WRITEDATA, &t);
+        curl_easy_setopt(t.easy, CURLOPT_HEADERFUNCTION, &HttpRangeSource::on_header);
+        curl_easy_setopt(t.easy, CURLOPT_HEADERDATA, &t);
+#if LIBCURL_VERSION_NUM >= 0x074b00
+        if (req_.sigv4) {
+            string provider = "aws:amz:" + req_.region + ":s3";
+            curl_easy_setopt(t.easy, CURLOPT_AWS_SIGV4, provider.c_str());
+            curl_easy_setopt(t.easy, CURLOPT_USERPWD, req_.userpwd.c_str());
+            if (!req_.sessionToken.empty()) {
+                t.headers = curl_slist_append(t.headers, ("x-amz-security-token: " + req_.sessionToken).c_str());
+            }
+        }
+#endif
+        if (t.headers) curl_easy_setopt(t.easy, CURLOPT_HTTPHEADER, t.headers);
+    }
+
+    static void cleanup(Transfer &t) {
+        if (t.easy) curl_easy_cleanup(t.easy);
+        if (t.headers) curl_slist_free_all(t.headers);
+        t.easy = nullptr;
+        t.headers = nullptr;
+    }
+
+    bool perform(Transfer** transfers, size_t count, string &err) {
+        CURLM* multi = curl_multi_init();
+        if (!multi) { err = "curl_multi_init failed"; return false; }
+        for (size_t i = 0; i < count; ++i) {
+            if (!transfers[i]->easy) { curl_multi_cleanup(multi); err = "curl_easy_init failed"; return false; }
+            curl_multi_add_handle(multi, transfers[i]->easy);
+        }
+        int running = 0;
+        do {
+            CURLMcode mc = curl_multi_perform(multi, &running);
+            if (mc != CURLM_OK) { err = curl_multi_strerror(mc); break; }
+            if (running) curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        } while (running);
+        CURLMsg* msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            for (size_t i = 0; i < count; ++i) {
+                if (transfers[i]->easy == msg->easy_handle) transfers[i]->result = msg->data.result;
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            curl_easy_getinfo(transfers[i]->easy, CURLINFO_RESPONSE_CODE, &transfers[i]->status);
+            curl_multi_remove_handle(multi, transfers[i]->easy);
+            requests_++;
+            bytes_ += transfers[i]->body.size();
+        }
+        curl_multi_cleanup(multi);
+        return err.empty();
+    }
+
+    // Check a finished transfer and cache its bytes; learns the object size from Content-Range
+    bool accept(Transfer &t, string &err) {
+        if (t.result != CURLE_OK) {
+            err = t.result == CURLE_WRITE_ERROR ? "server does not support range requests" : curl_easy_strerror(t.result);
+            return false;
+        }
+        uint64_t offset = 0;
+        if (t.status == 206) {
+            unsigned long long first = 0, last = 0, total = 0;
+            if (sscanf(t.contentRange.c_str(), " bytes %llu-%llu/%llu", &first, &last, &total) != 3) {
+                err = "unexpected Content-Range";
+                return false;
+            }
+            offset = first;
+            size_ = total;
+        } else if (t.status == 200) {
+            size_ = t.body.size();  // whole (small) object within the limit
+        } else {
+            err = "HTTP status " + std::to_string(t.status);
+            return false;
+        }
+        insert(offset, std::move(t.body));
+        return true;
+    }
+
+    bool fetch(uint64_t offset, uint64_t len, string* out, string &err) {
+        Transfer t;
+        setup(t, std::to_string(offset) + "-" + std::to_string(offset + len - 1), len);
+        Transfer* one[] = {&t};
+        bool ok = perform(one, 1, err);
+        if (ok && t.result == CURLE_OK && t.status == 206 && t.body.size() == len) {
+            if (out) *out = std::move(t.body);
+            else insert(offset, std::move(t.body));
+        } else {
+            ok = false;
+        }
+        cleanup(t);
+        return ok;
+    }
+
+    void insert(uint64_t offset, string data) {
+        uint64_t cached = data.size();
+        for (const Extent &e : extents_) cached += e.data.size();
+        while (cached > CACHE_LIMIT && !extents_.empty()) {
+            auto lru = std::min_element(extents_.begin(), extents_.end(),
+                                        [](const Extent &a, const Extent &b) { return a.lastUse < b.lastUse; });
+            cached -= lru->data.size();
+            extents_.erase(lru);
+        }
+        extents_.push_back({offset, std::move(data), ++tick_});
+    }
+
+    RemoteRequest req_;
+    uint64_t size_;
+    uint64_t requests_;
+    uint64_t bytes_;
+    uint64_t tick_;
+    vector<Extent> extents_;
+};
+#endif
+
+bool read_attrs_remote(const string &input, ImmersiveAttrs &out, string &why, Logger &log, AttrMask mask) {
+#ifdef BRAW2ILPD_HAVE_CURL
+    RemoteRequest req;
+    if (!resolve_remote(input, req, why)) return false;
+    HttpRangeSource src(req);
+    if (!src.open(why)) return false;
+    bool ok = read_attrs_container(src, out, why, mask);
+    log.debug("Remote read: " + std::to_string(src.bytes()) + " bytes in " + std::to_string(src.requests()) +
+              " range requests (object size " + std::to_string(src.size()) + ")");
+    return ok;
+#else
+    (void)input;
+    (void)out;
+    (void)log;
+    (void)mask;
+    why = "this build has no remote input support (libcurl not found)";
+    return false;
+#endif
+}
+
+} // namespace ilpd
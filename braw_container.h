@@ -0,0 +1,32 @@
+// braw_container.h
+// - SDK-free readers for the immersive metadata stored in the .braw container
+// - ByteSource abstracts where the bytes come from (mmapped file, HTTP ranges)
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "ilpdextract.h"
+
+namespace ilpd {
+
+// Random-access byte source for the container reader
+class ByteSource {
+public:
+    virtual ~ByteSource() {}
+    virtual uint64_t size() const = 0;
+    // Read exactly len bytes at offset into out; false on I/O error or out of range
+    virtual bool read(uint64_t offset, size_t len, string &out) = 0;
+};
+
+// Parse the container metadata from any byte source; false (with a reason) if the layout is not recognized
+// Only the attributes in `mask` are read (the others' value bytes are never fetched)
+bool read_attrs_container(ByteSource &src, ImmersiveAttrs &out, string &why, AttrMask mask = ALL_ATTRS);
+// Local file through a read-only memory map
+bool read_attrs_container(const string &inputBraw, ImmersiveAttrs &out, string &why, AttrMask mask = ALL_ATTRS);
+// s3:// and http(s):// inputs through byte-range requests; there is no SDK fallback for these
+bool read_attrs_remote(const string &input, ImmersiveAttrs &out, string &why, Logger &log, AttrMask mask = ALL_ATTRS);
+
+} // namespace ilpd
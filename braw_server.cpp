@@ -0,0 +1,510 @@
+// braw_server.cpp
+// - Unix domain socket server for braw2ilpd --serve
+// - One reader thread per connection; cache hits are answered on that thread,
+//   misses go through a bounded queue to the worker pool (one warm codec per worker)
+// - Responses carry the request "id" back, so a client may pipeline requests on one connection
+// - SIGINT/SIGTERM stop accepting and stop reading requests; queued ones are still answered
+//   ("file" outputs written) before serve() returns. A second signal exits at once
+// - Not on Windows, where serve() only reports that it is unavailable
+
+#include "braw_server.h"
+#include "bounded_queue.h"
+#include "json_reader.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <filesystem>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace ilpd {
+
+using std::string;
+using std::vector;
+
+#ifdef _WIN32
+
+ExitCode serve(const Extractor &, const ServeOptions &, const Logger &log) {
+    log.error("--serve is not available on Windows (it listens on a Unix domain socket)");
+    return USAGE;
+}
+
+#else
+
+namespace {
+
+enum class OutputMode { INLINE, FILE, NONE };
+
+struct ServeRequest {
+    string idRaw = "null";
+    string op = "extract";
+    string path;
+    vector<AttrSlot> attrs;     // empty == all (inline) / none (file)
+    bool attrsGiven = false;
+    OutputMode output = OutputMode::INLINE;
+    string out;             // output file or directory for "file" mode, empty == server cwd
+    bool detailed = false;  // also write the detailed attributes text file
+    std::chrono::steady_clock::time_point received;
+};
+
+// Result of one clip as kept in the cache; shared between the cache and in-flight responses
+struct CachedClip {
+    ExitCode status = OK;
+    ImmersiveAttrs attrs;
+    bool fromContainer = false;
+    string error;           // error lines joined
+};
+
+static bool attr_from_name(const string &name, AttrSlot &a) {
+    for (const AttrDesc &d : ATTR_TABLE) {
+        if (name == d.name) { a = d.slot; return true; }
+    }
+    return false;
+}
+
+static bool parse_request(const string &line, ServeRequest &req, string &err) {
+    JsonValue root;
+    if (!JsonParser(line).parse(root, err)) return false;
+    if (root.type != JsonValue::OBJECT) { err = "request must be a JSON object"; return false; }
+    if (const JsonValue* v = root.get("id")) req.idRaw = v->raw;
+    if (const JsonValue* v = root.get("op")) {
+        if (v->type != JsonValue::STRING) { err = "\"op\" must be a string"; return false; }
+        req.op = v->str;
+    }
+    if (req.op != "extract") return true;
+    const JsonValue* path = root.get("path");
+    if (!path || path->type != JsonValue::STRING || path->str.empty()) { err = "missing \"path\""; return false; }
+    req.path = path->str;
+    if (const JsonValue* v = root.get("attrs")) {
+        if (v->type != JsonValue::ARRAY) { err = "\"attrs\" must be an array of attribute names"; return false; }
+        req.attrsGiven = true;
+        for (const JsonValue &item : v->items) {
+            AttrSlot a;
+            if (item.type != JsonValue::STRING || !attr_from_name(item.str, a)) {
+                err = "unknown attribute: " + (item.type == JsonValue::STRING ? item.str : item.raw);
+                return false;
+            }
+            req.attrs.push_back(a);
+        }
+    }
+    if (const JsonValue* v = root.get("output")) {
+        if (v->type == JsonValue::STRING && v->str == "inline") req.output = OutputMode::INLINE;
+        else if (v->type == JsonValue::STRING && v->str == "file") req.output = OutputMode::FILE;
+        else if (v->type == JsonValue::STRING && v->str == "none") req.output = OutputMode::NONE;
+        else { err = "\"output\" must be \"inline\", \"file\" or \"none\""; return false; }
+    }
+    if (const JsonValue* v = root.get("out")) {
+        if (v->type != JsonValue::STRING) { err = "\"out\" must be a string"; return false; }
+        req.out = v->str;
+    }
+    if (const JsonValue* v = root.get("detailed")) req.detailed = v->type == JsonValue::BOOL && v->boolean;
+    return true;
+}
+
+static string join_errors(const vector<LogLine> &lines) {
+    string out;
+    for (const LogLine &l : lines) {
+        if (!l.isError) continue;
+        if (!out.empty()) out += "; ";
+        out += l.text;
+    }
+    return out;
+}
+
+static string error_response(const string &idRaw, ExitCode code, const string &message) {
+    return "{\"id\":" + idRaw + ",\"status\":" + json_quote(exit_code_name(code)) + ",\"code\":" + std::to_string((int)code) +
+           ",\"error\":" + json_quote(message) + "}";
+}
+
+// Least-recently-used result cache keyed by absolute path, validated against the file's FileKey
+class ResultCache {
+public:
+    explicit ResultCache(size_t capacity): capacity_(capacity) {}
+    std::shared_ptr<const CachedClip> get(const string &path, const FileKey &key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = map_.find(path);
+        if (it == map_.end() || it->second.key != key) { ++misses_; return nullptr; }
+        lru_.splice(lru_.begin(), lru_, it->second.pos);
+        ++hits_;
+        return it->second.clip;
+    }
+    void put(const string &path, const FileKey &key, std::shared_ptr<const CachedClip> clip) {
+        if (capacity_ == 0) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = map_.find(path);
+        if (it != map_.end()) {
+            it->second.key = key;
+            it->second.clip = std::move(clip);
+            lru_.splice(lru_.begin(), lru_, it->second.pos);
+            return;
+        }
+        lru_.push_front(path);
+        map_.emplace(path, Slot{key, std::move(clip), lru_.begin()});
+        if (map_.size() > capacity_) {
+            map_.erase(lru_.back());
+            lru_.pop_back();
+        }
+    }
+    string stats_json() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return "\"entries\":" + std::to_string(map_.size()) + ",\"hits\":" + std::to_string(hits_) +
+               ",\"misses\":" + std::to_string(misses_);
+    }
+private:
+    struct Slot {
+        FileKey key;
+        std::shared_ptr<const CachedClip> clip;
+        std::list<string>::iterator pos;
+    };
+    size_t capacity_;
+    std::mutex mutex_;
+    std::list<string> lru_;
+    std::unordered_map<string, Slot> map_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+// One client connection. Workers hold a reference until their response is sent;
+// the socket is closed when the last reference goes away.
+class Connection {
+public:
+    explicit Connection(int fd): fd_(fd) {}
+    ~Connection() { close(fd_); }
+    int fd() const { return fd_; }
+    void send(string line) {
+        line += '\n';
+        std::lock_guard<std::mutex> lock(mutex_);
+        const char* p = line.data();
+        size_t left = line.size();
+        while (left > 0) {
+            ssize_t n = write(fd_, p, left);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;     // client went away, nothing to report to
+            p += n;
+            left -= (size_t)n;
+        }
+    }
+private:
+    int fd_;
+    std::mutex mutex_;
+};
+
+struct ServeJob {
+    std::shared_ptr<Connection> conn;
+    ServeRequest req;
+    string key;         // absolute path used as cache key, empty == not cacheable
+    FileKey fileKey;
+};
+
+class Server {
+public:
+    Server(const ServeOptions &opts, const Logger &log): opts_(opts), log_(log), cache_(opts.cacheEntries),
+        queue_(opts.jobs * 4), writer_(opts.durability == Durability::BATCH ? Durability::FILE : opts.durability) {}
+
+    // Until `stopFd` is readable (or accept fails for good), then drains and joins every thread
+    ExitCode run(const Extractor &base, int listenFd, int stopFd) {
+        vector<Extractor> extractors;
+        for (unsigned w = 0; w < opts_.jobs; ++w) {
+            extractors.push_back(base.fork());
+            if (opts_.eagerOpen) {
+                ExitCode rc = extractors.back().open(log_);
+                if (rc != OK) return rc;
+            }
+        }
+        vector<std::thread> workers;
+        for (unsigned w = 0; w < opts_.jobs; ++w) {
+            workers.emplace_back([this, &extractors, w] {
+                ServeJob job;
+                while (queue_.pop(job)) handle_miss(extractors[w], job);
+            });
+        }
+        log_.info("Listening on " + opts_.socketPath + " (" + std::to_string(opts_.jobs) + " workers)");
+        for (;;) {
+            pollfd fds[2] = {{listenFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                log_.error(string("poll failed: ") + strerror(errno));
+                break;
+            }
+            if (fds[1].revents) break;
+            reap_readers();
+            if (!fds[0].revents) continue;
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+                log_.error(string("accept failed: ") + strerror(errno));
+                break;
+            }
+            // BSDs pass the listening socket's O_NONBLOCK on; the readers block
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            auto conn = std::make_shared<Connection>(fd);
+            auto done = std::make_shared<std::atomic<bool>>(false);
+            readers_.push_back({std::thread([this, conn, done] {
+                read_connection(conn);
+                *done = true;
+            }), conn, done});
+        }
+        // Readers first (their requests may still be queued), then the workers answer what is left
+        log_.info("Stopping: answering the requests already received");
+        for (Reader &r : readers_) {
+            if (std::shared_ptr<Connection> conn = r.conn.lock()) shutdown(conn->fd(), SHUT_RD);
+        }
+        for (Reader &r : readers_) r.thread.join();
+        readers_.clear();
+        queue_.close();
+        for (std::thread &t : workers) t.join();
+        return OK;
+    }
+
+private:
+    // A connection's reader thread; the socket itself lives as long as the Connection is referenced
+    struct Reader {
+        std::thread thread;
+        std::weak_ptr<Connection> conn;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+
+    ServeOptions opts_;
+    Logger log_;
+    ResultCache cache_;
+    BoundedQueue<ServeJob> queue_;
+    AtomicWriter writer_;
+    std::list<Reader> readers_;     // accept thread only
+
+    void reap_readers() {
+        for (auto it = readers_.begin(); it != readers_.end();) {
+            if (!*it->done) {
+                ++it;
+                continue;
+            }
+            it->thread.join();
+            it = readers_.erase(it);
+        }
+    }
+
+    void read_connection(std::shared_ptr<Connection> conn) {
+        string buffer;
+        char chunk[4096];
+        for (;;) {
+            ssize_t n = read(conn->fd(), chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            buffer.append(chunk, (size_t)n);
+            size_t start = 0;
+            size_t nl;
+            while ((nl = buffer.find('\n', start)) != string::npos) {
+                string line = buffer.substr(start, nl - start);
+                start = nl + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.find_first_not_of(" \t") == string::npos) continue;
+                handle_line(conn, line);
+            }
+            buffer.erase(0, start);
+        }
+        // Half-closed clients still get the responses of queued requests;
+        // the socket closes once the last worker drops its reference.
+        shutdown(conn->fd(), SHUT_RD);
+    }
+
+    void handle_line(const std::shared_ptr<Connection> &conn, const string &line) {
+        ServeJob job;
+        job.req.received = std::chrono::steady_clock::now();
+        string err;
+        if (!parse_request(line, job.req, err)) {
+            conn->send(error_response(job.req.idRaw, USAGE, err));
+            return;
+        }
+        if (job.req.op == "ping") {
+            conn->send("{\"id\":" + job.req.idRaw + ",\"status\":\"OK\",\"code\":0}");
+            return;
+        }
+        if (job.req.op == "stats") {
+            conn->send("{\"id\":" + job.req.idRaw + ",\"status\":\"OK\",\"code\":0,\"workers\":" +
+                       std::to_string(opts_.jobs) + "," + cache_.stats_json() + "}");
+            return;
+        }
+        if (job.req.op != "extract") {
+            conn->send(error_response(job.req.idRaw, USAGE, "unknown op: " + job.req.op));
+            return;
+        }
+        // Local clips are cached by absolute path and validated with stat(); remote objects are always re-read
+        if (!is_remote_input(job.req.path) && stat_file_key(job.req.path, job.fileKey)) {
+            job.key = std::filesystem::absolute(job.req.path).lexically_normal().string();
+            if (std::shared_ptr<const CachedClip> hit = cache_.get(job.key, job.fileKey)) {
+                conn->send(respond(job.req, *hit, true));
+                return;
+            }
+        }
+        job.conn = conn;
+        queue_.push(std::move(job));
+    }
+
+    void handle_miss(Extractor &extractor, ServeJob &job) {
+        ExtractResult r = extractor.extract(job.req.path);
+        auto clip = std::make_shared<CachedClip>();
+        clip->status = r.status;
+        clip->attrs = std::move(r.attrs);
+        clip->fromContainer = r.fromContainer;
+        clip->error = join_errors(r.log);
+        for (const LogLine &l : r.log) {
+            if (l.isError) log_.error(job.req.path + ": " + l.text);
+            else log_.debug(job.req.path + ": " + l.text);
+        }
+        // SDK load failures say nothing about the clip, so they are not cached
+        if (!job.key.empty() && r.status != FACTORY_FAIL && r.status != CODEC_FAIL)
+            cache_.put(job.key, job.fileKey, clip);
+        job.conn->send(respond(job.req, *clip, false));
+        job.conn.reset();
+    }
+
+    string respond(const ServeRequest &req, const CachedClip &clip, bool cached) {
+        if (clip.status != OK) return error_response(req.idRaw, clip.status, clip.error);
+
+        string ilpdPath;
+        if (req.output == OutputMode::FILE) {
+            if (!clip.attrs.hasProjectionData())
+                return error_response(req.idRaw, IMMERSIVE_NOT_SUPPORTED, "clip has no projection data");
+            vector<LogLine> lines;
+            Logger log;
+            log.sink = &lines;
+            ilpdPath = resolve_output_path(req.out, make_auto_ilpd_name(req.path, clip.attrs), log);
+            string err;
+            if (!writer_.write(ilpdPath, clip.attrs.projectionData(), err))
+                return error_response(req.idRaw, WRITE_FAIL, "failed to write " + ilpdPath + ": " + err);
+            if (req.detailed && !write_detailed_attributes(ilpdPath, req.path, clip.attrs, log, &writer_))
+                return error_response(req.idRaw, WRITE_FAIL, join_errors(lines));
+        }
+
+        string out = "{\"id\":" + req.idRaw + ",\"status\":\"OK\",\"code\":0,\"cached\":" + (cached ? "true" : "false");
+        out += ",\"source\":";
+        out += clip.fromContainer ? "\"container\"" : "\"sdk\"";
+        const std::string_view uuid = clip.attrs.text(ATTR_UUID);
+        if (!uuid.empty()) out += ",\"uuid\":" + json_quote(string(uuid));
+        if (clip.attrs.hasProjectionData()) {
+            std::string_view data = clip.attrs.projectionData();
+            out += ",\"hash\":" + json_quote(hash_to_hex(hash64(data.data(), data.size())));
+        }
+        if (!ilpdPath.empty()) out += ",\"ilpd\":" + json_quote(ilpdPath);
+
+        const bool inlineAll = req.output == OutputMode::INLINE && !req.attrsGiven;
+        if (inlineAll || !req.attrs.empty()) {
+            out += ",\"attrs\":{";
+            bool first = true;
+            auto emit = [&](AttrSlot a) {
+                const AttrValue* v = clip.attrs.get(a);
+                if (!first) out += ',';
+                first = false;
+                out += json_quote(ATTR_TABLE[a].name) + ":" + (v ? attr_value_json(*v) : string("null"));
+            };
+            if (inlineAll) for (const AttrDesc &d : ATTR_TABLE) emit(d.slot);
+            else for (AttrSlot a : req.attrs) emit(a);
+            out += '}';
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - req.received).count();
+        out += ",\"us\":" + std::to_string((long long)us) + "}";
+        return out;
+    }
+};
+
+char g_socketPath[sizeof(sockaddr_un::sun_path)];
+int g_stopPipe[2] = {-1, -1};
+volatile sig_atomic_t g_stopping = 0;
+
+// The first signal wakes the accept loop to drain, a second one does not wait for it
+extern "C" void on_terminate(int) {
+    if (g_stopping) {
+        unlink(g_socketPath);
+        _exit(1);
+    }
+    g_stopping = 1;
+    const char c = 0;
+    ssize_t n = write(g_stopPipe[1], &c, 1);
+    (void)n;
+}
+
+} // namespace
+
+ExitCode serve(const Extractor &base, const ServeOptions &opts, const Logger &log) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (opts.socketPath.empty() || opts.socketPath.size() >= sizeof(addr.sun_path)) {
+        log.error("Socket path is empty or too long: " + opts.socketPath);
+        return USAGE;
+    }
+    memcpy(addr.sun_path, opts.socketPath.c_str(), opts.socketPath.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log.error(string("Failed to create socket: ") + strerror(errno));
+        return USAGE;
+    }
+    // A socket file nobody answers on is left over from a previous server; one that answers is in use
+    if (std::filesystem::exists(opts.socketPath)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe >= 0 && connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) close(probe);
+        if (live) {
+            log.error("Another server is already listening on " + opts.socketPath);
+            close(fd);
+            return USAGE;
+        }
+        unlink(opts.socketPath.c_str());
+    }
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        log.error("Failed to listen on " + opts.socketPath + ": " + strerror(errno));
+        close(fd);
+        return USAGE;
+    }
+
+    if (pipe(g_stopPipe) != 0) {
+        log.error(string("Failed to create pipe: ") + strerror(errno));
+        close(fd);
+        unlink(opts.socketPath.c_str());
+        return USAGE;
+    }
+    fcntl(g_stopPipe[1], F_SETFL, O_NONBLOCK);
+    // non-blocking, so a connection that went away between poll and accept cannot hang the loop
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    memcpy(g_socketPath, addr.sun_path, sizeof(g_socketPath));
+    g_stopping = 0;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_terminate);
+    signal(SIGTERM, on_terminate);
+
+    ServeOptions effective = opts;
+    if (effective.jobs == 0) effective.jobs = 1;
+    ExitCode rc;
+    {
+        Server server(effective, log);
+        rc = server.run(base, fd, g_stopPipe[0]);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(fd);
+    unlink(opts.socketPath.c_str());
+    close(g_stopPipe[0]);
+    close(g_stopPipe[1]);
+    g_stopPipe[0] = g_stopPipe[1] = -1;
+    return rc;
+}
+
+#endif
+
+} // namespace ilpd
@@ -0,0 +1,28 @@
+// braw_server.h
+// - braw2ilpd --serve: long-running extractor behind a Unix domain socket
+// - Newline-delimited JSON requests and responses, one object per line
+// - Warm SDK factory and one codec per worker, results cached by (path, size, mtime, inode)
+// - POSIX only: on Windows serve() fails with USAGE
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#include "ilpdextract.h"
+
+namespace ilpd {
+
+struct ServeOptions {
+    string socketPath;
+    unsigned jobs = 1;              // worker threads, each with its own codec
+    size_t cacheEntries = 4096;     // clips kept in the result cache (least recently used dropped first)
+    bool eagerOpen = true;          // create the codecs before accepting connections (off with --fast)
+    Durability durability = Durability::NONE;   // "file" outputs; a server never ends, so batch acts as file
+};
+
+// Serve requests until SIGINT/SIGTERM; returns USAGE if the socket cannot be bound,
+// FACTORY_FAIL/CODEC_FAIL if the SDK cannot be loaded up front.
+ExitCode serve(const Extractor &base, const ServeOptions &opts, const Logger &log);
+
+} // namespace ilpd
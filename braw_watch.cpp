@@ -0,0 +1,418 @@
+// braw_watch.cpp
+// - --watch backends: inotify (Linux), FSEvents (macOS), rescans of the tree (fallback, Windows)
+// - Event sources only mark clips as touched; whether a clip has settled is decided in next(),
+//   with one stat() per clip and settle period
+
+#include "braw_watch.h"
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#elif defined(__APPLE__)
+#include <CoreServices/CoreServices.h>
+#include <dispatch/dispatch.h>
+#endif
+
+namespace ilpd {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t wall_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Same rules as the --recursive scanner: hidden entries (._ AppleDouble files, .Trashes, the
+// temporary dot files of rsync and friends) are never clips
+bool hidden(const string &name) { return !name.empty() && name[0] == '.'; }
+bool clip_name(const string &name) { return !hidden(name) && fs::path(name).extension() == ".braw"; }
+
+#ifndef _WIN32
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+void drain(int fd) {
+    char buf[256];
+    while (read(fd, buf, sizeof(buf)) > 0) {}
+}
+#endif
+
+} // namespace
+
+struct DirWatcher::Impl {
+    // A clip seen but not handed out yet
+    struct Candidate {
+        FileKey key;
+        bool known = false;     // key holds the last stat
+        int64_t dueNs = 0;      // next time to check whether it settled
+    };
+
+    WatchOptions opts;
+    const Logger &log;
+    int64_t settleNs;
+#ifdef _WIN32
+    HANDLE wakeEvent = nullptr; // stop() sets it
+#else
+    int wake[2] = {-1, -1};     // stop() writes here
+#endif
+    int eventFd = -1;           // readable when the backend has events, -1 for rescans only
+    bool stopped = false;
+    std::map<string, Candidate> pending;
+    std::map<string, FileKey> handed;   // what each clip looked like when it was handed out
+    std::deque<string> ready;
+
+#if defined(__linux__)
+    std::map<int, string> dirs;         // inotify watch descriptor -> directory
+#elif defined(__APPLE__)
+    FSEventStreamRef stream = nullptr;
+    dispatch_queue_t queue = nullptr;
+    int notify[2] = {-1, -1};           // the FSEvents callback wakes next() through this pipe
+    string canonicalRoot;               // FSEvents reports resolved paths
+    std::mutex incomingMutex;
+    vector<string> incomingFiles;
+    vector<string> incomingDirs;        // rescan these (new directories, dropped events)
+#endif
+
+    Impl(const WatchOptions &o, const Logger &l): opts(o), log(l), settleNs((int64_t)o.settleMs * 1000000) {}
+
+    ~Impl() {
+#if defined(__linux__)
+        if (eventFd >= 0) close(eventFd);
+#elif defined(__APPLE__)
+        if (stream) {
+            FSEventStreamStop(stream);
+            FSEventStreamInvalidate(stream);
+            FSEventStreamRelease(stream);
+        }
+        if (queue) dispatch_release(queue);
+        for (int fd : notify) if (fd >= 0) close(fd);
+#endif
+#ifdef _WIN32
+        if (wakeEvent) CloseHandle(wakeEvent);
+#else
+        for (int fd : wake) if (fd >= 0) close(fd);
+#endif
+    }
+
+    // Something happened to a clip: check it again once it has been quiet for the settle time
+    void touch(const string &path) {
+        pending[path].dueNs = steady_ns() + settleNs;
+    }
+
+    // Found by a scan: checked right away, so clips that are already complete go out at once
+    void found(const string &path) {
+        auto h = handed.find(path);
+        FileKey key;
+        if (h != handed.end() && stat_file_key(path, key) && key == h->second) return;
+        if (!pending.count(path)) pending[path].dueNs = steady_ns();
+    }
+
+    // The copy tool closed or renamed the clip into place
+    void complete(const string &path) {
+        pending.erase(path);
+        FileKey key;
+        if (stat_file_key(path, key)) hand_out(path, key);
+    }
+
+    void hand_out(const string &path, const FileKey &key) {
+        auto h = handed.find(path);
+        if (h != handed.end() && h->second == key) return;
+        handed[path] = key;
+        ready.push_back(path);
+    }
+
+    // Hand out every clip that settled: unchanged since the last check, or not modified for the settle time
+    void settle() {
+        const int64_t now = steady_ns();
+        for (auto it = pending.begin(); it != pending.end();) {
+            Candidate &c = it->second;
+            if (c.dueNs > now) { ++it; continue; }
+            FileKey key;
+            if (!stat_file_key(it->first, key)) { it = pending.erase(it); continue; }
+            if ((c.known && key == c.key) || wall_ns() - key.mtimeNs >= settleNs) {
+                hand_out(it->first, key);
+                it = pending.erase(it);
+                continue;
+            }
+            c.key = key;
+            c.known = true;
+            c.dueNs = now + settleNs;
+            ++it;
+        }
+    }
+
+    // poll()/wait timeout: until the next clip is due, forever when nothing is settling
+    int timeout_ms() const {
+        int64_t due = INT64_MAX;
+        for (const auto &kv : pending) due = std::min(due, kv.second.dueNs);
+        if (eventFd < 0) due = std::min(due, steady_ns() + settleNs);   // rescans
+        if (due == INT64_MAX) return -1;
+        int64_t ms = (due - steady_ns() + 999999) / 1000000;
+        return (int)std::max<int64_t>(0, std::min<int64_t>(ms, 60 * 60 * 1000));
+    }
+
+    // Queue the clips under dir (and watch its directories with inotify)
+    void scan(const string &dir) {
+        std::error_code ec;
+        watch_dir(dir);
+        DirWalker walker(dir);
+        if (!walker.open(ec)) {
+            log.error("Warning: failed to scan " + dir + " (" + ec.message() + ")");
+            return;
+        }
+        auto skipped = [&](const string &sub, const std::error_code &e) {
+            log.error("Warning: skipped " + sub + " while scanning " + dir + " (" + e.message() + ")");
+        };
+        fs::directory_entry entry;
+        while (walker.next(entry, skipped)) {
+            if (entry.is_directory(ec)) watch_dir(entry.path().string());
+            else if (clip_name(entry.path().filename().string()) && entry.is_regular_file(ec)) found(entry.path().string());
+        }
+    }
+
+#if defined(__linux__)
+    static const uint32_t DIR_MASK = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR;
+
+    bool start_backend(string &err) {
+        eventFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (eventFd < 0) {
+            err = string("inotify_init1 failed: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    void watch_dir(const string &dir) {
+        int wd = inotify_add_watch(eventFd, dir.c_str(), DIR_MASK);
+        if (wd < 0) {
+            log.error("Warning: cannot watch " + dir + ": " + strerror(errno) +
+                      (errno == ENOSPC ? " (raise fs.inotify.max_user_watches)" : ""));
+            return;
+        }
+        dirs[wd] = dir;
+    }
+
+    void read_events() {
+        alignas(struct inotify_event) char buf[64 * 1024];
+        for (;;) {
+            ssize_t n = read(eventFd, buf, sizeof(buf));
+            if (n <= 0) return;
+            for (char* p = buf; p < buf + n;) {
+                const struct inotify_event* e = reinterpret_cast<const struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + e->len;
+                if (e->mask & IN_Q_OVERFLOW) {
+                    log.debug("Watch event queue overflowed, rescanning " + opts.root);
+                    scan(opts.root);
+                    continue;
+                }
+                if (e->mask & IN_IGNORED) { dirs.erase(e->wd); continue; }
+                auto d = dirs.find(e->wd);
+                if (d == dirs.end() || e->len == 0) continue;
+                const string name = e->name;
+                const string path = d->second + "/" + name;
+                if (e->mask & IN_ISDIR) {
+                    // files may land in a new directory before it is watched
+                    if ((e->mask & (IN_CREATE | IN_MOVED_TO)) && !hidden(name)) scan(path);
+                } else if (clip_name(name)) {
+                    if (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) complete(path);
+                    else touch(path);
+                }
+            }
+        }
+    }
+#elif defined(__APPLE__)
+    static void on_events(ConstFSEventStreamRef, void* info, size_t count, void* eventPaths,
+                          const FSEventStreamEventFlags flags[], const FSEventStreamEventId[]) {
+        Impl* self = static_cast<Impl*>(info);
+        char** paths = static_cast<char**>(eventPaths);
+        {
+            std::lock_guard<std::mutex> lock(self->incomingMutex);
+            for (size_t i = 0; i < count; ++i) {
+                if (flags[i] & (kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagRootChanged)) {
+                    self->incomingDirs.push_back(self->canonicalRoot);
+                } else if (flags[i] & kFSEventStreamEventFlagItemIsFile) {
+                    self->incomingFiles.push_back(paths[i]);
+                } else if ((flags[i] & kFSEventStreamEventFlagItemIsDir) &&
+                           (flags[i] & (kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemRenamed))) {
+                    self->incomingDirs.push_back(paths[i]);
+                }
+            }
+        }
+        ssize_t ignored = write(self->notify[1], "e", 1);
+        (void)ignored;
+    }
+
+    bool start_backend(string &err) {
+        std::error_code ec;
+        canonicalRoot = fs::canonical(opts.root, ec).string();
+        if (ec) {
+            err = "Cannot resolve " + opts.root + ": " + ec.message();
+            return false;
+        }
+        if (pipe(notify) != 0 || !set_nonblocking(notify[0]) || !set_nonblocking(notify[1])) {
+            err = string("pipe failed: ") + strerror(errno);
+            return false;
+        }
+        CFStringRef root = CFStringCreateWithCString(kCFAllocatorDefault, canonicalRoot.c_str(), kCFStringEncodingUTF8);
+        CFArrayRef roots = CFArrayCreate(kCFAllocatorDefault, (const void**)&root, 1, &kCFTypeArrayCallBacks);
+        FSEventStreamContext context = {0, this, nullptr, nullptr, nullptr};
+        stream = FSEventStreamCreate(kCFAllocatorDefault, &Impl::on_events, &context, roots, kFSEventStreamEventIdSinceNow, 0.2,
+                                     kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagNoDefer);
+        CFRelease(roots);
+        CFRelease(root);
+        if (!stream) {
+            err = "FSEventStreamCreate failed for " + canonicalRoot;
+            return false;
+        }
+        queue = dispatch_queue_create("braw2ilpd.watch", DISPATCH_QUEUE_SERIAL);
+        FSEventStreamSetDispatchQueue(stream, queue);
+        if (!FSEventStreamStart(stream)) {
+            err = "FSEventStreamStart failed for " + canonicalRoot;
+            return false;
+        }
+        eventFd = notify[0];
+        return true;
+    }
+
+    void watch_dir(const string &) {}   // FSEvents streams cover the whole tree
+
+    // FSEvents paths are resolved (/private/var/..., no symlinks); report them under the root as given
+    bool relative_to_root(const string &eventPath, string &path) const {
+        if (eventPath.compare(0, canonicalRoot.size(), canonicalRoot) != 0) return false;
+        fs::path rel = fs::path(eventPath.substr(canonicalRoot.size())).relative_path();
+        for (const fs::path &part : rel) if (hidden(part.string())) return false;
+        path = (fs::path(opts.root) / rel).string();
+        return true;
+    }
+
+    void read_events() {
+        drain(notify[0]);
+        vector<string> files;
+        vector<string> newDirs;
+        {
+            std::lock_guard<std::mutex> lock(incomingMutex);
+            files.swap(incomingFiles);
+            newDirs.swap(incomingDirs);
+        }
+        string path;
+        for (const string &d : newDirs) {
+            if (relative_to_root(d, path)) scan(path);
+        }
+        for (const string &f : files) {
+            if (relative_to_root(f, path) && clip_name(fs::path(path).filename().string())) touch(path);
+        }
+    }
+#else
+    bool start_backend(string &) { return true; }
+    void watch_dir(const string &) {}
+    void read_events() {}
+#endif
+};
+
+DirWatcher::DirWatcher(const WatchOptions &opts, const Logger &log): impl_(new Impl(opts, log)) {}
+
+DirWatcher::~DirWatcher() = default;
+
+bool DirWatcher::start(string &err) {
+    Impl &d = *impl_;
+#ifdef _WIN32
+    d.wakeEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!d.wakeEvent) {
+        err = "CreateEvent failed (error " + std::to_string(GetLastError()) + ")";
+        return false;
+    }
+#else
+    if (pipe(d.wake) != 0 || !set_nonblocking(d.wake[0]) || !set_nonblocking(d.wake[1])) {
+        err = string("pipe failed: ") + strerror(errno);
+        return false;
+    }
+#endif
+    // The backend goes first, so a clip that arrives during the initial scan is not missed
+    if (!d.start_backend(err)) return false;
+    if (d.eventFd < 0) d.log.debug("No file system events on this platform, rescanning every settle period");
+    d.scan(d.opts.root);
+    return true;
+}
+
+bool DirWatcher::next(string &path) {
+    Impl &d = *impl_;
+    for (;;) {
+        if (d.stopped) return false;
+        d.settle();
+        if (!d.ready.empty()) {
+            path = d.ready.front();
+            d.ready.pop_front();
+            return true;
+        }
+#ifdef _WIN32
+        // rescans only: sleep until the next one is due or stop() is called
+        const DWORD r = WaitForSingleObject(d.wakeEvent, (DWORD)d.timeout_ms());
+        if (r == WAIT_OBJECT_0) {
+            d.stopped = true;
+            return false;
+        }
+        if (r != WAIT_TIMEOUT) {
+            d.log.error("Watch failed: WaitForSingleObject (error " + std::to_string(GetLastError()) + ")");
+            return false;
+        }
+        d.scan(d.opts.root);
+#else
+        struct pollfd fds[2];
+        fds[0] = {d.wake[0], POLLIN, 0};
+        fds[1] = {d.eventFd, POLLIN, 0};
+        int n = poll(fds, d.eventFd >= 0 ? 2 : 1, d.timeout_ms());
+        if (n < 0 && errno != EINTR) {
+            d.log.error(string("Watch failed: poll: ") + strerror(errno));
+            return false;
+        }
+        if (n > 0 && (fds[0].revents & POLLIN)) {
+            drain(d.wake[0]);
+            d.stopped = true;
+            return false;
+        }
+        if (d.eventFd >= 0) {
+            if (n > 0 && (fds[1].revents & POLLIN)) d.read_events();
+        } else if (n == 0) {
+            d.scan(d.opts.root);
+        }
+#endif
+    }
+}
+
+void DirWatcher::stop() {
+#ifdef _WIN32
+    if (impl_->wakeEvent) SetEvent(impl_->wakeEvent);
+#else
+    if (impl_->wake[1] >= 0) {
+        ssize_t ignored = write(impl_->wake[1], "s", 1);
+        (void)ignored;
+    }
+#endif
+}
+
+} // namespace ilpd
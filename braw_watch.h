@@ -0,0 +1,41 @@
+// braw_watch.h
+// - braw2ilpd --watch <dir>: hands out .braw clips while a card is being offloaded into dir
+// - inotify on Linux, FSEvents on macOS, periodic rescans anywhere else (Windows included)
+// - A clip is ready once the copy tool has closed it (inotify) or it has not changed for the settle time;
+//   clips already in the tree when the watch starts come first
+// - Nothing is polled while no clip is settling, an idle watch just sleeps in poll()
+
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "ilpdextract.h"
+
+namespace ilpd {
+
+struct WatchOptions {
+    string root;
+    unsigned settleMs = 2000;   // how long a clip's size and mtime must stay put
+};
+
+class DirWatcher {
+public:
+    DirWatcher(const WatchOptions &opts, const Logger &log);
+    ~DirWatcher();
+    DirWatcher(const DirWatcher&) = delete;
+    DirWatcher& operator=(const DirWatcher&) = delete;
+
+    // Start watching and queue the clips already there; false with `err` if the tree cannot be watched
+    bool start(string &err);
+    // Block until the next clip is ready; false once stop() was called
+    bool next(string &path);
+    // Make next() return false; async-signal-safe, for SIGINT/SIGTERM handlers
+    void stop();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace ilpd
@@ -0,0 +1,300 @@
+// file_io.cpp
+// - POSIX descriptors and mmap; on Windows CRT descriptors over CreateFile handles and file mappings
+
+#include "file_io.h"
+
+#include <cerrno>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+
+namespace ilpd {
+
+using std::string;
+
+#ifdef _WIN32
+
+// The errno closest to a Win32 error, so callers report both the same way
+static int errno_from(DWORD e) {
+    switch (e) {
+        case ERROR_FILE_NOT_FOUND:
+        case ERROR_PATH_NOT_FOUND:
+        case ERROR_INVALID_NAME: return ENOENT;
+        case ERROR_ACCESS_DENIED:
+        case ERROR_SHARING_VIOLATION:
+        case ERROR_LOCK_VIOLATION: return EACCES;
+        case ERROR_FILE_EXISTS:
+        case ERROR_ALREADY_EXISTS: return EEXIST;
+        case ERROR_DISK_FULL:
+        case ERROR_HANDLE_DISK_FULL: return ENOSPC;
+        case ERROR_NOT_ENOUGH_MEMORY:
+        case ERROR_OUTOFMEMORY: return ENOMEM;
+        case ERROR_TOO_MANY_OPEN_FILES: return EMFILE;
+        default: return EIO;
+    }
+}
+
+static bool fail_win() {
+    errno = errno_from(GetLastError());
+    return false;
+}
+
+static HANDLE handle_of(int fd) {
+    return (HANDLE)_get_osfhandle(fd);
+}
+
+// CreateFile instead of _open so the file can be renamed or deleted while it is open, as on POSIX
+int open_file(const string &path, OpenMode mode) {
+    static const DWORD ACCESS[] = {GENERIC_READ, GENERIC_READ | GENERIC_WRITE, GENERIC_READ | GENERIC_WRITE,
+                                   GENERIC_READ | GENERIC_WRITE};
+    static const DWORD DISPOSITION[] = {OPEN_EXISTING, OPEN_EXISTING, OPEN_ALWAYS, CREATE_ALWAYS};
+    HANDLE h = CreateFileA(path.c_str(), ACCESS[mode], FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                           DISPOSITION[mode], FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        fail_win();
+        return -1;
+    }
+    int fd = _open_osfhandle((intptr_t)h, _O_BINARY | (mode == OPEN_READ ? _O_RDONLY : 0));
+    if (fd < 0) CloseHandle(h);
+    return fd;
+}
+
+int close_file(int fd) {
+    return _close(fd);
+}
+
+bool write_all(int fd, std::string_view data) {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        // _write takes an unsigned int count
+        const unsigned chunk = (unsigned)(left < (1u << 30) ? left : (1u << 30));
+        int n = _write(fd, p, chunk);
+        if (n == 0) errno = EIO;
+        if (n <= 0) return false;
+        p += n;
+        left -= (size_t)n;
+    }
+    return true;
+}
+
+// FlushFileBuffers already asks the drive to flush its cache, there is nothing stronger for `full`
+int sync_fd(int fd, bool full) {
+    (void)full;
+    return FlushFileBuffers(handle_of(fd)) ? 0 : errno_from(GetLastError());
+}
+
+int sync_dir(const string &dir, bool full) {
+    (void)dir;
+    (void)full;
+    return 0;
+}
+
+int64_t file_size(int fd) {
+    return _filelengthi64(fd);
+}
+
+bool seek_end(int fd) {
+    return _lseeki64(fd, 0, SEEK_END) >= 0;
+}
+
+// Windows locks are mandatory, so the lock is on one byte far past any real data: it keeps other
+// lock_file() callers out without blocking reads and writes of the file
+bool lock_file(int fd) {
+    OVERLAPPED ov = {};
+    ov.Offset = 0xFFFFFFFF;
+    ov.OffsetHigh = 0x7FFFFFFF;
+    return LockFileEx(handle_of(fd), LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov) ? true : fail_win();
+}
+
+bool replace_file(const string &from, const string &to) {
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) ? true : fail_win();
+}
+
+bool remove_file(const string &path) {
+    return DeleteFileA(path.c_str()) ? true : fail_win();
+}
+
+long process_id() {
+    return (long)GetCurrentProcessId();
+}
+
+int stdout_fd() {
+    static const int fd = [] {
+        const int out = _fileno(stdout);
+        _setmode(out, _O_BINARY);
+        return out;
+    }();
+    return fd;
+}
+
+bool MappedFile::open(const string &path, bool replaceable) {
+    close();
+    found_ = false;
+    int fd = open_file(path, OPEN_READ);
+    if (fd < 0) return false;
+    found_ = true;
+    const int64_t size = file_size(fd);
+    bool ok = size >= 0;
+    if (ok && size > 0 && replaceable) {
+        char* buf = new (std::nothrow) char[(size_t)size];
+        size_t got = 0;
+        while (buf && got < (size_t)size) {
+            const size_t left = (size_t)size - got;
+            int n = _read(fd, buf + got, (unsigned)(left < (1u << 30) ? left : (1u << 30)));
+            if (n <= 0) break;
+            got += (size_t)n;
+        }
+        ok = buf && got == (size_t)size;
+        if (ok) data_ = buf;
+        else {
+            delete[] buf;
+            errno = buf ? EIO : ENOMEM;
+        }
+    } else if (ok && size > 0) {
+        HANDLE m = CreateFileMappingA(handle_of(fd), nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const void* view = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!view) fail_win();
+        if (m) CloseHandle(m);
+        ok = view != nullptr;
+        data_ = static_cast<const char*>(view);
+        mapped_ = ok;
+    }
+    if (ok) size_ = (size_t)size;
+    const int e = errno;
+    _close(fd);
+    errno = e;
+    return ok;
+}
+
+void MappedFile::close() {
+    if (mapped_) UnmapViewOfFile(data_);
+    else delete[] data_;
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+}
+
+void MappedFile::advise_random() {}
+
+#else
+
+int open_file(const string &path, OpenMode mode) {
+    static const int FLAGS[] = {O_RDONLY, O_RDONLY, O_RDWR | O_CREAT, O_RDWR | O_CREAT | O_TRUNC};
+    return ::open(path.c_str(), FLAGS[mode] | O_CLOEXEC, 0644);
+}
+
+int close_file(int fd) {
+    return ::close(fd);
+}
+
+bool write_all(int fd, std::string_view data) {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) errno = EIO;    // no progress and no error: errno says something all the same
+        if (n <= 0) return false;
+        p += n;
+        left -= (size_t)n;
+    }
+    return true;
+}
+
+int sync_fd(int fd, bool full) {
+#ifdef F_FULLFSYNC
+    if (full && fcntl(fd, F_FULLFSYNC) == 0) return 0;
+#else
+    (void)full;
+#endif
+    return fsync(fd) == 0 ? 0 : errno;
+}
+
+int sync_dir(const string &dir, bool full) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+    if (fd < 0) return errno;
+    const int e = sync_fd(fd, full);
+    ::close(fd);
+    return e;
+}
+
+int64_t file_size(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 ? (int64_t)st.st_size : -1;
+}
+
+bool seek_end(int fd) {
+    return lseek(fd, 0, SEEK_END) >= 0;
+}
+
+bool lock_file(int fd) {
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+bool replace_file(const string &from, const string &to) {
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+bool remove_file(const string &path) {
+    return unlink(path.c_str()) == 0;
+}
+
+long process_id() {
+    return (long)getpid();
+}
+
+int stdout_fd() {
+    return STDOUT_FILENO;
+}
+
+// The whole file is mapped whatever `replaceable` says: rename() never minds a mapping
+bool MappedFile::open(const string &path, bool replaceable) {
+    (void)replaceable;
+    close();
+    found_ = false;
+    int fd = open_file(path, OPEN_READ);
+    if (fd < 0) return false;
+    found_ = true;
+    const int64_t size = file_size(fd);
+    bool ok = size >= 0;
+    if (ok && size > 0) {
+        void* m = mmap(nullptr, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = m != MAP_FAILED;
+        if (ok) data_ = static_cast<const char*>(m);
+        mapped_ = ok;
+    }
+    if (ok) size_ = (size_t)size;
+    const int e = errno;
+    ::close(fd);
+    errno = e;
+    return ok;
+}
+
+void MappedFile::close() {
+    if (mapped_) munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+}
+
+void MappedFile::advise_random() {
+    if (mapped_) madvise(const_cast<char*>(data_), size_, MADV_RANDOM);
+}
+
+#endif
+
+} // namespace ilpd
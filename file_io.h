@@ -0,0 +1,72 @@
+// file_io.h
+// - The file calls that differ between POSIX and Windows: descriptors for the atomic writers and the
+//   pack, fsync, rename over an existing file, an exclusive lock, read-only whole-file views
+// - Paths are UTF-8; on Windows the executable's manifest makes UTF-8 the process code page
+// - Failures come back with errno set, like the POSIX calls behind them
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+namespace ilpd {
+
+enum OpenMode {
+    OPEN_READ,      // read only
+    OPEN_SYNC,      // an existing file, opened to be flushed (Windows needs write access for that)
+    OPEN_WRITE,     // read/write, created if missing
+    OPEN_TRUNCATE   // read/write, created if missing, emptied if not
+};
+// Binary, not inherited by child processes; -1 with errno
+int open_file(const std::string &path, OpenMode mode);
+int close_file(int fd);
+// write(2) until everything is written (EINTR and short writes are retried); false with errno set
+bool write_all(int fd, std::string_view data);
+// fsync, or F_FULLFSYNC where available when the data has to reach the platters (full);
+// 0 or the errno of the failed call
+int sync_fd(int fd, bool full);
+// Makes the entries of a directory (a rename into it) durable; 0 or errno.
+// Windows has no directory flush, NTFS journals the rename itself.
+int sync_dir(const std::string &dir, bool full);
+// Size of an open file; -1 with errno
+int64_t file_size(int fd);
+// Moves the offset of `fd` to the end of the file; false with errno
+bool seek_end(int fd);
+// Exclusive lock on the whole file, waited for and held until `fd` is closed; false with errno.
+// Only other lock_file() callers are kept out, plain reads and writes are not blocked.
+bool lock_file(int fd);
+// rename(2), replacing `to` if it exists; false with errno
+bool replace_file(const std::string &from, const std::string &to);
+bool remove_file(const std::string &path);
+long process_id();
+// Standard output as a descriptor taking raw bytes (no newline translation on Windows)
+int stdout_fd();
+
+// Read-only view of a whole file, mapped (only the pages read are faulted in).
+// On Windows a file with a live view cannot be replaced, so files rewritten by rename while they are
+// open (the extraction index, the catalog) ask for `replaceable` and are read into memory there.
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    // false with errno; found() tells a file that could not be opened at all from one that could not
+    // be mapped. An empty file opens with size() 0 and no data.
+    bool open(const std::string &path, bool replaceable = false);
+    void close();
+    bool found() const { return found_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    // No readahead: the reader jumps around the file
+    void advise_random();
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool found_ = false;
+    bool mapped_ = false;
+};
+
+} // namespace ilpd
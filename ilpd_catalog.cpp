@@ -0,0 +1,517 @@
+// ilpd_catalog.cpp
+// - Profile normalization and diff (json_reader.h), the mmapped catalog file and its updates
+
+#include "ilpd_catalog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "json_reader.h"
+
+namespace ilpd {
+
+namespace {
+
+const char MAGIC[8] = {'I', 'L', 'P', 'D', 'C', 'A', 'T', '1'};
+const uint32_t VERSION = 1;
+
+// Shortest spelling that reads back as the same double; integers without a fraction
+string canonical_number(const string &raw) {
+    const double v = strtod(raw.c_str(), nullptr);
+    if (!std::isfinite(v)) return raw;
+    char buf[32];
+    if (v == std::floor(v) && std::fabs(v) < 1e15) {
+        snprintf(buf, sizeof(buf), "%.0f", v);
+        return strcmp(buf, "-0") == 0 ? string("0") : string(buf);
+    }
+    for (int precision = 1; precision <= 17; ++precision) {
+        snprintf(buf, sizeof(buf), "%.*g", precision, v);
+        if (strtod(buf, nullptr) == v) break;
+    }
+    return buf;
+}
+
+void canonical(const JsonValue &v, string &out) {
+    switch (v.type) {
+        case JsonValue::NUL: out += "null"; break;
+        case JsonValue::BOOL: out += v.boolean ? "true" : "false"; break;
+        case JsonValue::NUMBER: out += canonical_number(v.raw); break;
+        case JsonValue::STRING: out += json_quote(v.str); break;
+        case JsonValue::ARRAY:
+            out += '[';
+            for (size_t i = 0; i < v.items.size(); ++i) {
+                if (i) out += ',';
+                canonical(v.items[i], out);
+            }
+            out += ']';
+            break;
+        case JsonValue::OBJECT: {
+            vector<const std::pair<string, JsonValue>*> members;
+            for (const auto &m : v.members) members.push_back(&m);
+            // a repeated key keeps its last value, as most readers do
+            std::stable_sort(members.begin(), members.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+            out += '{';
+            bool first = true;
+            for (size_t i = 0; i < members.size(); ++i) {
+                if (i + 1 < members.size() && members[i + 1]->first == members[i]->first) continue;
+                if (!first) out += ',';
+                first = false;
+                out += json_quote(members[i]->first);
+                out += ':';
+                canonical(members[i]->second, out);
+            }
+            out += '}';
+            break;
+        }
+    }
+}
+
+string canonical(const JsonValue &v) {
+    string out;
+    canonical(v, out);
+    return out;
+}
+
+// RFC 6901 reference token
+string pointer_token(const string &key) {
+    string out;
+    for (char c : key) {
+        if (c == '~') out += "~0";
+        else if (c == '/') out += "~1";
+        else out += c;
+    }
+    return out;
+}
+
+void diff_values(const JsonValue &a, const JsonValue &b, const string &path, vector<string> &changes) {
+    if (a.type == JsonValue::OBJECT && b.type == JsonValue::OBJECT) {
+        // normalized data: members are sorted and unique
+        size_t i = 0, j = 0;
+        while (i < a.members.size() || j < b.members.size()) {
+            int cmp = i >= a.members.size() ? 1 : j >= b.members.size() ? -1 : a.members[i].first.compare(b.members[j].first);
+            if (cmp < 0) {
+                changes.push_back("{\"path\":" + json_quote(path + "/" + pointer_token(a.members[i].first)) +
+                                  ",\"op\":\"removed\",\"a\":" + canonical(a.members[i].second) + "}");
+                ++i;
+            } else if (cmp > 0) {
+                changes.push_back("{\"path\":" + json_quote(path + "/" + pointer_token(b.members[j].first)) +
+                                  ",\"op\":\"added\",\"b\":" + canonical(b.members[j].second) + "}");
+                ++j;
+            } else {
+                diff_values(a.members[i].second, b.members[j].second, path + "/" + pointer_token(a.members[i].first), changes);
+                ++i;
+                ++j;
+            }
+        }
+        return;
+    }
+    if (a.type == JsonValue::ARRAY && b.type == JsonValue::ARRAY) {
+        const size_t n = std::max(a.items.size(), b.items.size());
+        for (size_t i = 0; i < n; ++i) {
+            const string item = path + "/" + std::to_string(i);
+            if (i >= b.items.size()) changes.push_back("{\"path\":" + json_quote(item) + ",\"op\":\"removed\",\"a\":" + canonical(a.items[i]) + "}");
+            else if (i >= a.items.size()) changes.push_back("{\"path\":" + json_quote(item) + ",\"op\":\"added\",\"b\":" + canonical(b.items[i]) + "}");
+            else diff_values(a.items[i], b.items[i], item, changes);
+        }
+        return;
+    }
+    const string ta = canonical(a), tb = canonical(b);
+    if (ta == tb) return;
+    string change = "{\"path\":" + json_quote(path) + ",\"op\":\"changed\",\"a\":" + ta + ",\"b\":" + tb;
+    if (a.type == JsonValue::NUMBER && b.type == JsonValue::NUMBER) {
+        char buf[32];
+        // rounded to what the two values hold, not the noise of the subtraction
+        snprintf(buf, sizeof(buf), "%.15g", strtod(tb.c_str(), nullptr) - strtod(ta.c_str(), nullptr));
+        change += ",\"delta\":" + canonical_number(buf);
+    }
+    changes.push_back(change + "}");
+}
+
+string iso_time(int64_t ns) {
+    if (!ns) return "null";
+    const time_t t = (time_t)(ns / 1000000000LL);
+    struct tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return json_quote(buf);
+}
+
+// Open-addressing tables: a power of two, at most half full
+uint64_t table_size(size_t count) {
+    uint64_t n = 16;
+    while (n < (uint64_t)count * 2) n <<= 1;
+    return n;
+}
+
+// Which of two sightings counts as earlier: by time, then by clip path so updates are repeatable
+bool earlier(int64_t ta, const string &ca, int64_t tb, const string &cb) {
+    return ta != tb ? ta < tb : ca < cb;
+}
+
+} // namespace
+
+string normalize_profile(std::string_view data) {
+    string text(data);
+    JsonValue v;
+    string err;
+    if (JsonParser(text).parse(v, err)) return canonical(v);
+    while (!text.empty() && (text.back() == '\0' || text.back() == ' ' || text.back() == '\n' || text.back() == '\r' || text.back() == '\t')) {
+        text.pop_back();
+    }
+    return text;
+}
+
+string catalog_entry_json(const CatalogEntry &e, bool withData) {
+    string out = "{\"uuid\":" + json_quote(e.uuid) + ",\"hash\":" + json_quote(hash_to_hex(e.hash)) +
+                 ",\"camera\":" + (e.camera.empty() ? string("null") : json_quote(e.camera)) +
+                 ",\"firstSeen\":" + iso_time(e.firstSeenNs) + ",\"firstClip\":" + json_quote(e.firstClip) +
+                 ",\"lastSeen\":" + iso_time(e.lastSeenNs) + ",\"lastClip\":" + json_quote(e.lastClip);
+    if (withData) {
+        JsonValue v;
+        string err;
+        // normalized JSON goes in as is, anything else as a string
+        out += ",\"profile\":" + (JsonParser(e.data).parse(v, err) ? e.data : json_quote(e.data));
+    }
+    return out + "}";
+}
+
+string diff_profiles_json(const CatalogEntry &a, const CatalogEntry &b) {
+    vector<string> changes;
+    JsonValue va, vb;
+    string err;
+    if (a.hash != b.hash) {
+        if (JsonParser(a.data).parse(va, err) && JsonParser(b.data).parse(vb, err)) diff_values(va, vb, "", changes);
+        else changes.push_back("{\"path\":\"\",\"op\":\"changed\",\"a\":" + json_quote(a.data) + ",\"b\":" + json_quote(b.data) + "}");
+    }
+    string out = "{\"a\":" + catalog_entry_json(a, false) + ",\"b\":" + catalog_entry_json(b, false) +
+                 ",\"identical\":" + (changes.empty() ? "true" : "false") + ",\"changes\":[";
+    for (size_t i = 0; i < changes.size(); ++i) out += (i ? "," : "") + changes[i];
+    return out + "]}";
+}
+
+struct ProfileCatalog::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entrySize;
+    uint64_t entryCount;
+    uint64_t tableSize;         // slots of the UUID and the profile hash tables each
+    uint64_t rawTableSize;
+};
+
+// Strings are (offset, length) in the blob
+struct ProfileCatalog::Entry {
+    uint64_t hash;
+    int64_t firstSeenNs;
+    int64_t lastSeenNs;
+    uint64_t uuidOff;
+    uint64_t cameraOff;
+    uint64_t dataOff;
+    uint64_t firstOff;
+    uint64_t lastOff;
+    uint32_t uuidLen;
+    uint32_t cameraLen;
+    uint32_t dataLen;
+    uint32_t firstLen;
+    uint32_t lastLen;
+    uint32_t reserved;
+};
+
+struct ProfileCatalog::RawSlot {
+    uint64_t key;               // raw_key()
+    uint32_t entry;             // index + 1, 0 == empty
+    uint32_t reserved;
+};
+
+ProfileCatalog::ProfileCatalog()
+    : entries_(nullptr), count_(0), uuidTable_(nullptr), hashTable_(nullptr), tableSize_(0),
+      rawTable_(nullptr), rawTableSize_(0), blob_(nullptr), blobSize_(0), materialized_(false), modified_(false) {}
+
+ProfileCatalog::~ProfileCatalog() { unmap(); }
+
+void ProfileCatalog::unmap() {
+    file_.close();
+    entries_ = nullptr;
+    count_ = 0;
+    uuidTable_ = hashTable_ = nullptr;
+    rawTable_ = nullptr;
+    tableSize_ = rawTableSize_ = 0;
+    blob_ = nullptr;
+    blobSize_ = 0;
+}
+
+bool ProfileCatalog::load(const string &path, string &err) {
+    unmap();
+    if (!file_.open(path)) {
+        if (!file_.found()) return true;
+        err = "Failed to map " + path;
+        return false;
+    }
+    if (file_.size() < sizeof(Header)) {
+        file_.close();
+        err = "not a braw2ilpd catalog: " + path;
+        return false;
+    }
+    Header h;
+    memcpy(&h, file_.data(), sizeof(h));
+    // the layout sizes are checked before they are multiplied, so no product can wrap
+    const bool pow2 = h.tableSize && !(h.tableSize & (h.tableSize - 1)) && h.rawTableSize && !(h.rawTableSize & (h.rawTableSize - 1));
+    const bool sane = pow2 && h.entryCount < (1ull << 31) && h.tableSize < (1ull << 32) && h.rawTableSize < (1ull << 32) &&
+                      h.entryCount <= h.tableSize;
+    const uint64_t layout = sane ? sizeof(Header) + h.entryCount * sizeof(Entry) + 2 * h.tableSize * sizeof(uint32_t) +
+                                   h.rawTableSize * sizeof(RawSlot) : 0;
+    if (memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0 || h.version != VERSION || h.entrySize != sizeof(Entry) || !sane ||
+        layout > file_.size()) {
+        unmap();
+        err = "not a braw2ilpd catalog (or another version): " + path;
+        return false;
+    }
+    const char* p = file_.data() + sizeof(Header);
+    entries_ = reinterpret_cast<const Entry*>(p);
+    count_ = (size_t)h.entryCount;
+    p += h.entryCount * sizeof(Entry);
+    uuidTable_ = reinterpret_cast<const uint32_t*>(p);
+    hashTable_ = uuidTable_ + h.tableSize;
+    tableSize_ = h.tableSize;
+    p += 2 * h.tableSize * sizeof(uint32_t);
+    rawTable_ = reinterpret_cast<const RawSlot*>(p);
+    rawTableSize_ = h.rawTableSize;
+    p += h.rawTableSize * sizeof(RawSlot);
+    blob_ = p;
+    blobSize_ = file_.size() - (size_t)layout;
+    auto inBlob = [&](uint64_t off, uint64_t len) { return off <= blobSize_ && len <= blobSize_ - off; };
+    for (size_t i = 0; i < count_; ++i) {
+        const Entry &e = entries_[i];
+        if (!inBlob(e.uuidOff, e.uuidLen) || !inBlob(e.cameraOff, e.cameraLen) || !inBlob(e.dataOff, e.dataLen) ||
+            !inBlob(e.firstOff, e.firstLen) || !inBlob(e.lastOff, e.lastLen)) {
+            unmap();
+            err = "corrupt catalog: " + path;
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < 2 * tableSize_; ++i) {
+        if (uuidTable_[i] > count_) { unmap(); err = "corrupt catalog: " + path; return false; }
+    }
+    for (uint64_t i = 0; i < rawTableSize_; ++i) {
+        if (rawTable_[i].entry > count_) { unmap(); err = "corrupt catalog: " + path; return false; }
+    }
+    return true;
+}
+
+size_t ProfileCatalog::size() const { return materialized_ ? mem_.size() : count_; }
+
+CatalogEntry ProfileCatalog::decode(const Entry &e) const {
+    CatalogEntry out;
+    out.hash = e.hash;
+    out.uuid.assign(blob_ + e.uuidOff, e.uuidLen);
+    out.camera.assign(blob_ + e.cameraOff, e.cameraLen);
+    out.data.assign(blob_ + e.dataOff, e.dataLen);
+    out.firstClip.assign(blob_ + e.firstOff, e.firstLen);
+    out.firstSeenNs = e.firstSeenNs;
+    out.lastClip.assign(blob_ + e.lastOff, e.lastLen);
+    out.lastSeenNs = e.lastSeenNs;
+    return out;
+}
+
+CatalogEntry ProfileCatalog::entry(size_t i) const { return materialized_ ? mem_[i] : decode(entries_[i]); }
+
+uint64_t ProfileCatalog::raw_key(uint64_t rawHash, std::string_view uuid) {
+    const uint64_t k = hash64(uuid.data(), uuid.size(), rawHash);
+    return k ? k : 1;
+}
+
+vector<size_t> ProfileCatalog::find_uuid(std::string_view uuid) const {
+    vector<size_t> out;
+    const uint64_t key = hash64(uuid.data(), uuid.size());
+    if (materialized_) {
+        auto range = memUuid_.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) if (mem_[it->second].uuid == uuid) out.push_back(it->second);
+    } else if (tableSize_) {
+        for (uint64_t i = key & (tableSize_ - 1), n = 0; uuidTable_[i] && n < tableSize_; i = (i + 1) & (tableSize_ - 1), ++n) {
+            const Entry &e = entries_[uuidTable_[i] - 1];
+            if (std::string_view(blob_ + e.uuidOff, e.uuidLen) == uuid) out.push_back(uuidTable_[i] - 1);
+        }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+vector<size_t> ProfileCatalog::find_hash(uint64_t hash) const {
+    vector<size_t> out;
+    if (materialized_) {
+        auto range = memHash_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) out.push_back(it->second);
+    } else if (tableSize_) {
+        for (uint64_t i = hash & (tableSize_ - 1), n = 0; hashTable_[i] && n < tableSize_; i = (i + 1) & (tableSize_ - 1), ++n) {
+            if (entries_[hashTable_[i] - 1].hash == hash) out.push_back(hashTable_[i] - 1);
+        }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+bool ProfileCatalog::find_raw(uint64_t rawHash, std::string_view uuid, size_t &index) const {
+    if (!rawHash) return false;
+    const uint64_t key = raw_key(rawHash, uuid);
+    if (materialized_) {
+        auto it = memRaw_.find(key);
+        if (it == memRaw_.end()) return false;
+        index = it->second;
+        return true;
+    }
+    for (uint64_t i = rawTableSize_ ? key & (rawTableSize_ - 1) : 0, n = 0; n < rawTableSize_ && rawTable_[i].entry;
+         i = (i + 1) & (rawTableSize_ - 1), ++n) {
+        if (rawTable_[i].key == key) {
+            index = rawTable_[i].entry - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ProfileCatalog::index_entry(size_t i) {
+    const CatalogEntry &e = mem_[i];
+    memUuid_.emplace(hash64(e.uuid.data(), e.uuid.size()), i);
+    memHash_.emplace(e.hash, i);
+}
+
+// Entries move to memory on the first update; only the profiles are copied, not the archive's clips
+void ProfileCatalog::materialize() {
+    if (materialized_) return;
+    mem_.reserve(count_ + 16);
+    for (size_t i = 0; i < count_; ++i) {
+        mem_.push_back(decode(entries_[i]));
+        index_entry(i);
+    }
+    for (uint64_t i = 0; i < rawTableSize_; ++i) {
+        if (rawTable_[i].entry) memRaw_[rawTable_[i].key] = rawTable_[i].entry - 1;
+    }
+    materialized_ = true;
+    unmap();
+}
+
+void ProfileCatalog::see(size_t index, const CatalogSighting &s) {
+    materialize();
+    CatalogEntry &e = mem_[index];
+    if (earlier(s.seenNs, s.clip, e.firstSeenNs, e.firstClip)) {
+        e.firstSeenNs = s.seenNs;
+        e.firstClip = s.clip;
+        modified_ = true;
+    }
+    if (earlier(e.lastSeenNs, e.lastClip, s.seenNs, s.clip)) {
+        e.lastSeenNs = s.seenNs;
+        e.lastClip = s.clip;
+        modified_ = true;
+    }
+    if (e.camera.empty() && !s.camera.empty()) {
+        e.camera = s.camera;
+        modified_ = true;
+    }
+}
+
+size_t ProfileCatalog::add(const CatalogSighting &s, std::string_view projectionData, bool &added) {
+    materialize();
+    string data = normalize_profile(projectionData);
+    const uint64_t hash = hash64(data.data(), data.size());
+    added = false;
+    size_t index = mem_.size();
+    for (size_t i : find_hash(hash)) {
+        if (mem_[i].uuid == s.uuid) index = i;
+    }
+    if (index == mem_.size()) {
+        CatalogEntry e;
+        e.hash = hash;
+        e.uuid = s.uuid;
+        e.camera = s.camera;
+        e.data = std::move(data);
+        e.firstClip = e.lastClip = s.clip;
+        e.firstSeenNs = e.lastSeenNs = s.seenNs;
+        mem_.push_back(std::move(e));
+        index_entry(index);
+        added = true;
+        modified_ = true;
+    } else {
+        see(index, s);
+    }
+    if (s.rawHash) {
+        auto r = memRaw_.emplace(raw_key(s.rawHash, s.uuid), index);
+        if (r.second) modified_ = true;
+    }
+    return index;
+}
+
+bool ProfileCatalog::save(const string &path, AtomicWriter &writer, string &err) {
+    materialize();
+    const uint64_t tableSize = table_size(mem_.size());
+    const uint64_t rawTableSize = table_size(memRaw_.size());
+    string blob;
+    auto append = [&blob](const string &s) {
+        uint64_t off = blob.size();
+        blob += s;
+        return off;
+    };
+    vector<Entry> entries(mem_.size());
+    vector<uint32_t> tables(2 * tableSize, 0);
+    for (size_t i = 0; i < mem_.size(); ++i) {
+        const CatalogEntry &c = mem_[i];
+        Entry &e = entries[i];
+        memset(&e, 0, sizeof(e));
+        e.hash = c.hash;
+        e.firstSeenNs = c.firstSeenNs;
+        e.lastSeenNs = c.lastSeenNs;
+        e.uuidOff = append(c.uuid);
+        e.uuidLen = (uint32_t)c.uuid.size();
+        e.cameraOff = append(c.camera);
+        e.cameraLen = (uint32_t)c.camera.size();
+        e.dataOff = append(c.data);
+        e.dataLen = (uint32_t)c.data.size();
+        e.firstOff = append(c.firstClip);
+        e.firstLen = (uint32_t)c.firstClip.size();
+        e.lastOff = append(c.lastClip);
+        e.lastLen = (uint32_t)c.lastClip.size();
+        const uint64_t keys[2] = {hash64(c.uuid.data(), c.uuid.size()), c.hash};
+        for (int t = 0; t < 2; ++t) {
+            uint32_t* table = tables.data() + t * tableSize;
+            uint64_t slot = keys[t] & (tableSize - 1);
+            while (table[slot]) slot = (slot + 1) & (tableSize - 1);
+            table[slot] = (uint32_t)(i + 1);
+        }
+    }
+    // by key, so the same catalog is always written the same way
+    vector<std::pair<uint64_t, size_t>> raws(memRaw_.begin(), memRaw_.end());
+    std::sort(raws.begin(), raws.end());
+    vector<RawSlot> rawTable(rawTableSize);
+    memset(rawTable.data(), 0, rawTable.size() * sizeof(RawSlot));
+    for (const auto &r : raws) {
+        uint64_t slot = r.first & (rawTableSize - 1);
+        while (rawTable[slot].entry) slot = (slot + 1) & (rawTableSize - 1);
+        rawTable[slot].key = r.first;
+        rawTable[slot].entry = (uint32_t)(r.second + 1);
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC, sizeof(h.magic));
+    h.version = VERSION;
+    h.entrySize = sizeof(Entry);
+    h.entryCount = entries.size();
+    h.tableSize = tableSize;
+    h.rawTableSize = rawTableSize;
+    string content(reinterpret_cast<const char*>(&h), sizeof(h));
+    content.append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+    content.append(reinterpret_cast<const char*>(tables.data()), tables.size() * sizeof(uint32_t));
+    content.append(reinterpret_cast<const char*>(rawTable.data()), rawTable.size() * sizeof(RawSlot));
+    content += blob;
+    if (!writer.write(path, content, err)) return false;
+    modified_ = false;
+    return true;
+}
+
+} // namespace ilpd
@@ -0,0 +1,109 @@
+// ilpd_catalog.h
+// - braw2ilpd catalog: the unique lens profiles of an archive, one entry per (UUID, profile data),
+//   with the camera ID of its ILPD file name and the first/last clip seen with it
+// - Profiles are identified by the hash64 of their normalized projection data (JSON key order,
+//   whitespace and number spelling do not count); two entries under one camera mean a recalibration
+// - On disk: header, fixed-size entries, open-addressing tables by UUID, by profile hash and by the
+//   raw ILPD hash of the extraction results, then one string blob. The file is mmapped and the tables
+//   are probed in place, so a lookup costs the same whatever the size of the catalog
+// - Updates: a clip whose ILPD hash is already known is a table probe; only new payloads are read and
+//   normalized. save() rewrites the file (a few entries per calibration) atomically
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "ilpdextract.h"
+
+namespace ilpd {
+
+struct CatalogEntry {
+    uint64_t hash = 0;              // hash64 of `data`
+    string uuid;
+    string camera;                  // camera ID parsed from the ILPD file name, empty if unknown
+    string data;                    // normalized projection data
+    string firstClip;
+    int64_t firstSeenNs = 0;        // clip mtime (or the time of the update when the clip is not here)
+    string lastClip;
+    int64_t lastSeenNs = 0;
+};
+
+// One clip of the extraction results the catalog is updated from
+struct CatalogSighting {
+    string uuid;
+    string camera;
+    uint64_t rawHash = 0;           // hash of the ILPD as written (manifest/index hash), 0 == unknown
+    string clip;
+    int64_t seenNs = 0;
+};
+
+// Canonical form of projection data: JSON with sorted keys, no whitespace and numbers in their
+// shortest round-trip spelling; anything that is not JSON is kept as is, trailing whitespace dropped
+string normalize_profile(std::string_view data);
+// Structured difference of two entries: {"a":{..},"b":{..},"identical":..,"changes":[{"path","op",..}]}
+// with JSON Pointer paths and, for numbers that changed, "delta" (b - a)
+string diff_profiles_json(const CatalogEntry &a, const CatalogEntry &b);
+// Entry summary as a JSON object (uuid, hash, camera, first/last seen), with the profile if `withData`
+string catalog_entry_json(const CatalogEntry &e, bool withData);
+
+class ProfileCatalog {
+public:
+    ProfileCatalog();
+    ~ProfileCatalog();
+    ProfileCatalog(const ProfileCatalog&) = delete;
+    ProfileCatalog& operator=(const ProfileCatalog&) = delete;
+
+    // A missing file is an empty catalog; false with `err` for an unreadable or foreign one
+    bool load(const string &path, string &err);
+    size_t size() const;
+    CatalogEntry entry(size_t i) const;
+
+    // Entries under a UUID / with a normalized profile hash, in entry order
+    vector<size_t> find_uuid(std::string_view uuid) const;
+    vector<size_t> find_hash(uint64_t hash) const;
+    // Entry of an ILPD already catalogued with this raw hash under this UUID
+    bool find_raw(uint64_t rawHash, std::string_view uuid, size_t &index) const;
+
+    // Another clip of a known entry: widens its first/last seen
+    void see(size_t index, const CatalogSighting &s);
+    // A clip with its projection data; the entry index, `added` when it starts a new entry
+    size_t add(const CatalogSighting &s, std::string_view projectionData, bool &added);
+    bool modified() const { return modified_; }
+
+    bool save(const string &path, AtomicWriter &writer, string &err);
+
+private:
+    struct Header;
+    struct Entry;
+    struct RawSlot;
+    void unmap();
+    void materialize();
+    CatalogEntry decode(const Entry &e) const;
+    void index_entry(size_t i);
+    static uint64_t raw_key(uint64_t rawHash, std::string_view uuid);
+
+    // mmapped file
+    MappedFile file_;
+    const Entry* entries_;
+    size_t count_;
+    const uint32_t* uuidTable_;
+    const uint32_t* hashTable_;
+    uint64_t tableSize_;
+    const RawSlot* rawTable_;
+    uint64_t rawTableSize_;
+    const char* blob_;
+    size_t blobSize_;
+    // after the first update everything lives here instead
+    bool materialized_;
+    bool modified_;
+    vector<CatalogEntry> mem_;
+    std::unordered_multimap<uint64_t, size_t> memUuid_;
+    std::unordered_multimap<uint64_t, size_t> memHash_;
+    std::unordered_map<uint64_t, size_t> memRaw_;
+};
+
+} // namespace ilpd
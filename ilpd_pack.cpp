@@ -0,0 +1,283 @@
+// ilpd_pack.cpp
+// - .ilpdpack reader (mmap, footer validation, binary search) and the append done at the end of a run
+
+#include "ilpd_pack.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+namespace ilpd {
+
+namespace {
+
+const char MAGIC[8] = {'I', 'L', 'P', 'D', 'P', 'A', 'K', '1'};
+const char FOOTER_MAGIC[8] = {'I', 'L', 'P', 'D', 'P', 'K', 'I', 'X'};
+const uint32_t VERSION = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+uint64_t align8(uint64_t n) { return (n + 7) & ~7ull; }
+
+} // namespace
+
+// Index entry; the UUID and file name are in the string pool after the entries
+struct PackReader::Entry {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t hash;
+    uint32_t uuidOff;
+    uint32_t uuidLen;
+    uint32_t nameOff;
+    uint32_t nameLen;
+};
+
+struct PackReader::Footer {
+    uint64_t indexOffset;
+    uint64_t count;
+    uint64_t poolSize;
+    uint64_t indexHash;         // hash64 of entries + pool, tells a finished index from a torn one
+    uint32_t version;
+    uint32_t reserved;
+    char magic[8];
+};
+
+PackReader::PackReader(): entries_(nullptr), count_(0), pool_(nullptr), poolSize_(0) {}
+
+PackReader::~PackReader() {}
+
+bool PackReader::valid_footer(uint64_t end, Footer &f) const {
+    if (end < sizeof(Header) + sizeof(Footer) || end > file_.size()) return false;
+    const char* base = file_.data();
+    memcpy(&f, base + end - sizeof(Footer), sizeof(f));
+    if (memcmp(f.magic, FOOTER_MAGIC, sizeof(f.magic)) != 0 || f.version != VERSION) return false;
+    const uint64_t indexEnd = end - sizeof(Footer);
+    if (f.indexOffset < sizeof(Header) || f.indexOffset > indexEnd || f.count > (indexEnd - f.indexOffset) / sizeof(Entry) ||
+        f.poolSize != indexEnd - f.indexOffset - f.count * sizeof(Entry)) {
+        return false;
+    }
+    if (hash64(base + f.indexOffset, (size_t)(indexEnd - f.indexOffset)) != f.indexHash) return false;
+    const Entry* entries = reinterpret_cast<const Entry*>(base + f.indexOffset);
+    for (uint64_t i = 0; i < f.count; ++i) {
+        const Entry &e = entries[i];
+        if (e.offset > f.indexOffset || e.length > f.indexOffset - e.offset || (uint64_t)e.uuidOff + e.uuidLen > f.poolSize ||
+            (uint64_t)e.nameOff + e.nameLen > f.poolSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PackReader::open(const string &path, string &err) {
+    if (!file_.open(path)) {
+        err = file_.found() ? "Failed to map " + path : "Cannot open pack " + path + ": " + strerror(errno);
+        return false;
+    }
+    if (file_.size() < sizeof(Header)) {
+        err = "not an ILPD pack: " + path;
+        return false;
+    }
+    Header h;
+    memcpy(&h, file_.data(), sizeof(h));
+    if (memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0 || h.version != VERSION) {
+        err = "not an ILPD pack (or another version): " + path;
+        return false;
+    }
+    // Normally the footer ends the file; after an interrupted append, the last one that checks out
+    Footer f;
+    uint64_t end = file_.size() & ~7ull;
+    while (end >= sizeof(Header) + sizeof(Footer) && !valid_footer(end, f)) end -= 8;
+    if (end < sizeof(Header) + sizeof(Footer)) {
+        err = "no valid index in pack: " + path;
+        return false;
+    }
+    const char* base = file_.data();
+    entries_ = reinterpret_cast<const Entry*>(base + f.indexOffset);
+    count_ = (size_t)f.count;
+    pool_ = base + f.indexOffset + f.count * sizeof(Entry);
+    poolSize_ = f.poolSize;
+    return true;
+}
+
+std::string_view PackReader::pool(uint32_t off, uint32_t len) const { return std::string_view(pool_ + off, len); }
+
+PackEntry PackReader::entry(size_t i) const {
+    const Entry &e = entries_[i];
+    PackEntry out;
+    out.uuid = string(pool(e.uuidOff, e.uuidLen));
+    out.name = string(pool(e.nameOff, e.nameLen));
+    out.hash = e.hash;
+    out.offset = e.offset;
+    out.length = e.length;
+    return out;
+}
+
+std::string_view PackReader::data(size_t i) const {
+    return std::string_view(file_.data() + entries_[i].offset, entries_[i].length);
+}
+
+bool PackReader::find(std::string_view uuid, size_t &index) const {
+    const Entry* first = entries_;
+    const Entry* last = entries_ + count_;
+    const Entry* it = std::lower_bound(first, last, uuid, [this](const Entry &e, std::string_view u) {
+        return pool(e.uuidOff, e.uuidLen) < u;
+    });
+    if (it == last || pool(it->uuidOff, it->uuidLen) != uuid) return false;
+    index = (size_t)(it - first);
+    return true;
+}
+
+void PackBuilder::add(const string &uuid, uint64_t hash, std::string_view data, const string &ilpdPath) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Item &item = items_[uuid];
+    if (item.haveData) return;
+    item.hash = hash;
+    item.data = string(data);
+    item.haveData = true;
+    item.ilpdPath = ilpdPath;
+}
+
+void PackBuilder::add_existing(const string &uuid, uint64_t hash, const string &ilpdPath) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Item &item = items_[uuid];
+    if (!item.ilpdPath.empty()) return;
+    item.hash = hash;
+    item.ilpdPath = ilpdPath;
+}
+
+bool PackBuilder::commit(AtomicWriter &writer, const Logger &log) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (items_.empty()) return true;
+    auto fail = [&](const string &what) {
+        log.error("Failed to write pack " + path_ + ": " + what);
+        return false;
+    };
+
+    // Every run opens (or creates) the pack and locks it before it looks at it, so concurrent
+    // runs (--shard) creating the same pack append one after the other instead of replacing it.
+    // The index is read again under the lock; an empty file is a pack nobody has written yet.
+    const std::filesystem::path parent = std::filesystem::path(path_).parent_path();
+    std::error_code ec;
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    int fd = open_file(path_, OPEN_WRITE);
+    if (fd < 0) return fail(strerror(errno));
+    struct FdCloser { int fd; ~FdCloser() { close_file(fd); } } closer{fd};
+    if (!lock_file(fd)) return fail(strerror(errno));
+    const int64_t size = file_size(fd);
+    if (size < 0) return fail(strerror(errno));
+    const bool created = size == 0;
+    PackReader existing;
+    string err;
+    if (!created && !existing.open(path_, err)) return fail(err + " (not appending to it)");
+
+    struct Fresh {
+        PackEntry entry;
+        string data;
+    };
+    vector<Fresh> fresh;
+    std::set<string> replaced;
+    for (auto &kv : items_) {
+        Item &item = kv.second;
+        size_t i;
+        const bool packed = !created && existing.find(kv.first, i);
+        if (packed && existing.entry(i).hash == item.hash) continue;
+        if (!item.haveData) {
+            std::ifstream in(item.ilpdPath, std::ios::binary);
+            std::stringstream ss;
+            ss << in.rdbuf();
+            item.data = ss.str();
+            if (!in || hash64(item.data.data(), item.data.size()) != item.hash) {
+                log.error("Warning: not packed, ILPD missing or changed since it was indexed: " + item.ilpdPath);
+                continue;
+            }
+        }
+        if (packed) {
+            log.error("Warning: UUID " + kv.first + " is packed with other projection data, the new profile replaces it");
+            replaced.insert(kv.first);
+        }
+        Fresh f;
+        f.entry.uuid = kv.first;
+        f.entry.name = std::filesystem::path(item.ilpdPath).filename().string();
+        f.entry.hash = item.hash;
+        f.data = std::move(item.data);
+        fresh.push_back(std::move(f));
+    }
+    items_.clear();
+    if (fresh.empty()) {
+        log.debug("Pack " + path_ + " already holds every profile of this run");
+        return true;
+    }
+
+    // Where the appended bytes start: a new file gets its header first
+    const uint64_t start = (uint64_t)size;
+    string content;
+    if (created) {
+        Header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, MAGIC, sizeof(h.magic));
+        h.version = VERSION;
+        content.assign(reinterpret_cast<const char*>(&h), sizeof(h));
+    } else {
+        content.assign(align8(start) - start, '\0');
+    }
+    vector<PackEntry> entries;
+    for (size_t i = 0; i < existing.size(); ++i) {
+        PackEntry e = existing.entry(i);
+        if (!replaced.count(e.uuid)) entries.push_back(std::move(e));
+    }
+    for (Fresh &f : fresh) {
+        f.entry.offset = start + content.size();
+        f.entry.length = f.data.size();
+        content += f.data;
+        content.append(align8(start + content.size()) - (start + content.size()), '\0');
+        entries.push_back(f.entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const PackEntry &a, const PackEntry &b) { return a.uuid < b.uuid; });
+
+    string index;
+    string pool;
+    for (const PackEntry &e : entries) {
+        PackReader::Entry ie;
+        ie.offset = e.offset;
+        ie.length = e.length;
+        ie.hash = e.hash;
+        ie.uuidOff = (uint32_t)pool.size();
+        ie.uuidLen = (uint32_t)e.uuid.size();
+        pool += e.uuid;
+        ie.nameOff = (uint32_t)pool.size();
+        ie.nameLen = (uint32_t)e.name.size();
+        pool += e.name;
+        index.append(reinterpret_cast<const char*>(&ie), sizeof(ie));
+    }
+    pool.append(align8(pool.size()) - pool.size(), '\0');
+    index += pool;
+    PackReader::Footer footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.indexOffset = start + content.size();
+    footer.count = entries.size();
+    footer.poolSize = pool.size();
+    footer.indexHash = hash64(index.data(), index.size());
+    footer.version = VERSION;
+    memcpy(footer.magic, FOOTER_MAGIC, sizeof(footer.magic));
+    content += index;
+    content.append(reinterpret_cast<const char*>(&footer), sizeof(footer));
+
+    {
+        StageTimer timer(log.track, Stage::WRITE);
+        if (!seek_end(fd) || !write_all(fd, content)) return fail(strerror(errno));
+        if (log.track) log.track->add_bytes(content.size());
+    }
+    if (!writer.sync(path_, err)) return fail(err);
+    log.info("Packed " + std::to_string(fresh.size()) + " profiles into " + path_ + " (" + std::to_string(entries.size()) + " in the pack)");
+    return true;
+}
+
+} // namespace ilpd
@@ -0,0 +1,86 @@
+// ilpd_pack.h
+// - --pack <file.ilpdpack>: every unique ILPD of a run in one file, so render nodes resolve a profile
+//   by UUID from one mapped file instead of opening one file per profile
+// - Layout: header, payloads (8-byte aligned), then an index sorted by UUID (offset, length, hash and
+//   the ILPD file name of each profile) and a fixed footer at the tail
+// - Updates only append: the new payloads, then a complete new index and footer. Bytes a reader has
+//   mapped never change, and a torn append leaves the previous footer as the valid one
+// - Readers map the file, take the last valid footer and binary-search the index in place
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+#include "ilpdextract.h"
+
+namespace ilpd {
+
+struct PackEntry {
+    string uuid;
+    string name;                    // ILPD file name it was written as ([cameraID].[uuid].ilpd)
+    uint64_t hash = 0;              // hash64 of the payload, as in the manifest
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+class PackReader {
+public:
+    PackReader();
+    ~PackReader();
+    PackReader(const PackReader&) = delete;
+    PackReader& operator=(const PackReader&) = delete;
+
+    // False with `err` when the file is missing, not a pack or has no valid index
+    bool open(const string &path, string &err);
+    size_t size() const { return count_; }
+    PackEntry entry(size_t i) const;
+    // The payload in place (valid while the reader is open)
+    std::string_view data(size_t i) const;
+    // Binary search by UUID: index of the entry, false if the pack does not hold it
+    bool find(std::string_view uuid, size_t &index) const;
+
+private:
+    struct Entry;
+    struct Footer;
+    bool valid_footer(uint64_t end, Footer &f) const;
+    std::string_view pool(uint32_t off, uint32_t len) const;
+
+    MappedFile file_;
+    const Entry* entries_;
+    size_t count_;
+    const char* pool_;
+    uint64_t poolSize_;
+
+    friend class PackBuilder;
+};
+
+// The profiles of one run, appended to the pack once the run is done
+class PackBuilder {
+public:
+    explicit PackBuilder(const string &path): path_(path) {}
+    const string &path() const { return path_; }
+    // An ILPD written by this run
+    void add(const string &uuid, uint64_t hash, std::string_view data, const string &ilpdPath);
+    // One already on disk (unchanged clip): read at commit unless the pack holds it already
+    void add_existing(const string &uuid, uint64_t hash, const string &ilpdPath);
+    // Append what the pack does not hold yet (the first commit creates the file); false after logging
+    bool commit(AtomicWriter &writer, const Logger &log);
+
+private:
+    struct Item {
+        uint64_t hash = 0;
+        string data;
+        bool haveData = false;
+        string ilpdPath;
+    };
+    string path_;
+    std::mutex mutex_;
+    map<string, Item> items_;       // by UUID, the first clip of the run wins
+};
+
+} // namespace ilpd
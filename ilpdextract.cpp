@@ -0,0 +1,1453 @@
+// ilpdextract.cpp
+// - Uses the BlackmagicRaw API; platform string types go through sdk_string.h
+// - Atomic text write (tmp + rename, fsync per --durability level)
+// - Caches all immersive attributes, SDK or container fast path, and formats the detailed file
+// - AIME documents (--emit-aime) from the cached attributes
+
+#include "ilpdextract.h"
+#include "braw_container.h"
+#include "sdk_string.h"
+#include "json_reader.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#ifdef BRAW2ILPD_HAVE_CURL
+#include <curl/curl.h>
+#endif
+
+namespace ilpd {
+
+using std::ostringstream;
+
+const char* exit_code_name(int code) {
+    switch (code) {
+        case OK: return "OK";
+        case USAGE: return "USAGE";
+        case FACTORY_FAIL: return "FACTORY_FAIL";
+        case CODEC_FAIL: return "CODEC_FAIL";
+        case OPENCLIP_FAIL: return "OPENCLIP_FAIL";
+        case IMMERSIVE_NOT_SUPPORTED: return "IMMERSIVE_NOT_SUPPORTED";
+        case FILE_NOT_FOUND: return "FILE_NOT_FOUND";
+        case WRITE_FAIL: return "WRITE_FAIL";
+        case INVALID_FILE_FORMAT: return "INVALID_FILE_FORMAT";
+        case BATCH_FAIL: return "BATCH_FAIL";
+        case ILPD_CONFLICT: return "ILPD_CONFLICT";
+        case VERIFY_MISMATCH: return "VERIFY_MISMATCH";
+        case CLIP_TIMEOUT: return "CLIP_TIMEOUT";
+        default: return "UNKNOWN";
+    }
+}
+
+// Unique temporary name next to dest, so concurrent writers of the same file never share a tmp
+static string make_tmp_path(const string &dest) {
+    static std::atomic<unsigned long> counter(0);
+    return dest + ".tmp." + std::to_string(process_id()) + "." + std::to_string(counter++);
+}
+
+bool parse_durability(const string &s, Durability &out) {
+    if (s == "none") out = Durability::NONE;
+    else if (s == "file") out = Durability::FILE;
+    else if (s == "batch") out = Durability::BATCH;
+    else if (s == "full") out = Durability::FULL;
+    else return false;
+    return true;
+}
+
+static bool sync_path(const string &path, bool full, bool isDir, string &err) {
+    if (isDir) {
+        const int e = sync_dir(path, full);
+        if (e) err = "Failed to sync " + path + " (" + strerror(e) + ")";
+        return e == 0;
+    }
+    int fd = open_file(path, OPEN_SYNC);
+    if (fd < 0) {
+        err = "Failed to open " + path + " for sync (" + strerror(errno) + ")";
+        return false;
+    }
+    const int e = sync_fd(fd, full);
+    if (e) err = "Failed to sync " + path + " (" + strerror(e) + ")";
+    close_file(fd);
+    return e == 0;
+}
+
+static string parent_dir(const string &path) {
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    return parent.empty() ? string(".") : parent.string();
+}
+
+AtomicWriter::AtomicWriter(Durability durability): durability_(durability) {}
+
+bool AtomicWriter::ensure_dir(const string &dir, string &err) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (knownDirs_.count(dir)) return true;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec && !std::filesystem::is_directory(dir)) {
+        err = "Failed to create directory " + dir + " (" + ec.message() + ")";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    knownDirs_.insert(dir);
+    return true;
+}
+
+// Atomic text write: write tmp, fsync (file/full), rename, fsync the directory (file/full).
+// The content goes to the descriptor straight from the caller's buffer, no stream buffer copy.
+bool AtomicWriter::write(const string &dest, std::string_view content, string &err, StageTrack* track) {
+    StageTimer timer(track, Stage::WRITE);
+    AtomicFile file(*this, dest);
+    if (!file.open(err)) return false;
+    file.write(content);
+    if (!file.commit(err)) return false;
+    if (track) track->add_bytes(content.size());
+    return true;
+}
+
+AtomicFile::AtomicFile(AtomicWriter &writer, const string &dest): writer_(writer), dest_(dest), dir_(parent_dir(dest)) {}
+
+AtomicFile::~AtomicFile() {
+    if (fd_ >= 0) {
+        close_file(fd_);
+        remove_file(tmp_);
+    }
+}
+
+bool AtomicFile::open(string &err) {
+    if (!writer_.ensure_dir(dir_, err)) return false;
+    tmp_ = make_tmp_path(dest_);
+    fd_ = open_file(tmp_, OPEN_TRUNCATE);
+    if (fd_ < 0) {
+        err = "Failed to create temporary file: " + tmp_ + " (" + strerror(errno) + ")";
+        return false;
+    }
+    return true;
+}
+
+bool AtomicFile::write(std::string_view data) {
+    if (errno_) return false;
+    // the errno of the first call that failed, read right after it
+    if (!write_all(fd_, data)) errno_ = errno;
+    return !errno_;
+}
+
+bool AtomicFile::commit(string &err) {
+    const Durability durability = writer_.durability_;
+    const bool now = durability == Durability::FILE || durability == Durability::FULL;
+    const bool full = durability == Durability::FULL;
+    int e = errno_;
+    if (!e && now) e = sync_fd(fd_, full);
+    if (close_file(fd_) != 0 && !e) e = errno;
+    fd_ = -1;
+    if (e) {
+        err = string("Failed to write/close temporary file (") + strerror(e) + ")";
+        remove_file(tmp_);
+        return false;
+    }
+    if (!replace_file(tmp_, dest_)) {
+        err = "Failed to rename " + tmp_ + " to " + dest_ + " (" + strerror(errno) + ")";
+        remove_file(tmp_);
+        return false;
+    }
+    if (now) return sync_path(dir_, full, true, err);
+    if (durability == Durability::BATCH) {
+        std::lock_guard<std::mutex> lock(writer_.mutex_);
+        writer_.pendingFiles_.push_back(dest_);
+        writer_.pendingDirs_.insert(dir_);
+    }
+    return true;
+}
+
+bool AtomicWriter::sync(const string &path, string &err) {
+    if (durability_ == Durability::NONE) return true;
+    if (durability_ == Durability::BATCH) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pendingFiles_.push_back(path);
+        pendingDirs_.insert(parent_dir(path));
+        return true;
+    }
+    const bool full = durability_ == Durability::FULL;
+    return sync_path(path, full, false, err) && sync_path(parent_dir(path), full, true, err);
+}
+
+bool AtomicWriter::finish(string &err, StageTrack* track) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pendingFiles_.empty() && pendingDirs_.empty()) return true;
+    StageTimer timer(track, Stage::SYNC);
+    bool ok = true;
+    // every file first, then each directory once, so the renames are durable after the data
+    for (const string &path : pendingFiles_) {
+        string e;
+        if (!sync_path(path, false, false, e)) { if (ok) err = e; ok = false; }
+    }
+    for (const string &dir : pendingDirs_) {
+        string e;
+        if (!sync_path(dir, false, true, e)) { if (ok) err = e; ok = false; }
+    }
+    pendingFiles_.clear();
+    pendingDirs_.clear();
+    return ok;
+}
+
+bool write_text_file_atomic(const string &dest, std::string_view content, string &err) {
+    AtomicWriter writer;
+    return writer.write(dest, content, err);
+}
+
+// Lowercase hex pairs for every byte value, so encoding is one table lookup per byte
+struct HexTable {
+    char pairs[256][2];
+    constexpr HexTable(): pairs() {
+        const char digits[] = "0123456789abcdef";
+        for (int i = 0; i < 256; ++i) {
+            pairs[i][0] = digits[i >> 4];
+            pairs[i][1] = digits[i & 0xF];
+        }
+    }
+};
+static constexpr HexTable HEX_TABLE;
+
+static void append_hex(string &out, const uint8_t* data, size_t len, bool spaced) {
+    if (len == 0) return;
+    size_t start = out.size();
+    out.resize(start + len * 2 + (spaced ? len - 1 : 0));
+    char* p = &out[start];
+    for (size_t i = 0; i < len; ++i) {
+        if (spaced && i) *p++ = ' ';
+        memcpy(p, HEX_TABLE.pairs[data[i]], 2);
+        p += 2;
+    }
+}
+
+// Helper: variant -> typed value (and raw copy for SafeArray)
+void store_variant(const Variant &v, AttrValue &out) {
+    out.vt = v.vt;
+    out.available = true;
+    if (v.vt == blackmagicRawVariantTypeString && v.bstrVal) {
+        sdk_string_to_utf8(v.bstrVal, out.rawValue);
+    }
+    else if (v.vt == blackmagicRawVariantTypeSafeArray && v.parray) {
+        const SdkArray array = sdk_array(v);
+        out.safeArrayElementCount = array.count;
+        out.safeArrayVariantType = array.type;
+        if (array.data && out.safeArrayElementCount > 0) {
+            uint32_t elementSize = 1;
+            switch (array.type) {
+                case blackmagicRawVariantTypeU8: elementSize = 1; break;
+                case blackmagicRawVariantTypeS16:
+                case blackmagicRawVariantTypeU16: elementSize = 2; break;
+                case blackmagicRawVariantTypeS32:
+                case blackmagicRawVariantTypeU32:
+                case blackmagicRawVariantTypeFloat32: elementSize = 4; break;
+                case blackmagicRawVariantTypeFloat64: elementSize = 8; break;
+                default: elementSize = 1; break;
+            }
+            out.safeArrayTotalSize = (uint64_t)elementSize * (uint64_t)out.safeArrayElementCount;
+            const uint64_t COPY_LIMIT = 64 * 1024;   // raw bytes copy limit
+            uint64_t copySize = (out.safeArrayTotalSize > COPY_LIMIT) ? COPY_LIMIT : out.safeArrayTotalSize;
+            out.rawBytes.assign(array.data, array.data + copySize);
+        }
+    } else {
+        // numeric/basic types
+        switch (v.vt) {
+            case blackmagicRawVariantTypeU8: out.number = sdk_u8(v); break;
+            case blackmagicRawVariantTypeS16: out.number = v.iVal; break;
+            case blackmagicRawVariantTypeU16: out.number = v.uiVal; break;
+            case blackmagicRawVariantTypeS32: out.number = v.intVal; break;
+            case blackmagicRawVariantTypeU32: out.number = v.uintVal; break;
+            case blackmagicRawVariantTypeFloat32: out.number = v.fltVal; break;
+            case blackmagicRawVariantTypeFloat64: out.number = v.dblVal; break;
+            default: break;
+        }
+    }
+}
+
+const AttrDesc* find_attr(BlackmagicRawImmersiveAttribute a) {
+    for (const AttrDesc &d : ATTR_TABLE) {
+        if (d.attr == a) return &d;
+    }
+    return nullptr;
+}
+
+static string lower(string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return s;
+}
+
+const AttrDesc* find_attr(const string &name) {
+    const string l = lower(name);
+    for (const AttrDesc &d : ATTR_TABLE) {
+        if (l == d.shortName || l == lower(d.name)) return &d;
+    }
+    return nullptr;
+}
+
+// Human-friendly name & description for attributes
+string attr_name(BlackmagicRawImmersiveAttribute a) {
+    const AttrDesc* d = find_attr(a);
+    return d ? d->name : "UnknownAttribute";
+}
+string attr_desc(BlackmagicRawImmersiveAttribute a) {
+    const AttrDesc* d = find_attr(a);
+    return d ? d->desc : "";
+}
+
+bool parse_attr_mask(const string &list, AttrMask &mask, string &err) {
+    mask = 0;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == string::npos) comma = list.size();
+        const string name = list.substr(start, comma - start);
+        start = comma + 1;
+        if (name.empty()) continue;
+        if (lower(name) == "all") {
+            mask |= ALL_ATTRS;
+            continue;
+        }
+        const AttrDesc* d = find_attr(name);
+        if (!d) {
+            string known;
+            for (const AttrDesc &a : ATTR_TABLE) known += string(a.shortName) + ", ";
+            err = "unknown attribute: " + name + " (" + known + "or all)";
+            return false;
+        }
+        mask |= attr_bit(d->slot);
+    }
+    if (!mask) {
+        err = "no attributes given";
+        return false;
+    }
+    return true;
+}
+
+static bool is_numeric_vt(uint32_t vt) {
+    switch (vt) {
+        case blackmagicRawVariantTypeU8:
+        case blackmagicRawVariantTypeS16:
+        case blackmagicRawVariantTypeU16:
+        case blackmagicRawVariantTypeS32:
+        case blackmagicRawVariantTypeU32:
+        case blackmagicRawVariantTypeFloat32:
+        case blackmagicRawVariantTypeFloat64: return true;
+        default: return false;
+    }
+}
+
+// Integers print exactly, floats with the stream's default precision (%g, 6 digits); no stream per
+// value, the manifest and index format one for every clip
+static string number_text(const AttrValue &v) {
+    if (v.vt != blackmagicRawVariantTypeFloat32 && v.vt != blackmagicRawVariantTypeFloat64)
+        return std::to_string((long long)v.number);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", v.vt == blackmagicRawVariantTypeFloat32 ? (double)(float)v.number : v.number);
+    return buf;
+}
+
+static const char NOT_AVAILABLE[] = "[Attribute not available]";
+
+string AttrValue::display() const {
+    if (!available) return NOT_AVAILABLE;
+    switch (vt) {
+        case blackmagicRawVariantTypeString: return "String value: " + rawValue;
+        case blackmagicRawVariantTypeSafeArray: {
+            if (rawBytes.empty()) return "SafeArray(empty)";
+            const size_t PREVIEW_LIMIT = 512;      // hex preview limit
+            size_t previewSize = std::min(rawBytes.size(), PREVIEW_LIMIT);
+            string out = "SafeArray elems=" + std::to_string(safeArrayElementCount) + ", type=" +
+                         std::to_string(safeArrayVariantType) + ", totalSize=" + std::to_string(safeArrayTotalSize) +
+                         ", hex(first " + std::to_string(previewSize) + " bytes)=";
+            append_hex(out, rawBytes.data(), previewSize, true);
+            if (previewSize < safeArrayTotalSize) out += " ... (truncated)";
+            return out;
+        }
+        case blackmagicRawVariantTypeEmpty: return "[Empty]";
+        case blackmagicRawVariantTypeU8: return "U8 value: " + number_text(*this);
+        case blackmagicRawVariantTypeS16: return "S16 value: " + number_text(*this);
+        case blackmagicRawVariantTypeU16: return "U16 value: " + number_text(*this);
+        case blackmagicRawVariantTypeS32: return "S32 value: " + number_text(*this);
+        case blackmagicRawVariantTypeU32: return "U32 value: " + number_text(*this);
+        case blackmagicRawVariantTypeFloat32: return "Float32 value: " + number_text(*this);
+        case blackmagicRawVariantTypeFloat64: return "Float64 value: " + number_text(*this);
+        default: return "[Unknown vt=" + std::to_string(vt) + "]";
+    }
+}
+
+// Numeric and string values keep their type, SafeArrays become hex
+static bool attr_value_plain(const AttrValue &v, string &out, bool &isNumber) {
+    isNumber = false;
+    if (!v.available || v.vt == blackmagicRawVariantTypeEmpty) return false;
+    if (v.vt == blackmagicRawVariantTypeString) { out = v.rawValue; return true; }
+    if (v.vt == blackmagicRawVariantTypeSafeArray) {
+        out.clear();
+        append_hex(out, v.rawBytes.data(), v.rawBytes.size(), false);
+        return true;
+    }
+    if (is_numeric_vt(v.vt) && std::isfinite(v.number)) {
+        out = number_text(v);
+        isNumber = true;
+        return true;
+    }
+    out = v.display();
+    return true;
+}
+
+string attr_value_json(const AttrValue &v) {
+    string text;
+    bool isNumber;
+    if (!attr_value_plain(v, text, isNumber)) return "null";
+    return isNumber ? text : json_quote(text);
+}
+
+string attr_value_text(const AttrValue &v) {
+    string text;
+    bool isNumber;
+    return attr_value_plain(v, text, isNumber) ? text : string();
+}
+
+// Extract the attributes in `mask` once and cache them into ImmersiveAttrs
+static bool extract_attributes(ImmersiveClip &clip, AttrMask mask, ImmersiveAttrs &out, Logger &log) {
+    for (AttrMask m = mask; m; m &= m - 1) {
+        const AttrDesc &d = ATTR_TABLE[attr_index(m)];
+        const BlackmagicRawImmersiveAttribute a = d.attr;
+        Variant v;
+        memset(&v, 0, sizeof(v));
+        HRESULT hr;
+        {
+            StageTimer timer(log.track, Stage::GET_ATTRIBUTE, (uint32_t)a);
+            hr = clip.get_attribute(a, v);
+        }
+        // read into the slot in place, so reused attributes keep their buffers
+        AttrValue &av = out.reset(d.slot);
+        if (hr == S_OK) {
+            store_variant(v, av);
+            // the display string is only built when it is going to be printed
+            if (log.verbose && !log.silent) {
+                log.debug(string("Read attribute: ") + d.name + " = " + av.display().substr(0, 120));
+                if (av.vt != d.type) log.debug(string("Unexpected variant type ") + std::to_string(av.vt) + " for " + d.name);
+            }
+        } else {
+            av.vt = v.vt;
+            log.debug(string("Failed to read attribute: ") + d.name);
+        }
+        VariantClear(&v);
+    }
+    return true;
+}
+
+// All frames, or `count` spread evenly from the first to the last
+static vector<uint64_t> sample_frame_indexes(uint64_t frameCount, uint64_t count) {
+    vector<uint64_t> frames;
+    if (count >= frameCount) count = frameCount;
+    frames.reserve((size_t)count);
+    for (uint64_t i = 0; i < count; ++i) {
+        frames.push_back(count == frameCount ? i : count == 1 ? 0 : (uint64_t)((double)i * (frameCount - 1) / (count - 1)));
+    }
+    return frames;
+}
+
+// --sample-frames: read the ATTR_USE_FRAME attributes of the sampled frames, recover a clip-level
+// OpticalInteraxial of 0 from the first frame that has one, and report where frames differ from the clip
+static void sample_frames(ImmersiveClip &clip, uint64_t count, AttrMask mask, ImmersiveAttrs &attrs, FrameReport &report,
+                          Logger &log) {
+    report = FrameReport();
+    report.frameCount = clip.frame_count();
+    if (!report.frameCount) {
+        log.error("Warning: frame count not available, frames not sampled");
+        return;
+    }
+    const vector<uint64_t> frames = sample_frame_indexes(report.frameCount, count);
+    vector<AttrSlot> slots;
+    vector<string> names;
+    for (AttrMask m = mask & attrs_used_for(ATTR_USE_FRAME); m; m &= m - 1) {
+        slots.push_back(attr_index(m));
+        names.push_back(ATTR_TABLE[slots.back()].name);
+    }
+    if (slots.empty()) return;
+
+    // Per sampled frame and slot: 1 + index of the value among the distinct values seen, 0 = not in the frame
+    const size_t width = slots.size();
+    vector<uint32_t> ids(frames.size() * width, 0);
+    vector<uint8_t> read(frames.size(), 0);
+    vector<vector<AttrValue>> distinct(width);
+    vector<vector<string>> texts(width);
+    vector<std::unordered_map<string, uint32_t>> known(width);
+    string err;
+    bool ok;
+    {
+        StageTimer timer(log.track, Stage::SAMPLE_FRAMES);
+        const unsigned inFlight = std::max(4u, 2 * std::thread::hardware_concurrency());
+        ok = clip.read_frames(frames, names, inFlight, [&](uint64_t frame, const Variant* values) {
+            const size_t row = (size_t)(std::lower_bound(frames.begin(), frames.end(), frame) - frames.begin());
+            if (row >= frames.size() || !values) return;
+            read[row] = 1;
+            for (size_t k = 0; k < width; ++k) {
+                if (values[k].vt == blackmagicRawVariantTypeEmpty) continue;
+                AttrValue av;
+                store_variant(values[k], av);
+                string text = attr_value_text(av);
+                auto it = known[k].emplace(text, (uint32_t)distinct[k].size() + 1).first;
+                if (it->second > distinct[k].size()) {
+                    distinct[k].push_back(std::move(av));
+                    texts[k].push_back(std::move(text));
+                }
+                ids[row * width + k] = it->second;
+            }
+        }, err);
+    }
+    if (!ok) {
+        log.error("Warning: frames not sampled: " + err);
+        return;
+    }
+    for (uint8_t r : read) report.sampled += r;
+    report.failed = frames.size() - report.sampled;
+    vector<uint8_t> changed(frames.size(), 0);
+
+    for (size_t k = 0; k < width; ++k) {
+        const AttrSlot slot = slots[k];
+        bool present = false;
+        for (size_t row = 0; row < frames.size() && !present; ++row) present = ids[row * width + k] != 0;
+        if (!present) {
+            // nothing to compare: not a match either
+            if (report.sampled) report.absent |= attr_bit(slot);
+            continue;
+        }
+        report.compared |= attr_bit(slot);
+        // a 0 interaxial means "not recorded" (clip level and frames alike)
+        auto isSet = [&](uint32_t id) { return id && (slot != ATTR_INTERAXIAL || distinct[k][id - 1].number != 0); };
+        if (slot == ATTR_INTERAXIAL) {
+            for (size_t row = 0; row < frames.size() && !report.interaxialFound; ++row) {
+                const uint32_t id = ids[row * width + k];
+                if (!isSet(id)) continue;
+                report.interaxialFound = true;
+                report.interaxialFrame = frames[row];
+                report.interaxial = distinct[k][id - 1].number;
+                const AttrValue* clipLevel = attrs.get(ATTR_INTERAXIAL);
+                if (!clipLevel || !clipLevel->available || clipLevel->number == 0) {
+                    attrs.set(ATTR_INTERAXIAL, distinct[k][id - 1]);
+                    report.interaxialRecovered = true;
+                }
+            }
+        }
+        const AttrValue* ref = attrs.get(slot);
+        const string reference = ref && ref->available ? attr_value_text(*ref) : string();
+        uint32_t runId = 0;     // value of the open run, 0 = none
+        for (size_t row = 0; row < frames.size(); ++row) {
+            if (!read[row]) continue;
+            const uint32_t id = ids[row * width + k];
+            if (!isSet(id) || texts[k][id - 1] == reference) {
+                runId = 0;
+                continue;
+            }
+            changed[row] = 1;
+            if (runId == id) {
+                report.changes.back().last = frames[row];
+                ++report.changes.back().frames;
+                continue;
+            }
+            FrameChange c;
+            c.slot = slot;
+            c.first = c.last = frames[row];
+            c.frames = 1;
+            c.value = texts[k][id - 1];
+            report.changes.push_back(std::move(c));
+            runId = id;
+        }
+    }
+    for (uint8_t c : changed) report.changedFrames += c;
+}
+
+static void log_frame_report(const FrameReport &r, const ImmersiveAttrs &attrs, Logger &log) {
+    if (!r.frameCount || (!r.sampled && !r.failed)) return;
+    log.info("Sampled " + std::to_string(r.sampled) + " of " + std::to_string(r.frameCount) + " frames" +
+             (r.failed ? " (" + std::to_string(r.failed) + " could not be read)" : string()));
+    if (r.interaxialRecovered) {
+        log.info("OpticalInteraxial is 0 at clip level, using " + attr_value_text(*attrs.get(ATTR_INTERAXIAL)) + " from frame " +
+                 std::to_string(r.interaxialFrame));
+    } else if (r.interaxialFound) {
+        log.debug("First non-zero OpticalInteraxial in the frames: frame " + std::to_string(r.interaxialFrame));
+    }
+    const size_t MAX_LINES = 20;
+    for (size_t i = 0; i < r.changes.size() && i < MAX_LINES; ++i) {
+        const FrameChange &c = r.changes[i];
+        const AttrValue* ref = attrs.get(c.slot);
+        string frames = c.first == c.last ? "frame " + std::to_string(c.first)
+                                          : "frames " + std::to_string(c.first) + "-" + std::to_string(c.last) + " (" +
+                                                std::to_string(c.frames) + " sampled)";
+        log.error(string("Warning: ") + ATTR_TABLE[c.slot].name + " is " + c.value + " at " + frames + ", clip level " +
+                  (ref && ref->available ? attr_value_text(*ref) : string("not set")));
+    }
+    if (r.changes.size() > MAX_LINES) log.error("Warning: ... " + std::to_string(r.changes.size() - MAX_LINES) + " more changes");
+    if (r.absent) {
+        string names;
+        for (AttrMask m = r.absent; m; m &= m - 1) names += string(names.empty() ? "" : ", ") + ATTR_TABLE[attr_index(m)].name;
+        log.error("Warning: not present in the frame metadata, not compared: " + names);
+    }
+    if (r.changedFrames) log.error("Warning: " + std::to_string(r.changedFrames) + " sampled frames differ from the clip-level values");
+    else if (r.compared) log.debug("Sampled frames match the clip-level values");
+}
+
+#ifdef _WIN32
+// The file index stands in for the inode, the last write time (100 ns ticks) for the mtime
+bool stat_file_key(const string &path, FileKey &key) {
+    HANDLE h = CreateFileA(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                           FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    BY_HANDLE_FILE_INFORMATION info;
+    const bool ok = GetFileInformationByHandle(h, &info) != 0;
+    CloseHandle(h);
+    if (!ok) return false;
+    key.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    key.mtimeNs = (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime) * 100;
+    key.inode = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    return true;
+}
+#else
+bool stat_file_key(const string &path, FileKey &key) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    key.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    key.mtimeNs = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    key.mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    key.inode = (uint64_t)st.st_ino;
+    return true;
+}
+#endif
+
+string json_quote(const string &s) {
+    static const char HEX[] = "0123456789abcdef";
+    string out;
+    out.reserve(s.size() + 2);
+    out += '"';
+    for (unsigned char ch : s) {
+        switch (ch) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (ch < 0x20) {
+                    out += "\\u00";
+                    out += HEX[ch >> 4];
+                    out += HEX[ch & 0xF];
+                } else {
+                    out += (char)ch;
+                }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+bool is_remote_input(const string &input) {
+    return input.compare(0, 5, "s3://") == 0 || input.compare(0, 8, "https://") == 0 || input.compare(0, 7, "http://") == 0;
+}
+
+std::filesystem::path input_name_path(const string &input) {
+    if (!is_remote_input(input)) return std::filesystem::path(input);
+    string p = input.substr(input.find("://") + 3);
+    size_t q = p.find_first_of("?#");
+    if (q != string::npos) p.resize(q);
+    return std::filesystem::path(p);
+}
+
+// Make auto ilpd name cameraID.uuid.ilpd (fallbacks)
+void split_ilpd_file_name(std::string_view fileName, string &camera, string &uuid) {
+    camera.clear();
+    uuid.clear();
+    if (fileName.empty()) return;
+    string stem = std::filesystem::path(fileName).stem().string();
+    size_t posDot = stem.find_last_of('.');
+    if (posDot != string::npos) {
+        camera = stem.substr(0, posDot);
+        uuid = stem.substr(posDot + 1);
+    } else {
+        camera = stem;
+    }
+}
+
+string make_auto_ilpd_name(const string &inputBraw, const ImmersiveAttrs &attrs) {
+    string cameraPart;
+    string uuidPart;
+    
+    // Get camera and uuid from ILPD filename
+    split_ilpd_file_name(attrs.text(ATTR_ILPD_FILE_NAME), cameraPart, uuidPart);
+    
+    // Get UUID from separate attribute if not found above
+    if (uuidPart.empty()) {
+        uuidPart = string(attrs.text(ATTR_UUID));
+    }
+    
+    // Fallbacks
+    if (cameraPart.empty()) {
+        cameraPart = input_name_path(inputBraw).stem().string();
+    }
+    if (uuidPart.empty()) uuidPart = "default";
+    
+    return cameraPart + "." + uuidPart + ".ilpd";
+}
+
+// Helper to create detailed attribute file path based on main ILPD path
+string make_detailed_attributes_path(const string &ilpdPath) {
+    std::filesystem::path finalPath(ilpdPath);
+    std::filesystem::path detailed = finalPath.parent_path() / (finalPath.stem().string() + "_detailed_attributes.txt");
+    
+    // Keep the same relative/absolute style as the main output file
+    if (finalPath.is_absolute()) {
+        return std::filesystem::absolute(detailed).string();
+    } else {
+        return detailed.string();
+    }
+}
+
+bool DirWalker::enter(const std::filesystem::path &dir, std::error_code &ec) {
+    std::filesystem::directory_iterator it(dir, std::filesystem::directory_options::skip_permission_denied, ec);
+    if (ec) return false;
+    if (it != std::filesystem::directory_iterator()) stack_.push_back(Level{dir, std::move(it)});
+    return true;
+}
+
+bool DirWalker::open(std::error_code &ec) {
+    stack_.clear();
+    returned_ = descend_ = false;
+    return enter(root_, ec);
+}
+
+// recursive_directory_iterator ends the whole walk on the first error (libstdc++ and libc++ reset it
+// to the end iterator), so the levels are kept here and an error only drops the level it came from
+bool DirWalker::next(std::filesystem::directory_entry &entry, const SkipFn &skipped) {
+    for (;;) {
+        if (returned_) {
+            returned_ = false;
+            Level &top = stack_.back();
+            std::filesystem::path sub;
+            if (descend_) sub = top.it->path();
+            std::error_code ec;
+            top.it.increment(ec);
+            if (ec) {
+                skipped(top.dir.string(), ec);
+                stack_.pop_back();
+            } else if (top.it == std::filesystem::directory_iterator()) {
+                stack_.pop_back();
+            }
+            if (!sub.empty() && !enter(sub, ec)) skipped(sub.string(), ec);
+        }
+        if (stack_.empty()) return false;
+        const std::filesystem::directory_entry &e = *stack_.back().it;
+        const string name = e.path().filename().string();
+        returned_ = true;
+        descend_ = false;
+        if (!name.empty() && name[0] == '.') continue;
+        std::error_code ec;
+        descend_ = e.is_directory(ec) && !e.is_symlink(ec);
+        entry = e;
+        return true;
+    }
+}
+
+// Generate detailed attributes content
+bool write_detailed_attributes(const string &ilpdPath, const string &inputBraw, const ImmersiveAttrs &cached, Logger &log,
+                               AtomicWriter* writer) {
+    string detailedPath = make_detailed_attributes_path(ilpdPath);
+    
+    ostringstream content;
+    content << "Complete Blackmagic RAW Immersive Video Attribute List (Detailed)\n";
+    content << string(62, '=') << "\n\n";
+    content << "Input file: " << inputBraw << "\n";
+    content << "ILPD file: " << ilpdPath << "\n";
+    content << "Generated on: " << __DATE__ << " " << __TIME__ << "\n\n";
+
+    for (size_t i = 0; i < ATTR_COUNT; ++i) {
+        const AttrDesc &d = ATTR_TABLE[i];
+        content << "[" << (i+1) << "] " << d.name << "\n";
+        content << "Description: " << d.desc << "\n";
+        const AttrValue* av = cached.get(d.slot);
+        if (!av) {
+            content << "Not retrieved.\n\n";
+            continue;
+        }
+        content << av->display() << "\n\n";
+    }
+
+    string outStr = content.str();
+    string err;
+    if (!(writer ? writer->write(detailedPath, outStr, err, log.track) : write_text_file_atomic(detailedPath, outStr, err))) {
+        log.error(string("Failed to write detailed attributes file: ") + err);
+        return false;
+    } else {
+        log.info(string("Detailed attributes saved to: ") + detailedPath);
+        return true;
+    }
+}
+
+string make_aime_path(const string &ilpdPath) {
+    std::filesystem::path p(ilpdPath);
+    if (p.extension() == ".ilpd") p.replace_extension(".aime");
+    else p += ".aime";
+    return p.string();
+}
+
+bool make_aime(const ImmersiveAttrs &attrs, string &out, string &err) {
+    if (!attrs.hasProjectionData()) {
+        err = "no OpticalProjectionData";
+        return false;
+    }
+    JsonValue profile;
+    if (!JsonParser(attrs.get(ATTR_PROJECTION_DATA)->rawValue).parse(profile, err)) {
+        err = "OpticalProjectionData is not JSON: " + err;
+        return false;
+    }
+    if (profile.type != JsonValue::OBJECT) {
+        err = "OpticalProjectionData is not a JSON object";
+        return false;
+    }
+    auto field = [&](AttrSlot s) {
+        const AttrValue* v = attrs.get(s);
+        return json_quote(ATTR_TABLE[s].name) + ": " + (v ? attr_value_json(*v) : string("null"));
+    };
+    out.clear();
+    out.reserve(profile.raw.size() + 512);
+    out += "{\n  \"aimeVersion\": 1,\n  \"generator\": \"braw2ilpd\",\n";
+    out += "  " + field(ATTR_UUID) + ",\n";
+    out += "  " + field(ATTR_INTERAXIAL) + ",\n";
+    out += "  " + field(ATTR_PROJECTION_KIND) + ",\n";
+    out += "  " + field(ATTR_CALIBRATION_TYPE) + ",\n";
+    out += "  \"OpticalProjectionData\": ";
+    out += profile.raw;
+    out += "\n}\n";
+    return true;
+}
+
+// Resource cleanup helpers
+static void cleanup_resources(IBlackmagicRawClipImmersiveVideo* immersive, IBlackmagicRawClip* clip, 
+                             IBlackmagicRaw* codec, IBlackmagicRawFactory* factory) {
+    if (immersive) immersive->Release();
+    if (clip) clip->Release();
+    if (codec) codec->Release();
+    if (factory) factory->Release();
+}
+static void cleanup_clip(IBlackmagicRawClipImmersiveVideo* immersive, IBlackmagicRawClip* clip) {
+    cleanup_resources(immersive, clip, nullptr, nullptr);
+}
+
+// Resolve output path according to rules, preserving relative/absolute path style
+string resolve_output_path(const string &outputArg, const string &autoName, Logger &log) {
+    std::filesystem::path result;
+    bool shouldBeAbsolute = false;
+    
+    if (outputArg.empty()) {
+        // Default case: relative path in current directory
+        result = autoName;
+        shouldBeAbsolute = false;
+    }
+    else if (outputArg == ".") {
+        result = autoName;
+        shouldBeAbsolute = false;
+    }
+    else {
+        // Check if user provided absolute or relative path
+        std::filesystem::path userPath(outputArg);
+        shouldBeAbsolute = userPath.is_absolute();
+        
+        if (std::filesystem::exists(outputArg)) {
+            if (std::filesystem::is_directory(outputArg)) {
+                result = userPath / autoName;
+            } else {
+                result = userPath; // overwrite existing file
+            }
+        } else {
+            string ext = userPath.extension().string();
+            if (ext.empty() || ext == ".") {
+                // No extension, treat as directory
+                try {
+                    std::filesystem::create_directories(userPath);
+                    result = userPath / autoName;
+                } catch (const std::filesystem::filesystem_error& e) {
+                    log.error("Failed to create directory: " + outputArg);
+                    return string();
+                }
+            } else {
+                // Has extension, treat as file
+                if (ext != ".ilpd") {
+                    log.info("Note: Output file does not have .ilpd extension. ILPD files typically use .ilpd extension.");
+                }
+                if (userPath.has_parent_path()) {
+                    try {
+                        std::filesystem::create_directories(userPath.parent_path());
+                    } catch (const std::filesystem::filesystem_error& e) {
+                        log.error("Failed to create parent directories for: " + userPath.parent_path().string());
+                        return string();
+                    }
+                }
+                result = userPath;
+            }
+        }
+    }
+    
+    // Return path in the same style as user input
+    if (shouldBeAbsolute) {
+        try {
+            return std::filesystem::absolute(result).string();
+        } catch (const std::filesystem::filesystem_error& e) {
+            log.error("Failed to resolve absolute path: " + string(e.what()));
+            return result.string();
+        }
+    } else {
+        return result.string();
+    }
+}
+
+// XXH64 (little-endian reads)
+static inline uint64_t xxh64_rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+static inline uint64_t xxh64_read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t xxh64_read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+uint64_t hash64(const void* data, size_t len, uint64_t seed) {
+    const uint64_t P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL, P3 = 0x165667B19E3779F9ULL,
+                   P4 = 0x85EBCA77C2B2AE63ULL, P5 = 0x27D4EB2F165667C5ULL;
+    auto round = [&](uint64_t acc, uint64_t input) { return xxh64_rotl(acc + input * P2, 31) * P1; };
+    auto merge = [&](uint64_t acc, uint64_t val) { return (acc ^ round(0, val)) * P1 + P4; };
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, xxh64_read64(p));
+            v2 = round(v2, xxh64_read64(p + 8));
+            v3 = round(v3, xxh64_read64(p + 16));
+            v4 = round(v4, xxh64_read64(p + 24));
+        }
+        h = xxh64_rotl(v1, 1) + xxh64_rotl(v2, 7) + xxh64_rotl(v3, 12) + xxh64_rotl(v4, 18);
+        h = merge(h, v1); h = merge(h, v2); h = merge(h, v3); h = merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += (uint64_t)len;
+    for (; p + 8 <= end; p += 8) h = xxh64_rotl(h ^ round(0, xxh64_read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) { h = xxh64_rotl(h ^ ((uint64_t)xxh64_read32(p) * P1), 23) * P2 + P3; p += 4; }
+    for (; p < end; ++p) h = xxh64_rotl(h ^ ((uint64_t)(*p) * P5), 11) * P1;
+    h ^= h >> 33; h *= P2; h ^= h >> 29; h *= P3; h ^= h >> 32;
+    return h;
+}
+
+string hash_to_hex(uint64_t h) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return string(buf);
+}
+
+// Numbers compare by value, so float32/float64 agree
+static bool attr_values_match(const AttrValue &a, const AttrValue &b) {
+    if (a.vt == blackmagicRawVariantTypeString || b.vt == blackmagicRawVariantTypeString) return a.rawValue == b.rawValue;
+    if (!is_numeric_vt(a.vt) || !is_numeric_vt(b.vt)) return a.display() == b.display();
+    double da = a.number, db = b.number;
+    return std::fabs(da - db) <= 1e-6 * std::max(1.0, std::max(std::fabs(da), std::fabs(db)));
+}
+
+// --verify: every attribute the SDK returned must have been found in the container with the same value
+static bool verify_container_attrs(const ImmersiveAttrs &fast, const ImmersiveAttrs &sdk, Logger &log) {
+    bool ok = true;
+    for (size_t i = 0; i < ATTR_COUNT; ++i) {
+        const AttrDesc &d = ATTR_TABLE[i];
+        const AttrValue* s = sdk.get(d.slot);
+        if (!s || s->vt == blackmagicRawVariantTypeEmpty) continue;
+        const AttrValue* f = fast.get(d.slot);
+        if (!f) {
+            log.error(string("Verify: ") + d.name + " missing from container metadata");
+            ok = false;
+        } else if (!attr_values_match(*f, *s)) {
+            log.error(string("Verify: ") + d.name + " differs (container: " + f->display().substr(0, 80) +
+                      ", SDK: " + s->display().substr(0, 80) + ")");
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Attribute name or metadata key without case and separators (OpticalInteraxial == optical_interaxial)
+static string metadata_key_match(const string &s) {
+    string out;
+    for (char c : s) {
+        if (isalnum((unsigned char)c)) out += (char)tolower((unsigned char)c);
+    }
+    return out;
+}
+
+// Codec callback of --sample-frames: ReadComplete hands each frame's metadata to the caller and
+// releases the job; the other callbacks are never triggered since nothing is decoded.
+// The SDK's keys for the wanted names are looked up once, walking the metadata of the first frame read.
+class FrameReadCallback : public IBlackmagicRawCallback {
+public:
+    FrameReadCallback(const vector<string> &names, const std::function<void(uint64_t, const Variant*)> &done)
+        : names_(names), keys_(names.size(), nullptr), resolved_(false), done_(done), queued_(0) {}
+    ~FrameReadCallback() {
+        for (SdkString k : keys_) {
+            if (k) sdk_string_release(k);
+        }
+    }
+
+    void ReadComplete(IBlackmagicRawJob* job, HRESULT result, IBlackmagicRawFrame* frame) override {
+        void* userData = nullptr;
+        job->GetUserData(&userData);
+        const uint64_t index = (uint64_t)(uintptr_t)userData;
+        vector<Variant> values(keys_.size());
+        for (Variant &v : values) memset(&v, 0, sizeof(v));
+        if (result == S_OK && frame) {
+            if (!resolved()) resolve(frame);
+            for (size_t k = 0; k < keys_.size(); ++k) {
+                if (keys_[k] && frame->GetMetadata(keys_[k], &values[k]) != S_OK) VariantClear(&values[k]);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(doneMutex_);
+            done_(index, result == S_OK && frame ? values.data() : nullptr);
+        }
+        for (Variant &v : values) VariantClear(&v);
+        job->Release();
+        finished();
+    }
+    void DecodeComplete(IBlackmagicRawJob*, HRESULT) override {}
+    void ProcessComplete(IBlackmagicRawJob*, HRESULT, IBlackmagicRawProcessedImage*) override {}
+    void TrimProgress(IBlackmagicRawJob*, float) override {}
+    void TrimComplete(IBlackmagicRawJob*, HRESULT) override {}
+    void SidecarMetadataParseWarning(IBlackmagicRawClip*, SdkString, uint32_t, SdkString) override {}
+    void SidecarMetadataParseError(IBlackmagicRawClip*, SdkString, uint32_t, SdkString) override {}
+    void PreparePipelineComplete(void*, HRESULT) override {}
+    HRESULT QueryInterface(REFIID, LPVOID*) override { return E_NOINTERFACE; }
+    ULONG AddRef() override { return 1; }     // owned by SdkClip::read_frames, which outlives its jobs
+    ULONG Release() override { return 1; }
+
+    // Until the keys are known, one job at a time: only the first frame read walks its metadata
+    bool resolved() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return resolved_;
+    }
+    // Called before a job is submitted; blocks while `limit` jobs are queued
+    void queue(unsigned limit) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [&] { return queued_ < limit; });
+        ++queued_;
+    }
+    // A job that completed, or failed to submit
+    void finished() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --queued_;
+        changed_.notify_all();
+    }
+    void wait_all() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [&] { return queued_ == 0; });
+    }
+    // Frame that could not be queued at all
+    void failed(uint64_t index) {
+        std::lock_guard<std::mutex> lock(doneMutex_);
+        done_(index, nullptr);
+    }
+
+private:
+    // Keys not in this frame are not in the clip's frame metadata; a frame that cannot list its
+    // metadata leaves them all unknown (empty values), which sample_frames reports as absent
+    void resolve(IBlackmagicRawFrame* frame) {
+        IBlackmagicRawMetadataIterator* it = nullptr;
+        if (frame->GetMetadataIterator(&it) == S_OK && it) {
+            vector<string> wanted;
+            for (const string &n : names_) wanted.push_back(metadata_key_match(n));
+            SdkString key = nullptr;
+            string k;
+            for (; it->GetKey(&key) == S_OK && key; it->Next()) {
+                sdk_string_to_utf8(key, k);
+                const string m = metadata_key_match(k);
+                for (size_t i = 0; i < wanted.size(); ++i) {
+                    if (!keys_[i] && wanted[i] == m) keys_[i] = sdk_string_create(k);
+                }
+                key = nullptr;
+            }
+            it->Release();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        resolved_ = true;
+    }
+
+    const vector<string> &names_;
+    vector<SdkString> keys_;        // SDK key per name, null if the frames do not have it
+    bool resolved_;
+    const std::function<void(uint64_t, const Variant*)> &done_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    unsigned queued_;
+    std::mutex doneMutex_;
+};
+
+// An open SDK clip and its immersive interface
+class SdkClip : public ImmersiveClip {
+public:
+    SdkClip(IBlackmagicRaw* codec, IBlackmagicRawClip* clip, IBlackmagicRawClipImmersiveVideo* immersive)
+        : codec_(codec), clip_(clip), immersive_(immersive) {}
+    ~SdkClip() override { cleanup_clip(immersive_, clip_); }
+    HRESULT get_attribute(BlackmagicRawImmersiveAttribute a, Variant &v) override {
+        return immersive_->GetImmersiveAttribute(a, &v);
+    }
+    uint64_t frame_count() override {
+        uint64_t n = 0;
+        return clip_->GetFrameCount(&n) == S_OK ? n : 0;
+    }
+    // The codec runs the read jobs on its own worker threads; its callback is set for the length of the call
+    bool read_frames(const vector<uint64_t> &frames, const vector<string> &names, unsigned inFlight,
+                     const std::function<void(uint64_t, const Variant*)> &done, string &err) override {
+        bool ok = true;
+        FrameReadCallback callback(names, done);
+        if (codec_->SetCallback(&callback) != S_OK) {
+            err = "SetCallback failed";
+            ok = false;
+        }
+        for (size_t i = 0; ok && i < frames.size(); ++i) {
+            IBlackmagicRawJob* job = nullptr;
+            if (clip_->CreateJobReadFrame(frames[i], &job) != S_OK || !job) {
+                callback.failed(frames[i]);
+                continue;
+            }
+            job->SetUserData((void*)(uintptr_t)frames[i]);
+            callback.queue(callback.resolved() ? std::max(1u, inFlight) : 1);
+            if (job->Submit() != S_OK) {
+                job->Release();
+                callback.finished();
+                callback.failed(frames[i]);
+            }
+        }
+        if (ok) {
+            callback.wait_all();
+            codec_->FlushJobs();
+            codec_->SetCallback(nullptr);
+        }
+        return ok;
+    }
+private:
+    IBlackmagicRaw* codec_;
+    IBlackmagicRawClip* clip_;
+    IBlackmagicRawClipImmersiveVideo* immersive_;
+};
+
+class SdkCodec : public ClipCodec {
+public:
+    explicit SdkCodec(IBlackmagicRaw* codec): codec_(codec) {}
+    ~SdkCodec() override { if (codec_) codec_->Release(); }
+
+    // Open a clip through the SDK and query its immersive interface
+    ExitCode open_clip(const string &inputBraw, std::unique_ptr<ImmersiveClip> &out, const Logger &log) override {
+        ScopedSdkString inputPath(inputBraw);
+        if (!inputPath.get()) { 
+            log.error("Failed to create SDK string for input path"); 
+            return OPENCLIP_FAIL; 
+        }
+        IBlackmagicRawClip* clip = nullptr;
+        HRESULT hrOpen = codec_->OpenClip(inputPath.get(), &clip);
+        if (hrOpen != S_OK || !clip) { 
+            log.error("Failed to open clip: " + inputBraw); 
+            if (hrOpen == E_INVALIDARG) {
+                log.error("This may indicate the file is corrupted or not a valid Blackmagic RAW file.");
+            } else if (hrOpen == E_ACCESSDENIED) {
+                log.error("Access denied. Check file permissions.");
+            }
+            cleanup_clip(nullptr, clip);
+            return OPENCLIP_FAIL; 
+        }
+
+        // Query immersive interface
+        IBlackmagicRawClipImmersiveVideo* immersive = nullptr;
+        HRESULT hrImmersive;
+        {
+            StageTimer timer(log.track, Stage::QUERY_INTERFACE);
+            hrImmersive = clip->QueryInterface(IID_IBlackmagicRawClipImmersiveVideo, (void**)&immersive);
+        }
+        if (hrImmersive != S_OK || !immersive) {
+            log.error("This clip does not support immersive video features.");
+            log.error("This tool only works with Blackmagic RAW files from URSA Cine Immersive cameras.");
+            log.error("Please ensure the input file is an immersive video recording.");
+            cleanup_clip(immersive, clip);
+            return IMMERSIVE_NOT_SUPPORTED;
+        }
+        out.reset(new SdkClip(codec_, clip, immersive));
+        return OK;
+    }
+private:
+    IBlackmagicRaw* codec_;
+};
+
+// macOS links the framework; the Linux SDK loads libBlackmagicRawAPI.so from a directory
+// (BRAW_SDK_LIBRARY_PATH, else next to the executable, where the build copies it); Windows uses the
+// COM server the SDK installer registers. The calling thread joins the multithreaded apartment (unless
+// the host already put it in one), so the worker threads using the factory and its codecs are in it too.
+static IBlackmagicRawFactory* create_sdk_factory() {
+#if defined(__APPLE__)
+    return CreateBlackmagicRawFactoryInstance();
+#elif defined(_WIN32)
+    const HRESULT init = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(init) && init != RPC_E_CHANGED_MODE) return nullptr;
+    IBlackmagicRawFactory* factory = nullptr;
+    if (CoCreateInstance(CLSID_CBlackmagicRawFactory, nullptr, CLSCTX_ALL, IID_IBlackmagicRawFactory, (void**)&factory) != S_OK)
+        return nullptr;
+    return factory;
+#else
+    string dir;
+    if (const char* env = getenv("BRAW_SDK_LIBRARY_PATH")) dir = env;
+    if (dir.empty()) {
+        std::error_code ec;
+        std::filesystem::path exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+        if (!ec) dir = exe.parent_path().string();
+    }
+    IBlackmagicRawFactory* factory = dir.empty() ? nullptr : CreateBlackmagicRawFactoryInstanceFromPath(dir.c_str());
+    return factory ? factory : CreateBlackmagicRawFactoryInstance();
+#endif
+}
+
+// The SDK factory, created on first use and shared by every codec of an Extractor and its forks
+class SdkBackend : public ClipBackend {
+public:
+    SdkBackend(): factory_(nullptr), attempted_(false) {}
+    ~SdkBackend() override { if (factory_) factory_->Release(); }
+    IBlackmagicRawFactory* factory(const Logger &log) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!attempted_) {
+            attempted_ = true;
+            StageTimer timer(log.track, Stage::FACTORY);
+            factory_ = create_sdk_factory();
+            if (!factory_) log.error("Failed to create BlackmagicRawFactory. Please ensure Blackmagic RAW SDK is properly installed.");
+        }
+        return factory_;
+    }
+    // Codecs are created under the same lock, one per worker
+    ExitCode create_codec(std::unique_ptr<ClipCodec> &out, const Logger &log) override {
+        IBlackmagicRawFactory* f = factory(log);
+        if (!f) return FACTORY_FAIL;
+        std::lock_guard<std::mutex> lock(mutex_);
+        IBlackmagicRaw* codec = nullptr;
+        if (f->CreateCodec(&codec) != S_OK || !codec) {
+            log.error("Failed to create codec");
+            if (codec) codec->Release();
+            return CODEC_FAIL;
+        }
+        out.reset(new SdkCodec(codec));
+        return OK;
+    }
+private:
+    std::mutex mutex_;
+    IBlackmagicRawFactory* factory_;
+    bool attempted_;
+};
+
+// A worker's codec, created on the first clip that needs the SDK (or its stand-in)
+class LazyCodec {
+public:
+    explicit LazyCodec(ClipBackend &backend): backend_(&backend), status_(OK), attempted_(false) {}
+    ExitCode get(ClipCodec* &codec, const Logger &log) {
+        if (!attempted_) {
+            attempted_ = true;
+            StageTimer timer(log.track, Stage::CODEC);
+            status_ = backend_->create_codec(codec_, log);
+        }
+        codec = codec_.get();
+        return status_;
+    }
+private:
+    ClipBackend* backend_;
+    std::unique_ptr<ClipCodec> codec_;
+    ExitCode status_;
+    bool attempted_;
+};
+
+// Open a clip through the backend and read the immersive attributes in `mask`; `keepOpen` receives the clip
+static ExitCode read_attrs_sdk(ClipCodec &codec, const string &inputBraw, AttrMask mask, ImmersiveAttrs &cached, Logger &log,
+                               std::unique_ptr<ImmersiveClip>* keepOpen = nullptr) {
+    std::unique_ptr<ImmersiveClip> clip;
+    ExitCode rc;
+    {
+        StageTimer timer(log.track, Stage::OPEN_CLIP);
+        rc = codec.open_clip(inputBraw, clip, log);
+    }
+    if (rc != OK) return rc;
+
+    extract_attributes(*clip, mask, cached, log);
+    if (keepOpen) *keepOpen = std::move(clip);
+    return OK;
+}
+
+struct Extractor::Impl {
+    ExtractOptions options;
+    std::shared_ptr<ClipBackend> sdk;
+    LazyCodec codec;
+    Impl(const ExtractOptions &o, std::shared_ptr<ClipBackend> s): options(o), sdk(std::move(s)), codec(*sdk) {}
+};
+
+static void global_init() {
+#ifdef BRAW2ILPD_HAVE_CURL
+    static std::once_flag once;
+    std::call_once(once, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+#endif
+}
+
+Extractor::Extractor(const ExtractOptions &options)
+    : impl_(new Impl(options, options.backend ? options.backend : std::make_shared<SdkBackend>())) {
+    global_init();
+}
+Extractor::Extractor(std::unique_ptr<Impl> impl): impl_(std::move(impl)) {}
+Extractor::~Extractor() = default;
+Extractor::Extractor(Extractor &&) noexcept = default;
+Extractor& Extractor::operator=(Extractor &&) noexcept = default;
+
+ExitCode Extractor::open(const Logger &log) {
+    ClipCodec* codec = nullptr;
+    return impl_->codec.get(codec, log);
+}
+
+Extractor Extractor::fork() const {
+    return Extractor(std::unique_ptr<Impl>(new Impl(impl_->options, impl_->sdk)));
+}
+
+const ExtractOptions &Extractor::options() const { return impl_->options; }
+
+ExtractResult Extractor::extract(const string &input) {
+    ExtractResult result;
+    result.input = input;
+    Logger log;
+    log.sink = &result.log;
+    result.status = extract(input, result.attrs, log, &result.fromContainer, &result.frames);
+    return result;
+}
+
+ExitCode Extractor::extract(const string &inputBraw, ImmersiveAttrs &cached, const Logger &log, bool* fromContainerOut,
+                            FrameReport* framesOut) {
+    const ExtractOptions &opts = impl_->options;
+    const bool remote = is_remote_input(inputBraw);
+    cached.clear();
+
+    // Check if input file exists
+    if (!remote && !std::filesystem::exists(inputBraw)) {
+        log.error("Input file does not exist: " + inputBraw);
+        return FILE_NOT_FOUND;
+    }
+
+    // Check if input file has .braw extension
+    std::filesystem::path inputPath = input_name_path(inputBraw);
+    if (inputPath.extension() != ".braw") {
+        log.error("Input file does not have .braw extension: " + inputBraw);
+        return INVALID_FILE_FORMAT;
+    }
+
+    Logger sdkLog = log;
+    bool fromContainer = false;
+    if (remote) {
+        string why;
+        bool read;
+        {
+            StageTimer timer(log.track, Stage::REMOTE);
+            read = read_attrs_remote(inputBraw, cached, why, sdkLog, opts.attrs);
+        }
+        if (!read) {
+            log.error("Failed to read remote clip: " + inputBraw + " (" + why + ")");
+            return OPENCLIP_FAIL;
+        }
+        if (opts.verify) log.info("Note: --verify needs the SDK and is skipped for remote inputs");
+        if (opts.sampleFrames) log.info("Note: --sample-frames needs the SDK and is skipped for remote inputs");
+    } else if (opts.fast) {
+        string why;
+        {
+            StageTimer timer(log.track, Stage::CONTAINER);
+            fromContainer = read_attrs_container(inputBraw, cached, why, opts.attrs);
+        }
+        if (fromContainer) log.debug("Read immersive metadata from container");
+        else log.debug("Container fast path not available (" + why + "), using the SDK");
+    }
+    // --sample-frames also opens container-read clips through the SDK, without reading the attributes again
+    const bool sample = !remote && opts.sampleFrames && (opts.attrs & attrs_used_for(ATTR_USE_FRAME));
+    std::unique_ptr<ImmersiveClip> sdkClip;
+    if (!remote && (!fromContainer || opts.verify || sample)) {
+        const bool readAttrs = !fromContainer || opts.verify;
+        ClipCodec* sdkCodec = nullptr;
+        ExitCode rc = impl_->codec.get(sdkCodec, log);
+        // straight into `cached` unless the container's values are kept for the comparison
+        ImmersiveAttrs verifyAttrs;
+        ImmersiveAttrs &sdkAttrs = fromContainer ? verifyAttrs : cached;
+        if (!fromContainer) cached.clear();    // whatever a failed container read left
+        if (rc == OK) rc = read_attrs_sdk(*sdkCodec, inputBraw, readAttrs ? opts.attrs : 0, sdkAttrs, sdkLog, sample ? &sdkClip : nullptr);
+        if (rc != OK && readAttrs) return rc;
+        // the attributes came from the container: a clip the SDK cannot open is just not sampled
+        if (rc != OK) log.error("Warning: frames not sampled, the SDK could not open " + inputBraw);
+        if (readAttrs) {
+            if (fromContainer) {
+                if (!verify_container_attrs(cached, verifyAttrs, sdkLog)) return VERIFY_MISMATCH;
+                log.debug("Verify: container metadata matches the SDK");
+                cached = std::move(verifyAttrs);
+            }
+            fromContainer = false;
+        }
+    }
+    if (sdkClip) {
+        FrameReport report;
+        FrameReport &frames = framesOut ? *framesOut : report;
+        sample_frames(*sdkClip, opts.sampleFrames, opts.attrs, cached, frames, sdkLog);
+        log_frame_report(frames, cached, sdkLog);
+    }
+    if (fromContainerOut) *fromContainerOut = fromContainer;
+    return OK;
+}
+
+void Extractor::extractMany(const vector<string> &inputs, const std::function<void(size_t, ExtractResult &&)> &callback,
+                            unsigned jobs) {
+    if (jobs == 0) jobs = 1;
+    if (jobs > inputs.size()) jobs = (unsigned)std::max<size_t>(1, inputs.size());
+    vector<Extractor> workers;
+    workers.push_back(fork());
+    for (unsigned w = 1; w < jobs; ++w) workers.push_back(fork());
+
+    std::atomic<size_t> nextJob(0);
+    std::mutex mutex;
+    map<size_t, ExtractResult> pending;
+    size_t nextReport = 0;
+    auto work = [&](Extractor &ex) {
+        for (size_t i = nextJob++; i < inputs.size(); i = nextJob++) {
+            ExtractResult r = ex.extract(inputs[i]);
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.emplace(i, std::move(r));
+            for (auto it = pending.find(nextReport); it != pending.end(); it = pending.find(nextReport)) {
+                callback(nextReport, std::move(it->second));
+                pending.erase(it);
+                ++nextReport;
+            }
+        }
+    };
+    vector<std::thread> threads;
+    for (unsigned w = 1; w < jobs; ++w) threads.emplace_back(work, std::ref(workers[w]));
+    work(workers[0]);
+    for (std::thread &t : threads) t.join();
+}
+
+} // namespace ilpd
@@ -0,0 +1,480 @@
+// ilpdextract.h
+// - Library API behind braw2ilpd: read the immersive attributes of a .braw (SDK, container
+//   fast path or remote byte ranges) into memory, no filesystem writes unless asked
+// - Extractor owns the SDK factory and a codec; fork() gives each thread its own codec
+// - ClipBackend abstracts the SDK calls (OpenClip, GetImmersiveAttribute) for stand-ins like the bench mock
+// - Output helpers (naming, atomic write, detailed attributes, AIME) are separate, opt-in calls
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <mutex>
+#include <set>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "BlackmagicRawAPI.h"
+#include "sdk_string.h"
+#include "stage_stats.h"
+#include "file_io.h"
+
+namespace ilpd {
+
+using std::string;
+using std::vector;
+using std::map;
+
+// Exit codes
+enum ExitCode {
+    OK = 0,
+    USAGE = 1,
+    FACTORY_FAIL = 2,
+    CODEC_FAIL = 3,
+    OPENCLIP_FAIL = 4,
+    IMMERSIVE_NOT_SUPPORTED = 5,
+    FILE_NOT_FOUND = 6,
+    WRITE_FAIL = 7,
+    INVALID_FILE_FORMAT = 8,
+    BATCH_FAIL = 9,         // one or more clips of a batch failed
+    ILPD_CONFLICT = 10,     // same UUID/output already seen with different projection data
+    VERIFY_MISMATCH = 11,   // --verify: container and SDK values differ
+    CLIP_TIMEOUT = 12       // batch --timeout: reading the clip took longer than the deadline
+};
+
+const char* exit_code_name(int code);
+
+// Logger
+// When `sink` is set, lines are captured instead of printed so a batch worker's
+// output can be replayed in input order once its clip is reported.
+// `infoToStderr` keeps stdout free for data (braw2ilpd -o -).
+// `track` is the calling thread's stage timing track (--stats/--trace), null when timing is off.
+struct LogLine {
+    bool isError;
+    string text;
+};
+struct Logger {
+    bool verbose;
+    bool silent;
+    bool infoToStderr;
+    vector<LogLine>* sink;
+    StageTrack* track;
+    Logger(): verbose(false), silent(false), infoToStderr(false), sink(nullptr), track(nullptr) {}
+    void info(const string &s) const { if (!silent) emit(false, s); }
+    void debug(const string &s) const { if (verbose && !silent) emit(false, s); }
+    void error(const string &s) const { emit(true, s); }
+    void replay(const vector<LogLine> &lines) const {
+        for (const LogLine &l : lines) emit(l.isError, l.text);
+    }
+private:
+    void emit(bool isError, const string &s) const {
+        if (sink) { sink->push_back({isError, s}); return; }
+        if (isError) std::cerr << s << std::endl;
+        else (infoToStderr ? std::cerr : std::cout) << s << std::endl;
+    }
+};
+
+// A generic AttrValue to cache attribute result.
+// Only the typed value is stored; the human readable form is built by display() when asked for.
+struct AttrValue {
+    uint32_t vt = 0;
+    bool available = false;         // the attribute could be read
+    string rawValue;                // raw string value (for strings only, used for processing)
+    double number = 0;              // numeric value (U8 ... Float64)
+    vector<uint8_t> rawBytes;       // raw bytes copy (SafeArray data truncated)
+    uint32_t safeArrayElementCount = 0;
+    uint32_t safeArrayVariantType = 0;
+    uint64_t safeArrayTotalSize = 0;
+    // Back to "not read", the string and byte buffers keep their capacity
+    void clear() {
+        vt = 0;
+        available = false;
+        rawValue.clear();
+        number = 0;
+        rawBytes.clear();
+        safeArrayElementCount = 0;
+        safeArrayVariantType = 0;
+        safeArrayTotalSize = 0;
+    }
+    string display() const;         // "String value: ...", "Float32 value: 64.5", hex preview, ...
+};
+
+// Attribute descriptors: the one place an attribute is declared. The slot of an attribute is its
+// index in ATTR_TABLE, its bit in AttrMask and its position in every output; to read another SDK
+// attribute, add a slot and its row (the static_assert below keeps the two in step).
+enum AttrSlot {
+    ATTR_UUID,
+    ATTR_ILPD_FILE_NAME,
+    ATTR_INTERAXIAL,
+    ATTR_PROJECTION_KIND,
+    ATTR_CALIBRATION_TYPE,
+    ATTR_PROJECTION_DATA,
+    ATTR_COUNT
+};
+// What an attribute is needed for besides being reported
+enum AttrUse : uint8_t {
+    ATTR_USE_NAMING = 1,    // output naming (auto ILPD name, index/manifest UUID)
+    ATTR_USE_OUTPUT = 2,    // the ILPD payload
+    ATTR_USE_FRAME = 4      // also in the per-frame metadata, compared by --sample-frames
+};
+struct AttrDesc {
+    AttrSlot slot;
+    BlackmagicRawImmersiveAttribute attr;
+    const char* name;           // attribute name without the SDK prefix (manifest columns, JSON keys)
+    const char* shortName;      // --attrs
+    const char* desc;           // detailed attributes file
+    BlackmagicRawVariantType type;  // variant type the SDK returns for it
+    uint8_t use;                // AttrUse bits
+};
+inline constexpr AttrDesc ATTR_TABLE[] = {
+    {ATTR_UUID, blackmagicRawImmersiveAttributeOpticalLensProcessingDataFileUUID, "OpticalLensProcessingDataFileUUID",
+     "uuid", "UUID of the projection data file", blackmagicRawVariantTypeString, ATTR_USE_NAMING | ATTR_USE_FRAME},
+    {ATTR_ILPD_FILE_NAME, blackmagicRawImmersiveAttributeOpticalILPDFileName, "OpticalILPDFileName",
+     "filename", "Name of the ILPD projection data file", blackmagicRawVariantTypeString, ATTR_USE_NAMING},
+    {ATTR_INTERAXIAL, blackmagicRawImmersiveAttributeOpticalInteraxial, "OpticalInteraxial",
+     "interaxial", "Interaxial lens separation", blackmagicRawVariantTypeFloat32, ATTR_USE_FRAME},
+    {ATTR_PROJECTION_KIND, blackmagicRawImmersiveAttributeOpticalProjectionKind, "OpticalProjectionKind",
+     "kind", "Projection kind ('fish' indicates Apple immersive video)", blackmagicRawVariantTypeString, ATTR_USE_FRAME},
+    {ATTR_CALIBRATION_TYPE, blackmagicRawImmersiveAttributeOpticalCalibrationType, "OpticalCalibrationType",
+     "calibration", "Calibration type ('meiRives' indicates ILPD lens projection)", blackmagicRawVariantTypeString, ATTR_USE_FRAME},
+    {ATTR_PROJECTION_DATA, blackmagicRawImmersiveAttributeOpticalProjectionData, "OpticalProjectionData",
+     "data", "The contents of the projection data file (ILPD)", blackmagicRawVariantTypeString, ATTR_USE_OUTPUT},
+};
+constexpr bool attr_table_in_slot_order() {
+    if (sizeof(ATTR_TABLE) / sizeof(ATTR_TABLE[0]) != ATTR_COUNT) return false;
+    for (size_t i = 0; i < ATTR_COUNT; ++i) {
+        if (ATTR_TABLE[i].slot != (AttrSlot)i) return false;
+    }
+    return true;
+}
+static_assert(attr_table_in_slot_order(), "one ATTR_TABLE row per AttrSlot, in slot order");
+
+// A set of slots, bit i = ATTR_TABLE[i]; readers walk the set bits, nothing is looked up per attribute
+typedef uint32_t AttrMask;
+static_assert(ATTR_COUNT <= 32, "AttrMask has one bit per slot");
+inline constexpr AttrMask ALL_ATTRS = (AttrMask)((1ull << ATTR_COUNT) - 1);
+constexpr AttrMask attr_bit(AttrSlot s) { return (AttrMask)1 << s; }
+// Slots whose descriptor has any of the AttrUse bits in `use`
+constexpr AttrMask attrs_used_for(uint8_t use) {
+    AttrMask m = 0;
+    for (size_t i = 0; i < ATTR_COUNT; ++i) {
+        if (ATTR_TABLE[i].use & use) m |= (AttrMask)1 << i;
+    }
+    return m;
+}
+// Slot of the lowest set bit, for `for (AttrMask m = mask; m; m &= m - 1) ATTR_TABLE[attr_index(m)]`
+#ifdef _MSC_VER
+inline AttrSlot attr_index(AttrMask m) {
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return (AttrSlot)i;
+}
+#else
+inline AttrSlot attr_index(AttrMask m) { return (AttrSlot)__builtin_ctz(m); }
+#endif
+// Descriptor of an SDK attribute, null if it is not in the table
+const AttrDesc* find_attr(BlackmagicRawImmersiveAttribute a);
+// Descriptor by name: short name or attribute name, case-insensitive
+const AttrDesc* find_attr(const string &name);
+// "uuid,filename,interaxial": short names (uuid, filename, interaxial, kind, calibration, data),
+// attribute names or "all"; false with `err` naming what was not recognized
+bool parse_attr_mask(const string &list, AttrMask &mask, string &err);
+
+// Container for all attributes: one value per slot, `present` tells which were stored.
+// Fixed size and allocation-free apart from the values themselves, so records stay compact in bulk.
+// clear() and reset() keep the values' buffers: attributes reused for the next clip (the batch
+// engine recycles them) are read into strings that already have the capacity.
+struct ImmersiveAttrs {
+    AttrValue values[ATTR_COUNT];
+    AttrMask present = 0;
+
+    bool has(AttrSlot s) const { return (present & attr_bit(s)) != 0; }
+    bool empty() const { return present == 0; }
+    const AttrValue* get(AttrSlot s) const { return has(s) ? &values[s] : nullptr; }
+    AttrValue* get(AttrSlot s) { return has(s) ? &values[s] : nullptr; }
+    void set(AttrSlot s, AttrValue v) {
+        values[s] = std::move(v);
+        present |= attr_bit(s);
+    }
+    // Slot emptied for a value read in place, and marked stored
+    AttrValue &reset(AttrSlot s) {
+        values[s].clear();
+        present |= attr_bit(s);
+        return values[s];
+    }
+    void erase(AttrSlot s) {
+        values[s].clear();
+        present &= ~attr_bit(s);
+    }
+    void clear() {
+        for (AttrValue &v : values) v.clear();
+        present = 0;
+    }
+    // String value of a stored attribute, empty otherwise
+    std::string_view text(AttrSlot s) const { return has(s) ? std::string_view(values[s].rawValue) : std::string_view(); }
+
+    bool hasProjectionData() const { return !text(ATTR_PROJECTION_DATA).empty(); }
+    // View of the payload, valid while these attributes are alive and unchanged
+    std::string_view projectionData() const { return text(ATTR_PROJECTION_DATA); }
+    // Copy of the payload
+    string getProjectionData() const { return string(projectionData()); }
+    // Move the payload out (the attribute is left empty)
+    string takeProjectionData() { return has(ATTR_PROJECTION_DATA) ? std::move(values[ATTR_PROJECTION_DATA].rawValue) : string(); }
+};
+
+// --sample-frames: per-frame metadata read through the SDK's frame read jobs (no image is decoded)
+// and compared with the clip-level attributes
+inline constexpr uint64_t SAMPLE_ALL_FRAMES = UINT64_MAX;
+// Consecutive sampled frames with the same value, different from the clip level
+struct FrameChange {
+    AttrSlot slot;
+    uint64_t first = 0;         // first and last frame of the run
+    uint64_t last = 0;
+    uint64_t frames = 0;        // sampled frames in the run
+    string value;               // the frames' value (attr_value_text)
+};
+struct FrameReport {
+    uint64_t frameCount = 0;    // frames in the clip
+    uint64_t sampled = 0;       // frames whose metadata was read
+    uint64_t failed = 0;        // frame reads that failed
+    bool interaxialFound = false;   // a frame has a non-zero OpticalInteraxial
+    uint64_t interaxialFrame = 0;   // the first such frame
+    double interaxial = 0;
+    bool interaxialRecovered = false;   // the clip level read 0 (or nothing) and now has the frame's value
+    uint64_t changedFrames = 0; // sampled frames with any value differing from the clip level
+    AttrMask compared = 0;      // sampled attributes at least one frame carries
+    AttrMask absent = 0;        // ... and the ones not present in the frame metadata of any frame read
+    vector<FrameChange> changes;    // in slot, then frame order
+};
+
+// Human-friendly name & description for attributes ("UnknownAttribute" / "" outside the table)
+string attr_name(BlackmagicRawImmersiveAttribute a);
+string attr_desc(BlackmagicRawImmersiveAttribute a);
+
+// Variant -> AttrValue (typed value, raw string value, SafeArray copy), into the buffers `out` has
+void store_variant(const Variant &v, AttrValue &out);
+// Typed value as a JSON literal: strings quoted, numbers bare, SafeArrays as hex, null if not available
+string attr_value_json(const AttrValue &v);
+// The same value as plain text (CSV cells), empty if not available
+string attr_value_text(const AttrValue &v);
+
+// XXH64 content hash, used to tell identical ILPD payloads apart
+uint64_t hash64(const void* data, size_t len, uint64_t seed = 0);
+string hash_to_hex(uint64_t h);
+
+// s3://, https:// and http:// inputs are read through byte-range requests
+bool is_remote_input(const string &input);
+// Path part of a local path or URL (no scheme, query or fragment), for extension checks and naming
+std::filesystem::path input_name_path(const string &input);
+
+// Identity of a local clip file (size, mtime, inode), used to tell whether it changed since it was read
+struct FileKey {
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    uint64_t inode = 0;
+    bool operator==(const FileKey &o) const { return size == o.size && mtimeNs == o.mtimeNs && inode == o.inode; }
+    bool operator!=(const FileKey &o) const { return !(*this == o); }
+};
+bool stat_file_key(const string &path, FileKey &key);
+
+// Quoted JSON string literal
+string json_quote(const string &s);
+
+// Output helpers
+// Camera ID and UUID parts of an ILPD file name ("cameraID.uuid.ilpd"); either may come back empty
+void split_ilpd_file_name(std::string_view fileName, string &camera, string &uuid);
+// Auto name cameraID.uuid.ilpd (fallbacks: input file stem, "default")
+string make_auto_ilpd_name(const string &inputBraw, const ImmersiveAttrs &attrs);
+// Resolve -o according to the CLI rules (file, directory, auto name), preserving relative/absolute style
+string resolve_output_path(const string &outputArg, const string &autoName, Logger &log);
+string make_detailed_attributes_path(const string &ilpdPath);
+
+// Depth-first walk below a directory that keeps going past errors: a subdirectory that cannot be
+// opened, or read any further, goes to `skipped` and the rest of the tree is still walked.
+// Hidden entries (._ AppleDouble files, .Trashes, .Spotlight-V100) are left out with all below them;
+// symlinked directories are returned but not descended into.
+class DirWalker {
+public:
+    typedef std::function<void(const string &dir, const std::error_code &ec)> SkipFn;
+    explicit DirWalker(const string &root): root_(root) {}
+    // false with `ec` if the root itself cannot be read
+    bool open(std::error_code &ec);
+    // The next file or directory; false once the whole tree was walked
+    bool next(std::filesystem::directory_entry &entry, const SkipFn &skipped);
+private:
+    struct Level {
+        std::filesystem::path dir;
+        std::filesystem::directory_iterator it;
+    };
+    bool enter(const std::filesystem::path &dir, std::error_code &ec);
+    string root_;
+    vector<Level> stack_;
+    bool returned_ = false;     // stack_.back().it is at the entry handed out last
+    bool descend_ = false;      // ... and that entry is a directory to walk next
+};
+
+// How hard a write tries to survive a crash or power loss
+enum class Durability {
+    NONE,   // tmp + rename only
+    FILE,   // fsync each file and its directory before moving on
+    BATCH,  // write everything, fsync all files then each distinct directory once in finish()
+    FULL    // like FILE, with F_FULLFSYNC where the platform has it
+};
+bool parse_durability(const string &s, Durability &out);
+
+// Atomic writes (tmp + rename) at one durability level; shared by all the threads of a run.
+// Directories are created once per writer instead of on every write.
+// `track` times the write on the calling thread's track and counts its bytes.
+class AtomicWriter {
+public:
+    explicit AtomicWriter(Durability durability = Durability::NONE);
+    Durability durability() const { return durability_; }
+    bool write(const string &dest, std::string_view content, string &err, StageTrack* track = nullptr);
+    // Give a file written by other means (a manifest stream) the same durability
+    bool sync(const string &path, string &err);
+    // BATCH: flush everything written so far; a no-op for the other levels
+    bool finish(string &err, StageTrack* track = nullptr);
+private:
+    friend class AtomicFile;
+    bool ensure_dir(const string &dir, string &err);
+    Durability durability_;
+    std::mutex mutex_;
+    std::set<string> knownDirs_;
+    vector<string> pendingFiles_;
+    std::set<string> pendingDirs_;
+};
+
+// A file of an AtomicWriter written piece by piece (large outputs streamed as they are computed):
+// a unique tmp next to `dest`, renamed over it by commit() at the writer's durability.
+// A file that is never committed is removed when it goes out of scope.
+class AtomicFile {
+public:
+    AtomicFile(AtomicWriter &writer, const string &dest);
+    ~AtomicFile();
+    AtomicFile(const AtomicFile &) = delete;
+    AtomicFile &operator=(const AtomicFile &) = delete;
+    bool open(string &err);
+    // false once a write failed; the error is reported by commit()
+    bool write(std::string_view data);
+    bool commit(string &err);
+private:
+    AtomicWriter &writer_;
+    string dest_;
+    string dir_;
+    string tmp_;
+    int fd_ = -1;
+    int errno_ = 0;
+};
+
+// One-off atomic write without fsync
+bool write_text_file_atomic(const string &dest, std::string_view content, string &err);
+bool write_detailed_attributes(const string &ilpdPath, const string &inputBraw, const ImmersiveAttrs &cached, Logger &log,
+                               AtomicWriter* writer = nullptr);
+
+// AIME document next to the ILPD (<stem>.aime): the lens profile together with the optical attributes
+// it is used with, built from the attributes in memory. The projection data is parsed once to check
+// it is a JSON object and embedded unchanged; false with `err` if there is none or it is not JSON.
+string make_aime_path(const string &ilpdPath);
+bool make_aime(const ImmersiveAttrs &attrs, string &out, string &err);
+
+// What the SDK path of an Extractor calls: the Blackmagic RAW SDK unless ExtractOptions::backend
+// says otherwise. A backend is shared by an Extractor and its forks (the factory), each of which
+// creates one codec on first use; a clip is open while its ImmersiveClip is alive.
+class ImmersiveClip {
+public:
+    virtual ~ImmersiveClip() {}
+    // IBlackmagicRawClipImmersiveVideo::GetImmersiveAttribute; the caller clears `v`
+    virtual HRESULT get_attribute(BlackmagicRawImmersiveAttribute a, Variant &v) = 0;
+    // IBlackmagicRawClip::GetFrameCount, 0 if unknown
+    virtual uint64_t frame_count() { return 0; }
+    // Read the frame metadata matching `names` (attribute names; metadata keys match ignoring case and
+    // underscores) of each of `frames` with frame read jobs (nothing is decoded), keeping at most
+    // `inFlight` jobs queued. `done` runs on SDK threads, one call at a time, once per frame, with the
+    // values in `names` order (empty variants for keys the frame does not have; cleared by the caller)
+    // or null if the frame could not be read. False with `err` if frames cannot be read at all.
+    virtual bool read_frames(const vector<uint64_t> &frames, const vector<string> &names, unsigned inFlight,
+                             const std::function<void(uint64_t frame, const Variant* values)> &done, string &err) {
+        (void)frames; (void)names; (void)inFlight; (void)done;
+        err = "frame reads are not supported by this backend";
+        return false;
+    }
+};
+class ClipCodec {
+public:
+    virtual ~ClipCodec() {}
+    // OpenClip + QueryInterface; OPENCLIP_FAIL or IMMERSIVE_NOT_SUPPORTED with the reason logged
+    virtual ExitCode open_clip(const string &input, std::unique_ptr<ImmersiveClip> &clip, const Logger &log) = 0;
+};
+class ClipBackend {
+public:
+    virtual ~ClipBackend() {}
+    // Called from any thread; FACTORY_FAIL or CODEC_FAIL with the reason logged
+    virtual ExitCode create_codec(std::unique_ptr<ClipCodec> &codec, const Logger &log) = 0;
+};
+
+struct ExtractOptions {
+    bool fast = false;      // read metadata from the container, SDK only as fallback
+    bool verify = false;    // fast path plus SDK cross-check (VERIFY_MISMATCH on difference)
+    AttrMask attrs = ALL_ATTRS; // attributes extract() reads; the others are not fetched at all
+    uint64_t sampleFrames = 0;  // --sample-frames: frames to read per clip (SAMPLE_ALL_FRAMES: every frame), 0 = none
+    std::shared_ptr<ClipBackend> backend;   // null: the Blackmagic RAW SDK
+};
+
+// Result of one extraction; move-only so large payloads are never copied by accident
+struct ExtractResult {
+    string input;
+    ExitCode status = OK;
+    ImmersiveAttrs attrs;
+    bool fromContainer = false;     // read without the SDK
+    FrameReport frames;             // ExtractOptions::sampleFrames
+    vector<LogLine> log;            // messages produced while extracting
+
+    ExtractResult() = default;
+    ExtractResult(ExtractResult &&) = default;
+    ExtractResult& operator=(ExtractResult &&) = default;
+    ExtractResult(const ExtractResult &) = delete;
+    ExtractResult& operator=(const ExtractResult &) = delete;
+};
+
+class Extractor {
+public:
+    explicit Extractor(const ExtractOptions &options = ExtractOptions());
+    ~Extractor();
+    Extractor(Extractor &&) noexcept;
+    Extractor& operator=(Extractor &&) noexcept;
+    Extractor(const Extractor &) = delete;
+    Extractor& operator=(const Extractor &) = delete;
+
+    // Load the SDK and create this extractor's codec now instead of on the first clip that needs it
+    ExitCode open(const Logger &log);
+    // New extractor sharing this one's SDK factory with a codec of its own, for another thread.
+    // The SDK does not document concurrent OpenClip on a single codec as safe.
+    Extractor fork() const;
+    const ExtractOptions &options() const;
+
+    // Read all attributes of one clip. Not thread-safe: one call at a time per Extractor.
+    // With ExtractOptions::sampleFrames the frames are read too (SDK clips only), see FrameReport.
+    ExtractResult extract(const string &input);
+    ExitCode extract(const string &input, ImmersiveAttrs &attrs, const Logger &log, bool* fromContainer = nullptr,
+                     FrameReport* frames = nullptr);
+
+    // Extract several clips with `jobs` threads; callback runs serialized, in input order
+    void extractMany(const vector<string> &inputs, const std::function<void(size_t, ExtractResult &&)> &callback,
+                     unsigned jobs = 1);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+    explicit Extractor(std::unique_ptr<Impl> impl);
+};
+
+} // namespace ilpd
@@ -0,0 +1,189 @@
+// json_reader.h
+// - Small JSON reader for --serve requests and JSON Lines manifests (braw2ilpd merge)
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace ilpd {
+
+using std::string;
+using std::vector;
+
+// Minimal JSON reader. Keeps the raw text of every value so it can be passed
+// through unchanged (the --serve request "id", manifest attributes in merge).
+struct JsonValue {
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+    bool boolean = false;
+    string str;
+    string raw;
+    vector<JsonValue> items;
+    vector<std::pair<string, JsonValue>> members;
+
+    const JsonValue* get(const string &key) const {
+        for (const auto &m : members) if (m.first == key) return &m.second;
+        return nullptr;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const string &text): s_(text), i_(0) {}
+    bool parse(JsonValue &out, string &err) {
+        if (!value(out, 0)) { err = err_.empty() ? "malformed JSON" : err_; return false; }
+        ws();
+        if (i_ != s_.size()) { err = "trailing characters after JSON value"; return false; }
+        return true;
+    }
+private:
+    const string &s_;
+    size_t i_;
+    string err_;
+
+    void ws() { while (i_ < s_.size() && (s_[i_] == ' ' || s_[i_] == '\t' || s_[i_] == '\r' || s_[i_] == '\n')) ++i_; }
+    bool literal(const char* word) {
+        size_t n = strlen(word);
+        if (s_.compare(i_, n, word) != 0) return false;
+        i_ += n;
+        return true;
+    }
+    bool value(JsonValue &out, int depth) {
+        if (depth > 32) { err_ = "JSON nested too deeply"; return false; }
+        ws();
+        if (i_ >= s_.size()) return false;
+        size_t start = i_;
+        bool ok = false;
+        char c = s_[i_];
+        if (c == '{') ok = object(out, depth);
+        else if (c == '[') ok = array(out, depth);
+        else if (c == '"') { out.type = JsonValue::STRING; ok = string_lit(out.str); }
+        else if (literal("true")) { out.type = JsonValue::BOOL; out.boolean = true; ok = true; }
+        else if (literal("false")) { out.type = JsonValue::BOOL; ok = true; }
+        else if (literal("null")) { out.type = JsonValue::NUL; ok = true; }
+        else if (c == '-' || (c >= '0' && c <= '9')) { out.type = JsonValue::NUMBER; ok = number(); }
+        if (ok) out.raw = s_.substr(start, i_ - start);
+        return ok;
+    }
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? and nothing else: strtod would also take inf, nan,
+    // hex floats and locale formats, and the raw text is passed on as JSON (the --serve "id", merge)
+    bool digits() {
+        const size_t start = i_;
+        while (i_ < s_.size() && s_[i_] >= '0' && s_[i_] <= '9') ++i_;
+        return i_ > start;
+    }
+    bool number() {
+        if (s_[i_] == '-') ++i_;
+        if (i_ < s_.size() && s_[i_] == '0') ++i_;
+        else if (!digits()) return false;
+        if (i_ < s_.size() && s_[i_] == '.') {
+            ++i_;
+            if (!digits()) return false;
+        }
+        if (i_ < s_.size() && (s_[i_] == 'e' || s_[i_] == 'E')) {
+            ++i_;
+            if (i_ < s_.size() && (s_[i_] == '+' || s_[i_] == '-')) ++i_;
+            if (!digits()) return false;
+        }
+        return true;
+    }
+    bool object(JsonValue &out, int depth) {
+        out.type = JsonValue::OBJECT;
+        ++i_;
+        ws();
+        if (i_ < s_.size() && s_[i_] == '}') { ++i_; return true; }
+        for (;;) {
+            ws();
+            string key;
+            if (i_ >= s_.size() || s_[i_] != '"' || !string_lit(key)) return false;
+            ws();
+            if (i_ >= s_.size() || s_[i_] != ':') return false;
+            ++i_;
+            JsonValue v;
+            if (!value(v, depth + 1)) return false;
+            out.members.emplace_back(std::move(key), std::move(v));
+            ws();
+            if (i_ < s_.size() && s_[i_] == ',') { ++i_; continue; }
+            if (i_ < s_.size() && s_[i_] == '}') { ++i_; return true; }
+            return false;
+        }
+    }
+    bool array(JsonValue &out, int depth) {
+        out.type = JsonValue::ARRAY;
+        ++i_;
+        ws();
+        if (i_ < s_.size() && s_[i_] == ']') { ++i_; return true; }
+        for (;;) {
+            JsonValue v;
+            if (!value(v, depth + 1)) return false;
+            out.items.push_back(std::move(v));
+            ws();
+            if (i_ < s_.size() && s_[i_] == ',') { ++i_; continue; }
+            if (i_ < s_.size() && s_[i_] == ']') { ++i_; return true; }
+            return false;
+        }
+    }
+    static void put_utf8(string &out, uint32_t cp) {
+        if (cp < 0x80) out += (char)cp;
+        else if (cp < 0x800) { out += (char)(0xC0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3F)); }
+        else if (cp < 0x10000) {
+            out += (char)(0xE0 | (cp >> 12)); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F));
+        } else {
+            out += (char)(0xF0 | (cp >> 18)); out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+    bool hex4(uint32_t &cp) {
+        if (i_ + 4 > s_.size()) return false;
+        cp = 0;
+        for (int k = 0; k < 4; ++k) {
+            char h = s_[i_++];
+            cp <<= 4;
+            if (h >= '0' && h <= '9') cp |= (uint32_t)(h - '0');
+            else if (h >= 'a' && h <= 'f') cp |= (uint32_t)(h - 'a' + 10);
+            else if (h >= 'A' && h <= 'F') cp |= (uint32_t)(h - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+    bool string_lit(string &out) {
+        ++i_;
+        while (i_ < s_.size()) {
+            char c = s_[i_++];
+            if (c == '"') return true;
+            if (c != '\\') { out += c; continue; }
+            if (i_ >= s_.size()) return false;
+            char e = s_[i_++];
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t cp;
+                    if (!hex4(cp)) return false;
+                    if (cp >= 0xD800 && cp < 0xDC00 && s_.compare(i_, 2, "\\u") == 0) {
+                        i_ += 2;
+                        uint32_t lo;
+                        if (!hex4(lo)) return false;
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    }
+                    put_utf8(out, cp);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace ilpd
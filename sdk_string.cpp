@@ -0,0 +1,132 @@
+// sdk_string.cpp
+// - CFString (macOS), UTF-8 char* (Linux) and BSTR (Windows) conversions for the SDK string shim
+// - SafeArray and U8 accessors over the two Variant layouts
+
+#include "sdk_string.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace ilpd {
+
+using std::string;
+
+#if defined(__APPLE__)
+
+void sdk_string_to_utf8(SdkString s, string &out) {
+    out.clear();
+    if (!s) return;
+    const char* fast = CFStringGetCStringPtr(s, kCFStringEncodingUTF8);
+    if (fast) {
+        out.assign(fast);
+        return;
+    }
+    // Size the UTF-8 result first so the payload is converted once, straight into `out`
+    CFIndex len = CFStringGetLength(s);
+    CFIndex used = 0;
+    CFStringGetBytes(s, CFRangeMake(0, len), kCFStringEncodingUTF8, 0, false, nullptr, 0, &used);
+    out.resize((size_t)used);
+    if (used > 0 && CFStringGetBytes(s, CFRangeMake(0, len), kCFStringEncodingUTF8, 0, false,
+                                     reinterpret_cast<UInt8*>(&out[0]), used, &used) != len) {
+        out.clear();
+        return;
+    }
+    out.resize((size_t)used);
+}
+
+SdkString sdk_string_create(const string &utf8) {
+    return CFStringCreateWithCString(kCFAllocatorDefault, utf8.c_str(), kCFStringEncodingUTF8);
+}
+
+void sdk_string_release(SdkString s) {
+    CFRelease(s);
+}
+
+#elif defined(_WIN32)
+
+void sdk_string_to_utf8(SdkString s, string &out) {
+    out.clear();
+    if (!s) return;
+    int wlen = (int)SysStringLen(s);
+    int used = WideCharToMultiByte(CP_UTF8, 0, s, wlen, nullptr, 0, nullptr, nullptr);
+    out.resize((size_t)used);
+    if (used > 0 && WideCharToMultiByte(CP_UTF8, 0, s, wlen, &out[0], used, nullptr, nullptr) != used) out.clear();
+}
+
+SdkString sdk_string_create(const string &utf8) {
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), nullptr, 0);
+    if (wlen == 0 && !utf8.empty()) return nullptr;
+    BSTR s = SysAllocStringLen(nullptr, (UINT)wlen);
+    if (s && wlen) MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), s, wlen);
+    return s;
+}
+
+void sdk_string_release(SdkString s) {
+    SysFreeString(s);
+}
+
+#else
+
+// Strings are plain UTF-8; the SDK frees Variant strings with free()
+void sdk_string_to_utf8(SdkString s, string &out) {
+    if (s) out.assign(s);
+    else out.clear();
+}
+
+SdkString sdk_string_create(const string &utf8) {
+    return strdup(utf8.c_str());
+}
+
+void sdk_string_release(SdkString s) {
+    free(const_cast<char*>(s));
+}
+
+#endif
+
+string sdk_string_to_utf8(SdkString s) {
+    string out;
+    sdk_string_to_utf8(s, out);
+    return out;
+}
+
+#if defined(_WIN32)
+
+// The SDK hands out one-dimensional arrays it owns until VariantClear; pvData is read in place
+SdkArray sdk_array(const Variant &v) {
+    SdkArray a;
+    if (v.vt != blackmagicRawVariantTypeSafeArray || !v.parray) return a;
+    VARTYPE vt = VT_EMPTY;
+    if (SafeArrayGetVartype(v.parray, &vt) != S_OK) return a;
+    a.type = (BlackmagicRawVariantType)vt;
+    if (v.parray->cDims != 1) return a;
+    a.count = (uint32_t)v.parray->rgsabound[0].cElements;
+    a.data = static_cast<const uint8_t*>(v.parray->pvData);
+    return a;
+}
+
+uint8_t sdk_u8(const Variant &v) {
+    return v.bVal;
+}
+
+#else
+
+SdkArray sdk_array(const Variant &v) {
+    SdkArray a;
+    if (v.vt != blackmagicRawVariantTypeSafeArray || !v.parray) return a;
+    a.type = v.parray->variantType;
+    a.count = v.parray->bounds.cElements;
+    a.data = reinterpret_cast<const uint8_t*>(v.parray->data);
+    return a;
+}
+
+uint8_t sdk_u8(const Variant &v) {
+    return (uint8_t)v.uiVal;
+}
+
+#endif
+
+} // namespace ilpd
@@ -0,0 +1,60 @@
+// sdk_string.h
+// - The Blackmagic RAW SDK passes strings as CFStringRef on macOS, const char* on Linux and BSTR on
+//   Windows; these helpers are the only place that knows, everything else works with UTF-8 std::string
+// - Used for OpenClip paths and string Variants (Variant::bstrVal)
+// - SafeArray Variants are read through sdk_array(): the SDK's own struct on macOS and Linux, a COM
+//   SAFEARRAY in a VARIANT on Windows (where `Variant` names VARIANT)
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "BlackmagicRawAPI.h"
+
+#if defined(_WIN32)
+typedef VARIANT Variant;
+#endif
+
+namespace ilpd {
+
+#if defined(__APPLE__)
+typedef CFStringRef SdkString;
+#elif defined(_WIN32)
+typedef BSTR SdkString;
+#else
+typedef const char* SdkString;
+#endif
+
+// UTF-8 copy of an SDK string; empty for null
+std::string sdk_string_to_utf8(SdkString s);
+// The same into `out`, reusing its buffer
+void sdk_string_to_utf8(SdkString s, std::string &out);
+// New SDK string owned by the caller (sdk_string_release, or VariantClear once stored in a Variant);
+// null if it cannot be created
+SdkString sdk_string_create(const std::string &utf8);
+void sdk_string_release(SdkString s);
+
+// Element type, count and bytes of a SafeArray Variant (all zero for any other Variant)
+struct SdkArray {
+    BlackmagicRawVariantType type = 0;
+    uint32_t count = 0;
+    const uint8_t* data = nullptr;
+};
+SdkArray sdk_array(const Variant &v);
+// Value of a blackmagicRawVariantTypeU8 Variant
+uint8_t sdk_u8(const Variant &v);
+
+// Owns an SDK string for the length of one call (OpenClip and friends)
+class ScopedSdkString {
+public:
+    explicit ScopedSdkString(const std::string &utf8): s_(sdk_string_create(utf8)) {}
+    ~ScopedSdkString() { if (s_) sdk_string_release(s_); }
+    ScopedSdkString(const ScopedSdkString&) = delete;
+    ScopedSdkString& operator=(const ScopedSdkString&) = delete;
+    SdkString get() const { return s_; }
+private:
+    SdkString s_;
+};
+
+} // namespace ilpd
@@ -0,0 +1,241 @@
+// stage_stats.cpp
+// - Stage timing tracks, --stats summary table and --trace writer
+
+#include "stage_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "ilpdextract.h"
+
+namespace ilpd {
+
+const char* stage_name(Stage s) {
+    switch (s) {
+        case Stage::FACTORY: return "CreateFactory";
+        case Stage::CODEC: return "CreateCodec";
+        case Stage::OPEN_CLIP: return "OpenClip";
+        case Stage::QUERY_INTERFACE: return "QueryInterface";
+        case Stage::GET_ATTRIBUTE: return "GetImmersiveAttribute";
+        case Stage::SAMPLE_FRAMES: return "SampleFrames";
+        case Stage::CONTAINER: return "ContainerRead";
+        case Stage::REMOTE: return "RemoteRead";
+        case Stage::WRITE: return "WriteFile";
+        case Stage::SYNC: return "BatchSync";
+        case Stage::EXTRACT: return "ExtractClip";
+        case Stage::OUTPUT: return "WriteClipOutputs";
+        default: return "Unknown";
+    }
+}
+
+StageTrack::StageTrack(const std::string &name, uint32_t id, bool keepEvents, int64_t originNs)
+    : name_(name), id_(id), keepEvents_(keepEvents), originNs_(originNs), rng_(0x9E3779B97F4A7C15ull ^ id),
+      bytesWritten_(0), filesWritten_(0) {}
+
+void StageTrack::add(Durations &d, int64_t ns) {
+    ++d.count;
+    d.total += ns;
+    d.max = std::max(d.max, ns);
+    if (d.sample.size() < SAMPLE_LIMIT) {
+        d.sample.push_back(ns);
+    } else {
+        // the n-th duration takes the place of a random one with probability SAMPLE_LIMIT / n
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        const uint64_t j = rng_ % d.count;
+        if (j < SAMPLE_LIMIT) d.sample[(size_t)j] = ns;
+    }
+}
+
+void StageTrack::record(Stage s, int64_t startNs, int64_t endNs, uint32_t arg) {
+    add(durations_[(size_t)s], endNs - startNs);
+    if (keepEvents_) events_.push_back({startNs - originNs_, endNs - startNs, arg, s});
+}
+
+uint32_t StageTrack::label(const std::string &s) {
+    if (!keepEvents_) return 0;
+    labels_.push_back(s);
+    return (uint32_t)(labels_.size() - 1);
+}
+
+void StageTrack::absorb(StageTrack &scratch) {
+    for (size_t s = 0; s < (size_t)Stage::COUNT; ++s) {
+        Durations &from = scratch.durations_[s];
+        if (!from.count) continue;
+        Durations &to = durations_[s];
+        int64_t sampled = 0;
+        for (int64_t ns : from.sample) {
+            add(to, ns);
+            sampled += ns;
+        }
+        // a scratch track that sampled itself (thousands of calls in one read): exact figures all the same
+        to.count += from.count - from.sample.size();
+        to.total += from.total - sampled;
+        to.max = std::max(to.max, from.max);
+        from.sample.clear();
+        from.count = 0;
+        from.total = 0;
+        from.max = 0;
+    }
+    const uint32_t base = (uint32_t)labels_.size();
+    for (std::string &l : scratch.labels_) labels_.push_back(std::move(l));
+    for (Event e : scratch.events_) {
+        if (e.stage == Stage::EXTRACT || e.stage == Stage::OUTPUT) e.arg += base;
+        events_.push_back(e);
+    }
+    scratch.labels_.clear();
+    scratch.events_.clear();
+    bytesWritten_ += scratch.bytesWritten_;
+    filesWritten_ += scratch.filesWritten_;
+    scratch.bytesWritten_ = 0;
+    scratch.filesWritten_ = 0;
+}
+
+StageStats::StageStats(bool keepEvents): keepEvents_(keepEvents), originNs_(now_ns()) {}
+
+int64_t StageStats::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+StageTrack* StageStats::track(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tracks_.emplace_back(name, (uint32_t)tracks_.size() + 1, keepEvents_, originNs_);
+    return &tracks_.back();
+}
+
+StageTrack StageStats::scratch() const {
+    return StageTrack("", 0, keepEvents_, originNs_);
+}
+
+static std::string format_ms(int64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", ns / 1e6);
+    return buf;
+}
+
+// Nearest-rank percentile of durations sorted by value, each standing for `weight` recorded ones
+// (1 until a track's sample is full, so short runs are exact)
+static int64_t percentile(const std::vector<std::pair<int64_t, double>> &sorted, double count, double p) {
+    const double rank = std::max(1.0, std::floor(p * count + 0.999999));
+    double seen = 0;
+    for (const auto &d : sorted) {
+        seen += d.second;
+        if (seen >= rank - 1e-6) return d.first;
+    }
+    return sorted.back().first;
+}
+
+std::string StageStats::summary() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    char line[160];
+    std::string out = "Stage timings (ms):\n";
+    snprintf(line, sizeof(line), "  %-22s %8s %12s %10s %10s %10s %10s\n", "stage", "count", "total", "p50", "p95", "p99", "max");
+    out += line;
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+    for (const StageTrack &t : tracks_) {
+        bytes += t.bytesWritten_;
+        files += t.filesWritten_;
+    }
+    for (size_t s = 0; s < (size_t)Stage::COUNT; ++s) {
+        std::vector<std::pair<int64_t, double>> all;
+        uint64_t count = 0;
+        int64_t total = 0;
+        int64_t max = 0;
+        for (const StageTrack &t : tracks_) {
+            const StageTrack::Durations &d = t.durations_[s];
+            if (!d.count) continue;
+            const double weight = (double)d.count / d.sample.size();
+            for (int64_t ns : d.sample) all.push_back({ns, weight});
+            count += d.count;
+            total += d.total;
+            max = std::max(max, d.max);
+        }
+        if (all.empty()) continue;
+        std::sort(all.begin(), all.end());
+        snprintf(line, sizeof(line), "  %-22s %8llu %12s %10s %10s %10s %10s\n", stage_name((Stage)s), (unsigned long long)count,
+                 format_ms(total).c_str(), format_ms(percentile(all, (double)count, 0.50)).c_str(),
+                 format_ms(percentile(all, (double)count, 0.95)).c_str(), format_ms(percentile(all, (double)count, 0.99)).c_str(),
+                 format_ms(max).c_str());
+        out += line;
+    }
+    out += "Bytes written: " + std::to_string(bytes) + " in " + std::to_string(files) + " files\n";
+    return out;
+}
+
+uint64_t StageStats::count(Stage s) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t n = 0;
+    for (const StageTrack &t : tracks_) n += t.durations_[(size_t)s].count;
+    return n;
+}
+
+// ru_maxrss is KiB on Linux, bytes on macOS
+uint64_t peak_rss_bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return (uint64_t)pmc.PeakWorkingSetSize;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)ru.ru_maxrss;
+#else
+    return (uint64_t)ru.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static void append_us(std::string &out, int64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", ns / 1e3);
+    out += buf;
+}
+
+// Trace-event format: complete ("X") events with microsecond timestamps, thread_name metadata per track
+bool StageStats::write_trace(const std::string &path, std::string &err) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto begin = [&]() {
+        if (!first) out += ",\n";
+        first = false;
+    };
+    for (const StageTrack &t : tracks_) {
+        const std::string tid = std::to_string(t.id_);
+        begin();
+        out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"name\":" + json_quote(t.name_) + "}}";
+        begin();
+        out += "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"sort_index\":" + tid + "}}";
+        for (const StageTrack::Event &e : t.events_) {
+            begin();
+            out += "{\"name\":\"";
+            out += stage_name(e.stage);
+            out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + tid + ",\"ts\":";
+            append_us(out, e.startNs);
+            out += ",\"dur\":";
+            append_us(out, e.durNs);
+            if (e.stage == Stage::GET_ATTRIBUTE) {
+                out += ",\"args\":{\"attr\":" + json_quote(attr_name((BlackmagicRawImmersiveAttribute)e.arg)) + "}";
+            } else if ((e.stage == Stage::EXTRACT || e.stage == Stage::OUTPUT) && e.arg < t.labels_.size()) {
+                out += ",\"args\":{\"clip\":" + json_quote(t.labels_[e.arg]) + "}";
+            }
+            out += "}";
+        }
+    }
+    out += "\n]}\n";
+    return write_text_file_atomic(path, out, err);
+}
+
+} // namespace ilpd
@@ -0,0 +1,119 @@
+// stage_stats.h
+// - Per-stage timers for --stats and --trace: SDK factory/codec creation, OpenClip, QueryInterface,
+//   each GetImmersiveAttribute, --sample-frames reads, container and remote reads, output writes
+// - One StageTrack per thread records into its own buffers, nothing is locked while timing
+// - Summary (count, total, p50/p95/p99, max per stage, bytes written) and Chrome trace-event JSON
+// - The summary keeps a fixed-size sample of durations per stage and thread, so --stats costs the same
+//   memory for ten clips or a million; only --trace keeps every event
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+namespace ilpd {
+
+enum class Stage : uint8_t {
+    FACTORY,            // CreateBlackmagicRawFactoryInstance
+    CODEC,              // IBlackmagicRawFactory::CreateCodec (the first one includes FACTORY)
+    OPEN_CLIP,          // IBlackmagicRaw::OpenClip (includes QUERY_INTERFACE)
+    QUERY_INTERFACE,    // IBlackmagicRawClipImmersiveVideo
+    GET_ATTRIBUTE,      // one GetImmersiveAttribute call (arg: the attribute)
+    SAMPLE_FRAMES,      // --sample-frames: all the frame read jobs of one clip
+    CONTAINER,          // --fast container read
+    REMOTE,             // s3:// / https:// byte-range read
+    WRITE,              // one atomic file write (fsync included)
+    SYNC,               // --durability batch: the final fsync pass
+    EXTRACT,            // everything done for one clip before its outputs are written (arg: clip label)
+    OUTPUT,             // writing one clip's outputs (arg: clip label)
+    COUNT
+};
+const char* stage_name(Stage s);
+
+// Timings of one thread; only that thread may record into it
+class StageTrack {
+public:
+    StageTrack(const std::string &name, uint32_t id, bool keepEvents, int64_t originNs);
+    void record(Stage s, int64_t startNs, int64_t endNs, uint32_t arg = 0);
+    void add_bytes(uint64_t n) { bytesWritten_ += n; ++filesWritten_; }
+    // Index of a name (clip path) for EXTRACT/OUTPUT event args; only stored when tracing
+    uint32_t label(const std::string &s);
+    // Moves what `scratch` recorded (a track of the same StageStats) into this one and empties it,
+    // its buffers keep their capacity
+    void absorb(StageTrack &scratch);
+
+private:
+    friend class StageStats;
+    struct Event {
+        int64_t startNs;
+        int64_t durNs;
+        uint32_t arg;
+        Stage stage;
+    };
+    // Every duration up to SAMPLE_LIMIT, then a uniform sample of that many (reservoir sampling);
+    // count, total and max stay exact
+    static const size_t SAMPLE_LIMIT = 4096;
+    struct Durations {
+        std::vector<int64_t> sample;
+        uint64_t count = 0;
+        int64_t total = 0;
+        int64_t max = 0;
+    };
+    std::string name_;
+    uint32_t id_;
+    bool keepEvents_;
+    int64_t originNs_;
+    Durations durations_[(size_t)Stage::COUNT];
+    uint64_t rng_;
+    void add(Durations &d, int64_t ns);
+    std::vector<Event> events_;
+    std::vector<std::string> labels_;
+    uint64_t bytesWritten_;
+    uint64_t filesWritten_;
+};
+
+// All the tracks of a run. Read the results only once the recording threads are done.
+class StageStats {
+public:
+    explicit StageStats(bool keepEvents);
+    // New track for the calling thread; the pointer stays valid for the lifetime of this object
+    StageTrack* track(const std::string &name);
+    // Track owned by the caller, not part of the results until absorbed into one of track()'s
+    StageTrack scratch() const;
+    std::string summary() const;
+    // Times a stage was recorded, over all tracks
+    uint64_t count(Stage s) const;
+    // Chrome trace-event JSON (Perfetto, chrome://tracing), one track per thread
+    bool write_trace(const std::string &path, std::string &err) const;
+    static int64_t now_ns();
+
+private:
+    bool keepEvents_;
+    int64_t originNs_;
+    mutable std::mutex mutex_;
+    std::deque<StageTrack> tracks_;
+};
+
+// Peak resident set size of this process so far, in bytes (0 if the platform does not say)
+uint64_t peak_rss_bytes();
+
+// Times one stage on `track`; does not touch the clock at all when track is null
+class StageTimer {
+public:
+    StageTimer(StageTrack* track, Stage stage, uint32_t arg = 0):
+        track_(track), stage_(stage), arg_(arg), startNs_(track ? StageStats::now_ns() : 0) {}
+    ~StageTimer() { if (track_) track_->record(stage_, startNs_, StageStats::now_ns(), arg_); }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+private:
+    StageTrack* track_;
+    Stage stage_;
+    uint32_t arg_;
+    int64_t startNs_;
+};
+
+} // namespace ilpd
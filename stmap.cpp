@@ -0,0 +1,688 @@
+// stmap.cpp
+// - ILPD lens model parser, kernel selection, banded row pipeline, OpenEXR / TIFF scanline writers
+
+#include "stmap.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <initializer_list>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "stmap_kernel.h"
+#include "json_reader.h"
+
+#if defined(ILPD_STMAP_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#error "the EXR and TIFF writers store native little-endian floats"
+#endif
+
+namespace ilpd {
+
+namespace {
+
+// ---- lens model ----
+
+bool number(const JsonValue* v, double &out) {
+    if (!v || v->type != JsonValue::NUMBER) return false;
+    out = strtod(v->raw.c_str(), nullptr);
+    return true;
+}
+
+void numbers(const JsonValue &v, vector<double> &out) {
+    if (v.type == JsonValue::NUMBER) out.push_back(strtod(v.raw.c_str(), nullptr));
+    else if (v.type == JsonValue::ARRAY) for (const JsonValue &i : v.items) numbers(i, out);
+}
+
+const JsonValue* field(const JsonValue &o, std::initializer_list<const char*> names) {
+    for (const char* n : names) {
+        if (const JsonValue* v = o.get(n)) return v;
+    }
+    return nullptr;
+}
+
+// Calibrations often group the values ("intrinsics": {...}, "distortion": {...}), so a lens object's
+// fields are looked up in the object itself and then in its direct child objects
+const JsonValue* lens_field(const JsonValue &o, std::initializer_list<const char*> names) {
+    if (const JsonValue* v = field(o, names)) return v;
+    for (const auto &m : o.members) {
+        if (m.second.type != JsonValue::OBJECT) continue;
+        if (const JsonValue* v = field(m.second, names)) return v;
+    }
+    return nullptr;
+}
+
+// [a, b] or {"x"/"width": a, "y"/"height": b}
+bool number_pair(const JsonValue* v, double &a, double &b) {
+    if (!v) return false;
+    if (v->type == JsonValue::ARRAY) {
+        vector<double> n;
+        numbers(*v, n);
+        if (n.size() != 2) return false;
+        a = n[0];
+        b = n[1];
+        return true;
+    }
+    if (v->type == JsonValue::OBJECT) {
+        return number(field(*v, {"x", "width", "w"}), a) && number(field(*v, {"y", "height", "h"}), b);
+    }
+    return false;
+}
+
+bool image_size(const JsonValue &o, double &w, double &h, bool nested) {
+    auto get = [&](std::initializer_list<const char*> names) { return nested ? lens_field(o, names) : field(o, names); };
+    double ww, hh;
+    if (number(get({"width", "imageWidth", "image_width"}), ww) && number(get({"height", "imageHeight", "image_height"}), hh)) {
+        w = ww;
+        h = hh;
+        return true;
+    }
+    if (number_pair(get({"imageSize", "image_size", "resolution", "size"}), ww, hh)) {
+        w = ww;
+        h = hh;
+        return true;
+    }
+    return false;
+}
+
+// fx/fy, a focal length or a pair of them in `o` (and its groups when `nested`)
+bool focal_length(const JsonValue &o, bool nested, double &fx, double &fy) {
+    auto get = [&](std::initializer_list<const char*> names) { return nested ? lens_field(o, names) : field(o, names); };
+    double f;
+    if (number(get({"fx", "focalLengthX", "focal_length_x"}), fx)) {
+        if (!number(get({"fy", "focalLengthY", "focal_length_y"}), fy)) fy = fx;
+    } else if (number(get({"focalLength", "focal_length", "focal"}), f)) {
+        fx = fy = f;
+    } else if (!number_pair(get({"focalLength", "focal_length", "focal"}), fx, fy)) {
+        return false;
+    }
+    return fx > 0 && fy > 0;
+}
+
+// Child objects that hold part of one lens rather than a lens of their own
+bool lens_group(const string &key) {
+    for (const char* g : {"intrinsics", "intrinsic", "intrinsicParameters", "camera", "cameraMatrix", "camera_matrix",
+                          "projection", "lens", "model", "parameters", "params"}) {
+        if (key == g) return true;
+    }
+    return false;
+}
+
+// With no focal length of its own, `o` is one lens with grouped fields only if at most one child
+// carries a focal length and that child is a group: {"left": {"fx": ..}, "right": {"fx": ..}} is two
+// eyes, {"intrinsics": {"fx": ..}, "distortion": {..}} one
+bool holds_lenses(const JsonValue &o) {
+    double fx, fy;
+    if (focal_length(o, false, fx, fy)) return false;
+    size_t lenses = 0;
+    bool groupOnly = true;
+    for (const auto &m : o.members) {
+        if (m.second.type != JsonValue::OBJECT || !focal_length(m.second, true, fx, fy)) continue;
+        ++lenses;
+        groupOnly = groupOnly && lens_group(m.first);
+    }
+    return lenses >= 2 || (lenses == 1 && !groupOnly);
+}
+
+// One eye, if `o` carries a focal length; width/height come from an enclosing object when it has none
+bool read_lens(const JsonValue &o, double inheritedW, double inheritedH, EyeLens &e) {
+    if (!focal_length(o, true, e.fx, e.fy)) return false;
+
+    e.width = inheritedW;
+    e.height = inheritedH;
+    image_size(o, e.width, e.height, true);
+    bool haveCenter = number(lens_field(o, {"cx", "principalPointX"}), e.cx) && number(lens_field(o, {"cy", "principalPointY"}), e.cy);
+    if (!haveCenter) haveCenter = number_pair(lens_field(o, {"principalPoint", "principal_point", "center", "opticalCenter"}), e.cx, e.cy);
+
+    const JsonValue* kv[4] = {lens_field(o, {"k1"}), lens_field(o, {"k2"}), lens_field(o, {"k3"}), lens_field(o, {"k4"})};
+    if (kv[0]) {
+        for (int i = 0; i < 4; ++i) number(kv[i], e.k[i]);
+    } else if (const JsonValue* d = lens_field(o, {"distortion", "distortionCoefficients", "distortion_coefficients", "kb", "k"})) {
+        vector<double> n;
+        numbers(*d, n);
+        for (size_t i = 0; i < n.size() && i < 4; ++i) e.k[i] = n[i];
+    }
+    if (const JsonValue* r = lens_field(o, {"rotation", "rotationMatrix", "rotation_matrix", "R"})) {
+        vector<double> n;
+        numbers(*r, n);
+        if (n.size() == 9) for (int i = 0; i < 9; ++i) e.rotation[i] = n[i];
+    }
+    number(lens_field(o, {"fov", "fieldOfView", "field_of_view"}), e.fovDeg);
+
+    // Normalized calibrations (focal length in image widths) are scaled to pixels
+    if (e.fx <= 4 && e.width > 0 && e.height > 0) {
+        e.fx *= e.width;
+        e.fy *= e.height;
+        if (haveCenter && e.cx <= 1.5 && e.cy <= 1.5) {
+            e.cx *= e.width;
+            e.cy *= e.height;
+        }
+    }
+    if (!haveCenter) {
+        e.cx = (e.width - 1) / 2;
+        e.cy = (e.height - 1) / 2;
+    }
+    return true;
+}
+
+void find_lenses(const JsonValue &v, const string &key, double w, double h, vector<EyeLens> &eyes) {
+    if (v.type == JsonValue::ARRAY) {
+        for (const JsonValue &item : v.items) find_lenses(item, string(), w, h, eyes);
+        return;
+    }
+    if (v.type != JsonValue::OBJECT) return;
+    image_size(v, w, h, false);
+    EyeLens e;
+    if (!holds_lenses(v) && read_lens(v, w, h, e)) {
+        const JsonValue* name = field(v, {"eye", "name", "label", "id"});
+        e.name = name && name->type == JsonValue::STRING ? name->str : key;
+        eyes.push_back(e);
+        return;
+    }
+    for (const auto &m : v.members) find_lenses(m.second, m.first, w, h, eyes);
+}
+
+// Eye names end up in file names
+string clean_name(const string &s) {
+    string out;
+    for (char c : s) out += (isalnum((unsigned char)c) || c == '-' || c == '_') ? c : '_';
+    return out;
+}
+
+// ---- kernels ----
+
+struct ScalarOps {
+    typedef float T;
+    typedef bool M;
+    static const size_t N = 1;
+    static T load(const float* p) { return *p; }
+    static void store(float* p, T v) { *p = v; }
+    static T set(float v) { return v; }
+    static T add(T a, T b) { return a + b; }
+    static T sub(T a, T b) { return a - b; }
+    static T mul(T a, T b) { return a * b; }
+    static T div(T a, T b) { return a / b; }
+    static T fma(T a, T b, T c) { return a * b + c; }
+    static T sqrt(T a) { return std::sqrt(a); }
+    static T abs(T a) { return std::fabs(a); }
+    static T min(T a, T b) { return a < b ? a : b; }
+    static T max(T a, T b) { return a > b ? a : b; }
+    static M gt(T a, T b) { return a > b; }
+    static M lt(T a, T b) { return a < b; }
+    static T select(M m, T a, T b) { return m ? a : b; }
+};
+
+#if defined(__aarch64__)
+struct NeonOps {
+    typedef float32x4_t T;
+    typedef uint32x4_t M;
+    static const size_t N = 4;
+    static T load(const float* p) { return vld1q_f32(p); }
+    static void store(float* p, T v) { vst1q_f32(p, v); }
+    static T set(float v) { return vdupq_n_f32(v); }
+    static T add(T a, T b) { return vaddq_f32(a, b); }
+    static T sub(T a, T b) { return vsubq_f32(a, b); }
+    static T mul(T a, T b) { return vmulq_f32(a, b); }
+    static T div(T a, T b) { return vdivq_f32(a, b); }
+    static T fma(T a, T b, T c) { return vfmaq_f32(c, a, b); }
+    static T sqrt(T a) { return vsqrtq_f32(a); }
+    static T abs(T a) { return vabsq_f32(a); }
+    static T min(T a, T b) { return vminq_f32(a, b); }
+    static T max(T a, T b) { return vmaxq_f32(a, b); }
+    static M gt(T a, T b) { return vcgtq_f32(a, b); }
+    static M lt(T a, T b) { return vcltq_f32(a, b); }
+    static T select(M m, T a, T b) { return vbslq_f32(m, a, b); }
+};
+
+size_t stmap_row_neon(const StmapRowParams &p, float sinLat, float cosLat, const float* sinLon, const float* cosLon,
+                      float* s, float* t, size_t count) {
+    size_t done = count - count % NeonOps::N;
+    stmap_row_vec<NeonOps>(p, sinLat, cosLat, sinLon, cosLon, s, t, done);
+    return done;
+}
+#endif
+
+typedef size_t (*RowKernel)(const StmapRowParams&, float, float, const float*, const float*, float*, float*, size_t);
+
+#ifdef ILPD_STMAP_X86
+// AVX2 and FMA, with an OS that saves the YMM registers
+bool cpu_has_avx2_fma() {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    const bool fma = (r[2] >> 12) & 1;
+    const bool osxsave = (r[2] >> 27) & 1;
+    if (!fma || !osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(r, 7, 0);
+    return (r[1] >> 5) & 1;
+#else
+    return false;
+#endif
+}
+#endif
+
+// Widest kernel for this CPU, null for scalar only
+RowKernel simd_kernel(const char* &name) {
+#if defined(ILPD_STMAP_X86)
+    if (cpu_has_avx2_fma()) {
+        float probe[8] = {0}, ps[8], pt[8];
+        StmapRowParams p = {};
+        p.rot[0] = p.rot[4] = p.rot[8] = 1;
+        // 0 when stmap_avx2.cpp was built without -mavx2 -mfma
+        if (stmap_row_avx2(p, 0, 1, probe, probe, ps, pt, 8) == 8) {
+            name = "avx2";
+            return stmap_row_avx2;
+        }
+    }
+#elif defined(__aarch64__)
+    name = "neon";
+    return stmap_row_neon;
+#endif
+    name = "scalar";
+    return nullptr;
+}
+
+// ---- writers ----
+
+void put_u16(string &out, uint16_t v) { out.append(reinterpret_cast<const char*>(&v), 2); }
+void put_u32(string &out, uint32_t v) { out.append(reinterpret_cast<const char*>(&v), 4); }
+void put_u64(string &out, uint64_t v) { out.append(reinterpret_cast<const char*>(&v), 8); }
+void put_f32(string &out, float v) { out.append(reinterpret_cast<const char*>(&v), 4); }
+void put_floats(string &out, const float* v, size_t n) { out.append(reinterpret_cast<const char*>(v), n * sizeof(float)); }
+
+// Uncompressed layouts only, so every row's offset is known before the first one is computed
+class StmapFile {
+public:
+    StmapFile(StmapFormat format, uint32_t width, uint32_t height): format_(format), w_(width), h_(height) {}
+
+    uint64_t size() const {
+        return format_ == StmapFormat::EXR ? exr_header_size() + (uint64_t)h_ * (8 + (uint64_t)w_ * 8)
+                                           : tiff_data_offset() + (uint64_t)h_ * w_ * 12;
+    }
+
+    string header() const { return format_ == StmapFormat::EXR ? exr_header() : tiff_header(); }
+
+    void rows(string &out, uint32_t y0, uint32_t count, const float* s, const float* t) const {
+        for (uint32_t r = 0; r < count; ++r) {
+            const float* rs = s + (size_t)r * w_;
+            const float* rt = t + (size_t)r * w_;
+            if (format_ == StmapFormat::EXR) {
+                // scanline block: y, byte count, then each channel in name order (G, R)
+                put_u32(out, y0 + r);
+                put_u32(out, w_ * 8);
+                put_floats(out, rt, w_);
+                put_floats(out, rs, w_);
+            } else {
+                for (uint32_t x = 0; x < w_; ++x) {
+                    const float px[3] = {rs[x], rt[x], 0.0f};
+                    put_floats(out, px, 3);
+                }
+            }
+        }
+    }
+
+private:
+    static void exr_attr(string &out, const char* name, const char* type, const string &value) {
+        out += name;
+        out += '\0';
+        out += type;
+        out += '\0';
+        put_u32(out, (uint32_t)value.size());
+        out += value;
+    }
+    string exr_attrs() const {
+        string h;
+        put_u32(h, 20000630);   // magic
+        put_u32(h, 2);          // version 2, single-part scanline
+        string chlist;
+        for (const char* c : {"G", "R"}) {
+            chlist += c;
+            chlist += '\0';
+            put_u32(chlist, 2);     // FLOAT
+            put_u32(chlist, 0);     // pLinear + reserved
+            put_u32(chlist, 1);     // x sampling
+            put_u32(chlist, 1);     // y sampling
+        }
+        chlist += '\0';
+        exr_attr(h, "channels", "chlist", chlist);
+        exr_attr(h, "compression", "compression", string(1, '\0'));
+        string box;
+        put_u32(box, 0);
+        put_u32(box, 0);
+        put_u32(box, w_ - 1);
+        put_u32(box, h_ - 1);
+        exr_attr(h, "dataWindow", "box2i", box);
+        exr_attr(h, "displayWindow", "box2i", box);
+        exr_attr(h, "lineOrder", "lineOrder", string(1, '\0'));
+        string f;
+        put_f32(f, 1.0f);
+        exr_attr(h, "pixelAspectRatio", "float", f);
+        string center;
+        put_f32(center, 0.0f);
+        put_f32(center, 0.0f);
+        exr_attr(h, "screenWindowCenter", "v2f", center);
+        exr_attr(h, "screenWindowWidth", "float", f);
+        h += '\0';
+        return h;
+    }
+    uint64_t exr_header_size() const { return exr_attrs().size() + (uint64_t)h_ * 8; }
+    string exr_header() const {
+        string h = exr_attrs();
+        const uint64_t first = h.size() + (uint64_t)h_ * 8;
+        for (uint32_t y = 0; y < h_; ++y) put_u64(h, first + (uint64_t)y * (8 + (uint64_t)w_ * 8));
+        return h;
+    }
+
+    // Little-endian baseline TIFF: header, one IFD, value arrays, then one strip per row
+    static const uint32_t TIFF_ENTRIES = 11;
+    uint32_t tiff_arrays_offset() const { return 8 + 2 + TIFF_ENTRIES * 12 + 4; }
+    uint64_t tiff_data_offset() const { return tiff_arrays_offset() + 16 + (uint64_t)h_ * 8; }
+    string tiff_header() const {
+        const uint32_t bpsOff = tiff_arrays_offset();
+        const uint32_t formatOff = bpsOff + 8;
+        const uint32_t stripOffsetsOff = formatOff + 8;
+        const uint32_t stripCountsOff = stripOffsetsOff + h_ * 4;
+        const uint32_t data = (uint32_t)tiff_data_offset();
+        const uint32_t rowBytes = w_ * 12;
+        string t = "II";
+        put_u16(t, 42);
+        put_u32(t, 8);
+        put_u16(t, (uint16_t)TIFF_ENTRIES);
+        auto entry = [&](uint16_t tag, uint16_t type, uint32_t count, uint32_t value) {
+            put_u16(t, tag);
+            put_u16(t, type);
+            put_u32(t, count);
+            if (type == 3 && count == 1) {
+                put_u16(t, (uint16_t)value);
+                put_u16(t, 0);
+            } else {
+                put_u32(t, value);
+            }
+        };
+        entry(256, 4, 1, w_);                   // ImageWidth
+        entry(257, 4, 1, h_);                   // ImageLength
+        entry(258, 3, 3, bpsOff);               // BitsPerSample 32, 32, 32
+        entry(259, 3, 1, 1);                    // Compression: none
+        entry(262, 3, 1, 2);                    // Photometric: RGB
+        entry(273, 4, h_, h_ == 1 ? data : stripOffsetsOff);
+        entry(277, 3, 1, 3);                    // SamplesPerPixel
+        entry(278, 4, 1, 1);                    // RowsPerStrip
+        entry(279, 4, h_, h_ == 1 ? rowBytes : stripCountsOff);
+        entry(284, 3, 1, 1);                    // PlanarConfiguration: interleaved
+        entry(339, 3, 3, formatOff);            // SampleFormat: IEEE float
+        put_u32(t, 0);                          // no next IFD
+        for (int i = 0; i < 3; ++i) put_u16(t, 32);
+        put_u16(t, 0);
+        for (int i = 0; i < 3; ++i) put_u16(t, 3);
+        put_u16(t, 0);
+        for (uint32_t y = 0; y < h_; ++y) put_u32(t, data + y * rowBytes);
+        for (uint32_t y = 0; y < h_; ++y) put_u32(t, rowBytes);
+        return t;
+    }
+
+    StmapFormat format_;
+    uint32_t w_;
+    uint32_t h_;
+};
+
+} // namespace
+
+bool parse_lens_model(const string &ilpd, LensModel &model, string &err) {
+    JsonValue root;
+    JsonParser parser(ilpd);
+    if (!parser.parse(root, err)) {
+        err = "ILPD is not JSON: " + err;
+        return false;
+    }
+    model.eyes.clear();
+    find_lenses(root, string(), 0, 0, model.eyes);
+    if (model.eyes.empty()) {
+        err = "no lens model found in the ILPD (expected fx/fy or focalLength per eye)";
+        return false;
+    }
+    for (size_t i = 0; i < model.eyes.size(); ++i) {
+        EyeLens &e = model.eyes[i];
+        e.name = clean_name(e.name);
+        bool taken = e.name.empty();
+        for (size_t j = 0; j < i; ++j) taken = taken || model.eyes[j].name == e.name;
+        if (taken) e.name = "eye" + std::to_string(i + 1);
+        if (!(e.width > 0) || !(e.height > 0)) {
+            err = "lens model " + e.name + " has no image size (width/height or imageSize)";
+            return false;
+        }
+    }
+    return true;
+}
+
+string describe_lens(const EyeLens &e) {
+    char buf[320];
+    snprintf(buf, sizeof(buf), "%s: %.0fx%.0f, f %.3f/%.3f, c %.3f/%.3f, k %g/%g/%g/%g%s", e.name.c_str(), e.width, e.height,
+             e.fx, e.fy, e.cx, e.cy, e.k[0], e.k[1], e.k[2], e.k[3],
+             e.fovDeg > 0 ? (", fov " + std::to_string((int)std::lround(e.fovDeg))).c_str() : "");
+    return buf;
+}
+
+const char* stmap_kernel_name(bool scalar) {
+    const char* name = "scalar";
+    if (!scalar) simd_kernel(name);
+    return name;
+}
+
+void stmap_row_params(const EyeLens &eye, StmapRowParams &p) {
+    p.fx = (float)eye.fx;
+    p.fy = (float)eye.fy;
+    p.cx = (float)eye.cx;
+    p.cy = (float)eye.cy;
+    p.k1 = (float)eye.k[0];
+    p.k2 = (float)eye.k[1];
+    p.k3 = (float)eye.k[2];
+    p.k4 = (float)eye.k[3];
+    for (int i = 0; i < 9; ++i) p.rot[i] = (float)eye.rotation[i];
+    p.invWidth = (float)(1.0 / eye.width);
+    p.invHeight = (float)(1.0 / eye.height);
+    p.thetaMax = eye.fovDeg > 0 ? (float)(eye.fovDeg * M_PI / 360.0) : 4.0f;
+}
+
+void stmap_size(const EyeLens &eye, const StmapOptions &opts, unsigned &width, unsigned &height) {
+    width = opts.width ? opts.width : (unsigned)std::lround(eye.width);
+    height = opts.height ? opts.height : (unsigned)std::lround(eye.height);
+}
+
+namespace {
+
+// One eye at one output size: equirectangular, longitude per column, latitude per row, pixel centers
+struct RowSetup {
+    StmapRowParams p;
+    RowKernel simd = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    double fov = 0;
+    vector<float> sinLon, cosLon;
+
+    RowSetup(const EyeLens &eye, const StmapOptions &opts, bool scalar) {
+        stmap_row_params(eye, p);
+        unsigned w, h;
+        stmap_size(eye, opts, w, h);
+        width = w;
+        height = h;
+        fov = opts.fovDeg * M_PI / 180.0;
+        sinLon.resize(width);
+        cosLon.resize(width);
+        for (uint32_t x = 0; x < width; ++x) {
+            double lon = ((x + 0.5) / width - 0.5) * fov;
+            sinLon[x] = (float)std::sin(lon);
+            cosLon[x] = (float)std::cos(lon);
+        }
+        const char* name;
+        if (!scalar) simd = simd_kernel(name);
+    }
+
+    void row(uint32_t y, float* s, float* t) const {
+        const double lat = (0.5 - (y + 0.5) / height) * fov;
+        const float sl = (float)std::sin(lat), cl = (float)std::cos(lat);
+        size_t done = simd ? simd(p, sl, cl, sinLon.data(), cosLon.data(), s, t, width) : 0;
+        stmap_row_vec<ScalarOps>(p, sl, cl, sinLon.data() + done, cosLon.data() + done, s + done, t + done, width - done);
+    }
+};
+
+bool check_size(const StmapFile &file, StmapFormat format, uint32_t w, uint32_t h, string &err) {
+    if (!w || !h) {
+        err = "empty output size";
+        return false;
+    }
+    if (format == StmapFormat::TIFF && file.size() > UINT32_MAX) {
+        err = "a " + std::to_string(w) + "x" + std::to_string(h) + " float TIFF is over 4 GB, use EXR";
+        return false;
+    }
+    return true;
+}
+
+const uint32_t BAND = 16;
+
+} // namespace
+
+bool write_stmap(const EyeLens &eye, const StmapOptions &opts, const string &path, string &err) {
+    const RowSetup setup(eye, opts, opts.scalar);
+    const uint32_t W = setup.width, H = setup.height;
+    StmapFile file(opts.format, W, H);
+    if (!check_size(file, opts.format, W, H, err)) return false;
+    AtomicWriter plain;
+    AtomicFile output(opts.writer ? *opts.writer : plain, path);
+    if (!output.open(err)) return false;
+    bool ok = output.write(file.header());
+
+    // Workers compute bands of rows into a ring of slots; this thread writes them out in order and
+    // frees the slot. A worker waits for its slot, so at most `slots` bands are ever held.
+    const uint32_t bands = (H + BAND - 1) / BAND;
+    const unsigned threads = std::max(1u, std::min(opts.threads, bands));
+    const uint32_t slots = threads * 2;
+    struct Slot {
+        vector<float> s, t;
+        uint32_t band = UINT32_MAX;
+    };
+    vector<Slot> ring(slots);
+    for (Slot &slot : ring) {
+        slot.s.resize((size_t)BAND * W);
+        slot.t.resize((size_t)BAND * W);
+    }
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint32_t nextBand = 0;
+    uint32_t written = 0;
+    bool failed = !ok;
+
+    auto work = [&]() {
+        for (;;) {
+            uint32_t band;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (failed || nextBand >= bands) return;
+                band = nextBand++;
+                changed.wait(lock, [&] { return failed || band < written + slots; });
+                if (failed) return;
+            }
+            Slot &slot = ring[band % slots];
+            const uint32_t y0 = band * BAND;
+            const uint32_t rows = std::min(BAND, H - y0);
+            for (uint32_t r = 0; r < rows; ++r) setup.row(y0 + r, slot.s.data() + (size_t)r * W, slot.t.data() + (size_t)r * W);
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.band = band;
+            changed.notify_all();
+        }
+    };
+    vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i) pool.emplace_back(work);
+
+    string out;
+    for (uint32_t band = 0; band < bands && !failed; ++band) {
+        Slot &slot = ring[band % slots];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return slot.band == band; });
+        }
+        const uint32_t y0 = band * BAND;
+        out.clear();
+        file.rows(out, y0, std::min(BAND, H - y0), slot.s.data(), slot.t.data());
+        bool wrote = output.write(out);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!wrote) failed = true;
+        ++written;
+        changed.notify_all();
+    }
+    for (std::thread &t : pool) t.join();
+    return output.commit(err);
+}
+
+bool write_stmap_planes(const string &path, StmapFormat format, unsigned width, unsigned height, const float* s,
+                        const float* t, AtomicWriter* writer, string &err) {
+    StmapFile file(format, width, height);
+    if (!check_size(file, format, width, height, err)) return false;
+    AtomicWriter plain;
+    AtomicFile output(writer ? *writer : plain, path);
+    if (!output.open(err)) return false;
+    bool ok = output.write(file.header());
+    string out;
+    for (uint32_t y0 = 0; ok && y0 < height; y0 += BAND) {
+        out.clear();
+        const size_t at = (size_t)y0 * width;
+        file.rows(out, y0, std::min(BAND, height - y0), s + at, t + at);
+        ok = output.write(out);
+    }
+    return output.commit(err);
+}
+
+double stmap_check_rows(const EyeLens &eye, const StmapOptions &opts, const float* s, const float* t, size_t &flipped) {
+    const RowSetup setup(eye, opts, true);
+    const uint32_t W = setup.width, H = setup.height;
+    vector<float> rs(W), rt(W);
+    double maxDiff = 0;
+    flipped = 0;
+    const uint32_t samples = std::min(H, 8u);
+    for (uint32_t i = 0; i < samples; ++i) {
+        const uint32_t y = (uint32_t)(((uint64_t)i * 2 + 1) * H / (samples * 2));
+        setup.row(y, rs.data(), rt.data());
+        const float* gs = s + (size_t)y * W;
+        const float* gt = t + (size_t)y * W;
+        for (uint32_t x = 0; x < W; ++x) {
+            // right at the edge of the lens either side may round outside
+            if ((rs[x] == -1) != (gs[x] == -1)) {
+                ++flipped;
+                continue;
+            }
+            maxDiff = std::max(maxDiff, (double)std::fabs(rs[x] - gs[x]));
+            maxDiff = std::max(maxDiff, (double)std::fabs(rt[x] - gt[x]));
+        }
+    }
+    return maxDiff;
+}
+
+#if !defined(BRAW2ILPD_HAVE_METAL)
+const char* stmap_gpu_name() {
+    return nullptr;
+}
+
+bool write_stmaps_gpu(const vector<StmapJob> &, const std::function<void(size_t, const string &)> &, string &err) {
+    err = "built without GPU support";
+    return false;
+}
+#endif
+
+} // namespace ilpd
@@ -0,0 +1,82 @@
+// stmap.h
+// - braw2ilpd stmap: STMaps (per-pixel source coordinates) for each eye of an ILPD lens profile
+// - Lens model per eye: fisheye intrinsics with Kannala-Brandt (equidistant) distortion, optional rotation
+// - Output: one equirectangular map per eye, 32-bit float OpenEXR (R, G) or TIFF (RGB, B = 0)
+// - Rows are computed in bands on every core with SIMD kernels (AVX2, NEON, scalar fallback) and
+//   streamed to the file in order, so memory stays at a few bands whatever the size
+// - macOS with BRAW2ILPD_HAVE_METAL: all maps of a run in one Metal batch (stmap_metal.mm), files
+//   written while the GPU computes the next ones
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "ilpdextract.h"
+
+namespace ilpd {
+
+struct EyeLens {
+    string name;                    // "left", "right", ... (from the profile, otherwise "eye1", "eye2")
+    double width = 0;               // source image size in pixels
+    double height = 0;
+    double fx = 0, fy = 0;          // focal length in pixels
+    double cx = 0, cy = 0;          // principal point in pixels (pixel centers on integers)
+    double k[4] = {0, 0, 0, 0};     // Kannala-Brandt coefficients
+    double rotation[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};  // camera direction = rotation * output direction
+    double fovDeg = 0;              // lens field of view if the profile states one, 0 = unlimited
+};
+
+struct LensModel {
+    vector<EyeLens> eyes;
+};
+
+// Find the per-eye lens models in an ILPD (JSON). The field names of OpenCV/Kannala-Brandt style
+// calibrations are recognized (fx/fy or focalLength, cx/cy or principalPoint, k1..k4 or a distortion
+// array, width/height or imageSize), at any depth; INVALID_FILE_FORMAT-style failure with `err`.
+bool parse_lens_model(const string &ilpd, LensModel &model, string &err);
+string describe_lens(const EyeLens &eye);
+
+enum class StmapFormat { EXR, TIFF };
+
+struct StmapOptions {
+    unsigned width = 0;             // output size, 0 = the source size of each eye
+    unsigned height = 0;
+    double fovDeg = 180;            // of the equirectangular output, horizontally and vertically
+    StmapFormat format = StmapFormat::EXR;
+    unsigned threads = 1;
+    bool scalar = false;            // skip the SIMD kernels (for comparisons)
+    AtomicWriter* writer = nullptr; // the files go through it (--durability); null: rename only
+};
+
+// "avx2", "neon" or "scalar": what write_stmap() runs on this CPU
+const char* stmap_kernel_name(bool scalar);
+
+// Generate one eye's STMap into `path` (unique tmp + rename through opts.writer)
+bool write_stmap(const EyeLens &eye, const StmapOptions &opts, const string &path, string &err);
+
+// One map of a GPU batch (threads and scalar are not used there)
+struct StmapJob {
+    EyeLens eye;
+    StmapOptions opts;
+    string path;
+};
+
+// "metal" when the GPU backend is built and a device is present, otherwise null
+const char* stmap_gpu_name();
+// Generate all jobs in one GPU batch. `done` runs on the calling thread after each job, in job order,
+// with an empty error once its file is written. False with `err` if the GPU cannot be used at all.
+bool write_stmaps_gpu(const vector<StmapJob> &jobs, const std::function<void(size_t, const string &)> &done, string &err);
+
+// Shared by the CPU and GPU paths
+struct StmapRowParams;
+void stmap_row_params(const EyeLens &eye, StmapRowParams &p);
+void stmap_size(const EyeLens &eye, const StmapOptions &opts, unsigned &width, unsigned &height);
+// Write a map computed elsewhere: s and t planes of width * height floats, row-major
+bool write_stmap_planes(const string &path, StmapFormat format, unsigned width, unsigned height, const float* s,
+                        const float* t, AtomicWriter* writer, string &err);
+// Largest difference to the CPU kernel over a few sampled rows; pixels inside on one side only counted in `flipped`
+double stmap_check_rows(const EyeLens &eye, const StmapOptions &opts, const float* s, const float* t, size_t &flipped);
+
+} // namespace ilpd
@@ -0,0 +1,63 @@
+// stmap_avx2.cpp
+// - AVX2 + FMA instance of the STMap row kernel; built with -mavx2 -mfma (/arch:AVX2 with MSVC, x86
+//   only) and only called after a runtime CPU check, so include nothing that other files also instantiate
+
+#include "stmap_kernel.h"
+
+// MSVC's /arch:AVX2 enables FMA as well but does not define __FMA__
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define ILPD_STMAP_AVX2 1
+#endif
+
+#if defined(ILPD_STMAP_X86) && defined(ILPD_STMAP_AVX2)
+#include <immintrin.h>
+#endif
+
+namespace ilpd {
+
+#ifdef ILPD_STMAP_X86
+#ifdef ILPD_STMAP_AVX2
+
+namespace {
+
+struct Avx2Ops {
+    typedef __m256 T;
+    typedef __m256 M;
+    static const size_t N = 8;
+    static T load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, T v) { _mm256_storeu_ps(p, v); }
+    static T set(float v) { return _mm256_set1_ps(v); }
+    static T add(T a, T b) { return _mm256_add_ps(a, b); }
+    static T sub(T a, T b) { return _mm256_sub_ps(a, b); }
+    static T mul(T a, T b) { return _mm256_mul_ps(a, b); }
+    static T div(T a, T b) { return _mm256_div_ps(a, b); }
+    static T fma(T a, T b, T c) { return _mm256_fmadd_ps(a, b, c); }
+    static T sqrt(T a) { return _mm256_sqrt_ps(a); }
+    static T abs(T a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static T min(T a, T b) { return _mm256_min_ps(a, b); }
+    static T max(T a, T b) { return _mm256_max_ps(a, b); }
+    static M gt(T a, T b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static M lt(T a, T b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static T select(M m, T a, T b) { return _mm256_blendv_ps(b, a, m); }
+};
+
+} // namespace
+
+size_t stmap_row_avx2(const StmapRowParams &p, float sinLat, float cosLat, const float* sinLon, const float* cosLon,
+                      float* s, float* t, size_t count) {
+    size_t done = count - count % Avx2Ops::N;
+    stmap_row_vec<Avx2Ops>(p, sinLat, cosLat, sinLon, cosLon, s, t, done);
+    return done;
+}
+
+#else
+
+// Built without AVX2 (the arm64 slice of a universal build): the caller falls back
+size_t stmap_row_avx2(const StmapRowParams &, float, float, const float*, const float*, float*, float*, size_t) {
+    return 0;
+}
+
+#endif
+#endif
+
+} // namespace ilpd
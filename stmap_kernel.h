@@ -0,0 +1,82 @@
+// stmap_kernel.h
+// - Per-row STMap kernel shared by the scalar, NEON and AVX2 builds, written against a small
+//   vector "ops" type (load/store, arithmetic, compare + select)
+// - Included by stmap_avx2.cpp, which is compiled with -mavx2 -mfma; keep it free of std headers
+//   and non-template inline functions so no AVX2 code leaks into functions shared with other files
+
+#pragma once
+
+#include <stddef.h>
+
+namespace ilpd {
+
+// One eye's lens model in the form the kernel uses (float, radians, source pixels)
+struct StmapRowParams {
+    float fx, fy, cx, cy;       // focal length and principal point
+    float k1, k2, k3, k4;       // Kannala-Brandt: r = theta (1 + k1 theta^2 + k2 theta^4 + k3 theta^6 + k4 theta^8)
+    float rot[9];               // camera direction = rot * output direction (row-major)
+    float invWidth, invHeight;  // 1 / source image size
+    float thetaMax;             // directions further off axis map to (-1, -1)
+};
+
+// s/t of one output row for `count` pixels (a multiple of O::N). The output direction of pixel i is
+// (cosLat sinLon[i], sinLat, cosLat cosLon[i]): x right, y up, z forward.
+template <class O>
+void stmap_row_vec(const StmapRowParams &p, float sinLat, float cosLat, const float* sinLon, const float* cosLon,
+                   float* s, float* t, size_t count) {
+    typedef typename O::T V;
+    typedef typename O::M M;
+    const V zero = O::set(0.0f), one = O::set(1.0f), half = O::set(0.5f), minusOne = O::set(-1.0f);
+    const V tiny = O::set(1e-12f), pi = O::set(3.14159265358979f), halfPi = O::set(1.57079632679490f);
+    const V quarterPi = O::set(0.78539816339745f), tanPi8 = O::set(0.41421356237310f);
+    const V a0 = O::set(8.05374449538e-2f), a1 = O::set(-1.38776856032e-1f), a2 = O::set(1.99777106478e-1f),
+            a3 = O::set(-3.33329491539e-1f);
+    const V k1 = O::set(p.k1), k2 = O::set(p.k2), k3 = O::set(p.k3), k4 = O::set(p.k4);
+    const V fx = O::set(p.fx), fy = O::set(p.fy), cx = O::set(p.cx), cy = O::set(p.cy);
+    const V invW = O::set(p.invWidth), invH = O::set(p.invHeight), thetaMax = O::set(p.thetaMax);
+    const V sl = O::set(sinLat), cl = O::set(cosLat);
+    const V r0 = O::set(p.rot[0]), r1 = O::set(p.rot[1]), r2 = O::set(p.rot[2]);
+    const V r3 = O::set(p.rot[3]), r4 = O::set(p.rot[4]), r5 = O::set(p.rot[5]);
+    const V r6 = O::set(p.rot[6]), r7 = O::set(p.rot[7]), r8 = O::set(p.rot[8]);
+
+    for (size_t i = 0; i < count; i += O::N) {
+        const V wx = O::mul(cl, O::load(sinLon + i));
+        const V wz = O::mul(cl, O::load(cosLon + i));
+        const V dx = O::fma(r0, wx, O::fma(r1, sl, O::mul(r2, wz)));
+        const V dy = O::fma(r3, wx, O::fma(r4, sl, O::mul(r5, wz)));
+        const V dz = O::fma(r6, wx, O::fma(r7, sl, O::mul(r8, wz)));
+
+        // theta = atan2(rho, dz): atan on [0, 1] (Cephes atanf reduction), then the octant fixups
+        const V rho = O::sqrt(O::fma(dx, dx, O::mul(dy, dy)));
+        const V az = O::abs(dz);
+        const V a = O::div(O::min(rho, az), O::max(O::max(rho, az), tiny));
+        const M big = O::gt(a, tanPi8);
+        const V x = O::select(big, O::div(O::sub(a, one), O::add(a, one)), a);
+        const V z = O::mul(x, x);
+        V at = O::fma(O::mul(O::fma(O::fma(O::fma(a0, z, a1), z, a2), z, a3), z), x, x);
+        at = O::add(at, O::select(big, quarterPi, zero));
+        at = O::select(O::gt(rho, az), O::sub(halfPi, at), at);
+        const V theta = O::select(O::lt(dz, zero), O::sub(pi, at), at);
+
+        // distorted radius over the undistorted one; theta / rho -> 1 on the optical axis
+        const V th2 = O::mul(theta, theta);
+        const V poly = O::fma(th2, O::fma(th2, O::fma(th2, O::fma(th2, k4, k3), k2), k1), one);
+        const V scale = O::select(O::gt(rho, tiny), O::div(O::mul(theta, poly), O::max(rho, tiny)), poly);
+
+        // source pixel (image y points down), normalized with pixel centers at +0.5, t = 0 at the bottom
+        const V px = O::fma(O::mul(fx, scale), dx, cx);
+        const V py = O::sub(cy, O::mul(O::mul(fy, scale), dy));
+        const M outside = O::gt(theta, thetaMax);
+        O::store(s + i, O::select(outside, minusOne, O::mul(O::add(px, half), invW)));
+        O::store(t + i, O::select(outside, minusOne, O::sub(one, O::mul(O::add(py, half), invH))));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define ILPD_STMAP_X86 1
+// stmap_avx2.cpp: full 8-pixel groups only, returns how many pixels were done (0 if built without AVX2)
+size_t stmap_row_avx2(const StmapRowParams &p, float sinLat, float cosLat, const float* sinLon, const float* cosLon,
+                      float* s, float* t, size_t count);
+#endif
+
+} // namespace ilpd
@@ -0,0 +1,232 @@
+// stmap_metal.mm
+// - Metal compute backend of braw2ilpd stmap (macOS, built with BRAW2ILPD_HAVE_METAL, ARC)
+// - One batch per run: the lens coefficients of every job go into one resident buffer, the command
+//   buffers of all jobs are queued up front (within a memory budget) and complete asynchronously
+// - Results land in shared-storage buffers; the calling thread writes job i while the GPU works on i+1..
+// - The shader is compiled from source at runtime, so the build needs no Metal toolchain
+
+#include "stmap.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <cstdio>
+
+#import <Foundation/Foundation.h>
+#import <Metal/Metal.h>
+
+#include "stmap_kernel.h"
+
+namespace ilpd {
+
+namespace {
+
+// Same math as stmap_row_vec() (stmap_kernel.h), one pixel per thread.
+// Params matches StmapRowParams: 20 floats, no vector types, so the layouts agree.
+const char* SHADER = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+struct Params {
+    float fx, fy, cx, cy;
+    float k1, k2, k3, k4;
+    float rot[9];
+    float invWidth, invHeight;
+    float thetaMax;
+};
+
+struct Job {
+    uint width;
+    uint height;
+    float fov;
+    uint param;
+};
+
+kernel void stmap(device float* s [[buffer(0)]], device float* t [[buffer(1)]],
+                  device const Params* params [[buffer(2)]], constant Job &job [[buffer(3)]],
+                  uint2 gid [[thread_position_in_grid]]) {
+    if (gid.x >= job.width || gid.y >= job.height) return;
+    const device Params &p = params[job.param];
+    const float lon = ((gid.x + 0.5f) / job.width - 0.5f) * job.fov;
+    const float lat = (0.5f - (gid.y + 0.5f) / job.height) * job.fov;
+    const float cl = precise::cos(lat), sl = precise::sin(lat);
+    const float wx = cl * precise::sin(lon), wz = cl * precise::cos(lon);
+    const float dx = fma(p.rot[0], wx, fma(p.rot[1], sl, p.rot[2] * wz));
+    const float dy = fma(p.rot[3], wx, fma(p.rot[4], sl, p.rot[5] * wz));
+    const float dz = fma(p.rot[6], wx, fma(p.rot[7], sl, p.rot[8] * wz));
+
+    const float rho = precise::sqrt(fma(dx, dx, dy * dy));
+    const float az = fabs(dz);
+    const float a = min(rho, az) / max(max(rho, az), 1e-12f);
+    const bool big = a > 0.41421356237310f;
+    const float x = big ? (a - 1.0f) / (a + 1.0f) : a;
+    const float z = x * x;
+    float at = fma(fma(fma(fma(8.05374449538e-2f, z, -1.38776856032e-1f), z, 1.99777106478e-1f), z, -3.33329491539e-1f) * z, x, x);
+    at += big ? 0.78539816339745f : 0.0f;
+    at = rho > az ? 1.57079632679490f - at : at;
+    const float theta = dz < 0.0f ? 3.14159265358979f - at : at;
+
+    const float th2 = theta * theta;
+    const float poly = fma(th2, fma(th2, fma(th2, fma(th2, p.k4, p.k3), p.k2), p.k1), 1.0f);
+    const float scale = rho > 1e-12f ? theta * poly / max(rho, 1e-12f) : poly;
+    const float px = fma(p.fx * scale, dx, p.cx);
+    const float py = p.cy - p.fy * scale * dy;
+    const bool outside = theta > p.thetaMax;
+    const uint i = gid.y * job.width + gid.x;
+    s[i] = outside ? -1.0f : (px + 0.5f) * p.invWidth;
+    t[i] = outside ? -1.0f : 1.0f - (py + 0.5f) * p.invHeight;
+}
+)";
+
+struct GpuJob {
+    uint32_t width;
+    uint32_t height;
+    float fov;
+    uint32_t param;
+};
+
+// Normalized coordinates; 1e-5 is 0.08 px on an 8K source
+const double TOLERANCE = 1e-5;
+
+// Completion state shared with the command buffer handlers (which run on a Metal thread)
+struct Completions {
+    std::mutex mutex;
+    std::condition_variable changed;
+    vector<int> state;          // 0 queued, 1 done, 2 failed
+    vector<string> error;
+};
+
+} // namespace
+
+const char* stmap_gpu_name() {
+    static const bool have = [] {
+        @autoreleasepool {
+            return MTLCreateSystemDefaultDevice() != nil;
+        }
+    }();
+    return have ? "metal" : nullptr;
+}
+
+bool write_stmaps_gpu(const vector<StmapJob> &jobs, const std::function<void(size_t, const string &)> &done, string &err) {
+    @autoreleasepool {
+        id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+        if (!device) {
+            err = "no Metal device";
+            return false;
+        }
+        NSError* error = nil;
+        MTLCompileOptions* compile = [MTLCompileOptions new];
+        compile.fastMathEnabled = NO;
+        id<MTLLibrary> library = [device newLibraryWithSource:@(SHADER) options:compile error:&error];
+        id<MTLFunction> function = library ? [library newFunctionWithName:@"stmap"] : nil;
+        id<MTLComputePipelineState> pipeline = function ? [device newComputePipelineStateWithFunction:function error:&error] : nil;
+        if (!pipeline) {
+            err = string("Metal shader failed to build: ") + (error ? error.localizedDescription.UTF8String : "no stmap function");
+            return false;
+        }
+        id<MTLCommandQueue> queue = [device newCommandQueue];
+
+        // Coefficients of every job, uploaded once for the whole batch
+        vector<StmapRowParams> params(jobs.size());
+        for (size_t i = 0; i < jobs.size(); ++i) stmap_row_params(jobs[i].eye, params[i]);
+        id<MTLBuffer> paramBuffer = [device newBufferWithBytes:params.data()
+                                                        length:std::max<size_t>(1, params.size()) * sizeof(StmapRowParams)
+                                                       options:MTLResourceStorageModeShared];
+        if (!queue || !paramBuffer) {
+            err = "Metal setup failed";
+            return false;
+        }
+
+        // Results stay queued until written, so limit what is committed ahead of the writer
+        const uint64_t budget = std::max<uint64_t>(device.recommendedMaxWorkingSetSize / 2, 256ull << 20);
+        vector<id<MTLBuffer>> outputs(jobs.size());
+        vector<uint64_t> bytes(jobs.size());
+        vector<unsigned> widths(jobs.size()), heights(jobs.size());
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            stmap_size(jobs[i].eye, jobs[i].opts, widths[i], heights[i]);
+            bytes[i] = (uint64_t)widths[i] * heights[i] * 2 * sizeof(float);
+        }
+        Completions shared;
+        Completions* completions = &shared;
+        completions->state.assign(jobs.size(), 0);
+        completions->error.resize(jobs.size());
+        auto fail = [&](size_t i, const string &what) {
+            std::lock_guard<std::mutex> lock(completions->mutex);
+            completions->state[i] = 2;
+            completions->error[i] = what;
+        };
+
+        const NSUInteger tw = pipeline.threadExecutionWidth;
+        const NSUInteger th = std::max<NSUInteger>(1, pipeline.maxTotalThreadsPerThreadgroup / tw);
+        auto submit = [&](size_t i) {
+            const unsigned W = widths[i], H = heights[i];
+            if (!W || !H) return fail(i, "empty output size");
+            if ((uint64_t)W * H > UINT32_MAX) return fail(i, "output too large for the GPU path");
+            outputs[i] = [device newBufferWithLength:(NSUInteger)bytes[i] options:MTLResourceStorageModeShared];
+            if (!outputs[i]) return fail(i, "out of GPU memory for " + std::to_string(W) + "x" + std::to_string(H));
+            id<MTLCommandBuffer> cmd = [queue commandBuffer];
+            id<MTLComputeCommandEncoder> enc = [cmd computeCommandEncoder];
+            [enc setComputePipelineState:pipeline];
+            [enc setBuffer:outputs[i] offset:0 atIndex:0];
+            [enc setBuffer:outputs[i] offset:(NSUInteger)W * H * sizeof(float) atIndex:1];
+            [enc setBuffer:paramBuffer offset:0 atIndex:2];
+            const GpuJob job = {W, H, (float)(jobs[i].opts.fovDeg * M_PI / 180.0), (uint32_t)i};
+            [enc setBytes:&job length:sizeof(job) atIndex:3];
+            // whole threadgroups; the kernel skips the threads past the edges
+            [enc dispatchThreadgroups:MTLSizeMake((W + tw - 1) / tw, (H + th - 1) / th, 1) threadsPerThreadgroup:MTLSizeMake(tw, th, 1)];
+            [enc endEncoding];
+            Completions* c = completions;   // the block copies plain values only
+            [cmd addCompletedHandler:^(id<MTLCommandBuffer> cb) {
+                std::lock_guard<std::mutex> lock(c->mutex);
+                if (cb.status == MTLCommandBufferStatusCompleted) {
+                    c->state[i] = 1;
+                } else {
+                    c->state[i] = 2;
+                    c->error[i] = string("GPU job failed: ") + (cb.error ? cb.error.localizedDescription.UTF8String : "unknown error");
+                }
+                c->changed.notify_all();
+            }];
+            [cmd commit];
+        };
+
+        size_t next = 0;
+        uint64_t inFlight = 0;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            while (next < jobs.size() && (next == i || inFlight + bytes[next] <= budget)) {
+                inFlight += bytes[next];
+                submit(next++);
+            }
+            int state;
+            string jobErr;
+            {
+                std::unique_lock<std::mutex> lock(completions->mutex);
+                completions->changed.wait(lock, [&] { return completions->state[i] != 0; });
+                state = completions->state[i];
+                jobErr = completions->error[i];
+            }
+            if (state == 1) {
+                const unsigned W = widths[i], H = heights[i];
+                const float* s = static_cast<const float*>(outputs[i].contents);
+                const float* t = s + (size_t)W * H;
+                size_t flipped = 0;
+                const double diff = stmap_check_rows(jobs[i].eye, jobs[i].opts, s, t, flipped);
+                if (diff > TOLERANCE || flipped > W / 100 + 8) {
+                    char buf[160];
+                    snprintf(buf, sizeof(buf), "GPU result differs from the CPU kernel (max %.3g, %zu edge pixels)", diff, flipped);
+                    jobErr = buf;
+                } else if (!write_stmap_planes(jobs[i].path, jobs[i].opts.format, W, H, s, t, jobs[i].opts.writer, jobErr) && jobErr.empty()) {
+                    jobErr = "Failed to write " + jobs[i].path;
+                }
+            }
+            outputs[i] = nil;
+            inFlight -= bytes[i];
+            done(i, jobErr);
+        }
+        // every handler has run by now: each job above waited for its own
+        return true;
+    }
+}
+
+} // namespace ilpd